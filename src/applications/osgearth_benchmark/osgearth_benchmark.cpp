@@ -0,0 +1,818 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Math>
+#include <osg/NodeVisitor>
+#include <osg/PagedLOD>
+#include <osg/Shape>
+#include <osg/Timer>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+
+#include <osgEarth/Common>
+#include <osgEarth/Map>
+#include <osgEarth/MapNode>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/RawImageCodec>
+#include <osgEarth/TerrainIntersector>
+#include <osgEarth/TileSource>
+#include <osgEarthFeatures/FeatureListSource>
+#include <osgEarthSymbology/Geometry>
+#include <osgEarthSymbology/Query>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[osgearth_benchmark] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // latency samples for one pipeline stage.
+    struct Stage
+    {
+        Stage() : _empty( 0 ) { }
+
+        void add( double ms, bool gotData )
+        {
+            _samples.push_back( ms );
+            if ( !gotData )
+                ++_empty;
+        }
+
+        std::vector<double> _samples; // milliseconds
+        unsigned            _empty;   // calls that produced no data
+    };
+
+    typedef std::map<std::string, Stage> Stages;
+
+    // nearest-rank percentile of a sorted sample list.
+    double percentile( const std::vector<double>& sorted, double p )
+    {
+        if ( sorted.empty() )
+            return 0.0;
+        int rank = (int)ceil( p/100.0 * (double)sorted.size() ) - 1;
+        return sorted[ osg::clampBetween( rank, 0, (int)sorted.size()-1 ) ];
+    }
+
+    // peak resident memory of this process, in kilobytes.
+    unsigned long getPeakMemoryKB()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS pmc;
+        if ( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) )
+            return (unsigned long)(pmc.PeakWorkingSetSize / 1024);
+        return 0;
+#else
+        struct rusage usage;
+        if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+            return 0;
+#  ifdef __APPLE__
+        return (unsigned long)(usage.ru_maxrss / 1024); // bytes on OSX
+#  else
+        return (unsigned long)usage.ru_maxrss;          // kilobytes on Linux
+#  endif
+#endif
+    }
+
+    std::string jsonString( const std::string& s )
+    {
+        std::stringstream buf;
+        buf << '"';
+        for( std::string::const_iterator i = s.begin(); i != s.end(); ++i )
+        {
+            if      ( *i == '"' )  buf << "\\\"";
+            else if ( *i == '\\' ) buf << "\\\\";
+            else if ( *i == '\n' ) buf << "\\n";
+            else if ( (unsigned char)*i < 0x20 ) buf << ' ';
+            else buf << *i;
+        }
+        buf << '"';
+        return buf.str();
+    }
+
+    // collects the file names of the paged children under a node that a given
+    // pseudo-loader extension handles.
+    struct CollectPagedURIs : public osg::NodeVisitor
+    {
+        CollectPagedURIs( const std::string& extension )
+            : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ), _extension( extension ) { }
+
+        void apply( osg::PagedLOD& plod )
+        {
+            for( unsigned i = 0; i < plod.getNumFileNames(); ++i )
+            {
+                const std::string& uri = plod.getFileName( i );
+                if ( !uri.empty() && osgDB::getFileExtension( uri ) == _extension )
+                    _uris.push_back( uri );
+            }
+            traverse( plod );
+        }
+
+        std::string              _extension;
+        std::vector<std::string> _uris;
+    };
+
+    // reads the keys of a key script: one "lod x y" per line, '#' starts a comment.
+    bool readKeyScript( const std::string& filename, const Profile* profile, std::vector<TileKey>& out_keys )
+    {
+        std::ifstream in( filename.c_str() );
+        if ( !in.is_open() )
+            return false;
+
+        std::string line;
+        while( std::getline( in, line ) )
+        {
+            std::string::size_type hash = line.find( '#' );
+            if ( hash != std::string::npos )
+                line = line.substr( 0, hash );
+
+            std::istringstream buf( line );
+            unsigned lod, x, y;
+            if ( buf >> lod >> x >> y )
+                out_keys.push_back( TileKey( lod, x, y, profile ) );
+        }
+        return true;
+    }
+
+    // lays out the keys covering a set of bounds for each LOD in a range. Levels
+    // with more keys than the limit are sampled at an even stride so that the
+    // set stays the same from run to run.
+    void makeKeys(const Profile*        profile,
+                  const Bounds&         bounds,
+                  unsigned              minLevel,
+                  unsigned              maxLevel,
+                  unsigned              maxKeysPerLevel,
+                  std::vector<TileKey>& out_keys )
+    {
+        for( unsigned lod = minLevel; lod <= maxLevel; ++lod )
+        {
+            TileKey k0 = profile->createTileKey( bounds.xMin(), bounds.yMax(), lod );
+            TileKey k1 = profile->createTileKey( bounds.xMax(), bounds.yMin(), lod );
+            if ( !k0.valid() || !k1.valid() )
+                continue;
+
+            unsigned xmin = osg::minimum( k0.getTileId().x, k1.getTileId().x );
+            unsigned xmax = osg::maximum( k0.getTileId().x, k1.getTileId().x );
+            unsigned ymin = osg::minimum( k0.getTileId().y, k1.getTileId().y );
+            unsigned ymax = osg::maximum( k0.getTileId().y, k1.getTileId().y );
+
+            unsigned numKeys = (xmax-xmin+1) * (ymax-ymin+1);
+            unsigned stride  = maxKeysPerLevel > 0 ? osg::maximum( 1u, (numKeys + maxKeysPerLevel - 1) / maxKeysPerLevel ) : 1u;
+
+            unsigned n = 0;
+            for( unsigned y = ymin; y <= ymax; ++y )
+            {
+                for( unsigned x = xmin; x <= xmax; ++x, ++n )
+                {
+                    if ( n % stride == 0 )
+                        out_keys.push_back( TileKey( lod, x, y, profile ) );
+                }
+            }
+        }
+    }
+
+    bool hasStage( const std::string& stages, const std::string& name )
+    {
+        std::string list = "," + stages + ",";
+        return list.find( "," + name + "," ) != std::string::npos;
+    }
+
+    inline double elapsedMS( osg::Timer_t start )
+    {
+        return osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+    }
+
+    // deterministic uniform random numbers, so that runs are comparable.
+    struct Random
+    {
+        Random() : _state( 12345u ) { }
+
+        double next( double lo, double hi )
+        {
+            _state = _state * 1103515245u + 12345u;
+            return lo + (hi - lo) * (double)((_state >> 8) & 0xffffff) / 16777216.0;
+        }
+
+        unsigned _state;
+    };
+
+    // Synthetic surfaces for the intersect stage. (osgearth_tests checks the
+    // intersectors against the same surfaces.)
+    typedef double (*SurfaceFunc)( double x, double y );
+
+    double tiltedPlane( double x, double y ) { return 0.25*x - 0.5*y + 10.0; }
+    double peak( double x, double y )        { return 32.0 - fabs(x - 32.0); }
+
+    const double RIDGE_HEIGHT = 5000.0;
+    double ridge( double x, double y )
+    {
+        return RIDGE_HEIGHT * osg::maximum( 0.0, 1.0 - fabs(x)/90.0 );
+    }
+
+    osg::HeightField* sampleSurface( SurfaceFunc h, double xMin, double yMin, double xMax, double yMax, unsigned size )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( size, size );
+        for( unsigned r = 0; r < size; ++r )
+        {
+            for( unsigned c = 0; c < size; ++c )
+            {
+                double x = xMin + (xMax - xMin) * (double)c / (double)(size-1);
+                double y = yMin + (yMax - yMin) * (double)r / (double)(size-1);
+                hf->setHeight( c, r, (float)h( x, y ) );
+            }
+        }
+        return hf;
+    }
+
+    // a dense point set for the index stage: most points fall in a 10x10 degree
+    // cluster that thickens toward its center, the rest anywhere on the globe.
+    osg::Vec3d randomDensePoint( Random& rand )
+    {
+        if ( rand.next(0, 1) < 0.9 )
+            return osg::Vec3d( 10.0 + rand.next(-5, 5) * rand.next(0, 1), 45.0 + rand.next(-5, 5) * rand.next(0, 1), 0.0 );
+        else
+            return osg::Vec3d( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+    }
+
+    inline bool boundsIntersect( const Bounds& a, const Bounds& b )
+    {
+        return a.xMin() <= b.xMax() && b.xMin() <= a.xMax() && a.yMin() <= b.yMax() && b.yMin() <= a.yMax();
+    }
+
+    // An elevation source that samples the ridge, for timing the terrain
+    // intersector's walk over the tile grid.
+    class RidgeElevationSource : public TileSource
+    {
+    public:
+        void initialize( const std::string& referenceURI, const Profile* overrideProfile )
+        {
+            setProfile( overrideProfile ? overrideProfile : Profile::create("global-geodetic") );
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            return 0L;
+        }
+
+        osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress )
+        {
+            const GeoExtent& ex = key.getExtent();
+            return sampleSurface( ridge, ex.xMin(), ex.yMin(), ex.xMax(), ex.yMax(), 17 );
+        }
+
+        bool supportsPersistentCaching() const
+        {
+            return false;
+        }
+    };
+
+    // the bytes of the bodies replayed by the http stage.
+    inline char bodyByte( unsigned i )
+    {
+        return (char)((i * 31u + 7u) & 0xffu);
+    }
+}
+
+//------------------------------------------------------------------------
+
+int
+usage( const std::string& msg )
+{
+    if ( !msg.empty() )
+    {
+        std::cout << msg << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << "USAGE: osgearth_benchmark file.earth" << std::endl
+        << std::endl
+        << "    Builds terrain tiles, heightfields, images and feature tiles without a" << std::endl
+        << "    graphics context, and reports latency percentiles, throughput and peak" << std::endl
+        << "    memory as JSON." << std::endl
+        << std::endl
+        << "        [--keys file]                   ; Script of tile keys to run, one \"lod x y\" per line" << std::endl
+        << "        [--min-level level]             ; Lowest LOD to run when no script is given (default=0)" << std::endl
+        << "        [--max-level level]             ; Highest LOD to run when no script is given (default=5)" << std::endl
+        << "        [--bounds xmin ymin xmax ymax]  ; Region to run, in map profile coordinates (default=whole profile)" << std::endl
+        << "        [--max-keys-per-level n]        ; Keys to sample per LOD (default=16, 0=all)" << std::endl
+        << "        [--feature-tiles n]             ; Feature tiles to build per model layer (default=64)" << std::endl
+        << "        [--decode-samples n]            ; Images to re-decode from PNG and oeraw (default=32)" << std::endl
+        << "        [--intersect-rays n]            ; Rays to cast per synthetic surface (default=10000)" << std::endl
+        << "        [--index-points n]              ; Points in the synthetic feature set (default=100000)" << std::endl
+        << "        [--index-queries n]             ; Tile-sized queries to run against it (default=1000)" << std::endl
+        << "        [--http-requests n]             ; Bodies to replay per mode in the http stage (default=64)" << std::endl
+        << "        [--http-body-kb n]              ; Size of each HTTP body, in kilobytes (default=256)" << std::endl
+        << "        [--stages list]                 ; Comma-separated subset of tile,heightfield,image,features,decode,intersect,index,http" << std::endl
+        << "        [--out file]                    ; Write the JSON report to a file instead of stdout" << std::endl
+        << std::endl;
+
+    return -1;
+}
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser args(&argc,argv);
+
+    if ( args.read("--help") || args.read("-h") || argc < 2 )
+        return usage("");
+
+    std::string keyScript;
+    while (args.read("--keys", keyScript));
+
+    unsigned int minLevel = 0;
+    while (args.read("--min-level", minLevel));
+
+    unsigned int maxLevel = 5;
+    while (args.read("--max-level", maxLevel));
+
+    Bounds bounds(0, 0, 0, 0);
+    while (args.read("--bounds", bounds.xMin(), bounds.yMin(), bounds.xMax(), bounds.yMax()));
+
+    unsigned int maxKeysPerLevel = 16;
+    while (args.read("--max-keys-per-level", maxKeysPerLevel));
+
+    unsigned int maxFeatureTiles = 64;
+    while (args.read("--feature-tiles", maxFeatureTiles));
+
+    unsigned int decodeSamples = 32;
+    while (args.read("--decode-samples", decodeSamples));
+
+    unsigned int intersectRays = 10000;
+    while (args.read("--intersect-rays", intersectRays));
+
+    unsigned int indexPoints = 100000;
+    while (args.read("--index-points", indexPoints));
+
+    unsigned int indexQueries = 1000;
+    while (args.read("--index-queries", indexQueries));
+
+    unsigned int httpRequests = 64;
+    while (args.read("--http-requests", httpRequests));
+
+    unsigned int httpBodyKB = 256;
+    while (args.read("--http-body-kb", httpBodyKB));
+
+    std::string stages = "tile,heightfield,image,features,decode,intersect,index,http";
+    while (args.read("--stages", stages));
+
+    std::string outFile;
+    while (args.read("--out", outFile));
+
+    osg::Timer_t runStart = osg::Timer::instance()->tick();
+
+    //Read in the earth file.
+    std::string earthFile;
+    for( int i = 1; i < args.argc() && earthFile.empty(); ++i )
+    {
+        if ( !args.isOption( i ) )
+            earthFile = args[i];
+    }
+
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( args );
+    if ( !node.valid() )
+        return usage( "Failed to read .earth file." );
+
+    MapNode* mapNode = MapNode::findMapNode( node.get() );
+    if ( !mapNode )
+        return usage( "Input file was not a .earth file" );
+
+    Map* map = mapNode->getMap();
+    const Profile* profile = map->getProfile();
+
+    double loadTime = osg::Timer::instance()->delta_s( runStart, osg::Timer::instance()->tick() );
+
+    // the scripted key set:
+    std::vector<TileKey> keys;
+    if ( !keyScript.empty() )
+    {
+        if ( !readKeyScript( keyScript, profile, keys ) )
+            return usage( "Failed to read the key script " + keyScript );
+    }
+    else
+    {
+        if ( !bounds.isValid() || bounds.width() <= 0.0 || bounds.height() <= 0.0 )
+        {
+            const GeoExtent& ex = profile->getExtent();
+            bounds = Bounds( ex.xMin(), ex.yMin(), ex.xMax(), ex.yMax() );
+        }
+        makeKeys( profile, bounds, minLevel, maxLevel, maxKeysPerLevel, keys );
+    }
+
+    OE_NOTICE << LC << "Running " << keys.size() << " keys" << std::endl;
+
+    Stages results;
+
+    // Terrain tiles. The terrain engine builds its tiles through a pseudo-loader, whose
+    // URIs name the engine that owns them; borrow the engine ID from the root tiles.
+    // Each read builds the four children of the key (OSGTileFactory::createPopulatedTile),
+    // just as the database pager would.
+    if ( hasStage( stages, "tile" ) )
+    {
+        CollectPagedURIs collect( "osgearth_osgterrain_tile" );
+        mapNode->getTerrainEngine()->accept( collect );
+
+        unsigned engineID;
+        unsigned lod, x, y;
+        if ( collect._uris.size() > 0 &&
+             sscanf( osgDB::getNameLessExtension( collect._uris.front() ).c_str(), "%u_%u_%u.%u", &lod, &x, &y, &engineID ) == 4 )
+        {
+            Stage& stage = results["tile"];
+            for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+            {
+                std::stringstream buf;
+                buf << k->str() << "." << engineID << ".osgearth_osgterrain_tile";
+
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osg::ref_ptr<osg::Node> tile = osgDB::readNodeFile( buf.str() );
+                stage.add( elapsedMS(start), tile.valid() );
+            }
+        }
+        else
+        {
+            OE_WARN << LC << "Skipping terrain tiles: the terrain engine does not page through osgearth_osgterrain_tile" << std::endl;
+        }
+    }
+
+    // Heightfields, composited from the whole elevation stack:
+    if ( hasStage( stages, "heightfield" ) && map->getNumElevationLayers() > 0 )
+    {
+        MapFrame mapf( map, Map::ELEVATION_LAYERS, "osgearth_benchmark" );
+        Stage& stage = results["heightfield"];
+        for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        {
+            osg::ref_ptr<osg::HeightField> hf;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            bool ok = mapf.getHeightField( *k, true, hf );
+            stage.add( elapsedMS(start), ok && hf.valid() );
+        }
+    }
+
+    // Images, one call per key and image layer. Keep a few to re-decode afterwards.
+    std::vector< osg::ref_ptr<osg::Image> > decodeImages;
+    if ( hasStage( stages, "image" ) && map->getNumImageLayers() > 0 )
+    {
+        MapFrame mapf( map, Map::IMAGE_LAYERS, "osgearth_benchmark" );
+        Stage& stage = results["image"];
+        for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        {
+            for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); ++i )
+            {
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                GeoImage image = i->get()->createImage( *k );
+                stage.add( elapsedMS(start), image.valid() );
+
+                if ( image.valid() && decodeImages.size() < decodeSamples )
+                    decodeImages.push_back( image.getImage() );
+            }
+        }
+    }
+
+    // Feature tiles: build each model layer's paged tiles breadth-first, starting from
+    // the ones its FeatureModelGraph sets up at load time.
+    if ( hasStage( stages, "features" ) )
+    {
+        CollectPagedURIs collect( "osgearth_pseudo_fmg" );
+        mapNode->accept( collect );
+
+        if ( collect._uris.size() > 0 )
+        {
+            Stage& stage = results["features"];
+            std::vector<std::string>& queue = collect._uris;
+            for( unsigned i = 0; i < queue.size() && i < maxFeatureTiles; ++i )
+            {
+                // copy the URI; reading it may add children to the queue.
+                std::string uri = queue[i];
+
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osg::ref_ptr<osg::Node> tile = osgDB::readNodeFile( uri );
+                stage.add( elapsedMS(start), tile.valid() && tile->asGroup() && tile->asGroup()->getNumChildren() > 0 );
+
+                if ( tile.valid() )
+                    tile->accept( collect );
+            }
+        }
+    }
+
+    // Cache decode: the cost of reading a tile back from a PNG cache entry versus an
+    // oeraw (RawImageCodec) one. Encoding happens up front and isn't timed.
+    if ( hasStage( stages, "decode" ) && decodeImages.size() > 0 )
+    {
+        osgDB::ReaderWriter* png = osgDB::Registry::instance()->getReaderWriterForExtension( "png" );
+
+        Stage& pngStage = results["decode_png"];
+        Stage& rawStage = results["decode_oeraw"];
+
+        for( unsigned i = 0; i < decodeImages.size(); ++i )
+        {
+            const osg::Image* image = decodeImages[i].get();
+
+            std::stringstream rawBuf;
+            if ( RawImageCodec::write( image, rawBuf ) )
+            {
+                std::istringstream in( rawBuf.str() );
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osg::ref_ptr<osg::Image> decoded = RawImageCodec::read( in );
+                rawStage.add( elapsedMS(start), decoded.valid() );
+            }
+
+            std::stringstream pngBuf;
+            if ( png && png->writeImage( *image, pngBuf ).success() )
+            {
+                std::istringstream in( pngBuf.str() );
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osgDB::ReaderWriter::ReadResult r = png->readImage( in );
+                pngStage.add( elapsedMS(start), r.success() && r.getImage() );
+            }
+        }
+    }
+
+    // Terrain intersection against synthetic surfaces. This runs independently of
+    // the earth file's data.
+    if ( hasStage( stages, "intersect" ) )
+    {
+        Random rand;
+
+        // MinMaxHeightField: the quadtree descent and the triangle tests.
+        SurfaceFunc surfaces[2] = { tiltedPlane, peak };
+
+        Stage& hfStage = results["intersect_heightfield"];
+        for( unsigned s = 0; s < 2; ++s )
+        {
+            SurfaceFunc h = surfaces[s];
+            osg::ref_ptr<osg::HeightField> hf = sampleSurface( h, 0.0, 0.0, 64.0, 64.0, 65 );
+            osg::ref_ptr<MinMaxHeightField> mmhf = new MinMaxHeightField( hf.get(), 0.0, 0.0, 64.0, 64.0 );
+            double zMin = mmhf->getMinHeight(), zMax = mmhf->getMaxHeight();
+
+            for( unsigned i = 0; i < intersectRays; ++i )
+            {
+                osg::Vec3d start( rand.next(0, 64), rand.next(0, 64), 0.0 );
+                osg::Vec3d end( rand.next(0, 64), rand.next(0, 64), 0.0 );
+                switch( i % 4 )
+                {
+                case 0: // straight down
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.set( start.x(), start.y(), zMin - 1.0 );
+                    break;
+                case 1: // oblique, from above the surface to below it
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.z()   = zMin - rand.next( 1, 20 );
+                    break;
+                case 2: // shallow, just above the surface; may cross it more than once
+                    start.z() = h( start.x(), start.y() ) + rand.next( 0.1, 2 );
+                    end.z()   = start.z() + rand.next( -2, 2 );
+                    break;
+                default: // entirely above the surface
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.z()   = zMax + rand.next( 1, 20 );
+                    break;
+                }
+
+                double t = 0.0;
+                osg::Timer_t tick = osg::Timer::instance()->tick();
+                bool hit = mmhf->intersect( start, end, t );
+                hfStage.add( elapsedMS(tick), hit );
+            }
+        }
+
+        // TerrainIntersector: the walk over the tile grid, on a projected map of the ridge.
+        MapOptions mapOptions;
+        mapOptions.coordSysType() = MapOptions::CSTYPE_PROJECTED;
+        mapOptions.profile() = ProfileOptions( "global-geodetic" );
+        osg::ref_ptr<Map> ridgeMap = new Map( mapOptions );
+
+        ElevationLayerOptions layerOptions( "ridge", TileSourceOptions() );
+        layerOptions.maxDataLevel() = 8;
+        ridgeMap->addElevationLayer( new ElevationLayer( layerOptions, new RidgeElevationSource() ) );
+
+        osg::ref_ptr<TerrainIntersector> intersector = new TerrainIntersector( ridgeMap.get() );
+        Stage& terrainStage = results["intersect_terrain"];
+        for( unsigned i = 0; i < intersectRays; ++i )
+        {
+            osg::Vec3d start( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+            start.z() = ridge( start.x(), start.y() ) + rand.next( 100, RIDGE_HEIGHT );
+
+            // alternate short collision probes and long picking rays.
+            osg::Vec3d end;
+            if ( i % 2 == 0 )
+                end.set(
+                    osg::clampBetween( start.x() + rand.next(-0.5, 0.5), -180.0, 180.0 ),
+                    osg::clampBetween( start.y() + rand.next(-0.5, 0.5), -90.0, 90.0 ),
+                    -100.0 );
+            else
+                end.set( rand.next(-180, 180), rand.next(-90, 90), -100.0 );
+
+            osg::Vec3d point;
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            bool hit = intersector->intersect( start, end, point );
+            terrainStage.add( elapsedMS(tick), hit );
+        }
+    }
+
+    // In-memory feature index: a dense synthetic point set in a FeatureListSource,
+    // queried with tile-sized boxes (most of them inside the dense cluster). Each
+    // query is also timed as a linear scan, the way the source worked before it
+    // had an index.
+    if ( hasStage( stages, "index" ) && indexPoints > 0 )
+    {
+        Random rand;
+        osg::ref_ptr<FeatureListSource> source = new FeatureListSource();
+
+        Stage& insertStage = results["index_insert"];
+        for( unsigned i = 0; i < indexPoints; ++i )
+        {
+            PointSet* points = new PointSet();
+            points->push_back( randomDensePoint(rand) );
+            osg::ref_ptr<Feature> feature = new Feature( points, Style(), (FeatureID)i );
+
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            bool ok = source->insertFeature( feature.get() );
+            insertStage.add( elapsedMS(tick), ok );
+        }
+
+        // a level-6 tile in the global-geodetic profile:
+        const double QUERY_SIZE = 180.0 / 64.0;
+
+        Stage& queryStage = results["index_query"];
+        Stage& scanStage  = results["index_scan"];
+        for( unsigned i = 0; i < indexQueries; ++i )
+        {
+            osg::Vec3d center = i % 4 != 0 ?
+                osg::Vec3d( 10.0 + rand.next(-5, 5), 45.0 + rand.next(-5, 5), 0.0 ) :
+                osg::Vec3d( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+            Bounds queryBounds(
+                center.x() - 0.5*QUERY_SIZE, center.y() - 0.5*QUERY_SIZE,
+                center.x() + 0.5*QUERY_SIZE, center.y() + 0.5*QUERY_SIZE );
+
+            Query query;
+            query.bounds() = queryBounds;
+
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            unsigned numFound = 0;
+            osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor( query );
+            while( cursor.valid() && cursor->hasMore() )
+            {
+                cursor->nextFeature();
+                ++numFound;
+            }
+            queryStage.add( elapsedMS(tick), numFound > 0 );
+
+            // the baseline: test every feature, copying out the hits.
+            tick = osg::Timer::instance()->tick();
+            FeatureList scanned;
+            FeatureList& all = source->getFeatures();
+            for( FeatureList::iterator f = all.begin(); f != all.end(); ++f )
+            {
+                if ( boundsIntersect( f->get()->getGeometry()->getBounds(), queryBounds ) )
+                    scanned.push_back( new Feature( *f->get(), osg::CopyOp::DEEP_COPY_ALL ) );
+            }
+            scanStage.add( elapsedMS(tick), scanned.size() > 0 );
+        }
+
+        // edits: move 1% of the points; the first query afterwards pays for the repack.
+        Stage& updateStage = results["index_update"];
+        FeatureList& all = source->getFeatures();
+        unsigned numMoved = 0;
+        for( FeatureList::iterator f = all.begin(); f != all.end() && numMoved < indexPoints/100; ++f, ++numMoved )
+        {
+            Geometry* geom = f->get()->getGeometry();
+            (*geom)[0] = randomDensePoint( rand );
+
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            bool ok = source->updateFeature( f->get() );
+            updateStage.add( elapsedMS(tick), ok );
+        }
+
+        Query query;
+        query.bounds() = Bounds( 10.0 - 0.5*QUERY_SIZE, 45.0 - 0.5*QUERY_SIZE, 10.0 + 0.5*QUERY_SIZE, 45.0 + 0.5*QUERY_SIZE );
+        osg::Timer_t tick = osg::Timer::instance()->tick();
+        osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor( query );
+        results["index_requery"].add( elapsedMS(tick), cursor.valid() && cursor->hasMore() );
+    }
+
+    // HTTP response bodies: replays the same 16KB deliveries (curl's write size) in
+    // memory, into the stringstream the client used to fill plus the copy that str()
+    // made for readString() and getPartAsString(), and into the presized string it
+    // fills now. That isolates the cost of the avoided copies from the socket.
+    if ( hasStage( stages, "http" ) && httpRequests > 0 )
+    {
+        unsigned size = httpBodyKB * 1024;
+
+        const unsigned CHUNK = 16384;
+        std::string body( size, '\0' );
+        for( unsigned i = 0; i < size; ++i )
+            body[i] = bodyByte( i );
+
+        Stage& streamStage = results["http_body_stream"];
+        Stage& bufferStage = results["http_body_buffer"];
+        for( unsigned i = 0; i < httpRequests; ++i )
+        {
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            std::stringstream stream;
+            for( unsigned offset = 0; offset < size; offset += CHUNK )
+                stream.write( body.data() + offset, osg::minimum( CHUNK, size - offset ) );
+            std::string copy = stream.str();
+            streamStage.add( elapsedMS(tick), copy.size() > 0 );
+
+            tick = osg::Timer::instance()->tick();
+            std::string data;
+            data.reserve( size );
+            for( unsigned offset = 0; offset < size; offset += CHUNK )
+                data.append( body.data() + offset, osg::minimum( CHUNK, size - offset ) );
+            bufferStage.add( elapsedMS(tick), data.size() > 0 );
+        }
+    }
+
+    double wallTime = osg::Timer::instance()->delta_s( runStart, osg::Timer::instance()->tick() );
+
+    // report:
+    std::ofstream fout;
+    if ( !outFile.empty() )
+    {
+        fout.open( outFile.c_str() );
+        if ( !fout.is_open() )
+            return usage( "Failed to open " + outFile + " for writing" );
+    }
+    std::ostream& out = outFile.empty() ? std::cout : fout;
+
+    out << std::fixed << std::setprecision(3)
+        << "{" << std::endl
+        << "  \"earth_file\": " << jsonString( earthFile ) << "," << std::endl
+        << "  \"keys\": " << keys.size() << "," << std::endl
+        << "  \"load_time_s\": " << loadTime << "," << std::endl
+        << "  \"wall_time_s\": " << wallTime << "," << std::endl
+        << "  \"peak_memory_kb\": " << getPeakMemoryKB() << "," << std::endl
+        << "  \"stages\": {";
+
+    for( Stages::iterator s = results.begin(); s != results.end(); ++s )
+    {
+        std::vector<double>& samples = s->second._samples;
+        std::sort( samples.begin(), samples.end() );
+
+        double total = 0.0;
+        for( unsigned i = 0; i < samples.size(); ++i )
+            total += samples[i];
+
+        out << (s == results.begin() ? "" : ",") << std::endl
+            << "    " << jsonString( s->first ) << ": {"
+            << " \"count\": " << samples.size() << ","
+            << " \"empty\": " << s->second._empty << ","
+            << " \"total_s\": " << total/1000.0 << ","
+            << " \"throughput_per_s\": " << (total > 0.0 ? 1000.0*(double)samples.size()/total : 0.0) << ","
+            << " \"mean_ms\": " << (samples.size() > 0 ? total/(double)samples.size() : 0.0) << ","
+            << " \"p50_ms\": " << percentile( samples, 50.0 ) << ","
+            << " \"p90_ms\": " << percentile( samples, 90.0 ) << ","
+            << " \"p99_ms\": " << percentile( samples, 99.0 ) << ","
+            << " \"max_ms\": " << (samples.size() > 0 ? samples.back() : 0.0)
+            << " }";
+    }
+
+    out << std::endl
+        << "  }" << std::endl
+        << "}" << std::endl;
+
+    return 0;
+}
@@ -17,30 +17,895 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#include <osg/Math>
+#include <osg/Shape>
+#include <osg/Timer>
 #include <osgUtil/Optimizer>
 #include <osgDB/ReadFile>
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
 #include <osgEarth/Map>
 #include <osgEarth/Registry>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/HTTPClient>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TerrainIntersector>
+#include <osgEarth/TileSource>
+#include <osgEarthFeatures/FeatureListSource>
+#include <osgEarthSymbology/Geometry>
+#include <osgEarthSymbology/Query>
 
 #include <osgEarthDrivers/gdal/GDALOptions>
 #include <osgEarthDrivers/arcgis/ArcGISOptions>
 #include <osgEarthDrivers/tms/TMSOptions>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <winsock2.h>
+#  include <windows.h>
+#else
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <unistd.h>
+#endif
 
 using namespace osg;
 using namespace osgDB;
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+// The checks below run against synthetic data and a stand-in HTTP server on the
+// loopback interface, so they need neither the data/ directory nor the network.
+namespace
+{
+    // deterministic uniform random numbers, so that failures are reproducible.
+    struct Random
+    {
+        Random() : _state( 12345u ) { }
+
+        double next( double lo, double hi )
+        {
+            _state = _state * 1103515245u + 12345u;
+            return lo + (hi - lo) * (double)((_state >> 8) & 0xffffff) / 16777216.0;
+        }
+
+        unsigned _state;
+    };
+
+    // Synthetic surfaces for the intersection tests. Each one is linear between creases
+    // that run along lines of constant X, so a heightfield with samples on the creases
+    // reproduces it exactly and every ray has an analytic answer.
+    typedef double (*SurfaceFunc)( double x, double y );
+
+    double tiltedPlane( double x, double y ) { return 0.25*x - 0.5*y + 10.0; }  // no creases
+    double peak( double x, double y )        { return 32.0 - fabs(x - 32.0); }  // crease at x=32
+
+    const double RIDGE_HEIGHT = 5000.0;
+    double ridge( double x, double y )                                         // creases at x=-90,0,90
+    {
+        return RIDGE_HEIGHT * osg::maximum( 0.0, 1.0 - fabs(x)/90.0 );
+    }
+
+    osg::HeightField* sampleSurface( SurfaceFunc h, double xMin, double yMin, double xMax, double yMax, unsigned size )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( size, size );
+        for( unsigned r = 0; r < size; ++r )
+        {
+            for( unsigned c = 0; c < size; ++c )
+            {
+                double x = xMin + (xMax - xMin) * (double)c / (double)(size-1);
+                double y = yMin + (yMax - yMin) * (double)r / (double)(size-1);
+                hf->setHeight( c, r, (float)h( x, y ) );
+            }
+        }
+        return hf;
+    }
+
+    // the first parameter along a segment that starts above the surface at which
+    // it meets the surface, solved piecewise between the creases.
+    bool firstCrossing(SurfaceFunc h, const std::vector<double>& creases,
+                       const osg::Vec3d& start, const osg::Vec3d& end, double& out_t )
+    {
+        osg::Vec3d dir = end - start;
+
+        std::vector<double> ts;
+        ts.push_back( 0.0 );
+        for( unsigned i = 0; i < creases.size() && dir.x() != 0.0; ++i )
+        {
+            double t = (creases[i] - start.x()) / dir.x();
+            if ( t > 0.0 && t < 1.0 )
+                ts.push_back( t );
+        }
+        ts.push_back( 1.0 );
+        std::sort( ts.begin(), ts.end() );
+
+        for( unsigned i = 0; i+1 < ts.size(); ++i )
+        {
+            osg::Vec3d a = start + dir*ts[i];
+            osg::Vec3d b = start + dir*ts[i+1];
+            double ga = a.z() - h( a.x(), a.y() );
+            double gb = b.z() - h( b.x(), b.y() );
+            if ( ga > 0.0 && gb <= 0.0 )
+            {
+                out_t = ts[i] + (ts[i+1] - ts[i]) * ga / (ga - gb);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a hit is correct if it lies on the surface, at the first crossing.
+    bool checkHit(SurfaceFunc h, const osg::Vec3d& start, const osg::Vec3d& end,
+                  bool expectHit, double expected_t, bool hit, double t )
+    {
+        if ( hit != expectHit )
+            return false;
+        if ( !hit )
+            return true;
+
+        osg::Vec3d p = start + (end - start)*t;
+        return fabs(t - expected_t) < 1e-4 && fabs(p.z() - h(p.x(), p.y())) < 1e-2;
+    }
+
+    // a dense point set for the index test: most points fall in a 10x10 degree
+    // cluster that thickens toward its center, the rest anywhere on the globe.
+    osg::Vec3d randomDensePoint( Random& rand )
+    {
+        if ( rand.next(0, 1) < 0.9 )
+            return osg::Vec3d( 10.0 + rand.next(-5, 5) * rand.next(0, 1), 45.0 + rand.next(-5, 5) * rand.next(0, 1), 0.0 );
+        else
+            return osg::Vec3d( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+    }
+
+    inline bool boundsIntersect( const Bounds& a, const Bounds& b )
+    {
+        return a.xMin() <= b.xMax() && b.xMin() <= a.xMax() && a.yMin() <= b.yMax() && b.yMin() <= a.yMax();
+    }
+
+    // An elevation source that samples the ridge, so the terrain intersector's
+    // walk over the tile grid can be checked against analytic answers.
+    class RidgeElevationSource : public TileSource
+    {
+    public:
+        void initialize( const std::string& referenceURI, const Profile* overrideProfile )
+        {
+            setProfile( overrideProfile ? overrideProfile : Profile::create("global-geodetic") );
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            return 0L;
+        }
+
+        osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress )
+        {
+            const GeoExtent& ex = key.getExtent();
+            return sampleSurface( ridge, ex.xMin(), ex.yMin(), ex.xMax(), ex.yMax(), 17 );
+        }
+
+        bool supportsPersistentCaching() const
+        {
+            return false;
+        }
+    };
+
+    // Sockets for the stand-in HTTP server.
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    typedef int    SockLen;
+    const Socket   BAD_SOCKET = INVALID_SOCKET;
+    inline void closeSocket( Socket s ) { closesocket( s ); }
+#else
+    typedef int       Socket;
+    typedef socklen_t SockLen;
+    const Socket      BAD_SOCKET = -1;
+    inline void closeSocket( Socket s ) { close( s ); }
+#endif
+
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_NOSIGNAL; // a client that hangs up early mustn't raise SIGPIPE
+#else
+    const int SEND_FLAGS = 0;
+#endif
+
+    bool sendAll( Socket s, const char* data, unsigned length )
+    {
+        while( length > 0 )
+        {
+            int n = send( s, data, length, SEND_FLAGS );
+            if ( n <= 0 )
+                return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    // the bytes of every body the stand-in server sends, so clients can check them.
+    inline char bodyByte( unsigned i )
+    {
+        return (char)((i * 31u + 7u) & 0xffu);
+    }
+
+    bool checkBody( const char* data, unsigned length, unsigned expectedLength )
+    {
+        if ( length != expectedLength || (length > 0 && !data) )
+            return false;
+        for( unsigned i = 0; i < length; ++i )
+            if ( data[i] != bodyByte(i) )
+                return false;
+        return true;
+    }
+
+    // the unsigned value of a parameter in a URL's query string, or 0 if it has none.
+    unsigned getQueryValue( const std::string& url, const std::string& name )
+    {
+        std::string::size_type q = url.find( '?' );
+        if ( q == std::string::npos )
+            return 0;
+
+        std::string query = "&" + url.substr( q+1 );
+        std::string::size_type p = query.find( "&" + name + "=" );
+        return p == std::string::npos ? 0 : (unsigned)atoi( query.c_str() + p + name.length() + 2 );
+    }
+
+    // A stand-in HTTP server on the loopback interface, so that the HTTP tests run
+    // HTTPClient end to end without depending on the network:
+    //
+    //   GET /sized/<n>    ; <n> bytes of application/octet-stream, with a Content-Length
+    //   GET /unsized/<n>  ; the same bytes, delimited by closing the connection
+    //
+    // Query parameters inject trouble:
+    //
+    //   delay=<ms>        ; wait this long before answering
+    //   fail=<k>          ; answer the first <k> requests for this URL with a 503
+    //
+    // Each connection serves one request, on a thread of its own. The server counts
+    // the requests for each URL, remembers whether they asked for compressed transfer,
+    // and tracks the most requests it was ever serving at once.
+    class StandInServer : public OpenThreads::Thread
+    {
+    public:
+        StandInServer() : _listener( BAD_SOCKET ), _port( 0 ), _done( false ), _active( 0 ), _peakActive( 0 ) { }
+
+        ~StandInServer()
+        {
+            stop();
+        }
+
+        bool start()
+        {
+#ifdef _WIN32
+            WSADATA wsaData;
+            if ( WSAStartup( MAKEWORD(2,2), &wsaData ) != 0 )
+                return false;
+#endif
+            sockaddr_in addr;
+            memset( &addr, 0, sizeof(addr) );
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+            addr.sin_port        = 0; // any free port
+            SockLen addrLen      = sizeof(addr);
+
+            _listener = socket( AF_INET, SOCK_STREAM, 0 );
+            if (_listener == BAD_SOCKET ||
+                bind( _listener, (sockaddr*)&addr, sizeof(addr) ) != 0 ||
+                listen( _listener, 64 ) != 0 ||
+                getsockname( _listener, (sockaddr*)&addr, &addrLen ) != 0 )
+            {
+                if ( _listener != BAD_SOCKET )
+                    closeSocket( _listener );
+                _listener = BAD_SOCKET;
+                return false;
+            }
+
+            _port = ntohs( addr.sin_port );
+            _done = false;
+            startThread();
+            return true;
+        }
+
+        void stop()
+        {
+            if ( _listener == BAD_SOCKET )
+                return;
+
+            // wake the accept() up with a connection of our own.
+            _done = true;
+            sockaddr_in addr;
+            memset( &addr, 0, sizeof(addr) );
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+            addr.sin_port        = htons( _port );
+            Socket wake = socket( AF_INET, SOCK_STREAM, 0 );
+            if ( wake != BAD_SOCKET )
+            {
+                connect( wake, (sockaddr*)&addr, sizeof(addr) );
+                closeSocket( wake );
+            }
+            join();
+
+            closeSocket( _listener );
+            _listener = BAD_SOCKET;
+
+            for( unsigned i = 0; i < _connections.size(); ++i )
+            {
+                _connections[i]->join();
+                delete _connections[i];
+            }
+            _connections.clear();
+#ifdef _WIN32
+            WSACleanup();
+#endif
+        }
+
+        std::string url( const std::string& path ) const
+        {
+            std::stringstream buf;
+            buf << "http://127.0.0.1:" << _port << path;
+            return buf.str();
+        }
+
+        /** Requests seen for a path (with its query string). */
+        unsigned getNumRequests( const std::string& path )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Requests::const_iterator i = _requests.find( path );
+            return i != _requests.end() ? i->second._count : 0;
+        }
+
+        /** Whether the last request for a path sent an Accept-Encoding header. */
+        bool getAcceptedEncoding( const std::string& path )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Requests::const_iterator i = _requests.find( path );
+            return i != _requests.end() && i->second._acceptEncoding;
+        }
+
+        /** The most requests the server was serving at once. */
+        unsigned getPeakActive()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            return _peakActive;
+        }
+
+        void run()
+        {
+            while( !_done )
+            {
+                Socket s = accept( _listener, 0L, 0L );
+                if ( s == BAD_SOCKET )
+                    continue;
+
+                if ( _done )
+                {
+                    closeSocket( s );
+                    break;
+                }
+
+                Connection* c = new Connection( this, s );
+                _connections.push_back( c );
+                c->startThread();
+            }
+        }
+
+    private:
+        struct Connection : public OpenThreads::Thread
+        {
+            Connection( StandInServer* server, Socket s ) : _server( server ), _socket( s ) { }
+
+            void run()
+            {
+                // a GET has no body; the request ends with the blank line after the headers.
+                std::string request;
+                char buf[4096];
+                while( request.find( "\r\n\r\n" ) == std::string::npos && request.size() < 65536 )
+                {
+                    int n = recv( _socket, buf, sizeof(buf), 0 );
+                    if ( n <= 0 )
+                        break;
+                    request.append( buf, n );
+                }
+
+                _server->respond( _socket, request );
+                closeSocket( _socket );
+            }
+
+            StandInServer* _server;
+            Socket         _socket;
+        };
+
+        void respond( Socket s, const std::string& request )
+        {
+            std::istringstream in( request );
+            std::string method, url;
+            in >> method >> url;
+
+            bool acceptEncoding = toLower( request ).find( "\r\naccept-encoding:" ) != std::string::npos;
+            unsigned count;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                Request& r = _requests[url];
+                count = ++r._count;
+                r._acceptEncoding = acceptEncoding;
+                _peakActive = osg::maximum( _peakActive, ++_active );
+            }
+
+            unsigned delay = getQueryValue( url, "delay" );
+            if ( delay > 0 )
+                OpenThreads::Thread::microSleep( delay * 1000u );
+
+            if ( count <= getQueryValue( url, "fail" ) )
+            {
+                std::string unavailable = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                sendAll( s, unavailable.data(), unavailable.size() );
+            }
+            else
+            {
+                sendBody( s, url.substr( 0, url.find('?') ) );
+            }
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _active--;
+        }
+
+        void sendBody( Socket s, const std::string& path )
+        {
+            unsigned size = 0;
+            bool sized;
+            if ( sscanf( path.c_str(), "/sized/%u", &size ) == 1 )
+                sized = true;
+            else if ( sscanf( path.c_str(), "/unsized/%u", &size ) == 1 )
+                sized = false;
+            else
+            {
+                std::string notFound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                sendAll( s, notFound.data(), notFound.size() );
+                return;
+            }
+
+            std::stringstream header;
+            header
+                << "HTTP/1.1 200 OK\r\n"
+                << "Content-Type: application/octet-stream\r\n"
+                << "Cache-Control: no-store\r\n"
+                << "Connection: close\r\n";
+            if ( sized )
+                header << "Content-Length: " << size << "\r\n";
+            header << "\r\n";
+
+            std::string str = header.str();
+            if ( !sendAll( s, str.data(), str.size() ) )
+                return;
+
+            char chunk[16384];
+            for( unsigned offset = 0; offset < size; offset += sizeof(chunk) )
+            {
+                unsigned length = osg::minimum( (unsigned)sizeof(chunk), size - offset );
+                for( unsigned i = 0; i < length; ++i )
+                    chunk[i] = bodyByte( offset + i );
+                if ( !sendAll( s, chunk, length ) )
+                    return;
+            }
+        }
+
+        struct Request
+        {
+            Request() : _count( 0 ), _acceptEncoding( false ) { }
+            unsigned _count;
+            bool     _acceptEncoding;
+        };
+        typedef std::map<std::string, Request> Requests;
+
+        Socket                    _listener;
+        unsigned short            _port;
+        volatile bool             _done;
+        std::vector<Connection*>  _connections;
+
+        OpenThreads::Mutex        _mutex;
+        Requests                  _requests;
+        unsigned                  _active;
+        unsigned                  _peakActive;
+    };
+
+    // fetches a list of URLs through HTTPClient on a thread of its own, and counts
+    // the responses that aren't a whole, correct body.
+    struct HTTPLoadThread : public OpenThreads::Thread
+    {
+        HTTPLoadThread( const std::vector<std::string>& urls, unsigned size ) : _urls( urls ), _size( size ), _failures( 0 ) { }
+
+        void run()
+        {
+            for( unsigned i = 0; i < _urls.size(); ++i )
+            {
+                HTTPResponse response = HTTPClient::get( _urls[i] );
+                if (!response.isOK() || response.getNumParts() != 1 ||
+                    !checkBody( response.getPartData(0), response.getPartSize(0), _size ) )
+                {
+                    ++_failures;
+                }
+            }
+        }
+
+        std::vector<std::string> _urls;
+        unsigned                 _size;
+        unsigned                 _failures;
+    };
+
+    // reports a failed check; returns the number of failures to add.
+    unsigned check( bool ok, const std::string& test, const std::string& what, unsigned count =1 )
+    {
+        if ( !ok )
+        {
+            std::stringstream buf;
+            buf << "Error:  " << test << ": " << what;
+            if ( count > 1 )
+                buf << " (" << count << " times)";
+            OE_NOTICE << buf.str() << std::endl;
+        }
+        return ok ? 0 : 1;
+    }
+
+    // MinMaxHeightField: the quadtree descent and the triangle tests, against
+    // rays with an analytic first crossing.
+    unsigned testMinMaxHeightField()
+    {
+        const unsigned RAYS = 2000;
+
+        Random rand;
+        SurfaceFunc surfaces[2] = { tiltedPlane, peak };
+        std::vector<double> creases[2];
+        creases[1].push_back( 32.0 );
+
+        unsigned failures = 0;
+        for( unsigned s = 0; s < 2; ++s )
+        {
+            SurfaceFunc h = surfaces[s];
+            osg::ref_ptr<osg::HeightField> hf = sampleSurface( h, 0.0, 0.0, 64.0, 64.0, 65 );
+            osg::ref_ptr<MinMaxHeightField> mmhf = new MinMaxHeightField( hf.get(), 0.0, 0.0, 64.0, 64.0 );
+            double zMin = mmhf->getMinHeight(), zMax = mmhf->getMaxHeight();
+
+            unsigned misses = 0;
+            for( unsigned i = 0; i < RAYS; ++i )
+            {
+                osg::Vec3d start( rand.next(0, 64), rand.next(0, 64), 0.0 );
+                osg::Vec3d end( rand.next(0, 64), rand.next(0, 64), 0.0 );
+                switch( i % 4 )
+                {
+                case 0: // straight down
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.set( start.x(), start.y(), zMin - 1.0 );
+                    break;
+                case 1: // oblique, from above the surface to below it
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.z()   = zMin - rand.next( 1, 20 );
+                    break;
+                case 2: // shallow, just above the surface; may cross it more than once
+                    start.z() = h( start.x(), start.y() ) + rand.next( 0.1, 2 );
+                    end.z()   = start.z() + rand.next( -2, 2 );
+                    break;
+                default: // entirely above the surface
+                    start.z() = zMax + rand.next( 1, 20 );
+                    end.z()   = zMax + rand.next( 1, 20 );
+                    break;
+                }
+
+                double expected_t = 0.0, t = 0.0;
+                bool expectHit = firstCrossing( h, creases[s], start, end, expected_t );
+                bool hit = mmhf->intersect( start, end, t );
+                if ( !checkHit( h, start, end, expectHit, expected_t, hit, t ) )
+                    ++misses;
+            }
+
+            failures += check( misses == 0, "MinMaxHeightField", s == 0 ? "wrong hit on a tilted plane" : "wrong hit on a peak", misses );
+        }
+        return failures;
+    }
+
+    // TerrainIntersector: the walk over the tile grid, on a projected map of the ridge.
+    unsigned testTerrainIntersector()
+    {
+        const unsigned RAYS = 2000;
+
+        MapOptions mapOptions;
+        mapOptions.coordSysType() = MapOptions::CSTYPE_PROJECTED;
+        mapOptions.profile() = ProfileOptions( "global-geodetic" );
+        osg::ref_ptr<Map> ridgeMap = new Map( mapOptions );
+
+        ElevationLayerOptions layerOptions( "ridge", TileSourceOptions() );
+        layerOptions.maxDataLevel() = 8;
+        ridgeMap->addElevationLayer( new ElevationLayer( layerOptions, new RidgeElevationSource() ) );
+
+        std::vector<double> ridgeCreases;
+        ridgeCreases.push_back( -90.0 );
+        ridgeCreases.push_back( 0.0 );
+        ridgeCreases.push_back( 90.0 );
+
+        Random rand;
+        osg::ref_ptr<TerrainIntersector> intersector = new TerrainIntersector( ridgeMap.get() );
+        unsigned misses = 0;
+        for( unsigned i = 0; i < RAYS; ++i )
+        {
+            osg::Vec3d start( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+            start.z() = ridge( start.x(), start.y() ) + rand.next( 100, RIDGE_HEIGHT );
+
+            // alternate short collision probes and long picking rays.
+            osg::Vec3d end;
+            if ( i % 2 == 0 )
+                end.set(
+                    osg::clampBetween( start.x() + rand.next(-0.5, 0.5), -180.0, 180.0 ),
+                    osg::clampBetween( start.y() + rand.next(-0.5, 0.5), -90.0, 90.0 ),
+                    -100.0 );
+            else
+                end.set( rand.next(-180, 180), rand.next(-90, 90), -100.0 );
+
+            double expected_t = 0.0;
+            bool expectHit = firstCrossing( ridge, ridgeCreases, start, end, expected_t );
+
+            osg::Vec3d point;
+            bool hit = intersector->intersect( start, end, point );
+
+            osg::Vec3d dir = end - start;
+            double t = hit ? ((point - start) * dir) / dir.length2() : 0.0;
+            if ( !checkHit( ridge, start, end, expectHit, expected_t, hit, t ) )
+                ++misses;
+        }
+
+        return check( misses == 0, "TerrainIntersector", "wrong hit on a ridge", misses );
+    }
+
+    // FeatureListSource's spatial index must return what a linear scan of the
+    // features returns, before and after features move.
+    unsigned testFeatureListIndex()
+    {
+        const unsigned POINTS  = 20000;
+        const unsigned QUERIES = 200;
+        const double   QUERY_SIZE = 180.0 / 64.0; // a level-6 tile in the global-geodetic profile
+
+        Random rand;
+        osg::ref_ptr<FeatureListSource> source = new FeatureListSource();
+        for( unsigned i = 0; i < POINTS; ++i )
+        {
+            PointSet* points = new PointSet();
+            points->push_back( randomDensePoint(rand) );
+            osg::ref_ptr<Feature> feature = new Feature( points, Style(), (FeatureID)i );
+            source->insertFeature( feature.get() );
+        }
+
+        unsigned failures = 0;
+        for( unsigned pass = 0; pass < 2; ++pass )
+        {
+            // the second pass runs after moving 1% of the points.
+            if ( pass == 1 )
+            {
+                FeatureList& all = source->getFeatures();
+                unsigned numMoved = 0;
+                for( FeatureList::iterator f = all.begin(); f != all.end() && numMoved < POINTS/100; ++f, ++numMoved )
+                {
+                    (*f->get()->getGeometry())[0] = randomDensePoint( rand );
+                    source->updateFeature( f->get() );
+                }
+            }
+
+            unsigned mismatches = 0;
+            for( unsigned i = 0; i < QUERIES; ++i )
+            {
+                osg::Vec3d center = i % 4 != 0 ?
+                    osg::Vec3d( 10.0 + rand.next(-5, 5), 45.0 + rand.next(-5, 5), 0.0 ) :
+                    osg::Vec3d( rand.next(-180, 180), rand.next(-90, 90), 0.0 );
+                Bounds queryBounds(
+                    center.x() - 0.5*QUERY_SIZE, center.y() - 0.5*QUERY_SIZE,
+                    center.x() + 0.5*QUERY_SIZE, center.y() + 0.5*QUERY_SIZE );
+
+                Query query;
+                query.bounds() = queryBounds;
+
+                unsigned numFound = 0;
+                osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor( query );
+                while( cursor.valid() && cursor->hasMore() )
+                {
+                    cursor->nextFeature();
+                    ++numFound;
+                }
+
+                unsigned numScanned = 0;
+                FeatureList& all = source->getFeatures();
+                for( FeatureList::iterator f = all.begin(); f != all.end(); ++f )
+                {
+                    if ( boundsIntersect( f->get()->getGeometry()->getBounds(), queryBounds ) )
+                        ++numScanned;
+                }
+
+                if ( numFound != numScanned )
+                    ++mismatches;
+            }
+
+            failures += check( mismatches == 0, "FeatureListSource",
+                pass == 0 ? "index and linear scan disagree" : "index and linear scan disagree after updates", mismatches );
+        }
+        return failures;
+    }
+
+    // HTTPClient end to end: bodies with and without a Content-Length, throttling,
+    // retries, compressed transfer for text only, and timeouts.
+    unsigned testHTTPClient()
+    {
+        StandInServer server;
+        if ( !server.start() )
+            return check( false, "HTTPClient", "failed to start the stand-in HTTP server" );
+
+        unsigned failures = 0;
+
+        // Response bodies: with a Content-Length the client fills a buffer sized up
+        // front; without one it grows the buffer as data arrives.
+        {
+            const unsigned SIZE = 256*1024;
+            const char* modes[] = { "sized", "unsized" };
+            for( unsigned m = 0; m < 2; ++m )
+            {
+                std::stringstream path;
+                path << "/" << modes[m] << "/" << SIZE;
+
+                unsigned bad = 0;
+                for( unsigned i = 0; i < 8; ++i )
+                {
+                    HTTPResponse response = HTTPClient::get( server.url( path.str() ) );
+                    if (!response.isOK() || response.getNumParts() != 1 ||
+                        !checkBody( response.getPartData(0), response.getPartSize(0), SIZE ) )
+                    {
+                        ++bad;
+                    }
+                }
+                failures += check( bad == 0, "HTTPClient", std::string("corrupt ") + modes[m] + " body", bad );
+            }
+        }
+
+        // Throttling and retries, against injected latency and errors: concurrent
+        // clients fetch URLs of which every other one fails with a 503 the first
+        // time. Every body must come back whole after exactly the expected number
+        // of tries, and the server must never serve more requests at once than
+        // the per-host limit allows.
+        HTTPSettings saved = HTTPClient::getHTTPSettings();
+        HTTPSettings settings = saved;
+        settings.compression()           = true;
+        settings.maxConnectionsPerHost() = 4;
+        settings.maxRetries()            = 2;
+        settings.retryDelay()            = 20;
+        settings.maxRetryDelay()         = 200;
+        HTTPClient::setHTTPSettings( settings );
+
+        {
+            const unsigned LOAD_THREADS  = 16;
+            const unsigned LOAD_REQUESTS = 64;
+            const unsigned LOAD_SIZE     = 16384;
+
+            std::vector<std::string> loadPaths;
+            std::vector<HTTPLoadThread*> threads;
+            for( unsigned t = 0; t < LOAD_THREADS; ++t )
+            {
+                std::vector<std::string> urls;
+                for( unsigned i = t; i < LOAD_REQUESTS; i += LOAD_THREADS )
+                {
+                    std::stringstream path;
+                    path << "/sized/" << LOAD_SIZE << "?id=" << i << "&delay=20&fail=" << (i % 2);
+                    loadPaths.push_back( path.str() );
+                    urls.push_back( server.url( path.str() ) );
+                }
+                threads.push_back( new HTTPLoadThread( urls, LOAD_SIZE ) );
+            }
+
+            for( unsigned t = 0; t < threads.size(); ++t )
+                threads[t]->startThread();
+
+            unsigned bad = 0;
+            for( unsigned t = 0; t < threads.size(); ++t )
+            {
+                threads[t]->join();
+                bad += threads[t]->_failures;
+                delete threads[t];
+            }
+            failures += check( bad == 0, "HTTPClient", "corrupt or missing body under load", bad );
+
+            unsigned wrongTries = 0;
+            for( unsigned i = 0; i < loadPaths.size(); ++i )
+            {
+                if ( server.getNumRequests( loadPaths[i] ) != getQueryValue( loadPaths[i], "fail" ) + 1 )
+                    ++wrongTries;
+            }
+            failures += check( wrongTries == 0, "HTTPClient", "wrong number of retries", wrongTries );
+
+            std::stringstream buf;
+            buf << "the server saw " << server.getPeakActive() << " concurrent requests; the limit is " << settings.maxConnectionsPerHost();
+            failures += check( server.getPeakActive() <= (unsigned)settings.maxConnectionsPerHost(), "HTTPClient", buf.str() );
+        }
+
+        // A URL that keeps failing: the client gives up after its retry budget,
+        // and reports the server's error.
+        {
+            std::string path = "/sized/1024?id=give_up&fail=1000";
+            HTTPResponse response = HTTPClient::get( server.url(path) );
+            failures += check(
+                response.getCode() == 503L && server.getNumRequests(path) == (unsigned)settings.maxRetries() + 1,
+                "HTTPClient", "didn't give up on a failing URL after its retries" );
+        }
+
+        // Compressed transfer is asked for on text only.
+        {
+            const char* paths[] = {
+                "/sized/1024?id=png&format=image/png",
+                "/sized/1024.xml?id=xml",
+                "/sized/1024?id=caps&request=GetCapabilities",
+                "/sized/1024?id=json&f=pjson" };
+            const bool text[] = { false, true, true, true };
+
+            for( unsigned i = 0; i < 4; ++i )
+            {
+                HTTPResponse response = HTTPClient::get( server.url(paths[i]) );
+                failures += check( response.isOK() && server.getAcceptedEncoding(paths[i]) == text[i],
+                    "HTTPClient", std::string("wrong Accept-Encoding for ") + paths[i] );
+            }
+        }
+
+        // A server that answers too slowly: the transfer times out rather than
+        // hanging. (Last, since the server keeps serving it after we give up.)
+        {
+            settings.timeout()    = 1;
+            settings.maxRetries() = 0;
+            HTTPClient::setHTTPSettings( settings );
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            HTTPResponse response = HTTPClient::get( server.url("/sized/1024?id=slow&delay=2500") );
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+            failures += check( !response.isOK() && ms <= 2000.0, "HTTPClient", "a slow transfer didn't time out" );
+        }
+
+        HTTPClient::setHTTPSettings( saved );
+        server.stop();
+        return failures;
+    }
+}
+
+//------------------------------------------------------------------------
 
 int main(int argc, char** argv)
 {
   osg::ArgumentParser arguments(&argc,argv);
 
+  // --local runs only the checks that need neither data/ nor the network.
+  bool localOnly = arguments.read("--local");
+
+  unsigned failures = 0;
+  failures += testMinMaxHeightField();
+  failures += testTerrainIntersector();
+  failures += testFeatureListIndex();
+  failures += testHTTPClient();
+
+  if ( localOnly )
+  {
+      return failures > 0 ? 1 : 0;
+  }
+
   //One to one test.  Read a single 1 to 1 tile out of a MapLayer
   {
       GDALOptions driverOpt;
@@ -118,6 +983,6 @@ int main(int argc, char** argv)
 	  osgDB::writeImageFile(*image.getImage(), layer->getName()+key.str() + std::string(".png"));
   }
 
-  return 0;
+  return failures > 0 ? 1 : 0;
 }
 
@@ -148,58 +148,84 @@ void CacheSeed::seed( Map* map )
 void
 CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
 {
-    unsigned int x, y, lod;
-    key.getTileXY(x, y);
-    lod = key.getLevelOfDetail();
-
-//	osg::ref_ptr<osgEarth::VersionedTerrain> terrain = new osgEarth::VersionedTerrain( map, engine );
+    unsigned int lod = key.getLevelOfDetail();
 
     if ( _minLevel <= lod && _maxLevel >= lod )
     {
-//        OE_NOTICE << "Caching tile = " << key.str() << std::endl; //<< lod << " (" << x << ", " << y << ") " << std::endl;
-	if ( _progress.valid() && _progress->reportProgress(0, 0, "Caching tile: " + key.str()) )
-	    return; // Task has been cancelled by user
+	    if ( _progress.valid() && _progress->reportProgress(0, 0, "Caching tile: " + key.str()) )
+	        return; // Task has been cancelled by user
 
         cacheTile( mapf, key );
-  //      bool validData;
-		//osg::ref_ptr<osg::Node> node = engine->createTile( map, terrain.get(), key, true, false, false, validData );        
     }
 
+    processChildren( mapf, key );
+}
+
+// Caches the four children of a key together, so that sources that can service
+// several tiles at once only see one request per sibling set; then recurses.
+void
+CacheSeed::processChildren(const MapFrame& mapf, const TileKey& key ) const
+{
+    unsigned int lod = key.getLevelOfDetail();
+
     if (lod <= _maxLevel)
     {
-        TileKey k0 = key.createChildKey(0);
-        TileKey k1 = key.createChildKey(1);
-        TileKey k2 = key.createChildKey(2);
-        TileKey k3 = key.createChildKey(3);        
+        std::vector<TileKey> children(4);
+        for( unsigned q = 0; q < 4; ++q )
+            children[q] = key.createChildKey(q);
 
         //Check to see if the bounds intersects ANY of the tile's children.  If it does, then process all of the children
         //for this level
-        if (_bounds.intersects( k0.getExtent().bounds() ) || _bounds.intersects(k1.getExtent().bounds()) ||
-            _bounds.intersects( k2.getExtent().bounds() ) || _bounds.intersects(k3.getExtent().bounds()) )
+        if (_bounds.intersects( children[0].getExtent().bounds() ) || _bounds.intersects(children[1].getExtent().bounds()) ||
+            _bounds.intersects( children[2].getExtent().bounds() ) || _bounds.intersects(children[3].getExtent().bounds()) )
         {
-            processKey(mapf, k0);
-            processKey(mapf, k1);
-            processKey(mapf, k2);
-            processKey(mapf, k3);
+            if ( _minLevel <= lod+1 && _maxLevel >= lod+1 )
+            {
+                for( unsigned q = 0; q < 4; ++q )
+                {
+                    if ( _progress.valid() && _progress->reportProgress(0, 0, "Caching tile: " + children[q].str()) )
+                        return; // Task has been cancelled by user
+                }
+
+                cacheTiles( mapf, children );
+            }
+
+            for( unsigned q = 0; q < 4; ++q )
+                processChildren( mapf, children[q] );
         }
     }
 }
 
 void
 CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
+{
+    cacheTiles( mapf, std::vector<TileKey>(1, key) );
+}
+
+void
+CacheSeed::cacheTiles(const MapFrame& mapf, const std::vector<TileKey>& keys ) const
 {
     for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); i++ )
     {
         ImageLayer* layer = i->get();
-        if ( layer->isKeyValid( key ) )
+
+        std::vector<TileKey> validKeys;
+        for( unsigned k = 0; k < keys.size(); ++k )
+        {
+            if ( layer->isKeyValid( keys[k] ) )
+                validKeys.push_back( keys[k] );
+        }
+
+        if ( validKeys.size() > 0 )
         {
-            GeoImage image = layer->createImage( key );
+            std::vector<GeoImage> images;
+            layer->createImages( validKeys, images );
         }
     }
 
     if ( mapf.elevationLayers().size() > 0 )
     {
-        osg::ref_ptr<osg::HeightField> hf;
-        mapf.getHeightField( key, false, hf );
+        std::vector< osg::ref_ptr<osg::HeightField> > hfs;
+        mapf.getHeightFields( keys, false, hfs );
     }
 }
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <limits.h>
+#include <stdio.h>
 #include <iomanip>
 
 #include <osgEarth/Caching>
@@ -24,6 +25,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/TileSource>
 
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
@@ -331,6 +333,46 @@ DiskCache::loadProperties(const std::string&           cacheId,
 	return false;
 }
 
+std::string
+DiskCache::getBlacklistPath(const std::string& cacheId) const
+{
+    return getPath() + std::string("/") + cacheId + std::string("/blacklist.txt");
+}
+
+void
+DiskCache::storeBlacklist(const CacheSpec& spec, const TileBlacklist* blacklist)
+{
+    if ( !blacklist || spec.cacheId().empty() )
+        return;
+
+    std::string path = getBlacklistPath( spec.cacheId() );
+
+    // don't leave a stale file behind if the blacklist was cleared
+    if ( blacklist->size() == 0 )
+    {
+        if ( osgDB::fileExists( path ) )
+            ::remove( path.c_str() );
+        return;
+    }
+
+    OE_DEBUG << LC << "Writing blacklist to " << path << std::endl;
+    blacklist->write( path );
+}
+
+TileBlacklist*
+DiskCache::loadBlacklist(const CacheSpec& spec)
+{
+    if ( spec.cacheId().empty() )
+        return 0L;
+
+    std::string path = getBlacklistPath( spec.cacheId() );
+    if ( !osgDB::fileExists( path ) )
+        return 0L;
+
+    OE_DEBUG << LC << "Reading blacklist from " << path << std::endl;
+    return TileBlacklist::read( path );
+}
+
 //------------------------------------------------------------------------
 
 #undef  LC
@@ -25,6 +25,22 @@ using namespace OpenThreads;
 
 #define LC "[ElevationLayer] "
 
+namespace
+{
+    // sets up the heightfield's origin and intervals to match the key's extent.
+    void initHeightField( osg::HeightField* hf, const TileKey& key )
+    {
+		double minx, miny, maxx, maxy;
+		key.getExtent().getBounds(minx, miny, maxx, maxy);
+		hf->setOrigin( osg::Vec3d( minx, miny, 0.0 ) );
+		double dx = (maxx - minx)/(double)(hf->getNumColumns()-1);
+		double dy = (maxy - miny)/(double)(hf->getNumRows()-1);
+		hf->setXInterval( dx );
+		hf->setYInterval( dy );
+		hf->setBorderWidth( 0 );
+    }
+}
+
 //------------------------------------------------------------------------
 
 ElevationLayerOptions::ElevationLayerOptions( const ConfigOptions& options ) :
@@ -365,15 +381,93 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
 	if ( result )
 	{	
 		//Go ahead and set up the heightfield so we don't have to worry about it later
-		double minx, miny, maxx, maxy;
-		key.getExtent().getBounds(minx, miny, maxx, maxy);
-		result->setOrigin( osg::Vec3d( minx, miny, 0.0 ) );
-		double dx = (maxx - minx)/(double)(result->getNumColumns()-1);
-		double dy = (maxy - miny)/(double)(result->getNumRows()-1);
-		result->setXInterval( dx );
-		result->setYInterval( dy );
-		result->setBorderWidth( 0 );
+        initHeightField( result, key );
 	}
 	
     return result;
 }
+
+void
+ElevationLayer::createHeightFields(const std::vector<TileKey>& keys,
+                                   std::vector< osg::ref_ptr<osg::HeightField> >& out_hfs,
+                                   ProgressCallback* progress )
+{
+    out_hfs.clear();
+    out_hfs.resize( keys.size() );
+
+    TileSource* source = getTileSource();
+    const Profile* layerProfile = getProfile();
+
+    // only keys in the layer's own profile map one-to-one onto source tiles:
+    bool batch = !_actualCacheOnly && source && source->isOK() && layerProfile && keys.size() > 1;
+    for( unsigned i=0; batch && i<keys.size(); ++i )
+    {
+        if ( !keys[i].getProfile()->isEquivalentTo( layerProfile ) )
+            batch = false;
+    }
+
+    if ( !batch )
+    {
+        for( unsigned i=0; i<keys.size(); ++i )
+            out_hfs[i] = createHeightField( keys[i], progress );
+        return;
+    }
+
+    bool useCache = _cache.valid() && _options.cacheEnabled() == true;
+
+    //Write the layer properties if they haven't been written yet.
+    if ( !_cacheProfile.valid() && useCache )
+    {
+        _cacheProfile = keys[0].getProfile();
+        _cache->storeProperties( _cacheSpec, _cacheProfile.get(), source->getPixelsPerTile() );
+    }
+
+    std::vector<TileKey> fetchKeys;
+    std::vector<unsigned> fetchSlots;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        const TileKey& key = keys[i];
+
+        if ( useCache )
+        {
+            osg::ref_ptr<const osg::HeightField> cachedHF;
+            if ( _cache->getHeightField( key, _cacheSpec, cachedHF ) )
+            {
+                out_hfs[i] = new osg::HeightField( *cachedHF.get() );
+                initHeightField( out_hfs[i].get(), key );
+                continue;
+            }
+        }
+
+        // same tests as createHeightField/createGeoHeightField:
+        if ( isKeyValid(key) && !source->getBlacklist()->contains(key.getTileId()) && source->hasData(key) )
+        {
+            fetchKeys.push_back( key );
+            fetchSlots.push_back( i );
+        }
+    }
+
+    if ( fetchKeys.size() == 0 )
+        return;
+
+    std::vector< osg::ref_ptr<osg::HeightField> > hfs;
+    source->createHeightFields( fetchKeys, hfs, _preCacheOp.get(), progress );
+
+    for( unsigned j=0; j<fetchKeys.size(); ++j )
+    {
+        osg::HeightField* hf = j < hfs.size() ? hfs[j].get() : 0L;
+        if ( hf )
+        {
+            if ( useCache )
+                _cache->setHeightField( fetchKeys[j], _cacheSpec, hf );
+
+            initHeightField( hf, fetchKeys[j] );
+            out_hfs[ fetchSlots[j] ] = hf;
+        }
+        else if ( !progress || !progress->isCanceled() )
+        {
+            source->getBlacklist()->add( fetchKeys[j].getTileId() );
+        }
+    }
+}
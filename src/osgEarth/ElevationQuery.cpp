@@ -10,6 +10,25 @@
 using namespace osgEarth;
 using namespace OpenThreads;
 
+namespace
+{
+    // wraps a heightfield in a terrain tile, as required for GEOMETRIC mode.
+    osgTerrain::TerrainTile* createQueryTile( const TileKey& key, osg::HeightField* hf, const MapInfo& mapInfo )
+    {
+        GeoLocator* locator = GeoLocator::createForKey( key, mapInfo );
+
+        osgTerrain::TerrainTile* tile = new osgTerrain::TerrainTile();
+
+        osgTerrain::HeightFieldLayer* layer = new osgTerrain::HeightFieldLayer( hf );
+        layer->setLocator( locator );
+
+        tile->setElevationLayer( layer );
+        tile->setRequiresNormals( false );
+        tile->setTerrainTechnique( new osgTerrain::GeometryTechnique );
+        return tile;
+    }
+}
+
 ElevationQuery::ElevationQuery( const Map* map ) :
 _mapf( map, Map::ELEVATION_LAYERS )
 {
@@ -117,7 +136,7 @@ ElevationQuery::getElevations(std::vector<osg::Vec3d>& points,
     {
         double elevation;
         double z = (*i).z();
-        if ( getElevationImpl( *i, pointsSRS, elevation, desiredResolution ) )
+        if ( getElevationImpl( *i, pointsSRS, elevation, desiredResolution, 0L, points.size() > 1 ) )
         {
             (*i).z() = ignoreZ ? elevation : elevation + z;
         }
@@ -130,7 +149,8 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
                                  const SpatialReference* pointSRS,
                                  double&                 out_elevation,
                                  double                  desiredResolution,
-                                 double*                 out_actualResolution)
+                                 double*                 out_actualResolution,
+                                 bool                    fetchSiblings)
 {
     if ( _maxDataLevel == 0 || _tileSize == 0 )
     {
@@ -198,9 +218,45 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
     // if we didn't find it (or it didn't have heightfield data), build it.
     if ( !tile.valid() )
     {
-        // generate the heightfield corresponding to the tile key, automatically falling back
+        // A batch of queries tends to be spatially coherent (paths, profiles, grids), so
+        // fetch the whole sibling set in one go and cache all of it. Each elevation layer
+        // then sees a single request instead of one per tile. A lone query only pays for
+        // the tile it needs.
+        std::vector<TileKey> keys;
+        if ( fetchSiblings && key.getLevelOfDetail() > 0 )
+        {
+            TileKey parent = key.createParentKey();
+            for( unsigned q = 0; q < 4; ++q )
+                keys.push_back( parent.createChildKey(q) );
+        }
+        else
+        {
+            keys.push_back( key );
+        }
+
+        // generate the heightfields corresponding to the tile keys, automatically falling back
         // on lower resolution if necessary:
-        _mapf.getHeightField( key, true, hf, 0L, _interpolation );
+        std::vector< osg::ref_ptr<osg::HeightField> > hfs;
+        _mapf.getHeightFields( keys, true, hfs, _interpolation );
+
+        for( unsigned k = 0; k < keys.size() && k < hfs.size(); ++k )
+        {
+            if ( !hfs[k].valid() )
+                continue;
+
+            // All this stuff is requires for GEOMETRIC mode. An optimization would be to
+            // defer this so that PARAMETRIC mode doesn't waste time
+            osg::ref_ptr<osgTerrain::TerrainTile> newTile = createQueryTile( keys[k], hfs[k].get(), _mapf.getMapInfo() );
+
+            // store it in the local tile cache.
+            _tileCache.insert( keys[k], newTile.get() );
+
+            if ( keys[k] == key )
+            {
+                tile = newTile.get();
+                hf = hfs[k].get();
+            }
+        }
 
         // bail out if we could not make a heightfield a all.
         if ( !hf.valid() )
@@ -208,22 +264,6 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
             OE_WARN << LC << "Unable to create heightfield for key " << key.str() << std::endl;
             return false;
         }
-
-        // All this stuff is requires for GEOMETRIC mode. An optimization would be to
-        // defer this so that PARAMETRIC mode doesn't waste time
-        GeoLocator* locator = GeoLocator::createForKey( key, _mapf.getMapInfo() );
-
-        tile = new osgTerrain::TerrainTile();
-
-        osgTerrain::HeightFieldLayer* layer = new osgTerrain::HeightFieldLayer( hf.get() );
-        layer->setLocator( locator );
-
-        tile->setElevationLayer( layer );
-        tile->setRequiresNormals( false );
-        tile->setTerrainTechnique( new osgTerrain::GeometryTechnique );
-
-        // store it in the local tile cache.
-        _tileCache.insert( key, tile.get() );
     }
 
     OE_DEBUG << LC << "LRU Cache, hit ratio = " << _tileCache.getHitRatio() << std::endl;
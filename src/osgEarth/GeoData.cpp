@@ -32,6 +32,8 @@
 
 #include <sstream>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
 
 #define LC "[GeoData] "
 
@@ -920,6 +922,154 @@ manualReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoE
 
 
 
+// Reprojects an RGBA8 image without GDAL. Rather than transforming the
+// coordinates of every output pixel, it transforms a coarse grid of them
+// and interpolates in between, which is exact enough for the smooth mappings
+// between contiguous SRS's (e.g. Mercator => geodetic) at tile scales. The
+// grid is checked against exact transforms at the cell centers; if the error
+// is too large, this returns NULL so the caller can fall back on a dense method.
+static osg::Image*
+gridReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoExtent& dest_extent,
+              unsigned int width, unsigned int height)
+{
+    // maximum grid cells along each axis
+    const unsigned int maxCells = 16;
+
+    // maximum acceptable interpolation error, in source pixels
+    const double maxError = 0.25;
+
+    if ( width < 2 || height < 2 || image->s() < 1 || image->t() < 1 )
+        return 0L;
+
+    const unsigned int cellsX = osg::minimum( maxCells, width-1 );
+    const unsigned int cellsY = osg::minimum( maxCells, height-1 );
+    const unsigned int numX   = cellsX + 1;
+    const unsigned int numY   = cellsY + 1;
+
+    // sample at pixel centers, as in manualReproject:
+    const double dx = dest_extent.width() / (double)width;
+    const double dy = dest_extent.height() / (double)height;
+    const double x0 = dest_extent.xMin() + .5 * dx, x1 = dest_extent.xMax() - .5 * dx;
+    const double y0 = dest_extent.yMin() + .5 * dy, y1 = dest_extent.yMax() - .5 * dy;
+
+    // transform the grid nodes (column-major, like transformExtentPoints):
+    std::vector<double> gx( numX * numY ), gy( numX * numY );
+    if ( !dest_extent.getSRS()->transformExtentPoints(
+        src_extent.getSRS(), x0, y0, x1, y1, &gx[0], &gy[0], numX, numY, 0L, true ) )
+    {
+        return 0L;
+    }
+
+    // express the grid in source pixel coordinates:
+    const double xfac = (image->s() - 1) / src_extent.width();
+    const double yfac = (image->t() - 1) / src_extent.height();
+    for( unsigned int k = 0; k < gx.size(); ++k )
+    {
+        if ( osg::isNaN(gx[k]) || osg::isNaN(gy[k]) || fabs(gx[k]) > 1e15 || fabs(gy[k]) > 1e15 )
+            return 0L;
+
+        gx[k] = (gx[k] - src_extent.xMin()) * xfac;
+        gy[k] = (gy[k] - src_extent.yMin()) * yfac;
+    }
+
+    // verify the grid against the exact transform at the cell centers:
+    {
+        const double cdx = (x1 - x0) / (double)cellsX;
+        const double cdy = (y1 - y0) / (double)cellsY;
+        std::vector<double> cx( cellsX * cellsY ), cy( cellsX * cellsY );
+        for( unsigned int i = 0; i < cellsX; ++i )
+        {
+            for( unsigned int j = 0; j < cellsY; ++j )
+            {
+                cx[i*cellsY + j] = x0 + (i + .5) * cdx;
+                cy[i*cellsY + j] = y0 + (j + .5) * cdy;
+            }
+        }
+
+        if ( !dest_extent.getSRS()->transformPoints( src_extent.getSRS(), &cx[0], &cy[0], 0L, cx.size(), 0L, true ) )
+            return 0L;
+
+        for( unsigned int i = 0; i < cellsX; ++i )
+        {
+            for( unsigned int j = 0; j < cellsY; ++j )
+            {
+                unsigned int a = i*numY + j, b = (i+1)*numY + j;
+                double ix = .25 * (gx[a] + gx[a+1] + gx[b] + gx[b+1]);
+                double iy = .25 * (gy[a] + gy[a+1] + gy[b] + gy[b+1]);
+                double ex = (cx[i*cellsY + j] - src_extent.xMin()) * xfac;
+                double ey = (cy[i*cellsY + j] - src_extent.yMin()) * yfac;
+                if ( osg::isNaN(ex) || osg::isNaN(ey) || fabs(ix - ex) > maxError || fabs(iy - ey) > maxError )
+                    return 0L;
+            }
+        }
+    }
+
+    osg::Image* result = new osg::Image();
+    result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    result->setInternalTextureFormat(GL_RGBA8);
+    //Initialize the image to be completely transparent
+    memset(result->data(), 0, result->getImageSizeInBytes());
+
+    const int    maxCol = image->s() - 1;
+    const int    maxRow = image->t() - 1;
+    const double uScale = (double)cellsX / (double)(width - 1);
+    const double vScale = (double)cellsY / (double)(height - 1);
+
+    // the grid, interpolated down to the current output row:
+    std::vector<double> rowX( numX ), rowY( numX );
+
+    for( unsigned int r = 0; r < height; ++r )
+    {
+        double v = r * vScale;
+        unsigned int j = osg::minimum( (unsigned int)v, cellsY - 1 );
+        double fv = v - (double)j;
+
+        for( unsigned int i = 0; i < numX; ++i )
+        {
+            unsigned int a = i*numY + j;
+            rowX[i] = gx[a] + fv * (gx[a+1] - gx[a]);
+            rowY[i] = gy[a] + fv * (gy[a+1] - gy[a]);
+        }
+
+        unsigned char* out = result->data(0, r);
+
+        for( unsigned int c = 0; c < width; ++c, out += 4 )
+        {
+            double u = c * uScale;
+            unsigned int i = osg::minimum( (unsigned int)u, cellsX - 1 );
+            double fu = u - (double)i;
+
+            double px = rowX[i] + fu * (rowX[i+1] - rowX[i]);
+            double py = rowY[i] + fu * (rowY[i+1] - rowY[i]);
+
+            // outside the source image: leave it transparent.
+            if ( px < 0.0 || py < 0.0 || px > (double)maxCol || py > (double)maxRow )
+                continue;
+
+            // bilinear sample, straight from the source bytes:
+            int col0 = (int)px, row0 = (int)py;
+            int col1 = osg::minimum( col0 + 1, maxCol );
+            int row1 = osg::minimum( row0 + 1, maxRow );
+            float fx = (float)(px - col0), fy = (float)(py - row0);
+
+            const unsigned char* p00 = image->data(col0, row0);
+            const unsigned char* p10 = image->data(col1, row0);
+            const unsigned char* p01 = image->data(col0, row1);
+            const unsigned char* p11 = image->data(col1, row1);
+
+            for( unsigned int k = 0; k < 4; ++k )
+            {
+                float bottom = p00[k] + fx * ((float)p10[k] - (float)p00[k]);
+                float top    = p01[k] + fx * ((float)p11[k] - (float)p01[k]);
+                out[k] = (unsigned char)( bottom + fy * (top - bottom) + 0.5f );
+            }
+        }
+    }
+
+    return result;
+}
+
+
 GeoImage
 GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent, unsigned int width, unsigned int height) const
 {  
@@ -935,24 +1085,37 @@ GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent,
 
     osg::Image* resultImage = 0L;
 
-    if ( getSRS()->isUserDefined() || to_srs->isUserDefined() ||
-        ( getSRS()->isMercator() && to_srs->isGeographic() ) ||
-        ( getSRS()->isGeographic() && to_srs->isMercator() ) )
+    // if we have RGBA8 data and a known output size, try warping natively with an
+    // interpolated coordinate grid. This avoids the GDAL lock (and the dataset copies).
+    const osg::Image* image = getImage();
+    if ( width > 0 && height > 0 && image &&
+         image->getPixelFormat() == GL_RGBA && image->getDataType() == GL_UNSIGNED_BYTE &&
+         getSRS()->isContiguous() && to_srs->isContiguous() )
     {
-        // if either of the SRS is a custom projection, we have to do a manual reprojection since
-        // GDAL will not recognize the SRS.
-        resultImage = manualReproject(getImage(), getExtent(), *to_extent, width, height);
+        resultImage = gridReproject(image, getExtent(), destExtent, width, height);
     }
-    else
+
+    if ( !resultImage )
     {
-        // otherwise use GDAL.
-        resultImage = reprojectImage(getImage(),
-            getSRS()->getWKT(),
-            getExtent().xMin(), getExtent().yMin(), getExtent().xMax(), getExtent().yMax(),
-            to_srs->getWKT(),
-            destExtent.xMin(), destExtent.yMin(), destExtent.xMax(), destExtent.yMax(),
-            width, height);
-    }   
+        if ( getSRS()->isUserDefined() || to_srs->isUserDefined() ||
+            ( getSRS()->isMercator() && to_srs->isGeographic() ) ||
+            ( getSRS()->isGeographic() && to_srs->isMercator() ) )
+        {
+            // if either of the SRS is a custom projection, we have to do a manual reprojection since
+            // GDAL will not recognize the SRS.
+            resultImage = manualReproject(getImage(), getExtent(), destExtent, width, height);
+        }
+        else
+        {
+            // otherwise use GDAL.
+            resultImage = reprojectImage(getImage(),
+                getSRS()->getWKT(),
+                getExtent().xMin(), getExtent().yMin(), getExtent().xMax(), getExtent().yMax(),
+                to_srs->getWKT(),
+                destExtent.xMin(), destExtent.yMin(), destExtent.xMax(), destExtent.yMax(),
+                width, height);
+        }
+    }
     return GeoImage(resultImage, destExtent);
 }
 
@@ -1079,14 +1242,13 @@ GeoHeightField::createSubSample( const GeoExtent& destEx, ElevationInterpolation
     double x, y;
     int col, row;
 
+    std::vector<double> px( w ), py( h );
     for( x = destEx.xMin(), col=0; col < w; x += dx, col++ )
-    {
-        for( y = destEx.yMin(), row=0; row < h; y += dy, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtLocation( _heightField.get(), x, y, _extent.xMin(), _extent.yMin(), xInterval, yInterval, interpolation);
-            dest->setHeight( col, row, height );
-        }
-    }
+        px[col] = (x - _extent.xMin()) / xInterval;
+    for( y = destEx.yMin(), row=0; row < h; y += dy, row++ )
+        py[row] = (y - _extent.yMin()) / yInterval;
+
+    HeightFieldUtils::resampleHeightField( _heightField.get(), px, py, dest, interpolation );
 
     osg::Vec3d orig( destEx.xMin(), destEx.yMin(), _heightField->getOrigin().z() );
     dest->setOrigin( orig );
@@ -1192,6 +1354,74 @@ Geoid::getOffset(double lat_deg, double lon_deg, const ElevationInterpolation& i
     return result;
 }
 
+void
+Geoid::getOffsets(const std::vector<osg::Vec2d>& lonLats,
+                  std::vector<float>& out_offsets,
+                  const ElevationInterpolation& interp ) const
+{
+    out_offsets.resize( lonLats.size() );
+    for( unsigned i=0; i<lonLats.size(); ++i )
+        out_offsets[i] = getOffset( lonLats[i].y(), lonLats[i].x(), interp );
+}
+
+void
+Geoid::getOffsets(double latMin, double lonMin, 
+                  double latInterval, double lonInterval,
+                  osg::HeightField* out_hf,
+                  const ElevationInterpolation& interp ) const
+{
+    osg::HeightField::HeightList& heights = out_hf->getHeightList();
+    std::fill( heights.begin(), heights.end(), 0.0f );
+    if ( !_valid )
+        return;
+
+    unsigned numCols = out_hf->getNumColumns();
+    unsigned numRows = out_hf->getNumRows();
+
+    const GeoExtent& ex = _hf.getExtent();
+    const osg::HeightField* hf = _hf.getHeightField();
+    double xInterval = ex.width()  / (double)(hf->getNumColumns()-1);
+    double yInterval = ex.height() / (double)(hf->getNumRows()-1);
+
+    // wrap each axis into the geoid's range (same as getOffset), noting which posts
+    // still fall outside of it; those get a zero offset.
+    std::vector<double> px( numCols ), py( numRows );
+    std::vector<bool>   colOK( numCols ), rowOK( numRows );
+
+    for( unsigned c=0; c<numCols; ++c )
+    {
+        double lon = lonMin + lonInterval*(double)c;
+        if ( lon < ex.xMin() )      lon += 360.0;
+        else if ( lon > ex.xMax() ) lon -= 360.0;
+        px[c] = (lon - ex.xMin()) / xInterval;
+        colOK[c] = 
+            (lon >= ex.xMin() || osg::equivalent(lon, ex.xMin())) && 
+            (lon <= ex.xMax() || osg::equivalent(lon, ex.xMax()));
+    }
+
+    for( unsigned r=0; r<numRows; ++r )
+    {
+        double lat = latMin + latInterval*(double)r;
+        if ( lat < ex.yMin() )      lat = 90.0 - (-90.0-lat);
+        else if ( lat > ex.yMax() ) lat = -90 + (lat-90.0);
+        py[r] = (lat - ex.yMin()) / yInterval;
+        rowOK[r] = 
+            (lat >= ex.yMin() || osg::equivalent(lat, ex.yMin())) && 
+            (lat <= ex.yMax() || osg::equivalent(lat, ex.yMax()));
+    }
+
+    HeightFieldUtils::resampleHeightField( hf, px, py, out_hf, interp );
+
+    for( unsigned r=0; r<numRows; ++r )
+    {
+        for( unsigned c=0; c<numCols; ++c )
+        {
+            if ( !rowOK[r] || !colOK[c] )
+                heights[r*numCols + c] = 0.0f;
+        }
+    }
+}
+
 bool
 Geoid::isEquivalentTo( const Geoid& rhs ) const
 {
@@ -0,0 +1,269 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <curl/curl.h>
+#include <osgEarth/HTTPCache>
+#include <osgEarth/StringUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <OpenThreads/Thread>
+#include <osg/Math>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#define LC "[HTTPCache] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    const char* s_signature = "OSGEARTH_HTTP_CACHE 1";
+
+    // upper limit on the heuristic freshness of a response that only has a Last-Modified.
+    const std::time_t s_maxHeuristicAge = 86400;
+
+    std::string getHeader( const HTTPCache::Headers& headers, const std::string& name )
+    {
+        HTTPCache::Headers::const_iterator i = headers.find( name );
+        return i != headers.end() ? i->second : std::string();
+    }
+
+    std::time_t parseDate( const std::string& value )
+    {
+        return value.empty() ? (std::time_t)-1 : curl_getdate( value.c_str(), 0L );
+    }
+}
+
+//------------------------------------------------------------------------
+
+HTTPCache::HTTPCache( const std::string& path ) :
+_path( path )
+{
+    //nop
+}
+
+std::string
+HTTPCache::makeFilename( const std::string& url ) const
+{
+    unsigned int hash = hashString( url );
+    std::stringstream buf;
+    buf << _path << "/"
+        << std::hex << std::setfill('0') << std::setw(2) << (hash >> 24) << "/"
+        << std::setw(8) << hash << ".http";
+    std::string str = buf.str();
+    return str;
+}
+
+bool
+HTTPCache::read( const std::string& url, Entry& out_entry ) const
+{
+    std::ifstream in( makeFilename(url).c_str(), std::ios::in | std::ios::binary );
+    if ( !in.is_open() )
+        return false;
+
+    std::string line;
+    if ( !std::getline(in, line) || line != s_signature )
+        return false;
+
+    Entry entry;
+    std::string entryURL;
+    unsigned long size = 0;
+
+    // header lines are "name value", up to a blank line.
+    while( std::getline(in, line) && !line.empty() )
+    {
+        std::string::size_type sp = line.find( ' ' );
+        std::string name  = line.substr( 0, sp );
+        std::string value = sp != std::string::npos ? line.substr( sp+1 ) : "";
+
+        if      ( name == "url" )           entryURL            = value;
+        else if ( name == "mime-type" )     entry._mimeType     = value;
+        else if ( name == "etag" )          entry._etag         = value;
+        else if ( name == "last-modified" ) entry._lastModified = value;
+        else if ( name == "expires" )       entry._expires      = (std::time_t)::strtod( value.c_str(), 0L );
+        else if ( name == "size" )          size                = ::strtoul( value.c_str(), 0L, 10 );
+    }
+
+    // different URL with the same hash:
+    if ( entryURL != url )
+        return false;
+
+    entry._body.resize( size );
+    if ( size > 0 && !in.read( &entry._body[0], size ) )
+    {
+        OE_DEBUG << LC << "Truncated entry for " << url << std::endl;
+        return false;
+    }
+
+    out_entry = entry;
+    return true;
+}
+
+bool
+HTTPCache::write( const std::string& url, const Entry& entry )
+{
+    std::string filename = makeFilename( url );
+    std::string path = osgDB::getFilePath( filename );
+
+    if ( !osgDB::fileExists(path) && !osgDB::makeDirectory(path) )
+    {
+        OE_WARN << LC << "Couldn't create path " << path << std::endl;
+        return false;
+    }
+
+    // write to a temporary file first, so a concurrent reader never sees a partial entry.
+    std::stringstream buf;
+    buf << filename << "." << OpenThreads::Thread::CurrentThread() << ".tmp";
+    std::string tempFilename = buf.str();
+
+    bool ok = false;
+    {
+        std::ofstream out( tempFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+        if ( out.is_open() )
+        {
+            out << s_signature << "\n"
+                << "url " << url << "\n"
+                << "mime-type " << entry._mimeType << "\n"
+                << "etag " << entry._etag << "\n"
+                << "last-modified " << entry._lastModified << "\n"
+                << "expires " << (double)entry._expires << "\n"
+                << "size " << entry._body.size() << "\n"
+                << "\n";
+            out.write( entry._body.data(), entry._body.size() );
+            ok = out.good();
+        }
+    }
+
+    // rename() won't replace an existing file everywhere, so clear it first.
+    ::remove( filename.c_str() );
+
+    if ( ok && ::rename( tempFilename.c_str(), filename.c_str() ) == 0 )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+        _stats._writes++;
+        return true;
+    }
+
+    ::remove( tempFilename.c_str() );
+    OE_DEBUG << LC << "Failed to write entry for " << url << std::endl;
+    return false;
+}
+
+void
+HTTPCache::remove( const std::string& url )
+{
+    ::remove( makeFilename(url).c_str() );
+}
+
+bool
+HTTPCache::updateEntry( const Headers& headers, std::time_t now, Entry& entry )
+{
+    std::string cacheControl = toLower( getHeader(headers, "cache-control") );
+
+    if ( cacheControl.find("no-store") != std::string::npos )
+        return false;
+
+    // validators (a 304 may or may not repeat them):
+    std::string etag = getHeader( headers, "etag" );
+    if ( !etag.empty() )
+        entry._etag = etag;
+
+    std::string lastModified = getHeader( headers, "last-modified" );
+    if ( !lastModified.empty() )
+        entry._lastModified = lastModified;
+
+    // freshness: Cache-Control takes precedence over Expires.
+    long maxAge = -1;
+    if ( cacheControl.find("no-cache") != std::string::npos )
+    {
+        maxAge = 0;
+    }
+    else
+    {
+        std::string::size_type p = cacheControl.find( "max-age=" );
+        if ( p != std::string::npos && (p == 0 || cacheControl[p-1] != '-') )
+            maxAge = ::strtol( cacheControl.c_str() + p + 8, 0L, 10 );
+    }
+
+    if ( maxAge >= 0 )
+    {
+        entry._expires = now + maxAge;
+    }
+    else
+    {
+        std::time_t expires = parseDate( getHeader(headers, "expires") );
+        std::time_t lm      = parseDate( entry._lastModified );
+
+        if ( expires != (std::time_t)-1 )
+        {
+            entry._expires = expires;
+        }
+        else if ( lm != (std::time_t)-1 && lm < now )
+        {
+            // no explicit lifetime; use the usual heuristic of 10% of the document's age.
+            entry._expires = now + osg::minimum( (now - lm) / 10, s_maxHeuristicAge );
+        }
+        else
+        {
+            entry._expires = now;
+        }
+    }
+
+    // no point storing something we can neither reuse nor revalidate.
+    return entry.isFresh(now) || entry.canRevalidate();
+}
+
+HTTPCache::Stats
+HTTPCache::getStats() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+    return _stats;
+}
+
+void
+HTTPCache::resetStats()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+    _stats = Stats();
+}
+
+void
+HTTPCache::recordHit()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+    _stats._hits++;
+}
+
+void
+HTTPCache::recordRevalidation()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+    _stats._revalidations++;
+}
+
+void
+HTTPCache::recordMiss()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _statsMutex );
+    _stats._misses++;
+}
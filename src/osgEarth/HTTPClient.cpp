@@ -22,15 +22,21 @@
 #include <osgEarth/HTTPClient>
 #include <osgEarth/Registry>
 #include <osgEarth/Version>
+#include <osgEarth/StringUtils>
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
 #include <osg/Notify>
+#include <osg/Timer>
+#include <OpenThreads/Condition>
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <sstream>
 #include <fstream>
 #include <iterator>
 #include <iostream>
 #include <algorithm>
+#include <ctime>
 
 #define LC "[HTTPClient] "
 
@@ -74,20 +80,78 @@ ProxySettings::getConfig() const
     return conf;
 }
 
+//----------------------------------------------------------------------------
+
+HTTPSettings::HTTPSettings( const Config& conf ) :
+_compression          ( true ),
+_connectTimeout       ( 30 ),
+_timeout              ( 0 ),
+_maxConnectionsPerHost( 0 ),
+_maxRetries           ( 2 ),
+_retryDelay           ( 250 ),
+_maxRetryDelay        ( 8000 )
+{
+    mergeConfig( conf );
+}
+
+void
+HTTPSettings::mergeConfig( const Config& conf )
+{
+    _compression           = conf.value<bool>( "compression", _compression );
+    _connectTimeout        = conf.value<int>( "connect_timeout", _connectTimeout );
+    _timeout               = conf.value<int>( "timeout", _timeout );
+    _maxConnectionsPerHost = conf.value<int>( "max_connections_per_host", _maxConnectionsPerHost );
+    _maxRetries            = conf.value<int>( "max_retries", _maxRetries );
+    _retryDelay            = conf.value<int>( "retry_delay", _retryDelay );
+    _maxRetryDelay         = conf.value<int>( "max_retry_delay", _maxRetryDelay );
+}
+
+Config
+HTTPSettings::getConfig() const
+{
+    Config conf( "http" );
+    conf.add( "compression", toString(_compression) );
+    conf.add( "connect_timeout", toString(_connectTimeout) );
+    conf.add( "timeout", toString(_timeout) );
+    conf.add( "max_connections_per_host", toString(_maxConnectionsPerHost) );
+    conf.add( "max_retries", toString(_maxRetries) );
+    conf.add( "retry_delay", toString(_retryDelay) );
+    conf.add( "max_retry_delay", toString(_maxRetryDelay) );
+    return conf;
+}
+
 /****************************************************************************/
    
 namespace osgEarth
 {
     struct StreamObject
     {
-        StreamObject(std::ostream* stream) : _stream(stream) { }
+        StreamObject(std::string* data, void* handle) : _data(data), _handle(handle), _first(true) { }
 
         void write(const char* ptr, size_t realsize)
         {
-            if (_stream) _stream->write(ptr, realsize);
+            if ( !_data ) return;
+
+            // on the first chunk, size the buffer to the whole body if the
+            // server told us how big it is, so it's filled without regrowing.
+            if ( _first )
+            {
+                _first = false;
+                double length = 0.0;
+                if ( _handle &&
+                     curl_easy_getinfo(_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) == CURLE_OK &&
+                     length > 0.0 )
+                {
+                    _data->reserve( _data->size() + (size_t)length );
+                }
+            }
+
+            _data->append(ptr, realsize);
         }
 
-        std::ostream* _stream;
+        std::string*    _data;
+        void*           _handle;
+        bool            _first;
         std::string     _resultMimeType;
     };
 
@@ -99,6 +163,210 @@ namespace osgEarth
         sp->write((const char*)ptr, realsize);
         return realsize;
     }
+
+    // collects response headers (lower-cased names) for the HTTP cache.
+    static size_t
+    HeaderReadCallback(void* ptr, size_t size, size_t nmemb, void* data)
+    {
+        size_t realsize = size* nmemb;
+        HTTPCache::Headers* headers = (HTTPCache::Headers*)data;
+        if ( headers )
+        {
+            std::string line( (const char*)ptr, realsize );
+            std::string::size_type colon = line.find( ':' );
+            if ( line.compare(0, 5, "HTTP/") == 0 )
+            {
+                // a new status line (e.g. after a redirect) starts a new set of headers.
+                headers->clear();
+            }
+            else if ( colon != std::string::npos )
+            {
+                (*headers)[toLower(trim(line.substr(0, colon)))] = trim( line.substr(colon+1) );
+            }
+        }
+        return realsize;
+    }
+}
+
+namespace
+{
+    // "host:port" part of a URL, used to group requests by server.
+    std::string getHostKey( const std::string& url )
+    {
+        std::string::size_type start = url.find( "://" );
+        start = start == std::string::npos ? 0 : start + 3;
+        std::string::size_type end = url.find_first_of( "/?#", start );
+        return toLower( url.substr(start, end == std::string::npos ? std::string::npos : end - start) );
+    }
+
+    // whether a URL asks for text (XML, JSON, GML...), judging by its file extension or
+    // by the OGC/ArcGIS query parameters that select an XML or JSON answer.
+    bool isTextRequest( const std::string& url )
+    {
+        std::string lower = toLower( url );
+        std::string::size_type q = lower.find( '?' );
+
+        std::string ext = osgDB::getFileExtension( lower.substr(0, q) );
+        if (ext == "xml" || ext == "gml" || ext == "json" || ext == "geojson" || ext == "kml" ||
+            ext == "txt" || ext == "prj" || ext == "css" || ext == "earth" )
+        {
+            return true;
+        }
+
+        if ( q == std::string::npos )
+            return false;
+
+        StringTokenizer izer( "&", "" );
+        StringVector params;
+        izer.tokenize( lower.substr(q+1), params );
+        for( StringVector::const_iterator i = params.begin(); i != params.end(); ++i )
+        {
+            std::string::size_type eq = i->find( '=' );
+            if ( eq == std::string::npos )
+                continue;
+
+            std::string name  = i->substr( 0, eq );
+            std::string value = i->substr( eq+1 );
+
+            // format, outputformat, info_format, or ArcGIS's "f":
+            if ( name == "f" || endsWith(name, "format") )
+            {
+                if (value.find("json") != std::string::npos || value.find("xml") != std::string::npos ||
+                    value.find("gml")  != std::string::npos || value.find("text") != std::string::npos )
+                {
+                    return true;
+                }
+            }
+            else if ( name == "request" )
+            {
+                if (value == "getcapabilities" || value == "gettileservice" || value == "getfeature" ||
+                    value == "describefeaturetype" || value == "describecoverage" )
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // whether a failure means the server (or the path to it) is overloaded,
+    // and the request is worth retrying after a pause.
+    bool isOverloaded( CURLcode res, long code )
+    {
+        return
+            res == CURLE_OPERATION_TIMEDOUT ||
+            res == CURLE_COULDNT_CONNECT ||
+            code == 408L || code == 429L ||
+            code == 502L || code == 503L || code == 504L;
+    }
+
+    // seconds the server asked us to wait, if any.
+    double getRetryAfter( const HTTPCache::Headers& headers )
+    {
+        HTTPCache::Headers::const_iterator i = headers.find( "retry-after" );
+        if ( i == headers.end() || i->second.empty() )
+            return 0.0;
+
+        if ( isdigit(i->second[0]) )
+            return atof( i->second.c_str() );
+
+        time_t when = curl_getdate( i->second.c_str(), 0L );
+        time_t now  = ::time( 0L );
+        return when != (time_t)-1 && when > now ? (double)(when - now) : 0.0;
+    }
+
+    /**
+     * Limits the number of concurrent requests to each host, and spaces them
+     * out (exponential backoff) while the host is reporting overload.
+     */
+    class HostThrottle
+    {
+    public:
+        /** Blocks until a request to "host" may proceed. Returns false if canceled while waiting. */
+        bool acquire( const std::string& host, const HTTPSettings& settings, ProgressCallback* progress )
+        {
+            unsigned maxActive = (unsigned)osg::maximum( settings.maxConnectionsPerHost(), 0 );
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Host& h = _hosts[host];
+            if ( h._limit == 0 || h._limit > maxActive )
+                h._limit = maxActive;
+
+            for(;;)
+            {
+                if ( progress && progress->isCanceled() )
+                    return false;
+
+                osg::Timer_t now = osg::Timer::instance()->tick();
+                double wait_s = h._backoffUntil > now ?
+                    osg::Timer::instance()->delta_s( now, h._backoffUntil ) : 0.0;
+
+                bool slotFree = maxActive == 0 || h._active < h._limit;
+                if ( wait_s <= 0.0 && slotFree )
+                    break;
+
+                // wake up at least every 100ms to notice cancelation.
+                unsigned ms = wait_s > 0.0 ? osg::minimum( (unsigned)(wait_s * 1000.0) + 1u, 100u ) : 100u;
+                _cond.wait( &_mutex, ms );
+            }
+
+            h._active++;
+            return true;
+        }
+
+        /** Reports the outcome of a request started with acquire(). */
+        void release( const std::string& host, bool overloaded, double retryAfter_s, const HTTPSettings& settings )
+        {
+            unsigned maxActive = (unsigned)osg::maximum( settings.maxConnectionsPerHost(), 0 );
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Host& h = _hosts[host];
+            if ( h._active > 0 )
+                h._active--;
+
+            if ( overloaded )
+            {
+                // multiplicative decrease, and an exponentially growing pause:
+                h._failures++;
+                h._limit = osg::maximum( h._limit / 2u, 1u );
+
+                double delay_s = 0.001 * settings.retryDelay() * (double)(1u << osg::minimum(h._failures - 1u, 16u));
+                delay_s = osg::minimum( delay_s, 0.001 * settings.maxRetryDelay() );
+                delay_s = osg::maximum( delay_s, retryAfter_s );
+
+                h._backoffUntil = osg::Timer::instance()->tick() + (osg::Timer_t)(delay_s / osg::Timer::instance()->getSecondsPerTick());
+
+                OE_INFO << LC << host << " is overloaded; backing off for " << delay_s << "s "
+                    << "(limit = " << h._limit << ")" << std::endl;
+            }
+            else
+            {
+                // additive increase:
+                h._failures = 0;
+                h._backoffUntil = 0;
+                if ( h._limit < maxActive )
+                    h._limit++;
+            }
+
+            _cond.broadcast();
+        }
+
+    private:
+        struct Host
+        {
+            Host() : _active(0), _limit(0), _failures(0), _backoffUntil(0) { }
+            unsigned     _active;
+            unsigned     _limit;
+            unsigned     _failures;
+            osg::Timer_t _backoffUntil;
+        };
+
+        OpenThreads::Mutex          _mutex;
+        OpenThreads::Condition      _cond;
+        std::map<std::string, Host> _hosts;
+    };
+
+    HostThrottle s_hostThrottle;
 }
 
 static int CurlProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
@@ -231,14 +499,52 @@ HTTPResponse::getPartHeader( unsigned int n, const std::string& name ) const {
 
 std::istream&
 HTTPResponse::getPartStream( unsigned int n ) const {
-    return _parts[n]->_stream;
+    return _parts[n]->getStream();
+}
+
+const char*
+HTTPResponse::getPartData( unsigned int n ) const {
+    return _parts[n]->_data.data();
 }
 
 std::string
 HTTPResponse::getPartAsString( unsigned int n ) const {
-	std::string streamStr;
-	streamStr = _parts[n]->_stream.str();
-    return streamStr;
+    return _parts[n]->_data;
+}
+
+std::istream&
+HTTPResponse::Part::getStream()
+{
+    if ( _streamBuf.base() != _data.data() || _streamBuf.length() != _data.size() )
+    {
+        _streamBuf.setBuffer( _data.data(), _data.size() );
+        _stream.clear();
+    }
+    return _stream;
+}
+
+std::streambuf::pos_type
+HTTPResponse::MemoryStreamBuf::seekoff( off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which )
+{
+    if ( (which & std::ios_base::in) == 0 )
+        return pos_type(off_type(-1));
+
+    off_type pos =
+        dir == std::ios_base::beg ? off :
+        dir == std::ios_base::cur ? off_type(gptr() - eback()) + off :
+        off_type(_length) + off;
+
+    if ( pos < 0 || pos > off_type(_length) )
+        return pos_type(off_type(-1));
+
+    setg( eback(), eback() + pos, egptr() );
+    return pos_type(pos);
+}
+
+std::streambuf::pos_type
+HTTPResponse::MemoryStreamBuf::seekpos( pos_type pos, std::ios_base::openmode which )
+{
+    return seekoff( off_type(pos), std::ios_base::beg, which );
 }
 
 const std::string&
@@ -257,6 +563,11 @@ static Threading::ReadWriteMutex   _threadClientMapMutex;
 static ThreadClientMap             _threadClientMap;
 static optional<ProxySettings>     _proxySettings;
 static std::string                 _userAgent = USER_AGENT;
+static OpenThreads::Mutex          _httpSettingsMutex;
+static HTTPSettings                _httpSettings;
+static OpenThreads::Mutex          _httpCacheMutex;
+static osg::ref_ptr<HTTPCache>     _httpCache;
+static bool                        _httpCacheInitialized = false;
 
 HTTPClient& HTTPClient::getClient()
 {
@@ -300,6 +611,7 @@ HTTPClient::HTTPClient()
 
     curl_easy_setopt( _curl_handle, CURLOPT_USERAGENT, userAgent.c_str() );
     curl_easy_setopt( _curl_handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+    curl_easy_setopt( _curl_handle, CURLOPT_HEADERFUNCTION, osgEarth::HeaderReadCallback );
     curl_easy_setopt( _curl_handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
     curl_easy_setopt( _curl_handle, CURLOPT_MAXREDIRS, (void*)5 );
     curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
@@ -319,6 +631,45 @@ HTTPClient::setProxySettings( const ProxySettings &proxySettings )
 	_proxySettings = proxySettings;
 }
 
+void
+HTTPClient::setHTTPCache( HTTPCache* cache )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _httpCacheMutex );
+    _httpCache = cache;
+    _httpCacheInitialized = true;
+}
+
+HTTPCache*
+HTTPClient::getHTTPCache()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _httpCacheMutex );
+    if ( !_httpCacheInitialized )
+    {
+        const char* path = getenv("OSGEARTH_HTTP_CACHE_PATH");
+        if ( path )
+        {
+            OE_INFO << LC << "HTTP cache enabled at " << path << std::endl;
+            _httpCache = new HTTPCache( std::string(path) );
+        }
+        _httpCacheInitialized = true;
+    }
+    return _httpCache.get();
+}
+
+void
+HTTPClient::setHTTPSettings( const HTTPSettings& settings )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _httpSettingsMutex );
+    _httpSettings = settings;
+}
+
+HTTPSettings
+HTTPClient::getHTTPSettings()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _httpSettingsMutex );
+    return _httpSettings;
+}
+
 const std::string& HTTPClient::getUserAgent()
 {
 	return _userAgent;
@@ -379,35 +730,53 @@ tokenize_str(const std::string & str, const std::string & delims=", \t")
 }
 
 
+namespace
+{
+    // reads a line (sans newline) from "data" starting at "pos", and advances "pos" past it.
+    std::string readLine( const std::string& data, std::string::size_type& pos )
+    {
+        if ( pos >= data.length() )
+            return "";
+
+        std::string::size_type nl = data.find( '\n', pos );
+        if ( nl == std::string::npos )
+            nl = data.length();
+
+        std::string line = data.substr( pos, nl - pos );
+        pos = nl + 1;
+        return line;
+    }
+}
+
 void
 HTTPClient::decodeMultipartStream(const std::string&   boundary,
                                   HTTPResponse::Part*  input,
                                   HTTPResponse::Parts& output) const
 {
+    // decodes straight from the input buffer; each part's bytes are copied exactly once.
+    const std::string& data = input->_data;
     std::string bstr = std::string("--") + boundary;
     std::string line;
-    char tempbuf[256];
 
     // first thing in the stream should be the boundary.
-    input->_stream.read( tempbuf, bstr.length() );
-    tempbuf[bstr.length()] = 0;
-    line = tempbuf;
-    if ( line != bstr )
+    if ( data.compare( 0, bstr.length(), bstr ) != 0 )
     {
         OE_WARN << LC 
             << "decodeMultipartStream: protocol violation; "
             << "expecting boundary; instead got: \"" 
-            << line
+            << data.substr( 0, bstr.length() )
             << "\"" << std::endl;
         return;
     }
 
+    std::string::size_type pos = bstr.length();
+
     for( bool done=false; !done; )
     {
         osg::ref_ptr<HTTPResponse::Part> next_part = new HTTPResponse::Part();
 
         // first finish off the boundary.
-        std::getline( input->_stream, line );
+        line = readLine( data, pos );
         if ( line == "--" )
         {
             done = true;
@@ -418,7 +787,7 @@ HTTPClient::decodeMultipartStream(const std::string&   boundary,
             line = " ";
             while( line.length() > 0 && !done )
             {
-                std::getline( input->_stream, line );
+                line = readLine( data, pos );
 
                 // check for EOS:
                 if ( line == "--" )
@@ -436,34 +805,49 @@ HTTPClient::decodeMultipartStream(const std::string&   boundary,
 
         if ( !done )
         {
-            // read data until we reach the boundary
-            unsigned int bstr_ptr = 0;
-            std::string temp;
-            //unsigned int c = 0;
-            while( bstr_ptr < bstr.length() )
+            // the data runs until the next boundary (or the end, if there isn't one)
+            std::string::size_type end = pos < data.length() ? data.find( bstr, pos ) : std::string::npos;
+            if ( end == std::string::npos )
             {
-                char b;
-                input->_stream.read( &b, 1 );
-                if ( b == bstr[bstr_ptr] )
-                {
-                    bstr_ptr++;
-                }
-                else
-                {
-                    for( unsigned int i=0; i<bstr_ptr; i++ )
-                    {
-                        next_part->_stream << bstr[i];
-                    }
-                    next_part->_stream << b;
-                    next_part->_size += bstr_ptr + 1;
-                    bstr_ptr = 0;
-                }
+                end = data.length();
+                done = true;
             }
+
+            std::string::size_type start = osg::minimum( pos, end );
+            next_part->_data.assign( data, start, end - start );
+            next_part->_size = next_part->_data.size();
+            pos = done ? end : end + bstr.length();
+
             output.push_back( next_part.get() );
         }
     }
 }
 
+void
+HTTPClient::decodeResponse(const std::string&  contentType,
+                           HTTPResponse::Part* part,
+                           HTTPResponse&       response) const
+{
+    // NOTE:
+    //   WCS 1.1 specified a "multipart/mixed" response, but ArcGIS Server gives a "multipart/related"
+    //   content type ...
+
+    //OE_NOTICE << "[osgEarth.HTTPClient] content-type = \"" << contentType << "\"" << std::endl;
+    if ( contentType.length() > 9 && ::strstr( contentType.c_str(), "multipart" ) == contentType.c_str() )
+    //if ( content_type == "multipart/mixed; boundary=wcs" ) //todo: parse this.
+    {
+        //OE_NOTICE << "[osgEarth.HTTPClient] detected multipart data; decoding..." << std::endl;
+        //TODO: parse out the "wcs" -- this is WCS-specific
+        decodeMultipartStream( "wcs", part, response._parts );
+    }
+    else
+    {
+        //OE_NOTICE << "[osgEarth.HTTPClient] detected single part data" << std::endl;
+        part->_size = part->_data.size();
+        response._parts.push_back( part );
+    }
+}
+
 HTTPResponse
 HTTPClient::get( const HTTPRequest& request,
                  const osgDB::ReaderWriter::Options* options,
@@ -507,7 +891,7 @@ HTTPClient::readString(const std::string& filename,
 }
 
 HTTPResponse
-HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Options* options, ProgressCallback* callback) const
+HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Options* options, ProgressCallback* callback, bool text) const
 {
     OE_DEBUG << LC << "doGet " << request.getURL() << std::endl;
 
@@ -620,12 +1004,48 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
 #endif
     }
 
+    std::string url = request.getURL();
+    std::time_t now = std::time( 0L );
+
+    // Consult the HTTP cache. A fresh entry needs no network access at all;
+    // a stale one with a validator turns this into a conditional GET.
+    osg::ref_ptr<HTTPCache> cache = getHTTPCache();
+    HTTPCache::Entry cached;
+    bool canRevalidate = false;
+
+    if ( cache.valid() && cache->read(url, cached) )
+    {
+        if ( cached.isFresh(now) )
+        {
+            OE_DEBUG << LC << "HTTP cache hit: " << url << std::endl;
+            cache->recordHit();
+
+            HTTPResponse response( 200L );
+            osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
+            part->_data.swap( cached._body );
+            decodeResponse( cached._mimeType, part.get(), response );
+            response._mimeType = cached._mimeType;
+            return response;
+        }
+        canRevalidate = cached.canRevalidate();
+    }
+
+    struct curl_slist* requestHeaders = 0L;
+    if ( canRevalidate )
+    {
+        if ( !cached._etag.empty() )
+            requestHeaders = curl_slist_append( requestHeaders, ("If-None-Match: " + cached._etag).c_str() );
+        if ( !cached._lastModified.empty() )
+            requestHeaders = curl_slist_append( requestHeaders, ("If-Modified-Since: " + cached._lastModified).c_str() );
+    }
+    HTTPCache::Headers responseHeaders;
+
     osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
-    StreamObject sp( &part->_stream );
+    StreamObject sp( &part->_data, _curl_handle );
 
     //Take a temporary ref to the callback
     osg::ref_ptr<ProgressCallback> progressCallback = callback;
-    curl_easy_setopt( _curl_handle, CURLOPT_URL, request.getURL().c_str() );
+    curl_easy_setopt( _curl_handle, CURLOPT_URL, url.c_str() );
     if (callback)
     {
         curl_easy_setopt(_curl_handle, CURLOPT_PROGRESSDATA, progressCallback.get());
@@ -635,58 +1055,136 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
     errorBuf[0] = 0;
     curl_easy_setopt( _curl_handle, CURLOPT_ERRORBUFFER, (void*)errorBuf );
 
+    // transfer settings:
+    HTTPSettings settings = getHTTPSettings();
+    curl_easy_setopt( _curl_handle, CURLOPT_CONNECTTIMEOUT, (long)osg::maximum(settings.connectTimeout(), 0) );
+    curl_easy_setopt( _curl_handle, CURLOPT_TIMEOUT, (long)osg::maximum(settings.timeout(), 0) );
+
+    // compress text only; imagery is compressed already, and inflating it again
+    // would only cost CPU.
+    const char* encoding = settings.compression() && (text || isTextRequest(url)) ? "gzip, deflate" : (const char*)0L;
+#if LIBCURL_VERSION_NUM >= 0x071506
+    curl_easy_setopt( _curl_handle, CURLOPT_ACCEPT_ENCODING, encoding );
+#else
+    curl_easy_setopt( _curl_handle, CURLOPT_ENCODING, encoding );
+#endif
+
+    curl_easy_setopt( _curl_handle, CURLOPT_HTTPHEADER, requestHeaders );
+    curl_easy_setopt( _curl_handle, CURLOPT_HEADERDATA, (void*)&responseHeaders );
     curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)&sp);
-    CURLcode res = curl_easy_perform( _curl_handle );
+
+    // Make the request, retrying (after the host throttle's backoff) while the
+    // server reports that it's overloaded.
+    std::string host = getHostKey( url );
+    CURLcode res = CURLE_OK;
+    long response_code = 0L;
+
+    for( int attempt = 0; ; ++attempt )
+    {
+        part->_data.clear();
+        responseHeaders.clear();
+        sp._first = true;
+
+        if ( !s_hostThrottle.acquire(host, settings, callback) )
+        {
+            res = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
+
+        res = curl_easy_perform( _curl_handle );
+        response_code = 0L;
+        curl_easy_getinfo( _curl_handle, CURLINFO_RESPONSE_CODE, &response_code );
+
+        bool overloaded = isOverloaded( res, response_code );
+        s_hostThrottle.release( host, overloaded, getRetryAfter(responseHeaders), settings );
+
+        if ( !overloaded || attempt >= settings.maxRetries() || (callback && callback->isCanceled()) )
+            break;
+
+        OE_DEBUG << LC << "Retrying " << url << " (code " << response_code << ", curl " << res << ")" << std::endl;
+    }
+
     curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)0 );
+    curl_easy_setopt( _curl_handle, CURLOPT_HEADERDATA, (void*)0 );
+    curl_easy_setopt( _curl_handle, CURLOPT_HTTPHEADER, (void*)0 );
     curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSDATA, (void*)0);
 
-    long response_code = 0L;
+    if ( requestHeaders )
+        curl_slist_free_all( requestHeaders );
+
 	if (!proxy_addr.empty())
 	{
 		long connect_code = 0L;
         curl_easy_getinfo( _curl_handle, CURLINFO_HTTP_CONNECTCODE, &connect_code );
 		OE_DEBUG << LC << "proxy connect code " << connect_code << std::endl;
 	}
-	
-    curl_easy_getinfo( _curl_handle, CURLINFO_RESPONSE_CODE, &response_code );     
 
 	OE_DEBUG << LC << "got response, code = " << response_code << std::endl;
 
-    HTTPResponse response( response_code );
-   
-    if ( response_code == 200L && res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_OPERATION_TIMEDOUT ) //res == 0 )
+    bool aborted = res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT;
+
+    // "304 Not Modified": our cached copy is still good. Refresh its lifetime
+    // and carry on as if the server had sent it again.
+    bool revalidated = false;
+    if ( response_code == 304L && canRevalidate && !aborted )
     {
-        // check for multipart content:
-        char* content_type_cp;
-        curl_easy_getinfo( _curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );
-        if ( content_type_cp == NULL )
-        {
-            OE_NOTICE << LC
-                << "NULL Content-Type (protocol violation) " 
-                << "URL=" << request.getURL() << std::endl;
-            return NULL;
-        }
+        OE_DEBUG << LC << "HTTP cache revalidated: " << url << std::endl;
+        cache->recordRevalidation();
+        if ( HTTPCache::updateEntry(responseHeaders, now, cached) )
+            cache->write( url, cached );
+        else
+            cache->remove( url );
 
-        // NOTE:
-        //   WCS 1.1 specified a "multipart/mixed" response, but ArcGIS Server gives a "multipart/related"
-        //   content type ...
+        part->_data.swap( cached._body );
+        response_code = 200L;
+        revalidated = true;
+    }
+    else if ( cache.valid() && !aborted )
+    {
+        cache->recordMiss();
+    }
 
-        std::string content_type( content_type_cp );
-        //OE_NOTICE << "[osgEarth.HTTPClient] content-type = \"" << content_type << "\"" << std::endl;
-        if ( content_type.length() > 9 && ::strstr( content_type.c_str(), "multipart" ) == content_type.c_str() )
-        //if ( content_type == "multipart/mixed; boundary=wcs" ) //todo: parse this.
+    HTTPResponse response( response_code );
+   
+    if ( response_code == 200L && !aborted ) //res == 0 )
+    {
+        std::string content_type;
+        if ( revalidated )
         {
-            //OE_NOTICE << "[osgEarth.HTTPClient] detected multipart data; decoding..." << std::endl;
-            //TODO: parse out the "wcs" -- this is WCS-specific
-            decodeMultipartStream( "wcs", part.get(), response._parts );
+            content_type = cached._mimeType;
         }
         else
         {
-            //OE_NOTICE << "[osgEarth.HTTPClient] detected single part data" << std::endl;
-            response._parts.push_back( part.get() );
+            // check for multipart content:
+            char* content_type_cp;
+            curl_easy_getinfo( _curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );
+            if ( content_type_cp == NULL )
+            {
+                OE_NOTICE << LC
+                    << "NULL Content-Type (protocol violation) " 
+                    << "URL=" << url << std::endl;
+                return NULL;
+            }
+            content_type = content_type_cp;
+
+            // store it in the HTTP cache, if the server allows it:
+            if ( cache.valid() )
+            {
+                HTTPCache::Entry entry;
+                entry._mimeType = content_type;
+                if ( HTTPCache::updateEntry(responseHeaders, now, entry) )
+                {
+                    // lend the body to the entry rather than copying it.
+                    entry._body.swap( part->_data );
+                    cache->write( url, entry );
+                    part->_data.swap( entry._body );
+                }
+            }
         }
+
+        decodeResponse( content_type, part.get(), response );
     }
-    else if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT)
+    else if (aborted)
     {
         //If we were aborted by a callback, then it was cancelled by a user
         response._cancelled = true;
@@ -712,7 +1210,11 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
     // Store the mime-type, if any. (Note: CURL manages the buffer returned by
     // this call.)
     char* ctbuf = NULL;
-    if ( curl_easy_getinfo(_curl_handle, CURLINFO_CONTENT_TYPE, &ctbuf) == 0 && ctbuf )
+    if ( revalidated )
+    {
+        response._mimeType = cached._mimeType;
+    }
+    else if ( curl_easy_getinfo(_curl_handle, CURLINFO_CONTENT_TYPE, &ctbuf) == 0 && ctbuf )
     {
         response._mimeType = ctbuf;
     }
@@ -736,19 +1238,10 @@ HTTPClient::downloadFile(const std::string &url, const std::string &filename)
     if ( response.isOK() )
     {
         unsigned int part_num = response.getNumParts() > 1? 1 : 0;
-        std::istream& input_stream = response.getPartStream( part_num );
 
         std::ofstream fout;
         fout.open(filename.c_str(), std::ios::out | std::ios::binary);
-
-        input_stream.seekg (0, std::ios::end);
-        int length = input_stream.tellg();
-        input_stream.seekg (0, std::ios::beg);
-
-        char *buffer = new char[length];
-        input_stream.read(buffer, length);
-        fout.write(buffer, length);
-        delete[] buffer;
+        fout.write(response.getPartData(part_num), response.getPartSize(part_num));
         fout.close();
         return true;
     }
@@ -949,10 +1442,11 @@ HTTPClient::doReadString(const std::string& filename,
 
     if ( osgDB::containsServerAddress( filename ) )
     {
-        HTTPResponse response = this->doGet( filename, NULL, callback );
-        if ( response.isOK() )
+        HTTPResponse response = this->doGet( HTTPRequest(filename), NULL, callback, true );
+        if ( response.isOK() && response.getNumParts() > 0 )
         {
-            output = response.getPartAsString( 0 );
+            // take the buffer instead of copying it.
+            output.swap( response._parts[0]->_data );
         }
         else
         {
@@ -20,9 +20,73 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/GeoData>
 #include <osg/Notify>
+#include <algorithm>
+#include <string.h>
 
 using namespace osgEarth;
 
+namespace
+{
+    // Per-output-position filter taps along one axis of the input grid.
+    struct Taps
+    {
+        std::vector<int>    _i0, _i1;
+        std::vector<double> _w;    // weight of _i1; _i0 gets (1-_w)
+
+        void compute( const std::vector<double>& pos, int size, ElevationInterpolation interp )
+        {
+            unsigned n = pos.size();
+            _i0.resize( n );
+            _i1.resize( n );
+            _w.resize( n );
+            double maxPos = (double)(size-1);
+
+            for( unsigned i=0; i<n; ++i )
+            {
+                double p = osg::clampBetween( pos[i], 0.0, maxPos );
+                if ( interp == INTERP_NEAREST )
+                {
+                    _i0[i] = _i1[i] = (int)osg::round(p);
+                    _w[i]  = 0.0;
+                }
+                else
+                {
+                    int lo = osg::maximum( (int)floor(p), 0 );
+                    int hi = osg::maximum( osg::minimum( (int)ceil(p), size-1 ), 0 );
+                    if ( lo > hi ) lo = hi;
+                    _i0[i] = lo;
+                    _i1[i] = hi;
+                    _w[i]  = p - (double)lo;
+                }
+            }
+        }
+    };
+
+    // Horizontal pass: filters one input row at the column taps.
+    void filterRow( const float* in, const Taps& cols, ElevationInterpolation interp, std::vector<float>& out )
+    {
+        unsigned n = cols._i0.size();
+        out.resize( n );
+        if ( interp == INTERP_NEAREST )
+        {
+            for( unsigned c=0; c<n; ++c )
+                out[c] = in[cols._i0[c]];
+        }
+        else
+        {
+            for( unsigned c=0; c<n; ++c )
+            {
+                float h0 = in[cols._i0[c]];
+                float h1 = in[cols._i1[c]];
+                if ( h0 == NO_DATA_VALUE || h1 == NO_DATA_VALUE )
+                    out[c] = NO_DATA_VALUE;
+                else
+                    out[c] = (float)((1.0-cols._w[c])*(double)h0 + cols._w[c]*(double)h1);
+            }
+        }
+    }
+}
+
 float
 HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double r, ElevationInterpolation interpolation)
 {
@@ -199,6 +263,97 @@ HeightFieldUtils::getHeightAtNormalizedLocation(const osg::HeightField* input,
     return getHeightAtPixel( input, px, py, interp );
 }
 
+void
+HeightFieldUtils::resampleHeightField(const osg::HeightField*    input,
+                                      const std::vector<double>& cols,
+                                      const std::vector<double>& rows,
+                                      osg::HeightField*          output,
+                                      ElevationInterpolation     interp)
+{
+    if ( !input || !output || output->getNumColumns() != cols.size() || output->getNumRows() != rows.size() )
+    {
+        OE_WARN << "[osgEarth::HeightFieldUtils] resampleHeightField: output size mismatch" << std::endl;
+        return;
+    }
+
+    int inCols = input->getNumColumns();
+    int inRows = input->getNumRows();
+    if ( inCols == 0 || inRows == 0 || cols.empty() || rows.empty() )
+        return;
+
+    // the triangulated mode isn't separable, so do it the slow way.
+    if ( interp == INTERP_TRIANGULATE )
+    {
+        for( unsigned r=0; r<rows.size(); ++r )
+        {
+            double py = osg::clampBetween( rows[r], 0.0, (double)(inRows-1) );
+            for( unsigned c=0; c<cols.size(); ++c )
+            {
+                double px = osg::clampBetween( cols[c], 0.0, (double)(inCols-1) );
+                output->setHeight( c, r, getHeightAtPixel(input, px, py, interp) );
+            }
+        }
+        return;
+    }
+
+    Taps colTaps, rowTaps;
+    colTaps.compute( cols, inCols, interp );
+    rowTaps.compute( rows, inRows, interp );
+
+    const float* in  = &input->getHeightList()[0];
+    float*       out = &output->getHeightList()[0];
+    unsigned     outCols = cols.size();
+
+    // horizontally filtered input rows; output rows usually share them, so keep the
+    // last two around.
+    std::vector<float> row0, row1;
+    int row0Index = -1, row1Index = -1;
+
+    for( unsigned r=0; r<rows.size(); ++r, out += outCols )
+    {
+        int i0 = rowTaps._i0[r];
+        int i1 = rowTaps._i1[r];
+
+        if ( i0 != row0Index )
+        {
+            if ( i0 == row1Index )
+            {
+                row0.swap( row1 );
+                std::swap( row0Index, row1Index );
+            }
+            else
+            {
+                filterRow( in + i0*inCols, colTaps, interp, row0 );
+                row0Index = i0;
+            }
+        }
+
+        if ( i1 == i0 )
+        {
+            ::memcpy( out, &row0[0], outCols*sizeof(float) );
+            continue;
+        }
+
+        if ( i1 != row1Index )
+        {
+            filterRow( in + i1*inCols, colTaps, interp, row1 );
+            row1Index = i1;
+        }
+
+        // vertical pass
+        double w = rowTaps._w[r];
+        for( unsigned c=0; c<outCols; ++c )
+        {
+            float h0 = row0[c];
+            float h1 = row1[c];
+            if ( h0 == NO_DATA_VALUE || h1 == NO_DATA_VALUE )
+                out[c] = NO_DATA_VALUE;
+            else
+                out[c] = (float)((1.0-w)*(double)h0 + w*(double)h1);
+        }
+    }
+}
+
 
 void
 HeightFieldUtils::scaleHeightFieldToDegrees( osg::HeightField* hf )
@@ -252,14 +407,13 @@ HeightFieldUtils::createSubSample(osg::HeightField* input, const GeoExtent& inpu
     double x, y;
     int col, row;
 
+    std::vector<double> px( numCols ), py( numRows );
     for( x = outputEx.xMin(), col=0; col < numCols; x += dx, col++ )
-    {
-        for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtLocation( input, x, y, inputEx.xMin(), inputEx.yMin(), xInterval, yInterval, interpolation);
-            dest->setHeight( col, row, height );
-        }
-    }
+        px[col] = (x - inputEx.xMin()) / xInterval;
+    for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
+        py[row] = (y - inputEx.yMin()) / yInterval;
+
+    resampleHeightField( input, px, py, dest, interpolation );
 
     osg::Vec3d orig( outputEx.xMin(), outputEx.yMin(), input->getOrigin().z() );
     dest->setOrigin( orig );
@@ -290,16 +444,13 @@ HeightFieldUtils::resizeHeightField(osg::HeightField* input, int newColumns, int
     output->setYInterval( stepY );
     output->setOrigin( origin );
     
+    std::vector<double> px( newColumns ), py( newRows );
+    for( int x = 0; x < newColumns; ++x )
+        px[x] = ((double)x / (double)(newColumns-1)) * (double)(input->getNumColumns()-1);
     for( int y = 0; y < newRows; ++y )
-    {
-        for( int x = 0; x < newColumns; ++x )
-        {
-            double nx = (double)x / (double)(newColumns-1);
-            double ny = (double)y / (double)(newRows-1);
-            float h = getHeightAtNormalizedLocation( input, nx, ny );
-            output->setHeight( x, y, h );
-        }
-    }
+        py[y] = ((double)y / (double)(newRows-1)) * (double)(input->getNumRows()-1);
+
+    resampleHeightField( input, px, py, output, interp );
 
     return output;
 }
@@ -22,7 +22,9 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
 #include <osg/Version>
+#include <OpenThreads/Thread>
 #include <memory.h>
 #include <limits.h>
 
@@ -452,6 +454,10 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 			osg::ref_ptr<ImageMosaic> mi = new ImageMosaic;
 			std::vector<TileKey> missingTiles;
 
+            // fetch all the source tiles at once; they are independent requests.
+            std::vector< osg::ref_ptr<osg::Image> > images;
+            createMosaicTiles( intersectingTiles, cacheInLayerProfile, images, progress );
+
             bool retry = false;
 			for (unsigned int j = 0; j < intersectingTiles.size(); ++j)
 			{
@@ -460,20 +466,9 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 
 				OE_DEBUG << LC << "\t Intersecting Tile " << j << ": " << minX << ", " << minY << ", " << maxX << ", " << maxY << std::endl;
 
-				osg::ref_ptr<osg::Image> img;
-                img = createImageWrapper( intersectingTiles[j], cacheInLayerProfile, progress );
-
-                if ( img.valid() )
+                if ( images[j].valid() )
                 {
-                    if (img->getPixelFormat() != GL_RGBA || img->getDataType() != GL_UNSIGNED_BYTE || img->getInternalTextureFormat() != GL_RGBA8 )
-					{
-                        osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(img.get());
-                        if (convertedImg.valid())
-                        {
-                            img = convertedImg;
-                        }
-					}
-					mi->getImages().push_back(TileImage(img.get(), intersectingTiles[j]));
+					mi->getImages().push_back(TileImage(images[j].get(), intersectingTiles[j]));
 				}
 				else
 				{
@@ -623,6 +618,212 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
     return result;
 }
 
+void
+ImageLayer::createImages(const std::vector<TileKey>& keys,
+                         std::vector<GeoImage>& out_images,
+                         ProgressCallback* progress )
+{
+    out_images.clear();
+    out_images.resize( keys.size(), GeoImage::INVALID );
+
+    TileSource* source = getTileSource();
+    const Profile* layerProfile = getProfile();
+
+    // only the direct case can be batched: keys in the layer's own profile, which
+    // map one-to-one onto source tiles. Everything else goes through createImage.
+    bool batch = !_actualCacheOnly && source && layerProfile && keys.size() > 1;
+    for( unsigned i=0; batch && i<keys.size(); ++i )
+    {
+        if ( !keys[i].getProfile()->isEquivalentTo( layerProfile ) )
+            batch = false;
+    }
+
+    if ( !batch )
+    {
+        for( unsigned i=0; i<keys.size(); ++i )
+            out_images[i] = createImage( keys[i], progress );
+        return;
+    }
+
+    bool useCache = _cache.valid() && _options.cacheEnabled() == true;
+
+    //Write the cache TMS file if it hasn't been written yet.
+    if ( !_cacheProfile.valid() && useCache )
+    {
+        _cacheProfile = layerProfile;
+        _cache->storeProperties( _cacheSpec, _cacheProfile.get(), source->getPixelsPerTile() );
+    }
+
+    // same checks as createImageWrapper, collecting the keys that need the source:
+    std::vector<TileKey> fetchKeys;
+    std::vector<unsigned> fetchSlots;
+    std::vector<bool> isNew( keys.size(), false );
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        const TileKey& key = keys[i];
+
+        if ( useCache )
+        {
+            osg::ref_ptr<const osg::Image> cachedImage;
+            if ( _cache->getImage( key, _cacheSpec, cachedImage ) )
+            {
+                out_images[i] = GeoImage( ImageUtils::cloneImage(cachedImage.get()), key.getExtent() );
+                ImageUtils::normalizeImage( out_images[i].getImage() );
+                continue;
+            }
+        }
+
+        if ( source->getBlacklist()->contains(key.getTileId()) )
+            continue;
+
+        // NULL result: the source cannot service this LOD.
+        if ( !source->hasDataAtLOD( key.getLevelOfDetail() ) )
+            continue;
+
+        if ( source->hasDataInExtent( key.getExtent() ) )
+        {
+            fetchKeys.push_back( key );
+            fetchSlots.push_back( i );
+        }
+        else
+        {
+            out_images[i] = GeoImage( ImageUtils::createEmptyImage(), key.getExtent() );
+            isNew[i] = true;
+        }
+    }
+
+    if ( fetchKeys.size() > 0 )
+    {
+        //Take a reference to the preCacheOp; see createImageWrapper.
+        osg::ref_ptr< TileSource::ImageOperation > op = _preCacheOp;
+
+        std::vector< osg::ref_ptr<osg::Image> > images;
+        source->createImages( fetchKeys, images, op.get(), progress );
+
+        for( unsigned j=0; j<fetchKeys.size(); ++j )
+        {
+            if ( j < images.size() && images[j].valid() )
+            {
+                out_images[ fetchSlots[j] ] = GeoImage( images[j].get(), fetchKeys[j].getExtent() );
+                isNew[ fetchSlots[j] ] = true;
+            }
+            else if ( !progress || !progress->isCanceled() )
+            {
+                source->getBlacklist()->add( fetchKeys[j].getTileId() );
+            }
+        }
+    }
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( isNew[i] && out_images[i].valid() )
+        {
+            ImageUtils::normalizeImage( out_images[i].getImage() );
+
+            if ( useCache )
+                _cache->setImage( keys[i], _cacheSpec, out_images[i].getImage() );
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // mosaic tiles are mostly I/O-bound, so allow more fetches than cores.
+    TaskService* getMosaicTaskService()
+    {
+        static OpenThreads::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "ImageLayer mosaic", osg::maximum(4, 2*OpenThreads::GetNumberOfProcessors()) );
+        return s_service.get();
+    }
+}
+
+struct ImageLayer::MosaicTileTask
+{
+    void init( ImageLayer* layer, const TileKey& key, bool cacheInLayerProfile,
+               osg::ref_ptr<osg::Image>* output, ProgressCallback* progress )
+    {
+        _layer               = layer;
+        _key                 = key;
+        _cacheInLayerProfile = cacheInLayerProfile;
+        _output              = output;
+        _progress            = progress;
+    }
+
+    void execute()
+    {
+        if ( _progress && _progress->isCanceled() )
+            return;
+
+        osg::ref_ptr<osg::Image> img = _layer->createImageWrapper( _key, _cacheInLayerProfile, _progress );
+
+        if ( img.valid() &&
+            (img->getPixelFormat() != GL_RGBA || img->getDataType() != GL_UNSIGNED_BYTE || img->getInternalTextureFormat() != GL_RGBA8) )
+        {
+            osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(img.get());
+            if (convertedImg.valid())
+            {
+                img = convertedImg;
+            }
+        }
+
+        *_output = img.get();
+    }
+
+    ImageLayer*               _layer;
+    TileKey                   _key;
+    bool                      _cacheInLayerProfile;
+    osg::ref_ptr<osg::Image>* _output;
+    ProgressCallback*         _progress;
+};
+
+void
+ImageLayer::createMosaicTiles(const std::vector<TileKey>& keys,
+                              bool cacheInLayerProfile,
+                              std::vector< osg::ref_ptr<osg::Image> >& output,
+                              ProgressCallback* progress )
+{
+    output.clear();
+    output.resize( keys.size() );
+
+    if ( keys.size() == 0 )
+        return;
+
+    // farm out all but the first tile, and fetch that one on this thread
+    // while we wait.
+    unsigned numTasks = keys.size() - 1;
+    if ( numTasks > 0 )
+    {
+        TaskService* service = getMosaicTaskService();
+        Threading::MultiEvent semaphore( numTasks );
+
+        for( unsigned j=1; j<keys.size(); ++j )
+        {
+            ParallelTask<MosaicTileTask>* task = new ParallelTask<MosaicTileTask>( &semaphore );
+            task->init( this, keys[j], cacheInLayerProfile, &output[j], progress );
+            service->add( task );
+        }
+
+        MosaicTileTask first;
+        first.init( this, keys[0], cacheInLayerProfile, &output[0], progress );
+        first.execute();
+
+        semaphore.wait();
+    }
+    else
+    {
+        MosaicTileTask task;
+        task.init( this, keys[0], cacheInLayerProfile, &output[0], progress );
+        task.execute();
+    }
+}
+
 osg::Image*
 ImageLayer::createImageWrapper(const TileKey& key,
                                bool cacheInLayerProfile,
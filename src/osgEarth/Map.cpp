@@ -898,7 +898,8 @@ namespace
                      ElevationSamplePolicy samplePolicy,
                      osg::ref_ptr<osg::HeightField>& out_result,
                      bool* out_isFallback,
-                     ProgressCallback* progress) 
+                     ProgressCallback* progress,
+                     const std::vector<osg::HeightField*>* prefetched =0L) 
     {
         unsigned int lowestLOD = key.getLevelOfDetail();
         bool hfInitialized = false;
@@ -922,7 +923,10 @@ namespace
             ElevationLayer* layer = i->get();
             if (layer->getProfile() && layer->getEnabled() )
             {
-                osg::HeightField* hf = layer->createHeightField( key, progress );
+                // use the batched result if the caller already fetched this layer:
+                osg::HeightField* hf = prefetched ?
+                    (*prefetched)[ i - elevLayers.begin() ] :
+                    layer->createHeightField( key, progress );
                 layerValidMap[ layer ] = (hf != 0L);
                 if ( hf )                {
                     numValidHeightFields++;
@@ -1019,6 +1023,20 @@ namespace
             double dy = (maxy - miny)/(double)(out_result->getNumRows()-1);
 
             const VerticalSpatialReference* vsrs = mapProfile->getVerticalSRS();
+
+            // build the vertical datum conversion for each heightfield once, instead of
+            // querying the geoid for every sample.
+            std::vector< osg::ref_ptr<osg::HeightField> > vsrsGrids( heightFields.size() );
+            std::vector<double> vsrsScales( heightFields.size(), 1.0 );
+            for( unsigned i = 0; i < heightFields.size(); ++i )
+            {
+                const VerticalSpatialReference* hfVSRS = heightFields[i].getVerticalSRS();
+                if ( VerticalSpatialReference::canTransform( hfVSRS, vsrs ) )
+                {
+                    vsrsGrids[i] = hfVSRS->createTransformHeightField( 
+                        vsrs, key.getExtent(), width, height, vsrsScales[i] );
+                }
+            }
             
 		    //Create the new heightfield by sampling all of them.
             for (unsigned int c = 0; c < width; ++c)
@@ -1030,15 +1048,17 @@ namespace
 
                     //Collect elevations from all of the layers
                     std::vector<float> elevations;
-                    for (GeoHeightFieldVector::iterator itr = heightFields.begin(); itr != heightFields.end(); ++itr)
+                    for (unsigned i = 0; i < heightFields.size(); ++i)
                     {
-                        const GeoHeightField& geoHF = *itr;
+                        const GeoHeightField& geoHF = heightFields[i];
 
                         float elevation = 0.0f;
-                        if ( geoHF.getElevation(key.getExtent().getSRS(), geoX, geoY, interpolation, vsrs, elevation) )
+                        if ( geoHF.getElevation(key.getExtent().getSRS(), geoX, geoY, interpolation, 0L, elevation) )
                         {
                             if (elevation != NO_DATA_VALUE)
                             {
+                                if ( vsrsGrids[i].valid() )
+                                    elevation = elevation * vsrsScales[i] + vsrsGrids[i]->getHeight(c, r);
                                 elevations.push_back(elevation);
                             }
                         }
@@ -1108,6 +1128,41 @@ namespace
 
 	    return out_result.valid();
     }
+
+    void
+    s_getHeightFields(const std::vector<TileKey>& keys,
+                      const ElevationLayerVector& elevLayers,
+                      const Profile* mapProfile,
+                      bool fallback,
+                      ElevationInterpolation interpolation,
+                      ElevationSamplePolicy samplePolicy,
+                      std::vector< osg::ref_ptr<osg::HeightField> >& out_results,
+                      ProgressCallback* progress)
+    {
+        // first pass, batched: one request per layer for the whole set of keys.
+        std::vector< std::vector< osg::ref_ptr<osg::HeightField> > > layerHFs( elevLayers.size() );
+        for( unsigned j = 0; j < elevLayers.size(); ++j )
+        {
+            ElevationLayer* layer = elevLayers[j].get();
+            if ( layer->getProfile() && layer->getEnabled() )
+                layer->createHeightFields( keys, layerHFs[j], progress );
+        }
+
+        out_results.clear();
+        out_results.resize( keys.size() );
+
+        // then fall back and composite each key as usual.
+        std::vector<osg::HeightField*> prefetched( elevLayers.size() );
+        for( unsigned k = 0; k < keys.size(); ++k )
+        {
+            for( unsigned j = 0; j < elevLayers.size(); ++j )
+                prefetched[j] = k < layerHFs[j].size() ? layerHFs[j][k].get() : 0L;
+
+            s_getHeightField(
+                keys[k], elevLayers, mapProfile, fallback, interpolation, samplePolicy,
+                out_results[k], 0L, progress, &prefetched );
+        }
+    }
 }
 
 
@@ -1327,6 +1382,17 @@ MapFrame::getHeightField(const TileKey& key,
     return s_getHeightField( key, _elevationLayers, _mapInfo.getProfile(), fallback, interpolation, samplePolicy, out_hf, out_isFallback, progress );
 }
 
+void
+MapFrame::getHeightFields(const std::vector<TileKey>& keys,
+                          bool fallback,
+                          std::vector< osg::ref_ptr<osg::HeightField> >& out_hfs,
+                          ElevationInterpolation interpolation,
+                          ElevationSamplePolicy samplePolicy,
+                          ProgressCallback* progress) const
+{
+    s_getHeightFields( keys, _elevationLayers, _mapInfo.getProfile(), fallback, interpolation, samplePolicy, out_hfs, progress );
+}
+
 int
 MapFrame::indexOf( ImageLayer* layer ) const
 {
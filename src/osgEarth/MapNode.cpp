@@ -192,6 +192,12 @@ MapNode::init()
 		HTTPClient::setProxySettings( _mapNodeOptions.proxySettings().get() );
     }
 
+    // Likewise the global HTTP transfer settings
+    if ( _mapNodeOptions.httpSettings().isSet() )
+    {
+        HTTPClient::setHTTPSettings( _mapNodeOptions.httpSettings().get() );
+    }
+
     // establish global driver options. These are OSG reader-writer options that
     // will make their way to any read* calls down the pipe
     const osgDB::ReaderWriter::Options* global_options = _map->getGlobalOptions();
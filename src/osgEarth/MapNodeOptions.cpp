@@ -33,6 +33,7 @@ static TerrainOptions s_defaultTerrainOptions;
 MapNodeOptions::MapNodeOptions( const Config& conf ) :
 ConfigOptions( conf ),
 _proxySettings( ProxySettings() ),
+_httpSettings( HTTPSettings() ),
 _cacheOnly( false ),
 _enableLighting( true ),
 _overlayVertexWarping( false ),
@@ -43,6 +44,7 @@ _terrainOptions( 0L )
 
 MapNodeOptions::MapNodeOptions( const TerrainOptions& to ) :
 _proxySettings( ProxySettings() ),
+_httpSettings( HTTPSettings() ),
 _cacheOnly( false ),
 _enableLighting( true ),
 _overlayVertexWarping( false ),
@@ -68,6 +70,7 @@ MapNodeOptions::getConfig() const
     conf.key() = "options";
 
     conf.updateObjIfSet( "proxy",           _proxySettings );
+    conf.updateObjIfSet( "http",            _httpSettings );
     conf.updateIfSet   ( "cache_only",      _cacheOnly );
     conf.updateIfSet   ( "lighting",        _enableLighting );
     conf.updateIfSet   ( "terrain",         _terrainOptionsConf );
@@ -82,6 +85,7 @@ MapNodeOptions::mergeConfig( const Config& conf )
     ConfigOptions::mergeConfig( conf );
 
     conf.getObjIfSet( "proxy",           _proxySettings );
+    conf.getObjIfSet( "http",            _httpSettings );
     conf.getIfSet   ( "cache_only",      _cacheOnly );
     conf.getIfSet   ( "lighting",        _enableLighting );
     conf.getIfSet   ( "overlay_warping", _overlayVertexWarping );
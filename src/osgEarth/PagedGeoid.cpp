@@ -0,0 +1,515 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/PagedGeoid>
+#include <osgEarth/ThreadingUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <string.h>
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#define LC "[PagedGeoid] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Header layout (little-endian):
+    //   0 magic "OEGD"     4 version        8 numCols      12 numRows
+    //  16 tileSize        20 sampleType    24 scale (f32) 28 offset (f32)
+    //  32 lonMin (f64)    40 latMin (f64)  48 lonMax (f64) 56 latMax (f64)
+
+    const char     MAGIC[4]       = { 'O', 'E', 'G', 'D' };
+    const unsigned VERSION        = 1;
+    const unsigned HEADER_SIZE    = 64;
+    const unsigned SAMPLE_FLOAT32 = 0;
+    const unsigned SAMPLE_INT16   = 1;
+
+    inline bool hostIsLittleEndian()
+    {
+        unsigned one = 1;
+        return *(unsigned char*)&one == 1;
+    }
+
+    inline unsigned get32( const unsigned char* p )
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+    }
+
+    inline float getFloat( const unsigned char* p )
+    {
+        unsigned u = get32( p );
+        float f;
+        ::memcpy( &f, &u, 4 );
+        return f;
+    }
+
+    inline double getDouble( const unsigned char* p )
+    {
+        unsigned char b[8];
+        for( int i=0; i<8; ++i )
+            b[i] = hostIsLittleEndian() ? p[i] : p[7-i];
+        double d;
+        ::memcpy( &d, b, 8 );
+        return d;
+    }
+
+    inline void put32( std::ostream& out, unsigned v )
+    {
+        unsigned char b[4] = {
+            (unsigned char)(v & 0xff),         (unsigned char)((v >> 8) & 0xff),
+            (unsigned char)((v >> 16) & 0xff), (unsigned char)((v >> 24) & 0xff) };
+        out.write( (const char*)b, 4 );
+    }
+
+    inline void putFloat( std::ostream& out, float f )
+    {
+        unsigned u;
+        ::memcpy( &u, &f, 4 );
+        put32( out, u );
+    }
+
+    inline void putDouble( std::ostream& out, double d )
+    {
+        unsigned char b[8], o[8];
+        ::memcpy( b, &d, 8 );
+        for( int i=0; i<8; ++i )
+            o[i] = hostIsLittleEndian() ? b[i] : b[7-i];
+        out.write( (const char*)o, 8 );
+    }
+}
+
+//------------------------------------------------------------------------
+
+/**
+ * The tiled grid file. Tiles come straight out of a read-only memory mapping; if
+ * the file can't be mapped (e.g., it won't fit in a 32-bit address space), tiles
+ * are read on first use and kept.
+ */
+class PagedGeoid::GridFile
+{
+public:
+    unsigned _numCols, _numRows, _tileSize, _tilesAcross, _tilesDown;
+    unsigned _sampleType, _sampleBytes, _tileBytes;
+    float    _scale, _offset;
+    double   _lonMin, _latMin, _lonMax, _latMax, _dx, _dy;
+
+    // Remembers the last tile used, so runs of samples from one tile skip the lookup.
+    struct Cursor
+    {
+        Cursor() : _index(-1), _tile(0L) { }
+        int                  _index;
+        const unsigned char* _tile;
+    };
+
+public:
+    GridFile() :
+      _data( 0L ),
+      _size( 0 )
+    {
+#if defined(WIN32) && !defined(__CYGWIN__)
+        _file    = INVALID_HANDLE_VALUE;
+        _mapping = 0L;
+#else
+        _fd = -1;
+#endif
+    }
+
+    ~GridFile()
+    {
+#if defined(WIN32) && !defined(__CYGWIN__)
+        if ( _data )    UnmapViewOfFile( _data );
+        if ( _mapping ) CloseHandle( _mapping );
+        if ( _file != INVALID_HANDLE_VALUE ) CloseHandle( _file );
+#else
+        if ( _data )    munmap( (void*)_data, _size );
+        if ( _fd >= 0 ) close( _fd );
+#endif
+    }
+
+    bool open( const std::string& filename )
+    {
+        _stream.open( filename.c_str(), std::ios::in | std::ios::binary );
+        if ( !_stream.is_open() )
+        {
+            OE_WARN << LC << "Cannot open geoid grid " << filename << std::endl;
+            return false;
+        }
+
+        unsigned char h[HEADER_SIZE];
+        if ( !_stream.read( (char*)h, HEADER_SIZE ) || ::memcmp( h, MAGIC, 4 ) != 0 || get32(h+4) > VERSION )
+        {
+            OE_WARN << LC << filename << " is not a geoid grid file (or is a newer version)" << std::endl;
+            return false;
+        }
+
+        _numCols     = get32( h+8 );
+        _numRows     = get32( h+12 );
+        _tileSize    = get32( h+16 );
+        _sampleType  = get32( h+20 );
+        _scale       = getFloat( h+24 );
+        _offset      = getFloat( h+28 );
+        _lonMin      = getDouble( h+32 );
+        _latMin      = getDouble( h+40 );
+        _lonMax      = getDouble( h+48 );
+        _latMax      = getDouble( h+56 );
+
+        if ( _numCols < 2 || _numRows < 2 || _tileSize == 0 || _tileSize > 4096 ||
+             (_sampleType != SAMPLE_FLOAT32 && _sampleType != SAMPLE_INT16) ||
+             !(_lonMax > _lonMin) || !(_latMax > _latMin) )
+        {
+            OE_WARN << LC << "Corrupt geoid grid header in " << filename << std::endl;
+            return false;
+        }
+
+        _sampleBytes = _sampleType == SAMPLE_INT16 ? 2 : 4;
+        _tileBytes   = _tileSize * _tileSize * _sampleBytes;
+        _tilesAcross = (_numCols + _tileSize - 1) / _tileSize;
+        _tilesDown   = (_numRows + _tileSize - 1) / _tileSize;
+        _dx          = (_lonMax - _lonMin) / (double)(_numCols-1);
+        _dy          = (_latMax - _latMin) / (double)(_numRows-1);
+
+        double expectedSize = (double)HEADER_SIZE + (double)_tilesAcross * (double)_tilesDown * (double)_tileBytes;
+
+        _stream.seekg( 0, std::ios::end );
+        double fileSize = (double)_stream.tellg();
+        if ( fileSize < expectedSize )
+        {
+            OE_WARN << LC << "Geoid grid " << filename << " is truncated" << std::endl;
+            return false;
+        }
+
+        if ( mapFile( filename, expectedSize ) )
+        {
+            _stream.close();
+            OE_INFO << LC << "Mapped geoid grid " << filename << " (" << _numCols << "x" << _numRows << ")" << std::endl;
+        }
+        else
+        {
+            OE_INFO << LC << "Could not map " << filename << "; reading tiles on demand" << std::endl;
+        }
+        return true;
+    }
+
+    /** Fractional column of a longitude, wrapped into range like Geoid::getOffset. Returns
+        false if it falls outside the grid. */
+    bool toColumn( double lon, double& out_px ) const
+    {
+        if ( lon < _lonMin )      lon += 360.0;
+        else if ( lon > _lonMax ) lon -= 360.0;
+        out_px = osg::clampBetween( (lon - _lonMin) / _dx, 0.0, (double)(_numCols-1) );
+        return 
+            (lon >= _lonMin || osg::equivalent(lon, _lonMin)) &&
+            (lon <= _lonMax || osg::equivalent(lon, _lonMax));
+    }
+
+    /** Fractional row of a latitude, wrapped into range like Geoid::getOffset. */
+    bool toRow( double lat, double& out_py ) const
+    {
+        if ( lat < _latMin )      lat = 90.0 - (-90.0-lat);
+        else if ( lat > _latMax ) lat = -90.0 + (lat-90.0);
+        out_py = osg::clampBetween( (lat - _latMin) / _dy, 0.0, (double)(_numRows-1) );
+        return
+            (lat >= _latMin || osg::equivalent(lat, _latMin)) &&
+            (lat <= _latMax || osg::equivalent(lat, _latMax));
+    }
+
+    inline float sample( unsigned col, unsigned row, Cursor& cursor ) const
+    {
+        int index = (row / _tileSize) * _tilesAcross + (col / _tileSize);
+        if ( index != cursor._index )
+        {
+            cursor._tile  = getTile( index );
+            cursor._index = index;
+        }
+        if ( !cursor._tile )
+            return 0.0f;
+
+        const unsigned char* p = cursor._tile + ((row % _tileSize) * _tileSize + (col % _tileSize)) * _sampleBytes;
+        if ( _sampleType == SAMPLE_INT16 )
+            return (float)(short)(p[0] | (p[1] << 8)) * _scale + _offset;
+        else
+            return getFloat( p ) * _scale + _offset;
+    }
+
+    float interpolate( double px, double py, ElevationInterpolation interp, Cursor& cursor ) const
+    {
+        if ( interp == INTERP_NEAREST )
+            return sample( (unsigned)osg::round(px), (unsigned)osg::round(py), cursor );
+
+        // everything else is bilinear; the geoid is far smoother than its post spacing.
+        unsigned c0 = (unsigned)px, r0 = (unsigned)py;
+        unsigned c1 = osg::minimum( c0+1, _numCols-1 );
+        unsigned r1 = osg::minimum( r0+1, _numRows-1 );
+        double wx = px - (double)c0;
+        double wy = py - (double)r0;
+
+        double s = (1.0-wx)*sample(c0, r0, cursor) + wx*sample(c1, r0, cursor);
+        double n = (1.0-wx)*sample(c0, r1, cursor) + wx*sample(c1, r1, cursor);
+        return (float)((1.0-wy)*s + wy*n);
+    }
+
+private:
+    const unsigned char* _data;
+    size_t               _size;
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+    HANDLE _file, _mapping;
+#else
+    int _fd;
+#endif
+
+    // fallback for unmappable files
+    mutable std::ifstream _stream;
+    mutable Threading::Mutex _tilesMutex;
+    mutable std::map<int, std::vector<unsigned char> > _tiles;
+
+    bool mapFile( const std::string& filename, double size )
+    {
+        if ( size > (double)((size_t)-1) )
+            return false;
+        _size = (size_t)size;
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+        _file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0L );
+        if ( _file == INVALID_HANDLE_VALUE )
+            return false;
+        _mapping = CreateFileMappingA( _file, 0L, PAGE_READONLY, 0, 0, 0L );
+        if ( !_mapping )
+            return false;
+        _data = (const unsigned char*)MapViewOfFile( _mapping, FILE_MAP_READ, 0, 0, _size );
+        return _data != 0L;
+#else
+        _fd = ::open( filename.c_str(), O_RDONLY );
+        if ( _fd < 0 )
+            return false;
+        void* ptr = mmap( 0L, _size, PROT_READ, MAP_SHARED, _fd, 0 );
+        if ( ptr == MAP_FAILED )
+            return false;
+#   ifdef MADV_RANDOM
+        // queries are scattered; don't read ahead into tiles nobody asked for
+        madvise( ptr, _size, MADV_RANDOM );
+#   endif
+        _data = (const unsigned char*)ptr;
+        return true;
+#endif
+    }
+
+    const unsigned char* getTile( int index ) const
+    {
+        if ( index < 0 || index >= (int)(_tilesAcross * _tilesDown) )
+            return 0L;
+
+        if ( _data )
+            return _data + HEADER_SIZE + (size_t)index * _tileBytes;
+
+        Threading::ScopedMutexLock lock( _tilesMutex );
+        std::map<int, std::vector<unsigned char> >::iterator i = _tiles.find( index );
+        if ( i != _tiles.end() )
+            return &i->second[0];
+
+        std::vector<unsigned char>& tile = _tiles[index];
+        tile.resize( _tileBytes );
+        _stream.clear();
+        _stream.seekg( (std::streamoff)HEADER_SIZE + (std::streamoff)index * (std::streamoff)_tileBytes );
+        if ( !_stream.read( (char*)&tile[0], _tileBytes ) )
+        {
+            OE_WARN << LC << "Failed to read geoid tile " << index << std::endl;
+            std::fill( tile.begin(), tile.end(), 0 );
+        }
+        return &tile[0];
+    }
+};
+
+//------------------------------------------------------------------------
+
+PagedGeoid::PagedGeoid(const std::string& name,
+                       const std::string& filename,
+                       const Units&       units ) :
+_grid    ( 0L ),
+_filename( filename )
+{
+    GridFile* grid = new GridFile();
+    if ( grid->open( filename ) )
+        _grid = grid;
+    else
+        delete grid;
+
+    setName( name );
+    setUnits( units );
+}
+
+PagedGeoid::~PagedGeoid()
+{
+    delete _grid;
+}
+
+void
+PagedGeoid::validate()
+{
+    _valid = _grid != 0L;
+}
+
+float
+PagedGeoid::getOffset(double lat_deg, double lon_deg, const ElevationInterpolation& interp ) const
+{
+    if ( !_valid )
+        return 0.0f;
+
+    double px, py;
+    if ( !_grid->toColumn( lon_deg, px ) || !_grid->toRow( lat_deg, py ) )
+        return 0.0f;
+
+    GridFile::Cursor cursor;
+    return _grid->interpolate( px, py, interp, cursor );
+}
+
+void
+PagedGeoid::getOffsets(const std::vector<osg::Vec2d>& lonLats,
+                       std::vector<float>& out_offsets,
+                       const ElevationInterpolation& interp ) const
+{
+    out_offsets.assign( lonLats.size(), 0.0f );
+    if ( !_valid )
+        return;
+
+    GridFile::Cursor cursor;
+    for( unsigned i=0; i<lonLats.size(); ++i )
+    {
+        double px, py;
+        if ( _grid->toColumn( lonLats[i].x(), px ) && _grid->toRow( lonLats[i].y(), py ) )
+            out_offsets[i] = _grid->interpolate( px, py, interp, cursor );
+    }
+}
+
+void
+PagedGeoid::getOffsets(double latMin, double lonMin, 
+                       double latInterval, double lonInterval,
+                       osg::HeightField* out_hf,
+                       const ElevationInterpolation& interp ) const
+{
+    osg::HeightField::HeightList& heights = out_hf->getHeightList();
+    std::fill( heights.begin(), heights.end(), 0.0f );
+    if ( !_valid )
+        return;
+
+    unsigned numCols = out_hf->getNumColumns();
+    unsigned numRows = out_hf->getNumRows();
+
+    // wrap and scale each axis once for the whole grid.
+    std::vector<double> px( numCols ), py( numRows );
+    std::vector<bool>   colOK( numCols ), rowOK( numRows );
+    for( unsigned c=0; c<numCols; ++c )
+        colOK[c] = _grid->toColumn( lonMin + lonInterval*(double)c, px[c] );
+    for( unsigned r=0; r<numRows; ++r )
+        rowOK[r] = _grid->toRow( latMin + latInterval*(double)r, py[r] );
+
+    GridFile::Cursor cursor;
+    for( unsigned r=0; r<numRows; ++r )
+    {
+        if ( !rowOK[r] )
+            continue;
+
+        float* out = &heights[r*numCols];
+        for( unsigned c=0; c<numCols; ++c )
+        {
+            if ( colOK[c] )
+                out[c] = _grid->interpolate( px[c], py[r], interp, cursor );
+        }
+    }
+}
+
+bool
+PagedGeoid::write(const std::string&    filename,
+                  const GeoHeightField& ghf,
+                  unsigned              tileSize )
+{
+    const osg::HeightField* hf = ghf.getHeightField();
+    const GeoExtent& ex = ghf.getExtent();
+
+    if ( !hf || hf->getNumColumns() < 2 || hf->getNumRows() < 2 || tileSize == 0 || tileSize > 4096 )
+        return false;
+
+    if ( !ex.getSRS() || !ex.getSRS()->isGeographic() )
+    {
+        OE_WARN << LC << "Geoid heightfield must be geodetic" << std::endl;
+        return false;
+    }
+
+    std::string path = osgDB::getFilePath( filename );
+    if ( !path.empty() && !osgDB::fileExists(path) && !osgDB::makeDirectory(path) )
+    {
+        OE_WARN << LC << "Couldn't create path " << path << std::endl;
+        return false;
+    }
+
+    std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary );
+    if ( !out.is_open() )
+        return false;
+
+    unsigned numCols = hf->getNumColumns();
+    unsigned numRows = hf->getNumRows();
+
+    out.write( MAGIC, 4 );
+    put32( out, VERSION );
+    put32( out, numCols );
+    put32( out, numRows );
+    put32( out, tileSize );
+    put32( out, SAMPLE_FLOAT32 );
+    putFloat( out, 1.0f );
+    putFloat( out, 0.0f );
+    putDouble( out, ex.xMin() );
+    putDouble( out, ex.yMin() );
+    putDouble( out, ex.xMax() );
+    putDouble( out, ex.yMax() );
+
+    // tiles along the edges are padded out to full size by repeating the last post.
+    unsigned tilesAcross = (numCols + tileSize - 1) / tileSize;
+    unsigned tilesDown   = (numRows + tileSize - 1) / tileSize;
+    for( unsigned ty=0; ty<tilesDown; ++ty )
+    {
+        for( unsigned tx=0; tx<tilesAcross; ++tx )
+        {
+            for( unsigned j=0; j<tileSize; ++j )
+            {
+                unsigned row = osg::minimum( ty*tileSize + j, numRows-1 );
+                for( unsigned i=0; i<tileSize; ++i )
+                {
+                    unsigned col = osg::minimum( tx*tileSize + i, numCols-1 );
+                    putFloat( out, hf->getHeight(col, row) );
+                }
+            }
+        }
+    }
+
+    return !out.fail();
+}
@@ -0,0 +1,397 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/RawImageCodec>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+#include <fstream>
+#include <string.h>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[RawImageCodec] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Stream layout (all integers little-endian uint32):
+    //
+    //   magic "OERI", version, codec, s, t, r, internalFormat, pixelFormat,
+    //   dataType, packing, origin, rawSize, storedSize, numMipmaps,
+    //   mipmap offsets[numMipmaps], stored data[storedSize]
+
+    const char     MAGIC[4]       = { 'O', 'E', 'R', 'I' };
+    const unsigned CODEC_NONE     = 0;
+    const unsigned CODEC_LZ4      = 1;
+    const unsigned MAX_DATA_SIZE  = 1u << 30;
+    const unsigned MAX_MIPMAPS    = 32;
+
+    // LZ4 block format constants
+    const unsigned MIN_MATCH      = 4;
+    const unsigned LAST_LITERALS  = 5;    // the last 5 bytes are always literals
+    const unsigned MF_LIMIT       = 12;   // no match may start within 12 bytes of the end
+    const unsigned MAX_OFFSET     = 65535;
+    const unsigned HASH_LOG       = 14;
+
+    inline unsigned read32( const unsigned char* p )
+    {
+        unsigned v;
+        ::memcpy( &v, p, 4 );
+        return v;
+    }
+
+    inline unsigned hash32( unsigned v )
+    {
+        return (v * 2654435761u) >> (32 - HASH_LOG);
+    }
+
+    inline void putLength( std::vector<unsigned char>& out, unsigned len )
+    {
+        for( ; len >= 255; len -= 255 )
+            out.push_back( 255 );
+        out.push_back( (unsigned char)len );
+    }
+
+    void putSequence( std::vector<unsigned char>& out, const unsigned char* lit, unsigned litLen, unsigned offset, unsigned matchLen )
+    {
+        unsigned m = matchLen - MIN_MATCH;
+        out.push_back( (unsigned char)(((litLen < 15 ? litLen : 15) << 4) | (m < 15 ? m : 15)) );
+        if ( litLen >= 15 )
+            putLength( out, litLen - 15 );
+        out.insert( out.end(), lit, lit + litLen );
+        out.push_back( (unsigned char)(offset & 0xff) );
+        out.push_back( (unsigned char)(offset >> 8) );
+        if ( m >= 15 )
+            putLength( out, m - 15 );
+    }
+
+    void putLastLiterals( std::vector<unsigned char>& out, const unsigned char* lit, unsigned litLen )
+    {
+        out.push_back( (unsigned char)((litLen < 15 ? litLen : 15) << 4) );
+        if ( litLen >= 15 )
+            putLength( out, litLen - 15 );
+        out.insert( out.end(), lit, lit + litLen );
+    }
+
+    // Greedy single-probe LZ4 block compressor. Imagery tiles are full of flat
+    // runs (nodata, water, alpha) which this catches cheaply.
+    void compressBlock( const unsigned char* src, unsigned srcLen, std::vector<unsigned char>& out )
+    {
+        out.clear();
+        out.reserve( srcLen + srcLen/255 + 16 );
+
+        unsigned anchor = 0;
+        if ( srcLen > MF_LIMIT )
+        {
+            std::vector<unsigned> table( 1u << HASH_LOG, 0u ); // stores position+1; 0 means empty
+            unsigned limit = srcLen - MF_LIMIT;
+            unsigned ip = 0;
+            while( ip < limit )
+            {
+                unsigned seq = read32( src + ip );
+                unsigned h = hash32( seq );
+                unsigned ref = table[h];
+                table[h] = ip + 1;
+
+                if ( ref > 0 && ip - (ref-1) <= MAX_OFFSET && read32( src + ref - 1 ) == seq )
+                {
+                    unsigned from = ref - 1;
+                    unsigned maxLen = srcLen - LAST_LITERALS - ip;
+                    unsigned len = MIN_MATCH;
+                    while( len < maxLen && src[from+len] == src[ip+len] )
+                        ++len;
+
+                    putSequence( out, src + anchor, ip - anchor, ip - from, len );
+                    ip += len;
+                    anchor = ip;
+                }
+                else
+                {
+                    ++ip;
+                }
+            }
+        }
+
+        putLastLiterals( out, src + anchor, srcLen - anchor );
+    }
+
+    inline bool getLength( const unsigned char* src, unsigned srcLen, unsigned& ip, unsigned& len )
+    {
+        unsigned char b;
+        do {
+            if ( ip >= srcLen ) return false;
+            b = src[ip++];
+            len += b;
+            if ( len > MAX_DATA_SIZE ) return false;
+        }
+        while( b == 255 );
+        return true;
+    }
+
+    // Bounds-checked LZ4 block decompressor. Returns false on malformed input.
+    bool decompressBlock( const unsigned char* src, unsigned srcLen, unsigned char* dst, unsigned dstLen )
+    {
+        unsigned ip = 0, op = 0;
+        while( ip < srcLen )
+        {
+            unsigned token = src[ip++];
+
+            unsigned litLen = token >> 4;
+            if ( litLen == 15 && !getLength(src, srcLen, ip, litLen) )
+                return false;
+            if ( litLen > srcLen - ip || litLen > dstLen - op )
+                return false;
+            ::memcpy( dst + op, src + ip, litLen );
+            ip += litLen;
+            op += litLen;
+
+            if ( ip == srcLen ) // last sequence has no match
+                break;
+
+            if ( srcLen - ip < 2 )
+                return false;
+            unsigned offset = src[ip] | (src[ip+1] << 8);
+            ip += 2;
+            if ( offset == 0 || offset > op )
+                return false;
+
+            unsigned matchLen = token & 15;
+            if ( matchLen == 15 && !getLength(src, srcLen, ip, matchLen) )
+                return false;
+            matchLen += MIN_MATCH;
+            if ( matchLen > dstLen - op )
+                return false;
+
+            unsigned char* d = dst + op;
+            const unsigned char* s = d - offset;
+            if ( offset >= matchLen )
+            {
+                ::memcpy( d, s, matchLen );
+            }
+            else
+            {
+                for( unsigned i=0; i<matchLen; ++i ) // overlapping copy replicates the run
+                    d[i] = s[i];
+            }
+            op += matchLen;
+        }
+        return op == dstLen;
+    }
+
+    inline void put32( std::vector<unsigned char>& out, unsigned v )
+    {
+        out.push_back( (unsigned char)(v & 0xff) );
+        out.push_back( (unsigned char)((v >> 8) & 0xff) );
+        out.push_back( (unsigned char)((v >> 16) & 0xff) );
+        out.push_back( (unsigned char)((v >> 24) & 0xff) );
+    }
+
+    inline bool get32( std::istream& in, unsigned& v )
+    {
+        unsigned char b[4];
+        if ( !in.read( (char*)b, 4 ) )
+            return false;
+        v = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned)b[3] << 24);
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+RawImageCodec::write( const osg::Image* image, std::ostream& out )
+{
+    if ( !image || !image->data() )
+        return false;
+
+    unsigned rawSize = image->getTotalSizeInBytesIncludingMipmaps();
+    if ( rawSize == 0 || rawSize > MAX_DATA_SIZE )
+        return false;
+
+    const osg::Image::MipmapDataType& mipmaps = image->getMipmapLevels();
+    if ( mipmaps.size() > MAX_MIPMAPS )
+        return false;
+
+    std::vector<unsigned char> stored;
+    compressBlock( image->data(), rawSize, stored );
+
+    // incompressible data (noise, already-compressed DXT blocks) is stored as-is
+    unsigned codec = CODEC_LZ4;
+    if ( stored.size() >= rawSize )
+    {
+        stored.assign( image->data(), image->data() + rawSize );
+        codec = CODEC_NONE;
+    }
+
+    std::vector<unsigned char> header;
+    header.reserve( 64 + 4*mipmaps.size() );
+    header.insert( header.end(), MAGIC, MAGIC + 4 );
+    put32( header, version() );
+    put32( header, codec );
+    put32( header, image->s() );
+    put32( header, image->t() );
+    put32( header, image->r() );
+    put32( header, image->getInternalTextureFormat() );
+    put32( header, image->getPixelFormat() );
+    put32( header, image->getDataType() );
+    put32( header, image->getPacking() );
+    put32( header, image->getOrigin() );
+    put32( header, rawSize );
+    put32( header, stored.size() );
+    put32( header, mipmaps.size() );
+    for( unsigned i=0; i<mipmaps.size(); ++i )
+        put32( header, mipmaps[i] );
+
+    out.write( (const char*)&header[0], header.size() );
+    out.write( (const char*)&stored[0], stored.size() );
+    return !out.fail();
+}
+
+osg::Image*
+RawImageCodec::read( std::istream& in )
+{
+    char magic[4];
+    if ( !in.read( magic, 4 ) || ::memcmp( magic, MAGIC, 4 ) != 0 )
+        return 0L;
+
+    unsigned ver, codec, s, t, r, internalFormat, pixelFormat, dataType, packing, origin;
+    unsigned rawSize, storedSize, numMipmaps;
+    if ( !get32(in, ver) || ver == 0 || ver > version() )
+    {
+        OE_WARN << LC << "Unsupported raw image version" << std::endl;
+        return 0L;
+    }
+
+    if (!get32(in, codec) || !get32(in, s) || !get32(in, t) || !get32(in, r) ||
+        !get32(in, internalFormat) || !get32(in, pixelFormat) || !get32(in, dataType) ||
+        !get32(in, packing) || !get32(in, origin) ||
+        !get32(in, rawSize) || !get32(in, storedSize) || !get32(in, numMipmaps) )
+    {
+        return 0L;
+    }
+
+    if ( (codec != CODEC_NONE && codec != CODEC_LZ4) ||
+         rawSize == 0 || rawSize > MAX_DATA_SIZE || storedSize > MAX_DATA_SIZE ||
+         (codec == CODEC_NONE && storedSize != rawSize) ||
+         numMipmaps > MAX_MIPMAPS )
+    {
+        OE_WARN << LC << "Corrupt raw image header" << std::endl;
+        return 0L;
+    }
+
+    osg::Image::MipmapDataType mipmaps( numMipmaps );
+    for( unsigned i=0; i<numMipmaps; ++i )
+    {
+        if ( !get32(in, mipmaps[i]) || mipmaps[i] >= rawSize )
+            return 0L;
+    }
+
+    unsigned char* data = new unsigned char[rawSize];
+
+    if ( codec == CODEC_NONE )
+    {
+        if ( !in.read( (char*)data, rawSize ) )
+        {
+            delete [] data;
+            return 0L;
+        }
+    }
+    else
+    {
+        std::vector<unsigned char> stored( storedSize );
+        if ( storedSize == 0 ||
+             !in.read( (char*)&stored[0], storedSize ) ||
+             !decompressBlock( &stored[0], storedSize, data, rawSize ) )
+        {
+            OE_WARN << LC << "Corrupt raw image data" << std::endl;
+            delete [] data;
+            return 0L;
+        }
+    }
+
+    osg::ref_ptr<osg::Image> image = new osg::Image();
+    image->setImage( s, t, r, internalFormat, pixelFormat, dataType, data, osg::Image::USE_NEW_DELETE, packing );
+    image->setOrigin( (osg::Image::Origin)origin );
+    if ( numMipmaps > 0 )
+        image->setMipmapLevels( mipmaps );
+
+    // guard against a header that doesn't match its payload
+    if ( image->getTotalSizeInBytesIncludingMipmaps() > rawSize )
+    {
+        OE_WARN << LC << "Raw image size mismatch" << std::endl;
+        return 0L;
+    }
+
+    return image.release();
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    struct RawImageReaderWriter : public osgDB::ReaderWriter
+    {
+        RawImageReaderWriter()
+        {
+            supportsExtension( RawImageCodec::extension(), "osgEarth raw image (decoded pixels, LZ4-compressed)" );
+        }
+
+        virtual const char* className()
+        {
+            return "osgEarth Raw Image ReaderWriter";
+        }
+
+        virtual ReadResult readImage(const std::string& fileName, const Options* options) const
+        {
+            if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( fileName )))
+                return ReadResult::FILE_NOT_HANDLED;
+
+            if ( !osgDB::fileExists( fileName ) )
+                return ReadResult::FILE_NOT_FOUND;
+
+            std::ifstream in( fileName.c_str(), std::ios::in | std::ios::binary );
+            return readImage( in, options );
+        }
+
+        virtual ReadResult readImage(std::istream& in, const Options* options) const
+        {
+            osg::Image* image = RawImageCodec::read( in );
+            if ( !image )
+                return ReadResult::ERROR_IN_READING_FILE;
+            return image;
+        }
+
+        virtual WriteResult writeImage(const osg::Image& image, const std::string& fileName, const Options* options) const
+        {
+            if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( fileName )))
+                return WriteResult::FILE_NOT_HANDLED;
+
+            std::ofstream out( fileName.c_str(), std::ios::out | std::ios::binary );
+            return writeImage( image, out, options );
+        }
+
+        virtual WriteResult writeImage(const osg::Image& image, std::ostream& out, const Options* options) const
+        {
+            return RawImageCodec::write( &image, out ) ? WriteResult::FILE_SAVED : WriteResult::ERROR_IN_WRITING_FILE;
+        }
+    };
+}
+REGISTER_OSGPLUGIN(oeraw, RawImageReaderWriter)
@@ -0,0 +1,586 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TerrainIntersector>
+#include <osgEarth/HeightFieldUtils>
+#include <OpenThreads/ScopedLock>
+#include <algorithm>
+#include <float.h>
+
+#define LC "[TerrainIntersector] "
+
+using namespace osgEarth;
+using namespace OpenThreads;
+
+namespace
+{
+    // Upper bound on terrain height, used to trim geocentric segments to the
+    // shell that can possibly contain terrain.
+    const double MAX_TERRAIN_HEIGHT = 10000.0;
+
+    // Maximum deviation (in meters) between a world segment and its straight
+    // approximation in map coordinates.
+    const double SEGMENT_TOLERANCE = 1.0;
+    const unsigned int MAX_SUBDIVISION_DEPTH = 12;
+
+    // Deepest LOD we will ever march, regardless of the reported data level.
+    const unsigned int MAX_LEVEL = 24;
+
+    /** Clips the parametric range [t0,t1] of a ray to a 1D slab. */
+    inline bool clipSlab( double origin, double dir, double lo, double hi, double& t0, double& t1 )
+    {
+        if ( dir == 0.0 )
+            return origin >= lo && origin <= hi;
+
+        double a = (lo - origin) / dir;
+        double b = (hi - origin) / dir;
+        if ( a > b ) std::swap( a, b );
+        if ( a > t0 ) t0 = a;
+        if ( b < t1 ) t1 = b;
+        return t0 <= t1;
+    }
+
+    /** Moller-Trumbore ray/triangle test; only accepts hits closer than inout_t. */
+    inline bool intersectTriangle(
+        const osg::Vec3d& start, const osg::Vec3d& dir,
+        const osg::Vec3d& v0, const osg::Vec3d& v1, const osg::Vec3d& v2,
+        double& inout_t )
+    {
+        const double EPS = 1e-9;
+
+        osg::Vec3d e1 = v1 - v0;
+        osg::Vec3d e2 = v2 - v0;
+        osg::Vec3d p = dir ^ e2;
+        double det = e1 * p;
+        if ( det == 0.0 )
+            return false;
+
+        double invDet = 1.0 / det;
+        osg::Vec3d s = start - v0;
+        double u = (s * p) * invDet;
+        if ( u < -EPS || u > 1.0 + EPS )
+            return false;
+
+        osg::Vec3d q = s ^ e1;
+        double v = (dir * q) * invDet;
+        if ( v < -EPS || u + v > 1.0 + EPS )
+            return false;
+
+        double t = (e2 * q) * invDet;
+        if ( t < 0.0 || t >= inout_t )
+            return false;
+
+        inout_t = t;
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------
+
+MinMaxHeightField::MinMaxHeightField(const osg::HeightField* hf,
+                                     double xMin, double yMin, double xMax, double yMax,
+                                     float verticalScale ) :
+_hf           ( hf ),
+_xMin         ( xMin ),
+_yMin         ( yMin ),
+_dx           ( 0.0 ),
+_dy           ( 0.0 ),
+_verticalScale( verticalScale ),
+_numCols      ( 0 ),
+_numRows      ( 0 )
+{
+    if ( !hf || hf->getNumColumns() < 2 || hf->getNumRows() < 2 )
+        return;
+
+    _numCols = hf->getNumColumns() - 1;
+    _numRows = hf->getNumRows() - 1;
+    _dx = (xMax - xMin) / (double)_numCols;
+    _dy = (yMax - yMin) / (double)_numRows;
+
+    // level 0: the height range of each cell.
+    _levels.push_back( std::vector<Range>(_numCols * _numRows) );
+    _levelCols.push_back( _numCols );
+    _levelRows.push_back( _numRows );
+
+    std::vector<Range>& cells = _levels.back();
+    for( unsigned int r=0; r<_numRows; ++r )
+    {
+        for( unsigned int c=0; c<_numCols; ++c )
+        {
+            float h00 = getHeight(c, r),   h10 = getHeight(c+1, r);
+            float h01 = getHeight(c, r+1), h11 = getHeight(c+1, r+1);
+            Range& range = cells[r*_numCols + c];
+            range._min = osg::minimum( osg::minimum(h00, h10), osg::minimum(h01, h11) );
+            range._max = osg::maximum( osg::maximum(h00, h10), osg::maximum(h01, h11) );
+        }
+    }
+
+    // each higher level merges 2x2 blocks of the one below, up to a single root.
+    while( _levelCols.back() > 1 || _levelRows.back() > 1 )
+    {
+        unsigned int childCols = _levelCols.back();
+        unsigned int childRows = _levelRows.back();
+        unsigned int cols = (childCols + 1) / 2;
+        unsigned int rows = (childRows + 1) / 2;
+
+        std::vector<Range> parents( cols * rows );
+        const std::vector<Range>& children = _levels.back();
+
+        for( unsigned int j=0; j<rows; ++j )
+        {
+            for( unsigned int i=0; i<cols; ++i )
+            {
+                Range& range = parents[j*cols + i];
+                range._min =  FLT_MAX;
+                range._max = -FLT_MAX;
+                for( unsigned int cj = 2*j; cj < osg::minimum(2*j+2, childRows); ++cj )
+                {
+                    for( unsigned int ci = 2*i; ci < osg::minimum(2*i+2, childCols); ++ci )
+                    {
+                        const Range& child = children[cj*childCols + ci];
+                        range._min = osg::minimum( range._min, child._min );
+                        range._max = osg::maximum( range._max, child._max );
+                    }
+                }
+            }
+        }
+
+        _levels.push_back( parents );
+        _levelCols.push_back( cols );
+        _levelRows.push_back( rows );
+    }
+}
+
+float
+MinMaxHeightField::getHeight( unsigned int c, unsigned int r ) const
+{
+    float h = _hf->getHeight( c, r );
+    return h == NO_DATA_VALUE ? 0.0f : h * _verticalScale;
+}
+
+float
+MinMaxHeightField::getMinHeight() const
+{
+    return _levels.empty() ? 0.0f : _levels.back()[0]._min;
+}
+
+float
+MinMaxHeightField::getMaxHeight() const
+{
+    return _levels.empty() ? 0.0f : _levels.back()[0]._max;
+}
+
+bool
+MinMaxHeightField::clipNode(unsigned int level, unsigned int i, unsigned int j,
+                            const osg::Vec3d& start, const osg::Vec3d& dir,
+                            double tMax, double& out_tEnter ) const
+{
+    unsigned int c0 = i << level, c1 = osg::minimum( (i+1) << level, _numCols );
+    unsigned int r0 = j << level, r1 = osg::minimum( (j+1) << level, _numRows );
+    const Range& range = _levels[level][j*_levelCols[level] + i];
+
+    // pad the box a little so rays grazing a shared edge are not lost to rounding.
+    double px = 1e-6 * fabs(_dx), py = 1e-6 * fabs(_dy), pz = 1e-3;
+
+    double t0 = 0.0, t1 = tMax;
+    if ( !clipSlab( start.x(), dir.x(), _xMin + c0*_dx - px, _xMin + c1*_dx + px, t0, t1 ) ) return false;
+    if ( !clipSlab( start.y(), dir.y(), _yMin + r0*_dy - py, _yMin + r1*_dy + py, t0, t1 ) ) return false;
+    if ( !clipSlab( start.z(), dir.z(), range._min - pz, range._max + pz, t0, t1 ) ) return false;
+
+    out_tEnter = t0;
+    return true;
+}
+
+bool
+MinMaxHeightField::intersectCell(unsigned int c, unsigned int r,
+                                 const osg::Vec3d& start, const osg::Vec3d& dir,
+                                 double& inout_t ) const
+{
+    double x0 = _xMin + c*_dx, x1 = x0 + _dx;
+    double y0 = _yMin + r*_dy, y1 = y0 + _dy;
+
+    osg::Vec3d v00( x0, y0, getHeight(c,   r)   );
+    osg::Vec3d v10( x1, y0, getHeight(c+1, r)   );
+    osg::Vec3d v11( x1, y1, getHeight(c+1, r+1) );
+    osg::Vec3d v01( x0, y1, getHeight(c,   r+1) );
+
+    bool hit = intersectTriangle( start, dir, v00, v10, v11, inout_t );
+    hit = intersectTriangle( start, dir, v00, v11, v01, inout_t ) || hit;
+    return hit;
+}
+
+void
+MinMaxHeightField::intersectNode(unsigned int level, unsigned int i, unsigned int j,
+                                 const osg::Vec3d& start, const osg::Vec3d& dir,
+                                 double& inout_t ) const
+{
+    if ( level == 0 )
+    {
+        intersectCell( i, j, start, dir, inout_t );
+        return;
+    }
+
+    // collect the children the ray passes through, and visit them front to back
+    // so we can stop as soon as the next one starts beyond the closest hit.
+    struct Child { double _t; unsigned int _i, _j; };
+    Child children[4];
+    unsigned int numChildren = 0;
+
+    unsigned int childLevel = level - 1;
+    for( unsigned int cj = 2*j; cj < osg::minimum(2*j+2, _levelRows[childLevel]); ++cj )
+    {
+        for( unsigned int ci = 2*i; ci < osg::minimum(2*i+2, _levelCols[childLevel]); ++ci )
+        {
+            double t;
+            if ( clipNode(childLevel, ci, cj, start, dir, inout_t, t) )
+            {
+                unsigned int k = numChildren++;
+                for( ; k > 0 && children[k-1]._t > t; --k )
+                    children[k] = children[k-1];
+                children[k]._t = t;
+                children[k]._i = ci;
+                children[k]._j = cj;
+            }
+        }
+    }
+
+    for( unsigned int k=0; k<numChildren && children[k]._t < inout_t; ++k )
+    {
+        intersectNode( childLevel, children[k]._i, children[k]._j, start, dir, inout_t );
+    }
+}
+
+bool
+MinMaxHeightField::intersect( const osg::Vec3d& start, const osg::Vec3d& end, double& out_t ) const
+{
+    if ( _levels.empty() )
+        return false;
+
+    osg::Vec3d dir = end - start;
+    unsigned int top = _levels.size() - 1;
+
+    double tEnter;
+    if ( !clipNode(top, 0, 0, start, dir, 1.0, tEnter) )
+        return false;
+
+    // only hits closer than the end of the segment are accepted:
+    double t = 1.0;
+    intersectNode( top, 0, 0, start, dir, t );
+    if ( t >= 1.0 )
+        return false;
+
+    out_t = t;
+    return true;
+}
+
+//------------------------------------------------------------------------
+
+TerrainIntersector::TerrainIntersector( const Map* map ) :
+_mapf              ( map, Map::ELEVATION_LAYERS, "TerrainIntersector" ),
+_initialized       ( false ),
+_verticalScale     ( 1.0f ),
+_maxTilesPerSegment( 16 ),
+_maxDataLevel      ( 0 ),
+_tileCache         ( 128 )
+{
+    //nop
+}
+
+void
+TerrainIntersector::setVerticalScale( float value )
+{
+    ScopedLock<Mutex> lock( _mutex );
+    if ( value != _verticalScale )
+    {
+        _verticalScale = value;
+        clearCache();
+    }
+}
+
+void
+TerrainIntersector::setMaxTilesPerSegment( unsigned int value )
+{
+    _maxTilesPerSegment = osg::maximum( value, 1u );
+}
+
+void
+TerrainIntersector::setMaxTilesToCache( unsigned int value )
+{
+    ScopedLock<Mutex> lock( _mutex );
+    _tileCache.setMaxSize( value );
+}
+
+unsigned int
+TerrainIntersector::getMaxTilesToCache() const
+{
+    return _tileCache.getMaxSize();
+}
+
+void
+TerrainIntersector::clearCache()
+{
+    unsigned int maxSize = _tileCache.getMaxSize();
+    _tileCache.setMaxSize( 0 );
+    _tileCache.setMaxSize( maxSize );
+}
+
+void
+TerrainIntersector::sync()
+{
+    if ( _mapf.sync() || !_initialized )
+    {
+        _maxDataLevel = 0;
+        for( ElevationLayerVector::const_iterator i = _mapf.elevationLayers().begin(); i != _mapf.elevationLayers().end(); ++i )
+        {
+            _maxDataLevel = osg::maximum( _maxDataLevel, i->get()->getMaxDataLevel() );
+        }
+        _maxDataLevel = osg::minimum( _maxDataLevel, MAX_LEVEL );
+
+        clearCache();
+        _initialized = true;
+    }
+}
+
+MinMaxHeightField*
+TerrainIntersector::getTile( const TileKey& key )
+{
+    TileCache::Record record = _tileCache.get( key );
+    if ( record.valid() )
+        return record.value().get();
+
+    osg::ref_ptr<osg::HeightField> hf;
+    if ( _mapf.elevationLayers().size() > 0 )
+    {
+        _mapf.getHeightField( key, true, hf, 0L, INTERP_BILINEAR );
+    }
+
+    // no elevation data here; intersect the reference surface instead.
+    if ( !hf.valid() )
+    {
+        hf = new osg::HeightField();
+        hf->allocate( 2, 2 );
+        for( unsigned int r=0; r<2; ++r )
+            for( unsigned int c=0; c<2; ++c )
+                hf->setHeight( c, r, 0.0f );
+    }
+
+    const GeoExtent& extent = key.getExtent();
+    osg::ref_ptr<MinMaxHeightField> tile = new MinMaxHeightField(
+        hf.get(), extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), _verticalScale );
+
+    _tileCache.insert( key, tile.get() );
+    return tile.get();
+}
+
+bool
+TerrainIntersector::intersectMapSegment( const osg::Vec3d& start, const osg::Vec3d& end, double& out_t )
+{
+    const Profile*   profile = _mapf.getProfile();
+    const GeoExtent& extent  = profile->getExtent();
+    osg::Vec3d       dir     = end - start;
+
+    // clip to the map's extent:
+    double t0 = 0.0, t1 = 1.0;
+    if ( !clipSlab(start.x(), dir.x(), extent.xMin(), extent.xMax(), t0, t1) ||
+         !clipSlab(start.y(), dir.y(), extent.yMin(), extent.yMax(), t0, t1) )
+    {
+        return false;
+    }
+
+    // pick the deepest LOD at which the segment crosses a bounded number of tiles.
+    unsigned int lod = _maxDataLevel;
+    double tileWidth, tileHeight;
+    profile->getTileDimensions( lod, tileWidth, tileHeight );
+    while( lod > 0 &&
+           (fabs(dir.x())*(t1-t0) > tileWidth  * (double)_maxTilesPerSegment ||
+            fabs(dir.y())*(t1-t0) > tileHeight * (double)_maxTilesPerSegment) )
+    {
+        --lod;
+        profile->getTileDimensions( lod, tileWidth, tileHeight );
+    }
+
+    unsigned int tilesWide, tilesHigh;
+    profile->getNumTiles( lod, tilesWide, tilesHigh );
+
+    // walk the tile grid along the segment (tile rows count down from the top, like TileKey).
+    double gx0 = (start.x() - extent.xMin()) / tileWidth;
+    double gy0 = (extent.yMax() - start.y()) / tileHeight;
+    double gdx =  dir.x() / tileWidth;
+    double gdy = -dir.y() / tileHeight;
+
+    int ix = osg::clampBetween( (int)floor(gx0 + gdx*t0), 0, (int)tilesWide-1 );
+    int iy = osg::clampBetween( (int)floor(gy0 + gdy*t0), 0, (int)tilesHigh-1 );
+
+    int    stepX   = gdx > 0.0 ? 1 : -1;
+    int    stepY   = gdy > 0.0 ? 1 : -1;
+    double tMaxX   = gdx != 0.0 ? ((double)(ix + (gdx > 0.0 ? 1 : 0)) - gx0) / gdx : DBL_MAX;
+    double tMaxY   = gdy != 0.0 ? ((double)(iy + (gdy > 0.0 ? 1 : 0)) - gy0) / gdy : DBL_MAX;
+    double tDeltaX = gdx != 0.0 ? 1.0 / fabs(gdx) : DBL_MAX;
+    double tDeltaY = gdy != 0.0 ? 1.0 / fabs(gdy) : DBL_MAX;
+
+    for( ;; )
+    {
+        // tiles are visited front to back, so the first hit is the closest one.
+        osg::ref_ptr<MinMaxHeightField> tile = getTile( TileKey(lod, ix, iy, profile) );
+        if ( tile.valid() && tile->intersect(start, end, out_t) )
+            return true;
+
+        if ( tMaxX < tMaxY )
+        {
+            if ( tMaxX > t1 ) break;
+            ix += stepX;
+            tMaxX += tDeltaX;
+        }
+        else
+        {
+            if ( tMaxY > t1 ) break;
+            iy += stepY;
+            tMaxY += tDeltaY;
+        }
+
+        if ( ix < 0 || iy < 0 || ix >= (int)tilesWide || iy >= (int)tilesHigh )
+            break;
+    }
+
+    return false;
+}
+
+void
+TerrainIntersector::subdivide(const osg::Vec3d& worldStart, const osg::Vec3d& worldEnd,
+                              const osg::Vec3d& mapStart, const osg::Vec3d& mapEnd,
+                              unsigned int depth, std::vector<osg::Vec3d>& out_mapPoints ) const
+{
+    const SpatialReference* srs = _mapf.getProfile()->getSRS();
+
+    // don't try to straighten pieces that wrap around the antimeridian.
+    bool wraps = srs->isGeographic() && fabs(mapEnd.x() - mapStart.x()) > 180.0;
+
+    if ( depth < MAX_SUBDIVISION_DEPTH && !wraps )
+    {
+        osg::Vec3d worldMid = (worldStart + worldEnd) * 0.5;
+        osg::Vec3d mapMid;
+        srs->transformFromECEF( worldMid, mapMid );
+
+        // how far does the straight map-space line stray from the world segment?
+        osg::Vec3d straightMid;
+        srs->transformToECEF( (mapStart + mapEnd) * 0.5, straightMid );
+
+        if ( (straightMid - worldMid).length() > SEGMENT_TOLERANCE )
+        {
+            subdivide( worldStart, worldMid, mapStart, mapMid, depth+1, out_mapPoints );
+            subdivide( worldMid, worldEnd, mapMid, mapEnd, depth+1, out_mapPoints );
+            return;
+        }
+    }
+
+    out_mapPoints.push_back( mapEnd );
+}
+
+bool
+TerrainIntersector::intersect( const osg::Vec3d& start, const osg::Vec3d& end, osg::Vec3d& out_point )
+{
+    ScopedLock<Mutex> lock( _mutex );
+
+    sync();
+
+    const Profile* profile = _mapf.getProfile();
+    if ( !profile )
+        return false;
+
+    // projected maps: world coordinates are map coordinates.
+    if ( !_mapf.getMapInfo().isGeocentric() )
+    {
+        double t;
+        if ( intersectMapSegment(start, end, t) )
+        {
+            out_point = start + (end - start) * t;
+            return true;
+        }
+        return false;
+    }
+
+    const SpatialReference* srs = profile->getSRS();
+
+    // trim the segment to the shell that can contain terrain; a picking ray from
+    // orbit spends most of its length in empty space.
+    osg::Vec3d dir = end - start;
+    double a = dir.length2();
+    if ( a == 0.0 )
+        return false;
+
+    double rMax = srs->getGeographicSRS()->getEllipsoid()->getRadiusEquator() +
+        MAX_TERRAIN_HEIGHT * osg::maximum( _verticalScale, 1.0f );
+    double b = 2.0 * (start * dir);
+    double c = start.length2() - rMax*rMax;
+    double disc = b*b - 4.0*a*c;
+    if ( disc < 0.0 )
+        return false;
+
+    double sq = sqrt( disc );
+    double t0 = osg::maximum( (-b - sq) / (2.0*a), 0.0 );
+    double t1 = osg::minimum( (-b + sq) / (2.0*a), 1.0 );
+    if ( t0 >= t1 )
+        return false;
+
+    osg::Vec3d worldStart = start + dir*t0;
+    osg::Vec3d worldEnd   = start + dir*t1;
+
+    osg::Vec3d mapStart, mapEnd;
+    srs->transformFromECEF( worldStart, mapStart );
+    srs->transformFromECEF( worldEnd, mapEnd );
+
+    // break the segment into pieces that are straight in map coordinates:
+    std::vector<osg::Vec3d> mapPoints;
+    mapPoints.push_back( mapStart );
+    subdivide( worldStart, worldEnd, mapStart, mapEnd, 0, mapPoints );
+
+    for( unsigned int i=0; i+1 < mapPoints.size(); ++i )
+    {
+        double t;
+        if ( intersectMapSegment(mapPoints[i], mapPoints[i+1], t) )
+        {
+            osg::Vec3d mapPoint = mapPoints[i] + (mapPoints[i+1] - mapPoints[i]) * t;
+            srs->transformToECEF( mapPoint, out_point );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+TerrainIntersector::intersect( const osg::Camera* camera, double x, double y, osg::Vec3d& out_point )
+{
+    if ( !camera )
+        return false;
+
+    osg::Matrixd matrix = camera->getViewMatrix() * camera->getProjectionMatrix();
+    if ( camera->getViewport() )
+        matrix.postMult( camera->getViewport()->computeWindowMatrix() );
+
+    osg::Matrixd inverse;
+    if ( !inverse.invert(matrix) )
+        return false;
+
+    // window depth runs 0..1 through the viewport, -1..1 in projection space.
+    double zNear = camera->getViewport() ? 0.0 : -1.0;
+    osg::Vec3d start = osg::Vec3d(x, y, zNear) * inverse;
+    osg::Vec3d end   = osg::Vec3d(x, y, 1.0) * inverse;
+
+    return intersect( start, end, out_point );
+}
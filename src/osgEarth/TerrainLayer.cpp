@@ -38,6 +38,7 @@ _minLevel( 0 ),
 _maxLevel( 99 ),
 _cacheEnabled( true ),
 _cacheOnly( false ),
+_cacheBlacklist( false ),
 _loadingWeight( 1.0f ),
 _exactCropping( false ),
 _enabled( true ),
@@ -65,6 +66,7 @@ TerrainLayerOptions::setDefaults()
     _reprojectedTileSize.init( 256 );
     _cacheEnabled.init( true );
     _cacheOnly.init( false );
+    _cacheBlacklist.init( false );
     _loadingWeight.init( 1.0f );
     _minLevel.init( 0 );
     _maxLevel.init( 99 );
@@ -84,6 +86,7 @@ TerrainLayerOptions::getConfig() const
     conf.updateIfSet( "cache_enabled", _cacheEnabled );
     conf.updateIfSet( "cache_only", _cacheOnly );
     conf.updateIfSet( "cache_format", _cacheFormat );
+    conf.updateIfSet( "cache_blacklist", _cacheBlacklist );
     conf.updateIfSet( "loading_weight", _loadingWeight );
     conf.updateIfSet( "enabled", _enabled );
     conf.updateIfSet( "edge_buffer_ratio", _edgeBufferRatio);
@@ -108,6 +111,7 @@ TerrainLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "cache_enabled", _cacheEnabled );
     conf.getIfSet( "cache_only", _cacheOnly );
     conf.getIfSet( "cache_format", _cacheFormat );
+    conf.getIfSet( "cache_blacklist", _cacheBlacklist );
     conf.getIfSet( "loading_weight", _loadingWeight );
     conf.getIfSet( "enabled", _enabled );
     conf.getIfSet( "edge_buffer_ratio", _edgeBufferRatio);
@@ -139,12 +143,22 @@ _tileSource( tileSource )
     init();
 }
 
+TerrainLayer::~TerrainLayer()
+{
+    // persist the tiles we learned are missing so the next session doesn't ask again
+    if ( _storeBlacklist && _tileSource.valid() && _cache.valid() && !_cacheSpec.cacheId().empty() )
+    {
+        _cache->storeBlacklist( _cacheSpec, _tileSource->getBlacklist() );
+    }
+}
+
 void
 TerrainLayer::init()
 {
     // Warning: don't access getTerrainLayerOptions() here, since it's a virtual function.
 
     _tileSourceInitialized = false;
+    _storeBlacklist        = false;
 
     _tileSize          = 256;
     _actualCacheFormat = "";
@@ -367,6 +381,19 @@ TerrainLayer::initTileSource()
     if ( _overrideCacheOnly.isSetTo( true ) )
         _actualCacheOnly = true;
 
+    // seed the tile source's blacklist with tiles found missing in earlier sessions
+    _storeBlacklist = getTerrainLayerOptions().cacheBlacklist() == true;
+    if ( _storeBlacklist && _tileSource.valid() && _cache.valid() && !_cacheSpec.cacheId().empty() )
+    {
+        osg::ref_ptr<TileBlacklist> stored = _cache->loadBlacklist( _cacheSpec );
+        if ( stored.valid() && stored->size() > 0 )
+        {
+            _tileSource->getBlacklist()->merge( *stored.get() );
+            OE_INFO << LC << "Loaded " << stored->size() << " blacklisted tiles for layer " 
+                << getName() << std::endl;
+        }
+    }
+
     _tileSourceInitialized = true;
 }
 
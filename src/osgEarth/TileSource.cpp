@@ -35,47 +35,157 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
-TileBlacklist::TileBlacklist()
+namespace
 {
-    //NOP
+    unsigned int
+    hashTileID( const osgTerrain::TileID& id )
+    {
+        unsigned int h = (unsigned int)id.level * 0x9E3779B1u;
+        h ^= (unsigned int)id.x + 0x7F4A7C15u + (h << 6) + (h >> 2);
+        h ^= (unsigned int)id.y + 0x165667B1u + (h << 6) + (h >> 2);
+
+        // final mix (from MurmurHash3) so that all the bits depend on all the inputs
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // second, odd hash for the double-hashing of bloom filter bits.
+    inline unsigned int
+    hashStep( unsigned int h )
+    {
+        return ((h >> 17) | (h << 15)) | 1u;
+    }
+}
+
+TileBlacklist::TileBlacklist() :
+_propagateToDescendants( false )
+{
+    for( unsigned i=0; i<BLOOM_WORDS; ++i )
+        _bloom[i] = 0u;
 }
 
 void
 TileBlacklist::add(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.insert(tile);
+    unsigned int h = hashTileID( tile );
+    Shard& shard = _shards[h % NUM_SHARDS];
+    {
+        Threading::ScopedWriteLock lock(shard._mutex);
+        shard._tiles.insert(tile);
+    }
+
+    // set the bloom bits after the insert, so a lookup that passes the filter will
+    // always find the tile in its shard.
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_bloomMutex);
+        unsigned int step = hashStep( h );
+        for( unsigned k=0; k<BLOOM_HASHES; ++k, h += step )
+        {
+            unsigned int bit = h & (BLOOM_BITS-1);
+            _bloom[bit >> 5] |= (1u << (bit & 31));
+        }
+    }
+
     OE_DEBUG << "Added " << tile.level << " (" << tile.x << ", " << tile.y << ") to blacklist" << std::endl;
 }
 
 void
 TileBlacklist::remove(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.erase(tile);
+    // bloom bits cannot be cleared for one tile; the shard lookup weeds out the stale ones.
+    Shard& shard = _shards[hashTileID(tile) % NUM_SHARDS];
+    Threading::ScopedWriteLock lock(shard._mutex);
+    shard._tiles.erase(tile);
     OE_DEBUG << "Removed " << tile.level << " (" << tile.x << ", " << tile.y << ") from blacklist" << std::endl;
 }
 
 void
 TileBlacklist::clear()
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.clear();
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_bloomMutex);
+        for( unsigned i=0; i<BLOOM_WORDS; ++i )
+            _bloom[i] = 0u;
+    }
+
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        Threading::ScopedWriteLock lock(_shards[i]._mutex);
+        _shards[i]._tiles.clear();
+    }
     OE_DEBUG << "Cleared blacklist" << std::endl;
 }
 
+void
+TileBlacklist::merge(const TileBlacklist& rhs)
+{
+    if ( &rhs == this )
+        return;
+
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        BlacklistedTiles tiles;
+        {
+            Threading::ScopedReadLock lock(const_cast<TileBlacklist&>(rhs)._shards[i]._mutex);
+            tiles = rhs._shards[i]._tiles;
+        }
+        for( BlacklistedTiles::const_iterator t = tiles.begin(); t != tiles.end(); ++t )
+            add( *t );
+    }
+}
+
+bool
+TileBlacklist::containsTile(const osgTerrain::TileID &tile) const
+{
+    unsigned int h = hashTileID( tile );
+    unsigned int step = hashStep( h );
+    unsigned int probe = h;
+    for( unsigned k=0; k<BLOOM_HASHES; ++k, probe += step )
+    {
+        unsigned int bit = probe & (BLOOM_BITS-1);
+        if ( (_bloom[bit >> 5] & (1u << (bit & 31))) == 0u )
+            return false;
+    }
+
+    const Shard& shard = _shards[h % NUM_SHARDS];
+    Threading::ScopedReadLock lock(const_cast<Shard&>(shard)._mutex);
+    return shard._tiles.find(tile) != shard._tiles.end();
+}
+
 bool
 TileBlacklist::contains(const osgTerrain::TileID &tile) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    return _tiles.find(tile) != _tiles.end();
+    if ( containsTile(tile) )
+        return true;
+
+    if ( _propagateToDescendants )
+    {
+        osgTerrain::TileID ancestor = tile;
+        while( ancestor.level > 0 )
+        {
+            ancestor = osgTerrain::TileID( ancestor.level-1, ancestor.x/2, ancestor.y/2 );
+            if ( containsTile(ancestor) )
+                return true;
+        }
+    }
+
+    return false;
 }
 
 unsigned int
 TileBlacklist::size() const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    return _tiles.size();
+    unsigned int total = 0;
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
+    {
+        Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_shards[i]._mutex);
+        total += _shards[i]._tiles.size();
+    }
+    return total;
 }
 
 TileBlacklist*
@@ -129,10 +239,14 @@ TileBlacklist::write(const std::string &filename) const
 void
 TileBlacklist::write(std::ostream &output) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    for (BlacklistedTiles::const_iterator itr = _tiles.begin(); itr != _tiles.end(); ++itr)
+    for( unsigned i=0; i<NUM_SHARDS; ++i )
     {
-        output << itr->level << " " << itr->x << " " << itr->y << std::endl;
+        Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_shards[i]._mutex);
+        const BlacklistedTiles& tiles = _shards[i]._tiles;
+        for (BlacklistedTiles::const_iterator itr = tiles.begin(); itr != tiles.end(); ++itr)
+        {
+            output << itr->level << " " << itr->x << " " << itr->y << std::endl;
+        }
     }
 }
 
@@ -172,6 +286,8 @@ _options( options )
         //Initialize the blacklist if we couldn't read it.
         _blacklist = new TileBlacklist();
     }
+
+    _blacklist->setPropagateToDescendants( *_options.blacklistDescendants() );
 }
 
 TileSource::~TileSource()
@@ -256,6 +372,135 @@ TileSource::createHeightField( const TileKey& key,
     return hf;
 }
 
+void
+TileSource::createImages(const std::vector<TileKey>& keys,
+                         std::vector< osg::ref_ptr<osg::Image> >& out_images,
+                         ImageOperation* prepOp,
+                         ProgressCallback* progress )
+{
+    out_images.clear();
+    out_images.resize( keys.size() );
+
+    // satisfy what we can from the memcache, and batch up the rest:
+    std::vector<TileKey> missingKeys;
+    std::vector<unsigned> missingSlots;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( _memCache.valid() )
+        {
+            osg::ref_ptr<const osg::Image> cachedImage;
+            if ( _memCache->getImage( keys[i], CacheSpec(), cachedImage ) )
+            {
+                out_images[i] = ImageUtils::cloneImage( cachedImage.get() );
+                continue;
+            }
+        }
+        missingKeys.push_back( keys[i] );
+        missingSlots.push_back( i );
+    }
+
+    if ( missingKeys.size() == 0 )
+        return;
+
+    std::vector< osg::ref_ptr<osg::Image> > newImages;
+    createImagesImpl( missingKeys, newImages, progress );
+
+    for( unsigned j=0; j<missingKeys.size() && j<newImages.size(); ++j )
+    {
+        osg::ref_ptr<osg::Image>& newImage = newImages[j];
+
+        if ( prepOp )
+            (*prepOp)( newImage );
+
+        if ( newImage.valid() && _memCache.valid() )
+            _memCache->setImage( missingKeys[j], CacheSpec(), newImage.get() );
+
+        out_images[ missingSlots[j] ] = newImage.get();
+    }
+}
+
+void
+TileSource::createHeightFields(const std::vector<TileKey>& keys,
+                               std::vector< osg::ref_ptr<osg::HeightField> >& out_hfs,
+                               HeightFieldOperation* prepOp,
+                               ProgressCallback* progress )
+{
+    out_hfs.clear();
+    out_hfs.resize( keys.size() );
+
+    std::vector<TileKey> missingKeys;
+    std::vector<unsigned> missingSlots;
+
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( _memCache.valid() )
+        {
+            osg::ref_ptr<const osg::HeightField> cachedHF;
+            if ( _memCache->getHeightField( keys[i], CacheSpec(), cachedHF ) )
+            {
+                out_hfs[i] = new osg::HeightField( *cachedHF.get() );
+                continue;
+            }
+        }
+        missingKeys.push_back( keys[i] );
+        missingSlots.push_back( i );
+    }
+
+    if ( missingKeys.size() == 0 )
+        return;
+
+    std::vector< osg::ref_ptr<osg::HeightField> > newHFs;
+    createHeightFieldsImpl( missingKeys, newHFs, progress );
+
+    for( unsigned j=0; j<missingKeys.size() && j<newHFs.size(); ++j )
+    {
+        osg::ref_ptr<osg::HeightField>& newHF = newHFs[j];
+
+        if ( prepOp )
+            (*prepOp)( newHF );
+
+        // the cached copy must stay untouched, so hand out a copy:
+        if ( newHF.valid() && _memCache.valid() )
+        {
+            _memCache->setHeightField( missingKeys[j], CacheSpec(), newHF.get() );
+            out_hfs[ missingSlots[j] ] = new osg::HeightField( *newHF.get() );
+        }
+        else
+        {
+            out_hfs[ missingSlots[j] ] = newHF.get();
+        }
+    }
+}
+
+void
+TileSource::createImagesImpl(const std::vector<TileKey>& keys,
+                             std::vector< osg::ref_ptr<osg::Image> >& out_images,
+                             ProgressCallback* progress )
+{
+    out_images.resize( keys.size() );
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            break;
+        out_images[i] = createImage( keys[i], progress );
+    }
+}
+
+void
+TileSource::createHeightFieldsImpl(const std::vector<TileKey>& keys,
+                                   std::vector< osg::ref_ptr<osg::HeightField> >& out_hfs,
+                                   ProgressCallback* progress )
+{
+    out_hfs.resize( keys.size() );
+    for( unsigned i=0; i<keys.size(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            break;
+        out_hfs[i] = createHeightField( keys[i], progress );
+    }
+}
+
 bool
 TileSource::isOK() const 
 {
@@ -147,6 +147,64 @@ VerticalSpatialReference::transform(const VerticalSpatialReference* toSRS,
     return true;
 }
 
+bool
+VerticalSpatialReference::transform(const VerticalSpatialReference* toSRS,
+                                    const GeoExtent& extent,
+                                    osg::HeightField* hf ) const
+{
+    if ( !hf || !toSRS )
+        return false;
+
+    if ( this->isEquivalentTo( toSRS ) )
+        return true;
+
+    double scale;
+    osg::ref_ptr<osg::HeightField> grid = createTransformHeightField(
+        toSRS, extent, hf->getNumColumns(), hf->getNumRows(), scale );
+
+    if ( !grid.valid() )
+        return false;
+
+    osg::HeightField::HeightList& heights = hf->getHeightList();
+    const osg::HeightField::HeightList& offsets = grid->getHeightList();
+    for( unsigned i=0; i<heights.size(); ++i )
+    {
+        if ( heights[i] != NO_DATA_VALUE )
+            heights[i] = heights[i]*scale + offsets[i];
+    }
+
+    return true;
+}
+
+osg::HeightField*
+VerticalSpatialReference::createTransformHeightField(const VerticalSpatialReference* toSRS,
+                                                     const GeoExtent& extent,
+                                                     int numCols, int numRows,
+                                                     double& out_scale ) const
+{
+    if ( !canTransform( toSRS ) )
+        return 0L;
+
+    if ( (_geoid.valid() && !_geoid->isValid()) || (toSRS->_geoid.valid() && !toSRS->_geoid->isValid()) )
+        return 0L;
+
+    // out_z = convert(z - fromOffset) + toOffset = z*scale - fromOffset*scale + toOffset
+    out_scale = Units::convert( getUnits(), toSRS->getUnits(), 1.0 );
+
+    osg::HeightField* grid = toSRS->createReferenceHeightField( extent, numCols, numRows );
+
+    if ( _geoid.valid() )
+    {
+        osg::ref_ptr<osg::HeightField> from = createReferenceHeightField( extent, numCols, numRows );
+        osg::HeightField::HeightList& offsets = grid->getHeightList();
+        const osg::HeightField::HeightList& fromOffsets = from->getHeightList();
+        for( unsigned i=0; i<offsets.size(); ++i )
+            offsets[i] -= fromOffsets[i] * out_scale;
+    }
+
+    return grid;
+}
+
 osg::HeightField*
 VerticalSpatialReference::createReferenceHeightField( const GeoExtent& ex, int numCols, int numRows ) const
 {
@@ -165,16 +223,7 @@ VerticalSpatialReference::createReferenceHeightField( const GeoExtent& ex, int n
         double lonInterval = geodeticExtent.width() / (double)(numCols-1);
         double latInterval = geodeticExtent.height() / (double)(numRows-1);
 
-        for( int r=0; r<numRows; ++r )
-        {            
-            double lat = latMin + latInterval*(double)r;
-            for( int c=0; c<numCols; ++c )
-            {
-                double lon = lonMin + lonInterval*(double)c;
-                double offset = _geoid->getOffset( lat, lon );
-                hf->setHeight( c, r, offset );
-            }
-        }
+        _geoid->getOffsets( latMin, lonMin, latInterval, lonInterval, hf );
     }
     else
     {
@@ -20,6 +20,7 @@
 
 #include <osgEarth/FileUtils>
 #include <osgEarth/TaskService>
+#include <osgEarth/RawImageCodec>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/ReaderWriter>
@@ -1114,8 +1115,16 @@ public: // Cache interface
         rec._tileSize = tileSize;
 
 #ifdef USE_SERIALIZERS
-        rec._format = "osgb";
-        rec._compressor = "zlib";
+        // raw images are already compressed and need no serializer
+        if ( spec.format() == RawImageCodec::extension() )
+        {
+            rec._format = spec.format();
+        }
+        else
+        {
+            rec._format = "osgb";
+            rec._compressor = "zlib";
+        }
 #else
         rec._format = spec.format();
 #endif
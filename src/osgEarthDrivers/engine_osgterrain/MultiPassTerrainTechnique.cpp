@@ -18,6 +18,7 @@
  */
 #include "MultiPassTerrainTechnique"
 #include "Terrain"
+#include "TerrainNormals"
 #include "TransparentLayer"
 #include <osgEarth/ImageUtils>
 
@@ -69,7 +70,8 @@ MultiPassTerrainTechnique::MultiPassTerrainTechnique( TextureCompositor* texComp
 TerrainTechnique(),
 //osgTerrain::TerrainTechnique(),
 _terrainTileInitialized(false),
-_texCompositor( texCompositor )
+_texCompositor( texCompositor ),
+_analyticNormals( false )
 {
     this->setThreadSafeRefUnref( true );
 }
@@ -79,6 +81,7 @@ TerrainTechnique(mt,copyop)
 {
     _terrainTileInitialized = mt._terrainTileInitialized;
     _texCompositor = mt._texCompositor.get();
+    _analyticNormals = mt._analyticNormals;
 }
 
 MultiPassTerrainTechnique::~MultiPassTerrainTechnique()
@@ -263,6 +266,11 @@ MultiPassTerrainTechnique::createGeometryPrototype(osgTerrain::Locator* masterLo
 
     typedef std::vector<int> Indices;
     Indices indices(numVertices, -1);
+
+    // with analytic normals, collect the post grid as we go and compute the normals
+    // from it in place of the smoothing pass.
+    bool analyticNormals = _analyticNormals && elevationLayer != 0L;
+    TerrainNormals terrainNormals( analyticNormals ? numColumns : 0u, analyticNormals ? numRows : 0u );
     
     // populate vertex and tex coord arrays
     unsigned int i, j;
@@ -296,6 +304,9 @@ MultiPassTerrainTechnique::createGeometryPrototype(osgTerrain::Locator* masterLo
 
                 (*vertices).push_back(model - centerModel);
 
+                if ( analyticNormals )
+                    terrainNormals.setPost( i, j, vertices->back() );
+
                 if (elevations.valid())
                 {
                     (*elevations).push_back(ndc.z());
@@ -398,7 +409,12 @@ MultiPassTerrainTechnique::createGeometryPrototype(osgTerrain::Locator* masterLo
     
     osg::ref_ptr<osg::Vec3Array> skirtVectors = new osg::Vec3Array((*normals));
     
-    if (elevationLayer)
+    if (analyticNormals)
+    {
+        terrainNormals.sampleNeighbors( _tile, elevationLayer, masterLocator, centerModel, i_sampleFactor, j_sampleFactor, scaleHeight );
+        terrainNormals.compute( indices, *normals );
+    }
+    else if (elevationLayer)
     {
         osgUtil::SmoothingVisitor smoother;
         smoother.smooth(*geometry);
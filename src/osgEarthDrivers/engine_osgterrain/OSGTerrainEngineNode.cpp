@@ -254,8 +254,11 @@ OSGTerrainEngineNode::onMapInfoEstablished( const MapInfo& mapInfo )
     }
     else
     {
-        _terrain = new StreamingTerrain(
+        StreamingTerrain* streamingTerrain = new StreamingTerrain(
             *_update_mapf, *_cull_mapf, _tileFactory.get(), *_terrainOptions.quickReleaseGLObjects() );
+
+        streamingTerrain->setPrefetchTime( _terrainOptions.prefetchTime().value() );
+        _terrain = streamingTerrain;
     }
 
     this->addChild( _terrain );
@@ -263,6 +266,7 @@ OSGTerrainEngineNode::onMapInfoEstablished( const MapInfo& mapInfo )
     // set the initial properties from the options structure:
     _terrain->setVerticalScale( _terrainOptions.verticalScale().value() );
     _terrain->setSampleRatio  ( _terrainOptions.heightFieldSampleRatio().value() );
+    _terrain->setEventDrivenUpdates( _terrainOptions.eventDrivenUpdates().value() );
 
     OE_INFO << LC << "Sample ratio = " << _terrainOptions.heightFieldSampleRatio().value() << std::endl;
 
@@ -270,18 +274,22 @@ OSGTerrainEngineNode::onMapInfoEstablished( const MapInfo& mapInfo )
 
     if ( _texCompositor->getTechnique() == TerrainOptions::COMPOSITING_MULTIPASS )
     {
-        _terrain->setTechniquePrototype( new MultiPassTerrainTechnique( _texCompositor.get() ) );
+        MultiPassTerrainTechnique* tech = new MultiPassTerrainTechnique( _texCompositor.get() );
+        tech->setAnalyticNormals( _terrainOptions.analyticNormals().value() );
+        _terrain->setTechniquePrototype( tech );
         OE_INFO << LC << "Compositing technique = MULTIPASS" << std::endl;
     }
 
     else 
     {
-        CustomTerrainTechnique* tech = new SinglePassTerrainTechnique( _texCompositor.get() );
+        SinglePassTerrainTechnique* tech = new SinglePassTerrainTechnique( _texCompositor.get() );
 
         // prepare the interpolation technique for generating triangles:
         if ( _terrainOptions.elevationInterpolation() == INTERP_TRIANGULATE )
             tech->setOptimizeTriangleOrientation( false );
 
+        tech->setAnalyticNormals( _terrainOptions.analyticNormals().value() );
+
         _terrain->setTechniquePrototype( tech );
     }
 
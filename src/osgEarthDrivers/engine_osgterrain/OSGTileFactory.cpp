@@ -122,26 +122,26 @@ OSGTileFactory::getTransformFromExtents(double minX, double minY, double maxX, d
 osg::Node*
 OSGTileFactory::createSubTiles( const MapFrame& mapf, Terrain* terrain, const TileKey& key, bool populateLayers )
 {
-    TileKey k0 = key.createChildKey(0);
-    TileKey k1 = key.createChildKey(1);
-    TileKey k2 = key.createChildKey(2);
-    TileKey k3 = key.createChildKey(3);
+    std::vector<TileKey> keys(4);
+    for( unsigned q = 0; q < 4; ++q )
+        keys[q] = key.createChildKey(q);
+
+    // fetch the data for all four quadrants at once, so each layer sees a single
+    // request for the sibling set instead of four.
+    std::vector<PrefetchedTileData> data;
+    if ( populateLayers )
+        prefetchTiles( mapf, keys, data );
 
     bool hasValidData = false;
     bool validData;
 
     bool fallback = false;
-    osg::ref_ptr<osg::Node> q0 = createTile( mapf, terrain, k0, populateLayers, true, fallback, validData);
-    if (!hasValidData && validData) hasValidData = true;
-
-    osg::ref_ptr<osg::Node> q1 = createTile( mapf, terrain, k1, populateLayers, true, fallback, validData );
-    if (!hasValidData && validData) hasValidData = true;
-
-    osg::ref_ptr<osg::Node> q2 = createTile( mapf, terrain, k2, populateLayers, true, fallback, validData );
-    if (!hasValidData && validData) hasValidData = true;
-
-    osg::ref_ptr<osg::Node> q3 = createTile( mapf, terrain, k3, populateLayers, true, fallback, validData );
-    if (!hasValidData && validData) hasValidData = true;
+    osg::ref_ptr<osg::Node> q[4];
+    for( unsigned i = 0; i < 4; ++i )
+    {
+        q[i] = createTile( mapf, terrain, keys[i], populateLayers, true, fallback, validData, populateLayers ? &data[i] : 0L );
+        if (!hasValidData && validData) hasValidData = true;
+    }
 
     if (!hasValidData)
     {
@@ -153,31 +153,62 @@ OSGTileFactory::createSubTiles( const MapFrame& mapf, Terrain* terrain, const Ti
 
     fallback = true;
     //Fallback on tiles if we couldn't create any
-    if (!q0.valid())
+    for( unsigned i = 0; i < 4; ++i )
     {
-        q0 = createTile( mapf, terrain, k0, populateLayers, true, fallback, validData);
+        if (!q[i].valid())
+        {
+            q[i] = createTile( mapf, terrain, keys[i], populateLayers, true, fallback, validData, populateLayers ? &data[i] : 0L );
+        }
     }
 
-    if (!q1.valid())
-    {
-        q1 = createTile( mapf, terrain, k1, populateLayers, true, fallback, validData);
-    }
+    for( unsigned i = 0; i < 4; ++i )
+        tile_parent->addChild( q[i].get() );
+
+    return tile_parent;
+}
+
+void
+OSGTileFactory::prefetchTiles(const MapFrame&                  mapf,
+                              const std::vector<TileKey>&      keys,
+                              std::vector<PrefetchedTileData>& out_data )
+{
+    out_data.clear();
+    out_data.resize( keys.size() );
 
-    if (!q2.valid())
+    for( unsigned k = 0; k < keys.size(); ++k )
+        out_data[k]._images.resize( mapf.imageLayers().size(), GeoImage::INVALID );
+
+    for( unsigned i = 0; i < mapf.imageLayers().size(); ++i )
     {
-        q2 = createTile( mapf, terrain, k2, populateLayers, true, fallback, validData);
-    }
+        ImageLayer* layer = mapf.getImageLayerAt(i);
 
-    if (!q3.valid())
-    {        
-        q3 = createTile( mapf, terrain, k3, populateLayers, true, fallback, validData);
+        std::vector<TileKey> validKeys;
+        std::vector<unsigned> slots;
+        for( unsigned k = 0; k < keys.size(); ++k )
+        {
+            if ( layer->isKeyValid( keys[k] ) )
+            {
+                validKeys.push_back( keys[k] );
+                slots.push_back( k );
+            }
+        }
+
+        if ( validKeys.size() > 0 )
+        {
+            std::vector<GeoImage> images;
+            layer->createImages( validKeys, images );
+            for( unsigned j = 0; j < images.size(); ++j )
+                out_data[ slots[j] ]._images[i] = images[j];
+        }
     }
 
-    tile_parent->addChild( q0.get() );
-    tile_parent->addChild( q1.get() );
-    tile_parent->addChild( q2.get() );
-    tile_parent->addChild( q3.get() );
-    return tile_parent;
+    if ( mapf.elevationLayers().size() > 0 )
+    {
+        std::vector< osg::ref_ptr<osg::HeightField> > hfs;
+        mapf.getHeightFields( keys, false, hfs, _terrainOptions.elevationInterpolation().value() );
+        for( unsigned k = 0; k < keys.size() && k < hfs.size(); ++k )
+            out_data[k]._hf = hfs[k].get();
+    }
 }
 
 bool
@@ -362,11 +393,12 @@ OSGTileFactory::createTile(const MapFrame&  mapf,
                            bool             populateLayers, 
                            bool             wrapInPagedLOD, 
                            bool             fallback,
-                           bool&            out_validData )
+                           bool&            out_validData,
+                           const PrefetchedTileData* prefetched )
 {
     if ( populateLayers )
     {        
-        return createPopulatedTile( mapf, terrain, key, wrapInPagedLOD, fallback, out_validData);
+        return createPopulatedTile( mapf, terrain, key, wrapInPagedLOD, fallback, out_validData, prefetched );
     }
     else
     {
@@ -529,7 +561,8 @@ OSGTileFactory::createPopulatedTile(const MapFrame&  mapf,
                                     const TileKey&   key, 
                                     bool             wrapInPagedLOD, 
                                     bool             fallback, 
-                                    bool&            validData )
+                                    bool&            validData,
+                                    const PrefetchedTileData* prefetched )
 {
     const MapInfo& mapInfo = mapf.getMapInfo();
     bool isPlateCarre = !mapInfo.isGeocentric() && mapInfo.isGeographicSRS();
@@ -549,7 +582,9 @@ OSGTileFactory::createPopulatedTile(const MapFrame&  mapf,
         // Only try to create images if the key is valid
         if ( layer->isKeyValid( key ) )
         {
-            imageData._image = layer->createImage( key );
+            imageData._image = prefetched ?
+                prefetched->_images[ i - mapf.imageLayers().begin() ] :
+                layer->createImage( key );
             imageData._layerUID = layer->getUID();
             imageData._imageTileKey = key;
         }
@@ -563,7 +598,11 @@ OSGTileFactory::createPopulatedTile(const MapFrame&  mapf,
 
     //Create the heightfield for the tile
     osg::ref_ptr<osg::HeightField> hf;
-    if ( mapf.elevationLayers().size() > 0 )
+    if ( prefetched )
+    {
+        hf = prefetched->_hf.get();
+    }
+    else if ( mapf.elevationLayers().size() > 0 )
     {
         mapf.getHeightField( key, false, hf, 0L, _terrainOptions.elevationInterpolation().value());     
     }
@@ -18,6 +18,7 @@
  */
 #include "SinglePassTerrainTechnique"
 #include "Terrain"
+#include "TerrainNormals"
 #include "Tile"
 
 #include <osgEarth/Cube>
@@ -72,6 +73,7 @@ _initCount(0),
 _pendingFullUpdate( false ),
 _pendingGeometryUpdate(false),
 _optimizeTriangleOrientation(true),
+_analyticNormals(false),
 _texCompositor( compositor ),
 _frontGeodeInstalled( false ),
 _debug( false )
@@ -86,6 +88,7 @@ _initCount( 0 ),
 _pendingFullUpdate( false ),
 _pendingGeometryUpdate( false ),
 _optimizeTriangleOrientation( rhs._optimizeTriangleOrientation ),
+_analyticNormals( rhs._analyticNormals ),
 _texCompositor( rhs._texCompositor.get() ),
 _frontGeodeInstalled( rhs._frontGeodeInstalled ),
 _debug( rhs._debug ),
@@ -123,6 +126,18 @@ SinglePassTerrainTechnique::getOptimizeTriangleOrientation() const
     return _optimizeTriangleOrientation;
 }
 
+void
+SinglePassTerrainTechnique::setAnalyticNormals(bool value)
+{
+    _analyticNormals = value;
+}
+
+bool
+SinglePassTerrainTechnique::getAnalyticNormals() const
+{
+    return _analyticNormals;
+}
+
 void 
 SinglePassTerrainTechnique::init()
 {
@@ -175,11 +190,7 @@ SinglePassTerrainTechnique::compile( const TileUpdate& update, ProgressCallback*
         // TODO: optimize this with a method that ONLY regenerates the texture coordinates.
         if ( !_texCompositor->requiresUnitTextureSpace() )
         {
-            osg::ref_ptr<osg::StateSet> stateSet = _backGeode.valid() ? _backGeode->getStateSet() : 0L;
-            _backGeode = createGeometry( tilef );
-            _backGeode->setStateSet( stateSet.get() );
-
-            _pendingGeometryUpdate = true;
+            prepareGeometryUpdate( tilef );
         }
     }
 
@@ -192,11 +203,7 @@ SinglePassTerrainTechnique::compile( const TileUpdate& update, ProgressCallback*
     // multitexture mode (white tiles show up). Need to investigate and fix.
     else if ( partialUpdateOK && update.getAction() == TileUpdate::UPDATE_ELEVATION )
     {
-        osg::ref_ptr<osg::StateSet> stateSet = _backGeode.valid() ? _backGeode->getStateSet() : 0L;
-        _backGeode = createGeometry( tilef );
-        _backGeode->setStateSet( stateSet.get() );
-
-        _pendingGeometryUpdate = true;
+        prepareGeometryUpdate( tilef );
     }
 
     else // all other update types
@@ -248,9 +255,42 @@ SinglePassTerrainTechnique::compile( const TileUpdate& update, ProgressCallback*
     }
 }
 
+// Builds a complete replacement geode for a geometry-only update. This runs with the
+// compile mutex held, usually in a worker thread.
+void
+SinglePassTerrainTechnique::prepareGeometryUpdate( const TileFrame& tilef )
+{
+    // share the stateset the new geode will replace: the pending full update's if there
+    // is one, otherwise the live one.
+    osg::Geode* frontGeode = getFrontGeode();
+    osg::ref_ptr<osg::StateSet> stateSet =
+        _pendingFullUpdate && _backGeode.valid() ? _backGeode->getStateSet() :
+        frontGeode ? frontGeode->getStateSet() :
+        0L;
+
+    _backGeode = createGeometry( tilef );
+    _backGeode->setStateSet( stateSet.get() );
+
+    _pendingGeometryUpdate = true;
+}
+
 // from the UPDATE traversal thread:
 bool
 SinglePassTerrainTechnique::applyTileUpdates()
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    bool applied = applyTileUpdatesImpl();
+
+    osg::ref_ptr<Terrain> terrain = _tile ? _tile->getTerrain() : 0L;
+    if ( terrain.valid() )
+        terrain->reportApplyTileUpdates( osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() ), applied );
+
+    return applied;
+}
+
+bool
+SinglePassTerrainTechnique::applyTileUpdatesImpl()
 {
     bool applied = false;
 
@@ -276,59 +316,19 @@ SinglePassTerrainTechnique::applyTileUpdates()
         // process any pending LIVE geometry updates:
         if ( _pendingGeometryUpdate )
         {
-            osg::Geode* frontGeode = getFrontGeode();
-
-            if (frontGeode)
+            if ( _backGeode->getStateSet() )
             {
-
-                if ( _texCompositor->requiresUnitTextureSpace() )
-                {
-                    // in "unit-texture-space" mode, we can take the shortcut of just updating
-                    // the geometry VBOs. The texture coordinates never change.
-                    for( unsigned int i=0; i<_backGeode->getNumDrawables(); ++i )
-                    {
-                        osg::Geometry* backGeom = static_cast<osg::Geometry*>( _backGeode->getDrawable(i) );
-                        osg::Vec3Array* backVerts = static_cast<osg::Vec3Array*>( backGeom->getVertexArray() );
-
-                        osg::Geometry* frontGeom = static_cast<osg::Geometry*>( frontGeode->getDrawable(i) );
-                        osg::Vec3Array* frontVerts = static_cast<osg::Vec3Array*>( frontGeom->getVertexArray() );
-
-                        if ( backVerts->size() == frontVerts->size() )
-                        {
-                            // simple VBO update:
-                            std::copy( backVerts->begin(), backVerts->end(), frontVerts->begin() );
-                            frontVerts->dirty();
-
-                            osg::Vec3Array* backNormals = static_cast<osg::Vec3Array*>( backGeom->getNormalArray() );
-                            if ( backNormals )
-                            {
-                                osg::Vec3Array* frontNormals = static_cast<osg::Vec3Array*>( frontGeom->getNormalArray() );
-                                std::copy( backNormals->begin(), backNormals->end(), frontNormals->begin() );
-                                frontNormals->dirty();
-                            }
-
-                            osg::Vec2Array* backTexCoords = static_cast<osg::Vec2Array*>( backGeom->getTexCoordArray(0) );
-                            if ( backTexCoords )
-                            {
-                                osg::Vec2Array* frontTexCoords = static_cast<osg::Vec2Array*>( frontGeom->getTexCoordArray(0) );
-                                std::copy( backTexCoords->begin(), backTexCoords->end(), frontTexCoords->begin() );
-                                frontTexCoords->dirty();
-                            }
-                        }
-                        else
-                        {
-                            frontGeom->setVertexArray( backVerts );
-                            frontGeom->setTexCoordArray( 0, backGeom->getTexCoordArray( 0 ) ); // TODO: un-hard-code
-                            if ( backGeom->getNormalArray() )
-                                frontGeom->setNormalArray( backGeom->getNormalArray() );
-                        }
-                    }
-                }
-                else
+                // the back geode was built complete, sharing the live stateset (and therefore
+                // the live textures), so installing it is a simple swap.
+                _transform->setChild( 0, _backGeode.get() );
+            }
+            else
+            {
+                // no stateset to share; move the new drawables into the front geode instead so
+                // that we keep its textures.
+                osg::Geode* frontGeode = getFrontGeode();
+                if ( frontGeode )
                 {
-                    // copy the drawables from the back buffer to the front buffer. By doing this,
-                    // we don't touch the front geode's stateset (which contains the textures) and
-                    // therefore they don't get re-applied.
                     for( unsigned int i=0; i<_backGeode->getNumDrawables(); ++i )
                     {
                         frontGeode->setDrawable( i, _backGeode->getDrawable( i ) );
@@ -546,6 +546,100 @@ namespace
     };
 
     typedef std::vector< RenderLayer > RenderLayerVector;
+
+    /**
+     * Index data for a full (unmasked, hole-free) tile grid. Every such tile with
+     * the same grid size and orientation has identical topology, so they all share
+     * these primitive sets and only generate their own vertex arrays.
+     */
+    struct GridTopology : public osg::Referenced
+    {
+        osg::Geometry::PrimitiveSetList _surface;
+        osg::Geometry::PrimitiveSetList _skirt;
+    };
+
+    class GridTopologyCache
+    {
+    public:
+        GridTopology* get( unsigned numColumns, unsigned numRows, bool swapOrientation )
+        {
+            Key key( numColumns, numRows, swapOrientation );
+
+            Threading::ScopedMutexLock lock( _mutex );
+
+            osg::ref_ptr<GridTopology>& topology = _table[key];
+            if ( !topology.valid() )
+                topology = build( numColumns, numRows, swapOrientation );
+            return topology.get();
+        }
+
+    private:
+        // Builds the same triangles and skirt strip that createGeometry builds for a full
+        // grid, consolidated the same way.
+        static GridTopology* build( unsigned numColumns, unsigned numRows, bool swapOrientation )
+        {
+            GridTopology* topology = new GridTopology();
+
+            osg::ref_ptr<osg::Geometry> surface = new osg::Geometry();
+            surface->setVertexArray( new osg::Vec3Array( numColumns*numRows ) );
+
+            osg::DrawElementsUInt* elements = new osg::DrawElementsUInt( GL_TRIANGLES );
+            elements->reserve( (numRows-1) * (numColumns-1) * 6 );
+
+            for( unsigned j=0; j<numRows-1; ++j )
+            {
+                for( unsigned i=0; i<numColumns-1; ++i )
+                {
+                    unsigned i00 = swapOrientation ? (j+1)*numColumns + i : j*numColumns + i;
+                    unsigned i01 = swapOrientation ? j*numColumns + i     : (j+1)*numColumns + i;
+                    unsigned i10 = i00+1;
+                    unsigned i11 = i01+1;
+
+                    elements->push_back(i01);
+                    elements->push_back(i00);
+                    elements->push_back(i11);
+
+                    elements->push_back(i00);
+                    elements->push_back(i10);
+                    elements->push_back(i11);
+                }
+            }
+
+            surface->addPrimitiveSet( elements );
+            MeshConsolidator::run( *surface );
+            topology->_surface = surface->getPrimitiveSetList();
+
+            // the skirt is one strip around the tile: bottom, right, top, then left
+            // (which closes the loop), with two verts per edge post.
+            unsigned numSkirtVerts = 2 * ( 2*(numColumns-1) + 2*(numRows-1) + 1 );
+
+            osg::ref_ptr<osg::Geometry> skirt = new osg::Geometry();
+            skirt->setVertexArray( new osg::Vec3Array( numSkirtVerts ) );
+            skirt->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLE_STRIP, 0, numSkirtVerts ) );
+            MeshConsolidator::run( *skirt );
+            topology->_skirt = skirt->getPrimitiveSetList();
+
+            return topology;
+        }
+
+        struct Key
+        {
+            Key( unsigned cols, unsigned rows, bool swap ) : _cols(cols), _rows(rows), _swap(swap) { }
+            bool operator < ( const Key& rhs ) const {
+                if ( _cols != rhs._cols ) return _cols < rhs._cols;
+                if ( _rows != rhs._rows ) return _rows < rhs._rows;
+                return _swap < rhs._swap;
+            }
+            unsigned _cols, _rows;
+            bool     _swap;
+        };
+
+        typedef std::map< Key, osg::ref_ptr<GridTopology> > Table;
+        Table            _table;
+        Threading::Mutex _mutex;
+    };
+
+    GridTopologyCache s_gridTopologyCache;
 }
 
 osg::Geode*
@@ -817,6 +911,11 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
     typedef std::vector<int> Indices;
     Indices indices(numVerticesInSurface, -1);    
 
+    // with analytic normals, collect the post grid as we go and compute the normals from it
+    // once all the posts are in.
+    bool analyticNormals = _analyticNormals && elevationLayer != NULL;
+    TerrainNormals terrainNormals( analyticNormals ? numColumns : 0u, analyticNormals ? numRows : 0u );
+
     // populate vertex and tex coord arrays    
     unsigned int i, j; //, k=0;
     for(j=0; j<numRows; ++j)
@@ -865,6 +964,9 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
                 //(*surfaceVerts)[k] = model - centerModel;
                 (*surfaceVerts).push_back(model - _centerModel);
 
+                if ( analyticNormals )
+                    terrainNormals.setPost( i, j, surfaceVerts->back() );
+
                 if ( _texCompositor->requiresUnitTextureSpace() )
                 {
                     // the unified unit texture space requires a single, untransformed unit coord [0..1]
@@ -1358,10 +1460,28 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
     // populate primitive sets
     bool swapOrientation = !(_masterLocator->orientationOpenGL());
 
-    osg::ref_ptr<osg::DrawElementsUInt> elements = new osg::DrawElementsUInt(GL_TRIANGLES);
-    elements->reserve((numRows-1) * (numColumns-1) * 6);
+    // A tile with no masks and no missing posts has the same topology as every other such
+    // tile of its size, so it takes its index data from the shared cache instead of building
+    // its own. (With triangle orientation optimization on, the triangulation depends on the
+    // elevation data, so it can't be shared.)
+    osg::ref_ptr<GridTopology> topology;
+    if ( masks.size() == 0 && surfaceVerts->size() == numVerticesInSurface && !_optimizeTriangleOrientation )
+    {
+        topology = s_gridTopologyCache.get( numColumns, numRows, swapOrientation );
+    }
 
-    surface->addPrimitiveSet(elements.get());
+    osg::ref_ptr<osg::DrawElementsUInt> elements;
+    if ( topology.valid() )
+    {
+        for( osg::Geometry::PrimitiveSetList::const_iterator p = topology->_surface.begin(); p != topology->_surface.end(); ++p )
+            surface->addPrimitiveSet( p->get() );
+    }
+    else
+    {
+        elements = new osg::DrawElementsUInt(GL_TRIANGLES);
+        elements->reserve((numRows-1) * (numColumns-1) * 6);
+        surface->addPrimitiveSet(elements.get());
+    }
     
     osg::ref_ptr<osg::Vec3Array> skirtVectors = new osg::Vec3Array( *normals );
     
@@ -1509,14 +1629,23 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
 
         skirt->setVertexArray( skirtVerts );
 
-        //Add a primative set for each continuous skirt strip
-        skirtBreaks.push_back(skirtVerts->size());
-        for (int p=1; p < skirtBreaks.size(); p++)
-          skirt->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLE_STRIP, skirtBreaks[p-1], skirtBreaks[p] - skirtBreaks[p-1] ) );
+        if ( topology.valid() )
+        {
+            // a full grid's skirt is one unbroken strip, which the cache has already.
+            for( osg::Geometry::PrimitiveSetList::const_iterator p = topology->_skirt.begin(); p != topology->_skirt.end(); ++p )
+                skirt->addPrimitiveSet( p->get() );
+        }
+        else
+        {
+            //Add a primative set for each continuous skirt strip
+            skirtBreaks.push_back(skirtVerts->size());
+            for (int p=1; p < skirtBreaks.size(); p++)
+              skirt->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLE_STRIP, skirtBreaks[p-1], skirtBreaks[p] - skirtBreaks[p-1] ) );
+        }
     }
 
 
-    bool recalcNormals = elevationLayer != NULL;
+    bool recalcNormals = elevationLayer != NULL && !analyticNormals;
 
     //Clear out the normals
     if (recalcNormals)
@@ -1592,13 +1721,16 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
 
                 if (!_optimizeTriangleOrientation || (e00-e11)<fabsf(e01-e10))
                 {
-                    elements->push_back(i01);
-                    elements->push_back(i00);
-                    elements->push_back(i11);
+                    if (elements.valid())
+                    {
+                        elements->push_back(i01);
+                        elements->push_back(i00);
+                        elements->push_back(i11);
 
-                    elements->push_back(i00);
-                    elements->push_back(i10);
-                    elements->push_back(i11);
+                        elements->push_back(i00);
+                        elements->push_back(i10);
+                        elements->push_back(i11);
+                    }
 
                     if (recalcNormals)
                     {                        
@@ -1615,13 +1747,16 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
                 }
                 else
                 {
-                    elements->push_back(i01);
-                    elements->push_back(i00);
-                    elements->push_back(i10);
+                    if (elements.valid())
+                    {
+                        elements->push_back(i01);
+                        elements->push_back(i00);
+                        elements->push_back(i10);
 
-                    elements->push_back(i01);
-                    elements->push_back(i10);
-                    elements->push_back(i11);
+                        elements->push_back(i01);
+                        elements->push_back(i10);
+                        elements->push_back(i11);
+                    }
 
                     if (recalcNormals)
                     {                       
@@ -1693,10 +1828,20 @@ SinglePassTerrainTechnique::createGeometry( const TileFrame& tilef )
         }
     }
 
-    MeshConsolidator::run( *surface );
+    if (analyticNormals)
+    {
+        terrainNormals.sampleNeighbors( _tile, elevationLayer, _masterLocator.get(), _centerModel, i_sampleFactor, j_sampleFactor, scaleHeight );
+        terrainNormals.compute( indices, *normals );
+    }
 
-    if ( skirt )
-        MeshConsolidator::run( *skirt );
+    // shared topology is already consolidated.
+    if ( !topology.valid() )
+    {
+        MeshConsolidator::run( *surface );
+
+        if ( skirt )
+            MeshConsolidator::run( *skirt );
+    }
 
     for (MaskRecordVector::iterator mr = masks.begin(); mr != masks.end(); ++mr)
         MeshConsolidator::run( *((*mr)._geom) );
@@ -28,6 +28,7 @@
 #include <osg/NodeVisitor>
 #include <osg/Node>
 #include <osgGA/EventVisitor>
+#include <osgUtil/CullVisitor>
 
 #include <OpenThreads/ScopedLock>
 
@@ -60,6 +61,48 @@ StreamingTerrain::~StreamingTerrain()
     //nop
 }
 
+void
+StreamingTerrain::setPrefetchTime( double seconds )
+{
+    if ( seconds > 0.0 )
+    {
+        if ( !_prefetcher.valid() )
+            _prefetcher = new TilePrefetcher( this, seconds );
+        else
+            _prefetcher->setLookAheadTime( seconds );
+    }
+    else if ( _prefetcher.valid() )
+    {
+        _prefetcher->clear();
+        _prefetcher = 0L;
+    }
+}
+
+double
+StreamingTerrain::getPrefetchTime() const
+{
+    return _prefetcher.valid() ? _prefetcher->getLookAheadTime() : 0.0;
+}
+
+void
+StreamingTerrain::traverse( osg::NodeVisitor& nv )
+{
+    // the prefetcher follows the camera by way of the eye point it culls from. (Take
+    // it from the double-precision modelview; the visitor's own eye point is single
+    // precision, which is too coarse for velocities in geocentric coordinates.)
+    if ( _prefetcher.valid() && nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR && nv.getFrameStamp() )
+    {
+        osgUtil::CullVisitor* cv = static_cast<osgUtil::CullVisitor*>( &nv );
+        if ( cv->getModelViewMatrix() )
+        {
+            osg::Matrixd viewInverse = osg::Matrixd::inverse( *cv->getModelViewMatrix() );
+            _prefetcher->recordEyePoint( viewInverse.getTrans(), nv.getFrameStamp() );
+        }
+    }
+
+    Terrain::traverse( nv );
+}
+
 Tile*
 StreamingTerrain::createTile(const TileKey& key, GeoLocator* locator) const
 {
@@ -192,6 +235,50 @@ StreamingTerrain::refreshFamily(const MapInfo&           mapInfo,
     }
 }
 
+void
+StreamingTerrain::getDependentTileIDs(const MapInfo&                  mapInfo,
+                                      const osgTerrain::TileID&        tileId,
+                                      std::vector<osgTerrain::TileID>& out_ids ) const
+{
+    out_ids.clear();
+    out_ids.push_back( tileId );
+
+    // same rules as refreshFamily(): neighbors wrap around in X on a geocentric map.
+    bool wrapX = mapInfo.isGeocentric();
+    unsigned int tileCountX, tileCountY;
+    mapInfo.getProfile()->getNumTiles( tileId.level, tileCountX, tileCountY );
+
+    if ( tileId.x > 0 || wrapX )
+        out_ids.push_back( osgTerrain::TileID( tileId.level, tileId.x > 0? tileId.x-1 : tileCountX-1, tileId.y ) );
+
+    if ( tileId.x < (int)tileCountX-1 || wrapX )
+        out_ids.push_back( osgTerrain::TileID( tileId.level, tileId.x < (int)tileCountX-1 ? tileId.x+1 : 0, tileId.y ) );
+
+    if ( tileId.y < (int)tileCountY-1 )
+        out_ids.push_back( osgTerrain::TileID( tileId.level, tileId.x, tileId.y+1 ) );
+
+    if ( tileId.y > 0 )
+        out_ids.push_back( osgTerrain::TileID( tileId.level, tileId.x, tileId.y-1 ) );
+
+    // the children list this tile as their parent.
+    for( int c = 0; c < 4; ++c )
+        out_ids.push_back( osgTerrain::TileID( tileId.level+1, tileId.x*2 + (c & 1), tileId.y*2 + (c >> 1) ) );
+}
+
+void
+StreamingTerrain::notifyTileDirty( const osgTerrain::TileID& tileId )
+{
+    Threading::ScopedMutexLock lock( _tileEventsMutex );
+    _dirtyTiles.insert( tileId );
+}
+
+void
+StreamingTerrain::notifyTileChanged( const osgTerrain::TileID& tileId )
+{
+    Threading::ScopedMutexLock lock( _tileEventsMutex );
+    _changedTiles.insert( tileId );
+}
+
 unsigned
 StreamingTerrain::getNumActiveTasks() const
 {
@@ -222,8 +309,66 @@ StreamingTerrain::updateTraversal( osg::NodeVisitor& nv )
         }
     }
 
+    // load data for the tiles along the predicted camera path:
+    if ( _prefetcher.valid() )
+    {
+        _prefetcher->update( _update_mapf, stamp );
+    }
+
+    if ( getEventDrivenUpdates() )
+    {
+        // only visit the tiles that reported something since the last frame.
+        TileIDSet dirty, changed;
+        {
+            Threading::ScopedMutexLock lock( _tileEventsMutex );
+            dirty.swap( _dirtyTiles );
+            changed.swap( _changedTiles );
+        }
+
+        if ( dirty.size() == 0 && changed.size() == 0 )
+            return;
+
+        const MapInfo& mapInfo = _update_mapf.getMapInfo();
+
+        Threading::ScopedReadLock tileTableReadLock( _tilesMutex );
+
+        // a changed tile shows up in the family of its neighbors and its children. Refresh
+        // those families, and service those tiles since they may now be ready to load.
+        std::vector<osgTerrain::TileID> dependents;
+        for( TileIDSet::const_iterator i = changed.begin(); i != changed.end(); ++i )
+        {
+            getDependentTileIDs( mapInfo, *i, dependents );
+            for( std::vector<osgTerrain::TileID>::const_iterator d = dependents.begin(); d != dependents.end(); ++d )
+            {
+                osg::ref_ptr<StreamingTile> tile;
+                getTile( *d, tile, false );
+                if ( tile.valid() )
+                {
+                    refreshFamily( mapInfo, tile->getKey(), tile->getFamily(), true );
+                    dirty.insert( *d );
+                }
+            }
+        }
+
+        for( TileIDSet::const_iterator i = dirty.begin(); i != dirty.end(); ++i )
+        {
+            osg::ref_ptr<StreamingTile> tile;
+            getTile( *i, tile, false );
+            if ( tile.valid() )
+            {
+                tile->servicePendingElevationRequests( _update_mapf, stamp, true );
+                tile->serviceCompletedRequests( _update_mapf, true );
+
+                // requests that went back to idle while servicing go out on the next frame.
+                if ( tile->hasIdleElevationRequest() )
+                    notifyTileDirty( *i );
+            }
+        }
+    }
+
     // next, go through the live tiles and process update-traversal requests. This
     // requires a read-lock on the master tiles table.
+    else
     {
         Threading::ScopedReadLock tileTableReadLock( _tilesMutex );
 
@@ -315,6 +460,12 @@ StreamingTerrain::getTileGenerationTaskSerivce()
 void
 StreamingTerrain::updateTaskServiceThreads( const MapFrame& mapf )
 {
+    // prefetched data may belong to layers that are gone or changed:
+    if ( _prefetcher.valid() )
+    {
+        _prefetcher->clear();
+    }
+
     //Get the maximum elevation weight
     float elevationWeight = 0.0f;
     for (ElevationLayerVector::const_iterator itr = mapf.elevationLayers().begin(); itr != mapf.elevationLayers().end(); ++itr)
@@ -43,15 +43,38 @@ using namespace OpenThreads;
 
 namespace
 {
+    // this progress callback reports the tile to its terrain when the request
+    // completes, so that in event-driven mode the terrain only services tiles that
+    // actually have something to do. It runs in the task service thread.
+    struct TileProgressCallback : ProgressCallback
+    {
+        TileProgressCallback(StreamingTile* tile) :
+          _terrain(tile->getStreamingTerrain()),
+          _tileId(tile->getTileId())
+        {
+        }
+
+        void onCompleted()
+        {
+            osg::ref_ptr<StreamingTerrain> terrain = _terrain.get();
+            if ( terrain.valid() && terrain->getEventDrivenUpdates() )
+                terrain->notifyTileDirty( _tileId );
+        }
+
+        osg::observer_ptr<StreamingTerrain> _terrain;
+        osgTerrain::TileID                  _tileId;
+    };
+
     // this progress callback checks to see whether the request being serviced is 
     // out of date with respect to the task service that is running it. It checks
     // for a disparity in frame stamps, and reports that the request should be
     // canceled if it appears the request has been abandoned by the Tile that
     // originally scheduled it.
-    struct StampedProgressCallback : ProgressCallback
+    struct StampedProgressCallback : TileProgressCallback
     {
     public:
-        StampedProgressCallback(TaskRequest* request, TaskService* service):
+        StampedProgressCallback(StreamingTile* tile, TaskRequest* request, TaskService* service):
+          TileProgressCallback(tile),
           _request(request),
           _service(service)
         {
@@ -85,6 +108,13 @@ namespace
               _numTries(0), 
               _maxTries(3) { }
 
+        // completes the request with data that was loaded elsewhere (i.e., prefetched).
+        void complete( osg::Referenced* result )
+        {
+            _result = result;
+            setState( STATE_COMPLETED );
+        }
+
         TileKey _key;
         MapFrame _mapf;
         //osg::ref_ptr<Map> _map;
@@ -259,6 +289,7 @@ StreamingTile::setElevationLOD( int lod )
 {
     _elevationLOD = lod;
     _elevationLayerUpToDate = _elevationLOD == (int)_key.getLevelOfDetail();
+    notifyChanged();
 }
 
 StreamingTerrain*
@@ -423,6 +454,9 @@ StreamingTile::resetElevationRequests( const MapFrame& mapf )
     ss << "TileElevationPlaceholderLayerRequest " << _key.str() << std::endl;
 	ssStr = ss.str();
     _elevPlaceholderRequest->setName( ssStr );
+
+    // the new requests are idle, and need to be serviced.
+    notifyDirty();
 }
 
 
@@ -458,6 +492,7 @@ StreamingTile::updateImagery( ImageLayer* imageLayer, const MapFrame& mapf, OSGT
     }
 
     r->setProgressCallback( new StampedProgressCallback( 
+        this,
         r,
         terrain->getImageryTaskService( imageLayer->getUID() ) ) );
 
@@ -497,9 +532,20 @@ StreamingTile::servicePendingImageRequests( const MapFrame& mapf, int stamp )
         //and it was either deemed out of date or was cancelled, so we need to add it again.
         if ( r->isIdle() )
         {
-            //OE_NOTICE << "Queuing IR (" << _key.str() << ")" << std::endl;
-            r->setStamp( stamp );
-            getStreamingTerrain()->getImageryTaskService( r->_layerUID )->add( r );
+            // if the prefetcher already loaded this imagery, the request is done.
+            TilePrefetcher* prefetcher = getStreamingTerrain()->getPrefetcher();
+            osg::ref_ptr<osg::Referenced> result;
+            if ( prefetcher && prefetcher->takeImageLayer( _key, r->_layerUID, result ) )
+            {
+                r->complete( result.get() );
+                notifyDirty();
+            }
+            else
+            {
+                //OE_NOTICE << "Queuing IR (" << _key.str() << ")" << std::endl;
+                r->setStamp( stamp );
+                getStreamingTerrain()->getImageryTaskService( r->_layerUID )->add( r );
+            }
         }
         else if ( !r->isCompleted() )
         {
@@ -553,10 +599,20 @@ StreamingTile::servicePendingElevationRequests( const MapFrame& mapf, int stamp,
         // otherwise, see if it is legal yet to start a new request:
         else if ( readyForNewElevation() )
         {
-            if ( _elevationLOD + 1 == _key.getLevelOfDetail() )
+            osg::ref_ptr<osg::Referenced> prefetched;
+            TilePrefetcher* prefetcher = terrain->getPrefetcher();
+
+            if ( _elevationLOD + 1 == _key.getLevelOfDetail() && prefetcher && prefetcher->takeElevationLayer( _key, prefetched ) )
+            {
+                // the prefetcher already loaded the final heightfield:
+                static_cast<TileLayerRequest*>( _elevRequest.get() )->complete( prefetched.get() );
+                notifyDirty();
+            }
+
+            else if ( _elevationLOD + 1 == _key.getLevelOfDetail() )
             {
                 _elevRequest->setStamp( stamp );
-                _elevRequest->setProgressCallback( new ProgressCallback() );
+                _elevRequest->setProgressCallback( new TileProgressCallback( this ) );
                 terrain->getElevationTaskService()->add( _elevRequest.get() );
 #ifdef PREEMPTIVE_DEBUG
                 OE_NOTICE << "..queued FE req for (" << _key.str() << ")" << std::endl;
@@ -573,7 +629,7 @@ StreamingTile::servicePendingElevationRequests( const MapFrame& mapf, int stamp,
                     TileElevationPlaceholderLayerRequest* er = static_cast<TileElevationPlaceholderLayerRequest*>(_elevPlaceholderRequest.get());
 
                     er->setStamp( stamp );
-                    er->setProgressCallback( new ProgressCallback() );
+                    er->setProgressCallback( new TileProgressCallback( this ) );
                     float priority = (float)_key.getLevelOfDetail();
                     er->setPriority( priority );
                     //TODO: should there be a read lock here when accessing the parent tile's elevation layer? GW
@@ -603,6 +659,7 @@ StreamingTile::queueTileUpdate( TileUpdate::Action action, int value )
     if ( _useTileGenRequest )
     {
         _tileUpdates.push( TileUpdate(action, value) );
+        notifyDirty();
     }
     else
     {
@@ -610,6 +667,19 @@ StreamingTile::queueTileUpdate( TileUpdate::Action action, int value )
     }
 }
 
+bool
+StreamingTile::hasIdleElevationRequest()
+{
+    // mirrors the conditions under which servicePendingElevationRequests queues a request.
+    return
+        _hasElevation && 
+        !_elevationLayerUpToDate &&
+        _elevRequest.valid() && _elevRequest->isIdle() &&
+        _elevPlaceholderRequest.valid() && _elevPlaceholderRequest->isIdle() &&
+        readyForNewElevation() &&
+        ( _elevationLOD + 1 == (int)_key.getLevelOfDetail() || _family[Relative::PARENT].elevLOD > _elevationLOD );
+}
+
 // called from the UPDATE TRAVERSAL, because this method can potentially alter
 // the scene graph.
 bool
@@ -711,7 +781,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
                             //Reset the cancelled task to IDLE and give it a new progress callback.
                             r->setState( TaskRequest::STATE_IDLE );
                             r->setProgressCallback( new StampedProgressCallback(
-                                r, terrain->getImageryTaskService( r->_layerUID )));
+                                this, r, terrain->getImageryTaskService( r->_layerUID )));
                             r->reset();
                         }
                         else // success..
@@ -790,7 +860,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
             {
                 // If the request was canceled, reset it to IDLE and reset the callback. On the next
                 _elevRequest->setState( TaskRequest::STATE_IDLE );
-                _elevRequest->setProgressCallback( new ProgressCallback() );            
+                _elevRequest->setProgressCallback( new TileProgressCallback( this ) );            
                 _elevRequest->reset();
             }
             else // success:
@@ -816,6 +886,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
 
                     // finalize the LOD marker for this tile, so other tiles can see where we are.
                     _elevationLOD = _key.getLevelOfDetail();
+                    notifyChanged();
 
     #ifdef PREEMPTIVE_DEBUG
                     OE_NOTICE << "Tile (" << _key.str() << ") final HF, LOD (" << _elevationLOD << ")" << std::endl;
@@ -832,6 +903,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
                 {
                     //We've tried to get the tile's elevation but couldn't.  Just mark the elevation layer as up to date and move on.
                     _elevationLOD = _key.getLevelOfDetail();
+                    notifyChanged();
                     _elevationLayerUpToDate = true;
 
                     //This code will retry indefinitely.  We need to have a way to limit the number of retries since
@@ -850,7 +922,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
             if ( r->wasCanceled() )
             {
                 r->setState( TaskRequest::STATE_IDLE );
-                r->setProgressCallback( new ProgressCallback() );
+                r->setProgressCallback( new TileProgressCallback( this ) );
                 r->reset();
             }
             else // success:
@@ -871,6 +943,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
                     // update the elevation LOD for this tile, now that the new HF data is installed. This will
                     // allow other tiles to see where this tile's HF data is.
                     _elevationLOD = r->_nextLOD;
+                    notifyChanged();
 
     #ifdef PREEMPTIVE_DEBUG
                     OE_NOTICE << "..tile (" << _key.str() << ") is now at (" << _elevationLOD << ")" << std::endl;
@@ -886,6 +959,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
     if ( _tileUpdates.size() > 0 && !_tileGenRequest.valid() ) // _tileGenNeeded && !_tileGenRequest.valid())
     {
         _tileGenRequest = new TileGenRequest( this, _tileUpdates.front() );
+        _tileGenRequest->setProgressCallback( new TileProgressCallback( this ) );
         _tileUpdates.pop();
         //OE_NOTICE << "tile (" << _key.str() << ") queuing new tile gen" << std::endl;
         getStreamingTerrain()->getTileGenerationTaskSerivce()->add( _tileGenRequest.get() );
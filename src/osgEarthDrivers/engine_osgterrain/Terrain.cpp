@@ -100,7 +100,12 @@ _quickReleaseGLObjects( quickReleaseGLObjects ),
 _quickReleaseCallbackInstalled( false ),
 _alwaysUpdate( false ),
 _sampleRatio( 1.0f ),
-_verticalScale( 1.0f )
+_verticalScale( 1.0f ),
+_eventDriven( false ),
+_applyTime( 0.0 ),
+_lastApplyTime( 0.0 ),
+_applyCount( 0 ),
+_lastApplyCount( 0 )
 {
     this->setThreadSafeRefUnref( true );
 
@@ -174,6 +179,16 @@ Terrain::registerTile( Tile* newTile )
 {
     Threading::ScopedWriteLock exclusiveTileTableLock( _tilesMutex );
     _tiles[ newTile->getTileId() ] = newTile;
+
+    if ( _eventDriven )
+        notifyTileChanged( newTile->getTileId() );
+}
+
+void
+Terrain::notifyTileOrphaned( Tile* tile )
+{
+    Threading::ScopedMutexLock lock( _orphanedTilesMutex );
+    _orphanedTiles.push_back( tile );
 }
 
 // immediately release GL memory for any expired tiles.
@@ -197,6 +212,15 @@ Terrain::releaseGLObjectsForTiles(osg::State* state)
     //}
 }
 
+void
+Terrain::reportApplyTileUpdates( double seconds, bool applied )
+{
+    Threading::ScopedMutexLock lock( _applyStatsMutex );
+    _applyTime += seconds;
+    if ( applied )
+        _applyCount++;
+}
+
 void
 Terrain::traverse( osg::NodeVisitor &nv )
 {
@@ -204,6 +228,15 @@ Terrain::traverse( osg::NodeVisitor &nv )
     // i.e., only runs then a new Tile is born.
     if ( nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
     {
+        // publish the tile-update stats gathered since the last UPDATE traversal.
+        {
+            Threading::ScopedMutexLock lock( _applyStatsMutex );
+            _lastApplyTime  = _applyTime;
+            _lastApplyCount = _applyCount;
+            _applyTime      = 0.0;
+            _applyCount     = 0;
+        }
+
         // if the terrain engine requested "quick release", install the quick release
         // draw callback now.
         if ( _quickReleaseGLObjects && !_quickReleaseCallbackInstalled )
@@ -217,10 +250,49 @@ Terrain::traverse( osg::NodeVisitor &nv )
             }
         }
 
+        // In event-driven mode, tiles report themselves when their parent goes away; we
+        // only need to look at those. A reported tile may still have its parent for a
+        // little while (the parent is in the process of being deleted), in which case it
+        // stays a candidate until the next frame. A candidate that's no longer the one in
+        // the table (it was replaced or already removed) is simply dropped.
+        if ( _eventDriven )
+        {
+            {
+                Threading::ScopedMutexLock lock( _orphanedTilesMutex );
+                _orphanCandidates.splice( _orphanCandidates.end(), _orphanedTiles );
+            }
+
+            if ( _orphanCandidates.size() > 0 )
+            {
+                Threading::ScopedWriteLock tileTableExclusiveLock( _tilesMutex );
+
+                for( TileList::iterator i = _orphanCandidates.begin(); i != _orphanCandidates.end(); )
+                {
+                    Tile* tile = i->get();
+                    TileTable::iterator t = _tiles.find( tile->getTileId() );
+
+                    if ( t == _tiles.end() || t->second.get() != tile )
+                    {
+                        i = _orphanCandidates.erase( i );
+                    }
+                    else if ( tile->getNumParents() == 0 && tile->getHasBeenTraversed() )
+                    {
+                        _tilesToShutDown.push_back( tile );
+                        _tiles.erase( t );
+                        notifyTileChanged( tile->getTileId() );
+                        i = _orphanCandidates.erase( i );
+                    }
+                    else
+                        ++i;
+                }
+            }
+        }
+
         // Collect any "dead" tiles and queue them for shutdown. Since UPDATE only runs
         // when new tiles arrive, this clears out old tiles from the queue at that time.
         // Another approach might be to use an observer_ptr instead...but then we may
         // not be able to use the quick-release.
+        else
         {
             Threading::ScopedWriteLock tileTableExclusiveLock( _tilesMutex );
 
@@ -0,0 +1,180 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2010 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TerrainNormals"
+#include "Terrain"
+#include "Tile"
+
+using namespace osgEarth;
+
+#define LC "[TerrainNormals] "
+
+//------------------------------------------------------------------------
+
+TerrainNormals::TerrainNormals( unsigned numColumns, unsigned numRows ) :
+_numColumns( numColumns ),
+_numRows   ( numRows ),
+_stride    ( numColumns+2 )
+{
+    unsigned size = (numColumns+2) * (numRows+2);
+    _x.resize( size, 0.0f );
+    _y.resize( size, 0.0f );
+    _z.resize( size, 0.0f );
+    _valid.resize( size, 0 );
+}
+
+void
+TerrainNormals::setPost( int col, int row, const osg::Vec3& pos )
+{
+    unsigned k = index( col, row );
+    _x[k] = pos.x();
+    _y[k] = pos.y();
+    _z[k] = pos.z();
+    _valid[k] = 1;
+}
+
+void
+TerrainNormals::sampleNeighbors(Tile*                      tile,
+                                osgTerrain::Layer*         elevationLayer,
+                                const osgTerrain::Locator* locator,
+                                const osg::Vec3d&          centerModel,
+                                double                     i_sampleFactor,
+                                double                     j_sampleFactor,
+                                float                      scaleHeight )
+{
+    Terrain* terrain = tile->getTerrain();
+    if ( !terrain || !elevationLayer || _numColumns < 2 || _numRows < 2 )
+        return;
+
+    const osgTerrain::TileID& id = tile->getTileId();
+
+    // each side: the neighbor's tile ID, the apron post at which to start and the step
+    // along the side, and the raw heightfield column/row in the neighbor that lines up
+    // with the apron (the neighbor's second post in from the shared edge).
+    struct Side
+    {
+        osgTerrain::TileID _id;
+        int  _col, _row;
+        bool _alongColumns;
+        int  _rawCol, _rawRow;
+    };
+
+    Side sides[4];
+
+    // west
+    sides[0]._id = osgTerrain::TileID( id.level, id.x-1, id.y );
+    sides[0]._col = -1; sides[0]._row = 0; sides[0]._alongColumns = false;
+    sides[0]._rawCol = (int)(double(_numColumns-2)*i_sampleFactor); sides[0]._rawRow = -1;
+
+    // east
+    sides[1]._id = osgTerrain::TileID( id.level, id.x+1, id.y );
+    sides[1]._col = (int)_numColumns; sides[1]._row = 0; sides[1]._alongColumns = false;
+    sides[1]._rawCol = (int)(1.0*i_sampleFactor); sides[1]._rawRow = -1;
+
+    // south
+    sides[2]._id = osgTerrain::TileID( id.level, id.x, id.y-1 );
+    sides[2]._col = 0; sides[2]._row = -1; sides[2]._alongColumns = true;
+    sides[2]._rawCol = -1; sides[2]._rawRow = (int)(double(_numRows-2)*j_sampleFactor);
+
+    // north
+    sides[3]._id = osgTerrain::TileID( id.level, id.x, id.y+1 );
+    sides[3]._col = 0; sides[3]._row = (int)_numRows; sides[3]._alongColumns = true;
+    sides[3]._rawCol = -1; sides[3]._rawRow = (int)(1.0*j_sampleFactor);
+
+    for( unsigned s=0; s<4; ++s )
+    {
+        const Side& side = sides[s];
+
+        // never wait on the tile table; the caller may already hold it.
+        osg::ref_ptr<Tile> neighbor;
+        if ( !terrain->tryGetTile( side._id, neighbor ) || !neighbor.valid() )
+            continue;
+
+        osg::ref_ptr<osgTerrain::HeightFieldLayer> neighborLayer;
+        {
+            Threading::ScopedReadLock sharedLock( neighbor->getTileLayersMutex() );
+            neighborLayer = neighbor->getElevationLayer();
+        }
+
+        if ( !neighborLayer.valid() ||
+             neighborLayer->getNumColumns() != elevationLayer->getNumColumns() ||
+             neighborLayer->getNumRows()    != elevationLayer->getNumRows() )
+        {
+            continue;
+        }
+
+        unsigned count = side._alongColumns ? _numColumns : _numRows;
+        for( unsigned n=0; n<count; ++n )
+        {
+            int col = side._alongColumns ? n : side._col;
+            int row = side._alongColumns ? side._row : n;
+
+            unsigned int i_equiv = side._alongColumns ? (unsigned int)(double(n)*i_sampleFactor) : side._rawCol;
+            unsigned int j_equiv = side._alongColumns ? side._rawRow : (unsigned int)(double(n)*j_sampleFactor);
+
+            float value = 0.0f;
+            if ( !neighborLayer->getValidValue( i_equiv, j_equiv, value ) )
+                continue;
+
+            osg::Vec3d ndc( double(col)/double(_numColumns-1), double(row)/double(_numRows-1), value*scaleHeight );
+            osg::Vec3d model;
+            locator->convertLocalToModel( ndc, model );
+            setPost( col, row, model - centerModel );
+        }
+    }
+}
+
+void
+TerrainNormals::compute( const std::vector<int>& indices, osg::Vec3Array& normals ) const
+{
+    const float*         x     = &_x[0];
+    const float*         y     = &_y[0];
+    const float*         z     = &_z[0];
+    const unsigned char* valid = &_valid[0];
+
+    for( unsigned row=0; row<_numRows; ++row )
+    {
+        const int* out = &indices[row*_numColumns];
+        unsigned   k   = index( 0, row );
+
+        for( unsigned col=0; col<_numColumns; ++col, ++k )
+        {
+            if ( out[col] < 0 )
+                continue;
+
+            // central differences, falling back on the post itself for a missing neighbor:
+            unsigned kw = valid[k-1]       ? k-1       : k;
+            unsigned ke = valid[k+1]       ? k+1       : k;
+            unsigned ks = valid[k-_stride] ? k-_stride : k;
+            unsigned kn = valid[k+_stride] ? k+_stride : k;
+
+            float ux = x[ke]-x[kw], uy = y[ke]-y[kw], uz = z[ke]-z[kw];
+            float vx = x[kn]-x[ks], vy = y[kn]-y[ks], vz = z[kn]-z[ks];
+
+            osg::Vec3 normal( uy*vz - uz*vy, uz*vx - ux*vz, ux*vy - uy*vx );
+
+            float length = normal.length();
+            if ( length > 0.0f )
+            {
+                osg::Vec3& up = normals[out[col]];
+                normal /= (normal * up) < 0.0f ? -length : length;
+                up = normal;
+            }
+        }
+    }
+}
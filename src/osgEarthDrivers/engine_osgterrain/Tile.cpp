@@ -30,6 +30,7 @@
 #include <osg/NodeVisitor>
 #include <osg/Node>
 #include <osg/Texture2D>
+#include <osg/Observer>
 #include <osgGA/EventVisitor>
 
 #include <OpenThreads/ScopedLock>
@@ -42,6 +43,35 @@ using namespace OpenThreads;
 
 //----------------------------------------------------------------------------
 
+namespace
+{
+    /**
+     * Watches one of a tile's parents, and reports the tile to its terrain as
+     * possibly orphaned when that parent is deleted. The observer deletes itself
+     * once it fires.
+     */
+    struct ParentObserver : public osg::Observer
+    {
+        ParentObserver( Terrain* terrain, Tile* tile ) : _terrain(terrain), _tile(tile) { }
+
+        virtual void objectDeleted( void* )
+        {
+            osg::ref_ptr<Terrain> terrain = _terrain.get();
+            osg::ref_ptr<Tile>    tile    = _tile.get();
+            if ( terrain.valid() && tile.valid() )
+            {
+                terrain->notifyTileOrphaned( tile.get() );
+            }
+            delete this;
+        }
+
+        osg::observer_ptr<Terrain> _terrain;
+        osg::observer_ptr<Tile>    _tile;
+    };
+}
+
+//----------------------------------------------------------------------------
+
 Tile::Tile( const TileKey& key, GeoLocator* keyLocator, bool quickReleaseGLObjects ) :
 _key( key ),
 _locator( keyLocator ),
@@ -92,6 +122,22 @@ Tile::attachToTerrain( Terrain* terrain )
         terrain->registerTile( this );
 }
 
+void
+Tile::notifyChanged()
+{
+    osg::ref_ptr<Terrain> terrain = _terrain.get();
+    if ( terrain.valid() && terrain->getEventDrivenUpdates() )
+        terrain->notifyTileChanged( _tileId );
+}
+
+void
+Tile::notifyDirty()
+{
+    osg::ref_ptr<Terrain> terrain = _terrain.get();
+    if ( terrain.valid() && terrain->getEventDrivenUpdates() )
+        terrain->notifyTileDirty( _tileId );
+}
+
 void
 Tile::setVerticalScale (float verticalScale )
 {
@@ -124,6 +170,8 @@ Tile::setCustomColorLayer( const CustomColorLayer& layer, bool writeLock )
 
         if ( delta != 0 )
             ADJUST_UPDATE_TRAV_COUNT( this, delta );
+
+        notifyChanged();
     }
 }
 
@@ -144,6 +192,7 @@ Tile::removeCustomColorLayer( UID layerUID, bool writeLock )
                 ADJUST_UPDATE_TRAV_COUNT( this, -1 );
 
             _colorLayers.erase( i );
+            notifyChanged();
         }
     }
 }
@@ -203,6 +252,8 @@ Tile::setCustomColorLayers( const ColorLayersByUID& in, bool writeLock )
 
         if ( delta != 0 )
             ADJUST_UPDATE_TRAV_COUNT( this, delta );
+
+        notifyChanged();
     }
 }
 
@@ -307,6 +358,16 @@ Tile::traverse( osg::NodeVisitor& nv )
                     // here and we could register the tile. Now we can decrement it back to normal.
                     // this MUST be called from the UPDATE traversal.
                     ADJUST_UPDATE_TRAV_COUNT( this, -1 );
+
+                    // in event-driven mode, watch our parents so the terrain hears about it
+                    // when we drop out of the scene graph; and get serviced for the first time.
+                    if ( _terrain->getEventDrivenUpdates() )
+                    {
+                        for( unsigned i = 0; i < getNumParents(); ++i )
+                            getParent( i )->addObserver( new ParentObserver( _terrain.get(), this ) );
+
+                        notifyDirty();
+                    }
                 }
             }
         }
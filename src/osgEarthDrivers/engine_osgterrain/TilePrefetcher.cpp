@@ -0,0 +1,465 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2010 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+#include "TilePrefetcher"
+#include "StreamingTerrain"
+#include "StreamingTile"
+
+#include <set>
+#include <sstream>
+
+using namespace osgEarth;
+
+#define LC "[TilePrefetcher] "
+
+// prefetch requests queue behind every regular tile request (lower values run first):
+#define PRI_PREFETCH_OFFSET 1000.0f
+
+// number of points along the predicted path at which to look up tiles
+#define NUM_PATH_SAMPLES 4
+
+// frames a prediction may go unconfirmed before its request is canceled
+#define PREFETCH_EXPIRY_FRAMES 30
+
+// upper bound on outstanding prefetch requests and results
+#define MAX_PREFETCH_ENTRIES 256u
+
+// weight of the newest sample in the smoothed eye velocity
+#define VELOCITY_SMOOTHING 0.3
+
+// a longer gap between frames (paused or on-demand rendering) says nothing about velocity
+#define MAX_SAMPLE_GAP 0.5
+
+//----------------------------------------------------------------------------
+
+namespace
+{
+    // cancels a prefetch request that the predicted path stopped confirming.
+    struct PrefetchProgressCallback : ProgressCallback
+    {
+        PrefetchProgressCallback( TaskRequest* request, TaskService* service ) :
+          _request( request ),
+          _service( service ) { }
+
+        bool reportProgress( double current, double total )
+        {
+            if ( _canceled ) return _canceled;
+            _canceled = (_service->getStamp() - _request->getStamp() > PREFETCH_EXPIRY_FRAMES);
+            return _canceled;
+        }
+
+        TaskRequest* _request;
+        TaskService* _service;
+    };
+
+    // NOTE: like the tile requests, each prefetch request runs against its own copy
+    // of the map frame.
+
+    struct PrefetchImageRequest : public TaskRequest
+    {
+        PrefetchImageRequest( const TileKey& key, const MapFrame& mapf, OSGTileFactory* tileFactory, UID layerUID )
+            : _key( key ),
+              _mapf( mapf, "osgterrain.PrefetchImageRequest" ),
+              _tileFactory( tileFactory ),
+              _layerUID( layerUID ) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            if ( progress->isCanceled() )
+                return;
+
+            osg::ref_ptr<ImageLayer> imageLayer = _mapf.getImageLayerByUID( _layerUID );
+            if ( imageLayer.valid() )
+            {
+                _result = _tileFactory->createImageLayer( _mapf.getMapInfo(), imageLayer.get(), _key, progress );
+            }
+        }
+
+        TileKey                      _key;
+        MapFrame                     _mapf;
+        osg::ref_ptr<OSGTileFactory> _tileFactory;
+        UID                          _layerUID;
+    };
+
+    struct PrefetchElevationRequest : public TaskRequest
+    {
+        PrefetchElevationRequest( const TileKey& key, const MapFrame& mapf, OSGTileFactory* tileFactory )
+            : _key( key ),
+              _mapf( mapf, "osgterrain.PrefetchElevationRequest" ),
+              _tileFactory( tileFactory ) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            if ( !progress->isCanceled() )
+            {
+                _result = _tileFactory->createHeightFieldLayer( _mapf, _key, true ); //exactOnly=true
+            }
+        }
+
+        TileKey                      _key;
+        MapFrame                     _mapf;
+        osg::ref_ptr<OSGTileFactory> _tileFactory;
+    };
+
+    // converts a world point to map coordinates (x, y, height)
+    bool worldToMap( const MapInfo& mapInfo, const osg::Vec3d& world, osg::Vec3d& out_map )
+    {
+        if ( mapInfo.isGeocentric() )
+            return mapInfo.getProfile()->getSRS()->transformFromECEF( world, out_map );
+
+        out_map = world;
+        return true;
+    }
+
+    // converts a map point to world coordinates
+    bool mapToWorld( const MapInfo& mapInfo, const osg::Vec3d& map, osg::Vec3d& out_world )
+    {
+        if ( mapInfo.isGeocentric() )
+            return mapInfo.getProfile()->getSRS()->transformToECEF( map, out_world );
+
+        out_world = map;
+        return true;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+TilePrefetcher::TilePrefetcher( StreamingTerrain* terrain, double lookAheadTime ) :
+_terrain      ( terrain ),
+_lookAheadTime( lookAheadTime ),
+_haveEye      ( false ),
+_eyeTime      ( 0.0 ),
+_eyeFrame     ( 0 ),
+_numIssued    ( 0 ),
+_numCompleted ( 0 ),
+_numHits      ( 0 )
+{
+    //nop
+}
+
+TilePrefetcher::~TilePrefetcher()
+{
+    clear();
+}
+
+void
+TilePrefetcher::recordEyePoint( const osg::Vec3d& eye, const osg::FrameStamp* frameStamp )
+{
+    Threading::ScopedMutexLock lock( _eyeMutex );
+
+    // with several cameras (or cull threads) on the terrain, the first one each frame
+    // speaks for the view.
+    if ( _haveEye && frameStamp->getFrameNumber() == _eyeFrame )
+        return;
+
+    double t = frameStamp->getReferenceTime();
+
+    if ( _haveEye )
+    {
+        double dt = t - _eyeTime;
+        if ( dt > MAX_SAMPLE_GAP )
+        {
+            _velocity.set( 0, 0, 0 );
+        }
+        else if ( dt > 0.0 )
+        {
+            osg::Vec3d v = (eye - _eye) / dt;
+            _velocity = _velocity * (1.0 - VELOCITY_SMOOTHING) + v * VELOCITY_SMOOTHING;
+        }
+    }
+
+    _eye      = eye;
+    _eyeTime  = t;
+    _eyeFrame = frameStamp->getFrameNumber();
+    _haveEye  = true;
+}
+
+TileKey
+TilePrefetcher::findPagedKey( const MapInfo& mapInfo, const osg::Vec3d& worldPoint ) const
+{
+    // Walk down the LODs at the point under the eye for as long as the tiles would
+    // subdivide, using the same range rule as OSGTileFactory (radius * minTileRangeFactor).
+    const Profile* profile = mapInfo.getProfile();
+    const OSGTerrainOptions& options = _terrain->getTileFactory()->getTerrainOptions();
+    unsigned maxLOD = (unsigned)osg::maximum( 0, options.maxLOD().value() );
+    double   rangeFactor = options.minTileRangeFactor().value();
+
+    osg::Vec3d mapPoint;
+    if ( !worldToMap( mapInfo, worldPoint, mapPoint ) )
+        return TileKey();
+
+    TileKey result;
+    for( unsigned lod = 0; lod <= maxLOD; ++lod )
+    {
+        TileKey key = profile->createTileKey( mapPoint.x(), mapPoint.y(), lod );
+        if ( !key.valid() )
+            break;
+
+        result = key;
+
+        const GeoExtent& ex = key.getExtent();
+        osg::Vec3d center, corner;
+        if (!mapToWorld( mapInfo, osg::Vec3d(ex.xMin() + 0.5*ex.width(), ex.yMin() + 0.5*ex.height(), 0.0), center ) ||
+            !mapToWorld( mapInfo, osg::Vec3d(ex.xMin(), ex.yMin(), 0.0), corner ) )
+        {
+            break;
+        }
+
+        double radius = (corner - center).length();
+        if ( (worldPoint - center).length() >= radius * rangeFactor )
+            break;
+    }
+
+    return result;
+}
+
+void
+TilePrefetcher::predictKeys(const MapInfo&     mapInfo,
+                            const osg::Vec3d&  eye,
+                            const osg::Vec3d&  velocity,
+                            PredictedKeys&     out_keys ) const
+{
+    const Profile* profile = mapInfo.getProfile();
+
+    for( unsigned s = 1; s <= NUM_PATH_SAMPLES; ++s )
+    {
+        double t = _lookAheadTime * (double)s / (double)NUM_PATH_SAMPLES;
+        TileKey key = findPagedKey( mapInfo, eye + velocity * t );
+        if ( !key.valid() )
+            continue;
+
+        // the path is only an estimate, so take in the neighbors as well:
+        const GeoExtent& ex = key.getExtent();
+        double cx = ex.xMin() + 0.5*ex.width();
+        double cy = ex.yMin() + 0.5*ex.height();
+
+        for( int dy = -1; dy <= 1; ++dy )
+        {
+            for( int dx = -1; dx <= 1; ++dx )
+            {
+                TileKey nk = profile->createTileKey( cx + dx*ex.width(), cy + dy*ex.height(), key.getLevelOfDetail() );
+                if ( nk.valid() && out_keys.find( nk.getTileId() ) == out_keys.end() )
+                {
+                    // remember the earliest sample that wants the key; it goes first.
+                    out_keys[nk.getTileId()] = std::make_pair( nk, s );
+                }
+            }
+        }
+    }
+}
+
+bool
+TilePrefetcher::harvest( Entry& entry )
+{
+    // tallies a request the first time it is seen completed. Returns false if
+    // it completed without data (failed or canceled).
+    TaskRequest* r = entry._request.get();
+    if ( !r->isCompleted() )
+        return true;
+
+    bool ok = !r->wasCanceled() && r->getResult() != 0L;
+    if ( ok && !entry._counted )
+    {
+        entry._counted = true;
+        ++_numCompleted;
+    }
+    return ok;
+}
+
+void
+TilePrefetcher::update( const MapFrame& mapf, int stamp )
+{
+    osg::Vec3d eye, velocity;
+    {
+        Threading::ScopedMutexLock lock( _eyeMutex );
+        if ( !_haveEye )
+            return;
+        eye      = _eye;
+        velocity = _velocity;
+    }
+
+    const MapInfo& mapInfo = mapf.getMapInfo();
+
+    PredictedKeys predicted;
+    if ( _lookAheadTime > 0.0 && velocity.length2() > 0.0 )
+    {
+        predictKeys( mapInfo, eye, velocity, predicted );
+    }
+
+    // Tiles that already exist schedule their own requests, so they need no prefetching.
+    // Finished results for them wait up to PREFETCH_EXPIRY_FRAMES for the tile to take
+    // them; a tile that doesn't (e.g. it already has the data) must not pin them. (Look
+    // up the tile table before locking the entries; tiles take results while holding it.)
+    std::set< osgTerrain::TileID > live;
+    {
+        std::set< osgTerrain::TileID > ids;
+        for( PredictedKeys::const_iterator i = predicted.begin(); i != predicted.end(); ++i )
+            ids.insert( i->first );
+        {
+            Threading::ScopedMutexLock lock( _entriesMutex );
+            for( EntryMap::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+                ids.insert( i->first.first );
+        }
+
+        for( std::set< osgTerrain::TileID >::const_iterator i = ids.begin(); i != ids.end(); ++i )
+        {
+            osg::ref_ptr<StreamingTile> tile;
+            _terrain->getTile( *i, tile );
+            if ( tile.valid() )
+                live.insert( *i );
+        }
+    }
+
+    Threading::ScopedMutexLock lock( _entriesMutex );
+
+    // refresh the requests the prediction still agrees with, and let go of the rest:
+    for( EntryMap::iterator i = _entries.begin(); i != _entries.end(); )
+    {
+        TaskRequest* r = i->second._request.get();
+        const osgTerrain::TileID& id = i->first.first;
+
+        if ( !harvest( i->second ) )
+        {
+            _entries.erase( i++ );
+        }
+        else if ( predicted.find( id ) != predicted.end() && live.find( id ) == live.end() )
+        {
+            r->setStamp( stamp );
+            ++i;
+        }
+        else if ( stamp - r->getStamp() > PREFETCH_EXPIRY_FRAMES )
+        {
+            if ( r->isRunning() )
+                r->cancel();
+            _entries.erase( i++ );
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    // issue requests for newly predicted tiles:
+    OSGTileFactory* tileFactory = _terrain->getTileFactory();
+    bool hasElevation = mapf.elevationLayers().size() > 0;
+
+    for( PredictedKeys::const_iterator i = predicted.begin(); i != predicted.end() && _entries.size() < MAX_PREFETCH_ENTRIES; ++i )
+    {
+        if ( live.find( i->first ) != live.end() )
+            continue;
+
+        const TileKey& key   = i->second.first;
+        float          priority = PRI_PREFETCH_OFFSET + (float)i->second.second;
+
+        if ( hasElevation )
+        {
+            Entry& entry = _entries[ EntryKey(i->first, (UID)ELEVATION_UID) ];
+            if ( !entry._request.valid() )
+            {
+                TaskService* service = _terrain->getElevationTaskService();
+                TaskRequest* r = new PrefetchElevationRequest( key, mapf, tileFactory );
+                std::stringstream buf;
+                buf << "PrefetchElevationRequest " << key.str();
+                r->setName( buf.str() );
+                r->setPriority( priority );
+                r->setStamp( stamp );
+                r->setProgressCallback( new PrefetchProgressCallback( r, service ) );
+                entry._request = r;
+                service->add( r );
+                ++_numIssued;
+            }
+        }
+
+        for( ImageLayerVector::const_iterator j = mapf.imageLayers().begin(); j != mapf.imageLayers().end(); ++j )
+        {
+            UID layerUID = j->get()->getUID();
+            Entry& entry = _entries[ EntryKey(i->first, layerUID) ];
+            if ( !entry._request.valid() )
+            {
+                TaskService* service = _terrain->getImageryTaskService( layerUID );
+                TaskRequest* r = new PrefetchImageRequest( key, mapf, tileFactory, layerUID );
+                std::stringstream buf;
+                buf << "PrefetchImageRequest " << key.str();
+                r->setName( buf.str() );
+                r->setPriority( priority );
+                r->setStamp( stamp );
+                r->setProgressCallback( new PrefetchProgressCallback( r, service ) );
+                entry._request = r;
+                service->add( r );
+                ++_numIssued;
+            }
+        }
+    }
+}
+
+bool
+TilePrefetcher::take( const EntryKey& entryKey, osg::ref_ptr<osg::Referenced>& out_result )
+{
+    Threading::ScopedMutexLock lock( _entriesMutex );
+
+    EntryMap::iterator i = _entries.find( entryKey );
+    if ( i == _entries.end() )
+        return false;
+
+    TaskRequest* r = i->second._request.get();
+    if ( !r->isCompleted() )
+    {
+        // the tile is about to ask for the same data with a higher priority; a
+        // prefetch that hasn't started yet is wasted work.
+        if ( r->isPending() )
+        {
+            r->cancel();
+            _entries.erase( i );
+        }
+        return false;
+    }
+
+    bool ok = harvest( i->second );
+    if ( ok )
+    {
+        out_result = r->getResult();
+        ++_numHits;
+    }
+    _entries.erase( i );
+    return ok;
+}
+
+bool
+TilePrefetcher::takeImageLayer( const TileKey& key, UID layerUID, osg::ref_ptr<osg::Referenced>& out_result )
+{
+    return take( EntryKey(key.getTileId(), layerUID), out_result );
+}
+
+bool
+TilePrefetcher::takeElevationLayer( const TileKey& key, osg::ref_ptr<osg::Referenced>& out_result )
+{
+    return take( EntryKey(key.getTileId(), (UID)ELEVATION_UID), out_result );
+}
+
+void
+TilePrefetcher::clear()
+{
+    Threading::ScopedMutexLock lock( _entriesMutex );
+
+    for( EntryMap::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->second._request->isRunning() )
+            i->second._request->cancel();
+    }
+    _entries.clear();
+}
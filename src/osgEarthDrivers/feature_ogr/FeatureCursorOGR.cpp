@@ -20,111 +20,224 @@
 #include <osgEarthFeatures/OgrUtils>
 #include <osgEarthFeatures/Feature>
 #include <osgEarth/Registry>
+#include <OpenThreads/Thread>
 #include <algorithm>
 
+#define LC "[FeatureCursorOGR] "
+
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
+// how long a consumer waits on a producer that hasn't left the pool queue
+// before running it itself
+#define PRODUCER_START_TIMEOUT_MS 50
+
 using namespace osgEarth;
 using namespace osgEarth::Features;
 
+//------------------------------------------------------------------------
+
+namespace
+{
+    // the thread pool that runs the producers of all OGR cursors.
+    TaskService* getProducerService()
+    {
+        static OpenThreads::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_mutex );
+        if ( !s_service.valid() )
+        {
+            int numThreads = osg::maximum( 2, OpenThreads::GetNumberOfProcessors() );
+            s_service = new TaskService( "OGR feature cursors", numThreads );
+        }
+        return s_service.get();
+    }
+}
+
+OGRDataSourcePool::OGRDataSourcePool( const std::string& source, unsigned maxIdle ) :
+_source ( source ),
+_maxIdle( maxIdle )
+{
+    //nop
+}
+
+OGRDataSourcePool::~OGRDataSourcePool()
+{
+    for( std::vector<OGRDataSourceH>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+        OGR_DS_Destroy( *i );
+}
+
+OGRDataSourceH
+OGRDataSourcePool::acquire()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        if ( _idle.size() > 0 )
+        {
+            OGRDataSourceH dsHandle = _idle.back();
+            _idle.pop_back();
+            return dsHandle;
+        }
+    }
+
+    // opening a data source walks the driver registry, so it needs the global lock.
+    OGR_SCOPED_LOCK;
+    OGRDataSourceH dsHandle = OGROpen( _source.c_str(), 0, 0L );
+    if ( !dsHandle )
+    {
+        OE_WARN << LC << "Failed to open " << _source << std::endl;
+    }
+    return dsHandle;
+}
+
+void
+OGRDataSourcePool::release( OGRDataSourceH dsHandle )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        if ( _idle.size() < _maxIdle )
+        {
+            _idle.push_back( dsHandle );
+            return;
+        }
+    }
+    OGR_DS_Destroy( dsHandle );
+}
+
+//------------------------------------------------------------------------
+
+bool
+FeatureCursorOGR::ProducerClaim::claim()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    if ( _claimed )
+        return false;
+    _claimed = true;
+    return true;
+}
+
+void
+FeatureCursorOGR::ProducerTask::operator()( ProgressCallback* progress )
+{
+    // the cursor stays alive while its producer runs (see ~FeatureCursorOGR).
+    if ( _claim->claim() )
+        _cursor->produce();
+}
+
+//------------------------------------------------------------------------
+
 
 FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH dsHandle,
                                    OGRLayerH layerHandle,
+                                   OGRDataSourcePool* pool,
                                    const FeatureProfile* profile,
                                    const Symbology::Query& query,
-                                   const FeatureFilterList& filters ) :
+                                   const FeatureFilterList& filters,
+                                   const OGRSpatialIndex* index ) :
 _dsHandle( dsHandle ),
 _layerHandle( layerHandle ),
-_resultSetHandle( 0L ),
+_pool( pool ),
 _spatialFilter( 0L ),
 _query( query ),
 _chunkSize( 500 ),
-_nextHandleToQueue( 0L ),
+_maxChunksQueued( 2 ),
 _profile( profile ),
-_filters( filters )
+_filters( filters ),
+_index( index ),
+_producerDone( false ),
+_canceled( false )
 {
-    //_resultSetHandle = _layerHandle;
-    {
-        OGR_SCOPED_LOCK;
-
-        std::string expr;
-        std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));
-        from = std::string("'") + from + std::string("'");
+    std::string expr;
+    std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));
+    from = std::string("'") + from + std::string("'");
 
-        if ( query.expression().isSet() )
-        {
-            // build the SQL: allow the Query to include either a full SQL statement or
-            // just the WHERE clause.
-            expr = query.expression().value();
-
-            // if the expression is just a where clause, expand it into a complete SQL expression.
-            std::string temp = expr;
-            std::transform( temp.begin(), temp.end(), temp.begin(), ::tolower );
-            //bool complete = temp.find( "select" ) == 0;
-            if ( temp.find( "select" ) != 0 )
-            {
-                std::stringstream buf;
-                buf << "SELECT * FROM " << from << " WHERE " << expr;
-                std::string bufStr;
-                bufStr = buf.str();
-                expr = bufStr;
-            }
-        }
-        else
+    if ( query.expression().isSet() )
+    {
+        // build the SQL: allow the Query to include either a full SQL statement or
+        // just the WHERE clause.
+        expr = query.expression().value();
+
+        // if the expression is just a where clause, expand it into a complete SQL expression.
+        std::string temp = expr;
+        std::transform( temp.begin(), temp.end(), temp.begin(), ::tolower );
+        //bool complete = temp.find( "select" ) == 0;
+        if ( temp.find( "select" ) != 0 )
         {
             std::stringstream buf;
-            buf << "SELECT * FROM " << from;
-            expr = buf.str();
+            buf << "SELECT * FROM " << from << " WHERE " << expr;
+            std::string bufStr;
+            bufStr = buf.str();
+            expr = bufStr;
         }
+    }
+    else
+    {
+        std::stringstream buf;
+        buf << "SELECT * FROM " << from;
+        expr = buf.str();
+    }
 
-        // if there's a spatial extent in the query, build the spatial filter:
-        if ( query.bounds().isSet() )
-        {
-            OGRGeometryH ring = OGR_G_CreateGeometry( wkbLinearRing );
-            OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMin(), 0 );
-            OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMax(), 0 );
-            OGR_G_AddPoint(ring, query.bounds()->xMax(), query.bounds()->yMax(), 0 );
-            OGR_G_AddPoint(ring, query.bounds()->xMax(), query.bounds()->yMin(), 0 );
-            OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMin(), 0 );
-
-            _spatialFilter = OGR_G_CreateGeometry( wkbPolygon );
-            OGR_G_AddGeometryDirectly( _spatialFilter, ring ); 
-            // note: "Directly" above means _spatialFilter takes ownership if ring handle
-        }
-
-
-        _resultSetHandle = OGR_DS_ExecuteSQL( _dsHandle, expr.c_str(), _spatialFilter, 0L );
+    _sql = expr;
 
-        if ( _resultSetHandle )
-        {
-            OGR_L_ResetReading( _resultSetHandle );
-        }
+    // if there's a spatial extent in the query, build the spatial filter:
+    if ( query.bounds().isSet() )
+    {
+        OGRGeometryH ring = OGR_G_CreateGeometry( wkbLinearRing );
+        OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMin(), 0 );
+        OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMax(), 0 );
+        OGR_G_AddPoint(ring, query.bounds()->xMax(), query.bounds()->yMax(), 0 );
+        OGR_G_AddPoint(ring, query.bounds()->xMax(), query.bounds()->yMin(), 0 );
+        OGR_G_AddPoint(ring, query.bounds()->xMin(), query.bounds()->yMin(), 0 );
+
+        _spatialFilter = OGR_G_CreateGeometry( wkbPolygon );
+        OGR_G_AddGeometryDirectly( _spatialFilter, ring ); 
+        // note: "Directly" above means _spatialFilter takes ownership if ring handle
     }
 
-    readChunk();
+    // The producer is the only thread that touches the data source handle
+    // until it finishes, so no GDAL lock is necessary while it runs.
+    _claim = new ProducerClaim();
+    _producerTask = new ProducerTask( this, _claim.get() );
+    getProducerService()->add( _producerTask.get() );
 }
 
 FeatureCursorOGR::~FeatureCursorOGR()
 {
-    OGR_SCOPED_LOCK;
-
-    if ( _nextHandleToQueue )
-        OGR_F_Destroy( _nextHandleToQueue );
-
-    if ( _resultSetHandle != _layerHandle )
-        OGR_DS_ReleaseResultSet( _dsHandle, _resultSetHandle );
+    if ( _claim->claim() )
+    {
+        // the producer never started, and now it never will.
+        _producerTask->cancel();
+    }
+    else
+    {
+        // stop the producer and wait for it to let go of the cursor.
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        _canceled = true;
+        _cond.broadcast();
+        while( !_producerDone )
+            _cond.wait( &_mutex );
+    }
 
     if ( _spatialFilter )
         OGR_G_DestroyGeometry( _spatialFilter );
 
+    // private handle; closing it does not touch the shared data source list.
     if ( _dsHandle )
-        OGRReleaseDataSource( _dsHandle );
+    {
+        if ( _pool.valid() )
+            _pool->release( _dsHandle );
+        else
+            OGR_DS_Destroy( _dsHandle );
+    }
 }
 
 bool
 FeatureCursorOGR::hasMore() const
 {
-    return _resultSetHandle && ( _queue.size() > 0 || _nextHandleToQueue != 0L );
+    if ( _current.size() == 0 )
+        takeChunk();
+
+    return _current.size() > 0;
 }
 
 Feature*
@@ -133,82 +246,217 @@ FeatureCursorOGR::nextFeature()
     if ( !hasMore() )
         return 0L;
 
-    if ( _queue.size() == 0 && _nextHandleToQueue )
-        readChunk();
-
     // do this in order to hold a reference to the feature we return, so the caller
     // doesn't have to. This lets us avoid requiring the caller to use a ref_ptr when 
     // simply iterating over the cursor, making the cursor move conventient to use.
-    _lastFeatureReturned = _queue.front();
-    _queue.pop();
+    _lastFeatureReturned = _current.front();
+    _current.pop_front();
 
     return _lastFeatureReturned.get();
 }
 
-
-// reads a chunk of features into a memory cache; do this for performance
-// and to avoid needing the OGR Mutex every time
+// runs the query and converts the results in chunks, handing each chunk to
+// the consumer as it completes. Runs on a pool thread, or on the consumer
+// thread if the pool was slow to start it.
 void
-FeatureCursorOGR::readChunk()
+FeatureCursorOGR::produce()
 {
-    if ( !_resultSetHandle )
-        return;
-    
-    FeatureList preProcessList;
-    
-    OGR_SCOPED_LOCK;
+    OGRLayerH resultSet = 0L;
+    std::vector<GIntBig> fids;
+    unsigned nextFid = 0;
 
-    if ( _nextHandleToQueue )
+    // A bounds-only query can be answered from the sidecar index, which saves
+    // a full scan on formats that have no native spatial filtering.
+    bool useIndex = _index.valid() && _query.bounds().isSet() && !_query.expression().isSet();
+    bool randomRead = false;
+
+    if ( useIndex )
+    {
+        const Bounds& b = _query.bounds().value();
+        _index->query( b.xMin(), b.yMin(), b.xMax(), b.yMax(), fids );
+        randomRead = OGR_L_TestCapability( _layerHandle, OLCRandomRead ) != 0;
+        if ( !randomRead )
+            OGR_L_ResetReading( _layerHandle );
+    }
+    else
     {
-        Feature* f = OgrUtils::createFeature( _nextHandleToQueue );
-        if ( f ) 
+        resultSet = OGR_DS_ExecuteSQL( _dsHandle, _sql.c_str(), _spatialFilter, 0L );
+        if ( resultSet )
+            OGR_L_ResetReading( resultSet );
+    }
+
+    if ( useIndex || resultSet )
+    {
+        bool more = true;
+        while( more )
         {
-            _queue.push( f );
-            
-            if ( _filters.size() > 0 )
-                preProcessList.push_back( f );
+            FeatureList chunk;
+            int count = 0;
+            while( count < _chunkSize )
+            {
+                OGRFeatureH handle = 
+                    !useIndex  ? OGR_L_GetNextFeature( resultSet ) :
+                    randomRead ? nextCandidate( fids, nextFid ) :
+                                 scanCandidate( fids, nextFid );
+                if ( !handle )
+                {
+                    more = false;
+                    break;
+                }
+
+                // The index only compares envelopes. OGR's own spatial filter also
+                // tests the geometry, so do the same to return the same features.
+                if ( useIndex && _spatialFilter )
+                {
+                    OGRGeometryH geom = OGR_F_GetGeometryRef( handle );
+                    if ( !geom || !OGR_G_Intersects( geom, _spatialFilter ) )
+                    {
+                        OGR_F_Destroy( handle );
+                        continue;
+                    }
+                }
+
+                Feature* f = OgrUtils::createFeature( handle );
+                if ( f )
+                {
+                    chunk.push_back( f );
+                    ++count;
+                }
+                OGR_F_Destroy( handle );
+            }
+
+            if ( !pushChunk( chunk, !more ) )
+                break;
         }
-        OGR_F_Destroy( _nextHandleToQueue );
-        _nextHandleToQueue = 0L;
+
+        if ( resultSet )
+            OGR_DS_ReleaseResultSet( _dsHandle, resultSet );
     }
 
-    int handlesToQueue = _chunkSize - _queue.size();
+    // always leave the consumer in a state where it can stop waiting:
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _producerDone = true;
+    _cond.broadcast();
+}
 
-    for( int i=0; i<handlesToQueue; i++ )
+// fetches the next candidate feature by FID; returns NULL when none are left.
+OGRFeatureH
+FeatureCursorOGR::nextCandidate( const std::vector<GIntBig>& fids, unsigned& next )
+{
+    while( next < fids.size() )
     {
-        OGRFeatureH handle = OGR_L_GetNextFeature( _resultSetHandle );
+        OGRFeatureH handle = OGR_L_GetFeature( _layerHandle, fids[next++] );
         if ( handle )
-        {
-            Feature* f = OgrUtils::createFeature( handle );
-            if ( f ) 
-            {
-                _queue.push( f );
+            return handle;
+    }
+    return 0L;
+}
 
-                if ( _filters.size() > 0 )
-                    preProcessList.push_back( f );
-            }
-            OGR_F_Destroy( handle );
+// for layers without random access: reads forward, skipping features that
+// are not candidates, and stops as soon as every candidate has been seen.
+OGRFeatureH
+FeatureCursorOGR::scanCandidate( const std::vector<GIntBig>& fids, unsigned& found )
+{
+    while( found < fids.size() )
+    {
+        OGRFeatureH handle = OGR_L_GetNextFeature( _layerHandle );
+        if ( !handle )
+            return 0L;
+
+        if ( std::binary_search( fids.begin(), fids.end(), OGR_F_GetFID(handle) ) )
+        {
+            ++found;
+            return handle;
         }
-        else
-            break;
+        OGR_F_Destroy( handle );
+    }
+    return 0L;
+}
+
+// hands a chunk to the consumer, blocking while the queue is full. Returns
+// false if the cursor was destroyed in the meantime.
+bool
+FeatureCursorOGR::pushChunk( FeatureList& chunk, bool last )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+    // no point in blocking on the last chunk; the producer is about to exit.
+    while( !last && !_canceled && _chunks.size() >= _maxChunksQueued )
+        _cond.wait( &_mutex );
+
+    if ( _canceled )
+        return false;
+
+    if ( chunk.size() > 0 )
+    {
+        _chunks.push_back( FeatureList() );
+        _chunks.back().swap( chunk );
+        _cond.broadcast();
     }
+    return true;
+}
 
-    // preprocess the features using the filter list:
-    if ( preProcessList.size() > 0 )
+// waits for the next non-empty chunk from the producer and makes it current.
+// Runs on the consumer thread.
+void
+FeatureCursorOGR::takeChunk() const
+{
+    while( _current.size() == 0 )
     {
-        FilterContext cx;
-        cx.profile() = _profile.get();
+        bool produceHere = false;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+            while( _chunks.size() == 0 && !_producerDone )
+            {
+                // A producer still waiting in the pool queue may be stuck behind
+                // producers whose consumers are waiting on this thread. Don't wait
+                // on it; run it here instead.
+                if ( _cond.wait( &_mutex, PRODUCER_START_TIMEOUT_MS ) != 0 && _claim->claim() )
+                {
+                    produceHere = true;
+                    _maxChunksQueued = ~0u; // nobody consumes while we produce, so don't block
+                    break;
+                }
+            }
+
+            if ( !produceHere )
+            {
+                if ( _chunks.size() == 0 )
+                    return;
 
-        for( FeatureFilterList::const_iterator i = _filters.begin(); i != _filters.end(); ++i )
+                _current.swap( _chunks.front() );
+                _chunks.pop_front();
+                _cond.broadcast();
+            }
+        }
+
+        if ( produceHere )
         {
-            FeatureFilter* filter = i->get();
-            cx = filter->push( preProcessList, cx );
+            _producerTask->cancel();
+            const_cast<FeatureCursorOGR*>(this)->produce();
+            continue;
         }
+
+        // filters run on the consumer thread, same as before the reader moved
+        // off-thread, so they need not be thread-safe among themselves.
+        preProcess( _current );
     }
+}
+
+// preprocess the features using the filter list:
+void
+FeatureCursorOGR::preProcess( FeatureList& features ) const
+{
+    if ( _filters.size() == 0 || features.size() == 0 )
+        return;
 
-    // read one more for "more" detection:
-    _nextHandleToQueue = OGR_L_GetNextFeature( _resultSetHandle );
+    FilterContext cx;
+    cx.profile() = _profile.get();
 
-    //OE_NOTICE << "read " << _queue.size() << " features ... " << std::endl;
+    for( FeatureFilterList::const_iterator i = _filters.begin(); i != _filters.end(); ++i )
+    {
+        FeatureFilter* filter = i->get();
+        cx = filter->push( features, cx );
+    }
 }
-
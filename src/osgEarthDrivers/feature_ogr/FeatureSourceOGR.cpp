@@ -25,10 +25,12 @@
 #include <osgEarthFeatures/ScaleFilter>
 #include "OGRFeatureOptions"
 #include "FeatureCursorOGR"
+#include "OGRSpatialIndex"
 #include <osgEarthFeatures/OgrUtils>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
+#include <OpenThreads/Thread>
 #include <list>
 #include <ogr_api.h>
 
@@ -102,6 +104,9 @@ public:
         {
             _source = _options.connection().value();
         }
+
+        // keep about one idle read handle per thread that might be reading.
+        _dsPool = new OGRDataSourcePool( _source, osg::maximum(2, OpenThreads::GetNumberOfProcessors()) );
     }
 
     /** Called once at startup to create the profile for this feature set. Successful profile
@@ -154,6 +159,16 @@ public:
                 {                    
                     GeoExtent extent;
 
+                    // formats without a native spatial index get a sidecar index, which also
+                    // caches the extent and feature count so we can skip the forced scans below.
+                    if ( _options.sidecarIndex() == true && 
+                         !_writable &&
+                         _options.buildSpatialIndex() != true &&
+                         !OGR_L_TestCapability( _layerHandle, OLCFastSpatialFilter ) )
+                    {
+                        _index = OGRSpatialIndex::open( _source, _layerHandle );
+                    }
+
                     // extract the SRS and Extent:                
                     OGRSpatialReferenceH srHandle = OGR_L_GetSpatialRef( _layerHandle );
                     if ( srHandle )
@@ -163,7 +178,13 @@ public:
                         {
                             // extract the full extent of the layer:
                             OGREnvelope env;
-                            if ( OGR_L_GetExtent( _layerHandle, &env, 1 ) == OGRERR_NONE )
+                            if ( _index.valid() && _index->getFeatureCount() > 0 )
+                            {
+                                result = new FeatureProfile( GeoExtent( srs.get(), 
+                                    _index->getExtent().MinX, _index->getExtent().MinY,
+                                    _index->getExtent().MaxX, _index->getExtent().MaxY ) );
+                            }
+                            else if ( OGR_L_GetExtent( _layerHandle, &env, 1 ) == OGRERR_NONE )
                             {
                                 GeoExtent extent( srs.get(), env.MinX, env.MinY, env.MaxX, env.MaxY );
                                 
@@ -189,7 +210,9 @@ public:
                     }
 
                     //Get the feature count
-                    _featureCount = OGR_L_GetFeatureCount( _layerHandle, 1 );
+                    _featureCount = _index.valid() ?
+                        _index->getFeatureCount() :
+                        OGR_L_GetFeatureCount( _layerHandle, 1 );
 
                     initSchema();
 
@@ -259,12 +282,11 @@ public:
         }
         else
         {
-            OGR_SCOPED_LOCK;
-
             // Each cursor requires its own DS handle so that multi-threaded access will work.
-            // The cursor impl will dispose of the new DS handle.
-
-	        OGRDataSourceH dsHandle = OGROpenShared( _source.c_str(), 0, &_ogrDriverHandle );
+            // The handles are private (not shared) so the cursor can read without the global
+            // lock, and they come from a pool so they're reused across queries rather than
+            // reopened. The cursor impl will return the DS handle to the pool.
+            OGRDataSourceH dsHandle = _dsPool->acquire();
 	        if ( dsHandle )
 	        {
                 OGRLayerH layerHandle = OGR_DS_GetLayer( dsHandle, 0 );
@@ -272,9 +294,11 @@ public:
                 return new FeatureCursorOGR( 
                     dsHandle,
                     layerHandle, 
+                    _dsPool.get(),
                     getFeatureProfile(),
                     query, 
-                    _options.filters() );
+                    _options.filters(),
+                    _index.get() );
             }
             else
             {
@@ -461,6 +485,8 @@ private:
     bool _writable;
     FeatureSchema _schema;
     Geometry::Type _geometryType;
+    osg::ref_ptr<OGRSpatialIndex> _index;
+    osg::ref_ptr<OGRDataSourcePool> _dsPool;
 };
 
 
@@ -0,0 +1,358 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "OGRSpatialIndex"
+#include <osgEarth/Notify>
+#include <OpenThreads/Atomic>
+#include <cpl_vsi.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#define LC "[OGRSpatialIndex] "
+
+namespace
+{
+    const char     s_magic[8] = { 'O','E','O','G','R','I','D','X' };
+    const unsigned s_version  = 2; // 2: 64-bit FIDs
+
+    // bytes per leaf entry in the file: FID and envelope.
+    const std::streamoff s_entrySize = sizeof(GIntBig) + 4*sizeof(double);
+
+    // numbers the temporary files so concurrent writers never share one.
+    OpenThreads::Atomic s_tempFileCounter;
+
+    // entry used while packing the tree:
+    struct PackEntry
+    {
+        GIntBig fid;
+        double xmin, ymin, xmax, ymax;
+        double cx() const { return 0.5*(xmin+xmax); }
+        double cy() const { return 0.5*(ymin+ymax); }
+    };
+
+    struct SortByX {
+        bool operator()( const PackEntry& lhs, const PackEntry& rhs ) const { return lhs.cx() < rhs.cx(); }
+    };
+
+    struct SortByY {
+        bool operator()( const PackEntry& lhs, const PackEntry& rhs ) const { return lhs.cy() < rhs.cy(); }
+    };
+
+    template<typename T>
+    void writeValue( std::ostream& out, const T& value ) {
+        out.write( reinterpret_cast<const char*>(&value), sizeof(T) );
+    }
+
+    template<typename T>
+    bool readValue( std::istream& in, T& value ) {
+        in.read( reinterpret_cast<char*>(&value), sizeof(T) );
+        return in.good();
+    }
+}
+
+//------------------------------------------------------------------------
+
+OGRSpatialIndex::OGRSpatialIndex() :
+_nodeCapacity( 16 ),
+_featureCount( 0 )
+{
+    _extent.MinX = _extent.MinY = _extent.MaxX = _extent.MaxY = 0.0;
+}
+
+OGRSpatialIndex*
+OGRSpatialIndex::open( const std::string& source, OGRLayerH layerHandle )
+{
+    // only sources that live in a file can have a sidecar:
+    VSIStatBufL stat;
+    if ( source.empty() || VSIStatL( source.c_str(), &stat ) != 0 )
+        return 0L;
+
+    double mtime = (double)stat.st_mtime;
+    double size  = (double)stat.st_size;
+    std::string filename = source + ".oeidx";
+
+    osg::ref_ptr<OGRSpatialIndex> index = new OGRSpatialIndex();
+
+    if ( index->read( filename, mtime, size ) )
+    {
+        OE_DEBUG << LC << "Loaded spatial index " << filename << std::endl;
+        return index.release();
+    }
+
+    OE_INFO << LC << "Building spatial index for " << source << " ..." << std::endl;
+
+    if ( !index->build( layerHandle ) )
+        return 0L;
+
+    // a read-only location is fine; the index still serves this session.
+    if ( !index->write( filename, mtime, size ) )
+    {
+        OE_INFO << LC << "Could not write spatial index " << filename << "; using it in memory only" << std::endl;
+    }
+
+    return index.release();
+}
+
+bool
+OGRSpatialIndex::build( OGRLayerH layerHandle )
+{
+    if ( !layerHandle )
+        return false;
+
+    std::vector<PackEntry> entries;
+    _featureCount = 0;
+    bool haveExtent = false;
+
+    OGR_L_ResetReading( layerHandle );
+    OGRFeatureH handle;
+    while( (handle = OGR_L_GetNextFeature( layerHandle )) != 0L )
+    {
+        ++_featureCount;
+
+        OGRGeometryH geom = OGR_F_GetGeometryRef( handle );
+        if ( geom )
+        {
+            OGREnvelope env;
+            OGR_G_GetEnvelope( geom, &env );
+
+            PackEntry e;
+            e.fid  = OGR_F_GetFID( handle );
+            e.xmin = env.MinX; e.ymin = env.MinY; e.xmax = env.MaxX; e.ymax = env.MaxY;
+            entries.push_back( e );
+
+            if ( !haveExtent )
+            {
+                _extent = env;
+                haveExtent = true;
+            }
+            else
+            {
+                _extent.MinX = std::min( _extent.MinX, env.MinX );
+                _extent.MinY = std::min( _extent.MinY, env.MinY );
+                _extent.MaxX = std::max( _extent.MaxX, env.MaxX );
+                _extent.MaxY = std::max( _extent.MaxY, env.MaxY );
+            }
+        }
+        OGR_F_Destroy( handle );
+    }
+    OGR_L_ResetReading( layerHandle );
+
+    // Sort-Tile-Recursive packing: sort by X, cut into vertical slices of
+    // whole leaf nodes, then sort each slice by Y.
+    unsigned numLeaves = (entries.size() + _nodeCapacity - 1) / _nodeCapacity;
+    unsigned numSlices = (unsigned)ceil( sqrt( (double)numLeaves ) );
+    unsigned sliceSize = std::max( numSlices, 1u ) * _nodeCapacity;
+
+    std::sort( entries.begin(), entries.end(), SortByX() );
+    for( unsigned i = 0; i < entries.size(); i += sliceSize )
+    {
+        unsigned end = std::min( i + sliceSize, (unsigned)entries.size() );
+        std::sort( entries.begin() + i, entries.begin() + end, SortByY() );
+    }
+
+    _fids.resize( entries.size() );
+    _levels.clear();
+    _levels.push_back( std::vector<Box>(entries.size()) );
+    for( unsigned i = 0; i < entries.size(); ++i )
+    {
+        _fids[i] = entries[i].fid;
+        Box& b = _levels[0][i];
+        b.xmin = entries[i].xmin; b.ymin = entries[i].ymin; b.xmax = entries[i].xmax; b.ymax = entries[i].ymax;
+    }
+
+    buildLevels();
+    return true;
+}
+
+// builds the interior levels of the tree over the leaf boxes in _levels[0].
+void
+OGRSpatialIndex::buildLevels()
+{
+    _levels.resize( 1 );
+
+    while( _levels.back().size() > 1 )
+    {
+        const std::vector<Box>& below = _levels.back();
+        std::vector<Box> level( (below.size() + _nodeCapacity - 1) / _nodeCapacity );
+
+        for( unsigned n = 0; n < level.size(); ++n )
+        {
+            unsigned first = n * _nodeCapacity;
+            unsigned last  = std::min( first + _nodeCapacity, (unsigned)below.size() );
+
+            Box b = below[first];
+            for( unsigned i = first+1; i < last; ++i )
+            {
+                b.xmin = std::min( b.xmin, below[i].xmin );
+                b.ymin = std::min( b.ymin, below[i].ymin );
+                b.xmax = std::max( b.xmax, below[i].xmax );
+                b.ymax = std::max( b.ymax, below[i].ymax );
+            }
+            level[n] = b;
+        }
+
+        _levels.push_back( level );
+    }
+}
+
+void
+OGRSpatialIndex::query( double xmin, double ymin, double xmax, double ymax, std::vector<GIntBig>& out_fids ) const
+{
+    if ( _levels.size() == 0 || _levels[0].size() == 0 )
+        return;
+
+    unsigned start = out_fids.size();
+
+    // (level, node) pairs left to visit, starting at the root:
+    std::vector< std::pair<unsigned,unsigned> > stack;
+    stack.push_back( std::make_pair( (unsigned)_levels.size()-1, 0u ) );
+
+    while( stack.size() > 0 )
+    {
+        unsigned level = stack.back().first;
+        unsigned node  = stack.back().second;
+        stack.pop_back();
+
+        if ( !_levels[level][node].intersects( xmin, ymin, xmax, ymax ) )
+            continue;
+
+        if ( level == 0 )
+        {
+            out_fids.push_back( _fids[node] );
+        }
+        else
+        {
+            unsigned first = node * _nodeCapacity;
+            unsigned last  = std::min( first + _nodeCapacity, (unsigned)_levels[level-1].size() );
+            for( unsigned i = first; i < last; ++i )
+                stack.push_back( std::make_pair( level-1, i ) );
+        }
+    }
+
+    // ascending FIDs read the source front-to-back, which most drivers prefer.
+    std::sort( out_fids.begin() + start, out_fids.end() );
+}
+
+bool
+OGRSpatialIndex::read( const std::string& filename, double mtime, double size )
+{
+    std::ifstream in( filename.c_str(), std::ios::in | std::ios::binary );
+    if ( !in.is_open() )
+        return false;
+
+    char magic[8];
+    in.read( magic, 8 );
+    if ( !in.good() || !std::equal( magic, magic+8, s_magic ) )
+        return false;
+
+    unsigned version, capacity, numEntries;
+    double fileMtime, fileSize;
+    int featureCount;
+    if ( !readValue(in, version) || version != s_version ||
+         !readValue(in, fileMtime) || fileMtime != mtime ||
+         !readValue(in, fileSize) || fileSize != size ||
+         !readValue(in, featureCount) ||
+         !readValue(in, _extent.MinX) || !readValue(in, _extent.MinY) ||
+         !readValue(in, _extent.MaxX) || !readValue(in, _extent.MaxY) ||
+         !readValue(in, capacity) || capacity < 2 ||
+         !readValue(in, numEntries) )
+    {
+        return false;
+    }
+
+    // a truncated or corrupt file must not talk us into a huge allocation.
+    std::streamoff start = in.tellg();
+    in.seekg( 0, std::ios::end );
+    std::streamoff remaining = in.tellg() - start;
+    in.seekg( start );
+    if ( !in.good() || remaining < (std::streamoff)numEntries * s_entrySize )
+        return false;
+
+    _featureCount = featureCount;
+    _nodeCapacity = capacity;
+    _fids.resize( numEntries );
+    _levels.clear();
+    _levels.push_back( std::vector<Box>(numEntries) );
+
+    for( unsigned i = 0; i < numEntries; ++i )
+    {
+        GIntBig fid;
+        Box& b = _levels[0][i];
+        if ( !readValue(in, fid) ||
+             !readValue(in, b.xmin) || !readValue(in, b.ymin) ||
+             !readValue(in, b.xmax) || !readValue(in, b.ymax) )
+        {
+            return false;
+        }
+        _fids[i] = fid;
+    }
+
+    buildLevels();
+    return true;
+}
+
+bool
+OGRSpatialIndex::write( const std::string& filename, double mtime, double size ) const
+{
+    // write to a temporary file first, so a concurrent reader never sees a partial index.
+    std::stringstream buf;
+    buf << filename << "." << ++s_tempFileCounter << ".tmp";
+    std::string tempFilename = buf.str();
+
+    bool ok = false;
+    {
+        std::ofstream out( tempFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+        if ( out.is_open() )
+        {
+            out.write( s_magic, 8 );
+            writeValue( out, s_version );
+            writeValue( out, mtime );
+            writeValue( out, size );
+            writeValue( out, _featureCount );
+            writeValue( out, _extent.MinX );
+            writeValue( out, _extent.MinY );
+            writeValue( out, _extent.MaxX );
+            writeValue( out, _extent.MaxY );
+            writeValue( out, _nodeCapacity );
+            writeValue( out, (unsigned)_fids.size() );
+
+            const std::vector<Box>& leaves = _levels[0];
+            for( unsigned i = 0; i < _fids.size(); ++i )
+            {
+                writeValue( out, _fids[i] );
+                writeValue( out, leaves[i].xmin );
+                writeValue( out, leaves[i].ymin );
+                writeValue( out, leaves[i].xmax );
+                writeValue( out, leaves[i].ymax );
+            }
+            ok = out.good();
+        }
+    }
+
+    // rename() won't replace an existing file everywhere, so clear it first.
+    ::remove( filename.c_str() );
+
+    if ( ok && ::rename( tempFilename.c_str(), filename.c_str() ) == 0 )
+        return true;
+
+    ::remove( tempFilename.c_str() );
+    return false;
+}
@@ -167,15 +167,7 @@ public:
         std::ofstream fout;
         fout.open(filename.c_str(), std::ios::out | std::ios::binary);
 
-        std::istream& input_stream = response.getPartStream(0);
-        input_stream.seekg (0, std::ios::end);
-        int length = input_stream.tellg();
-        input_stream.seekg (0, std::ios::beg);
-
-        char *buffer = new char[length];
-        input_stream.read(buffer, length);
-        fout.write(buffer, length);
-        delete[] buffer;
+        fout.write(response.getPartData(0), response.getPartSize(0));
         fout.close();
     }
     
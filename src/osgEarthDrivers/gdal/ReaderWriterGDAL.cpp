@@ -32,6 +32,9 @@
 #include <sstream>
 #include <stdlib.h>
 #include <memory.h>
+#include <float.h>
+#include <climits>
+#include <vector>
 
 #include <gdal_priv.h>
 #include <gdalwarper.h>
@@ -960,15 +963,114 @@ public:
 
         int tileSize = _options.tileSize().value();
 
-        osg::ref_ptr<osg::Image> image;
-        if (intersects(key)) //TODO: I think this test is OBE -gw
+        //Get the extents of the tile
+        double xmin, ymin, xmax, ymax;
+        key.getExtent().getBounds(xmin, ymin, xmax, ymax);
+
+        return createImageForExtent(xmin, ymin, xmax, ymax, tileSize, tileSize, intersects(key));
+    }
+
+    // override
+    // A complete block of same-level tiles (e.g. four siblings) is read with a
+    // single pass over the combined extent, so the warper runs once for the
+    // whole block, and the result is then split into tiles.
+    void createImagesImpl( const std::vector<TileKey>& keys,
+                           std::vector< osg::ref_ptr<osg::Image> >& out_images,
+                           ProgressCallback* progress)
+    {
+        unsigned minX = UINT_MAX, minY = UINT_MAX, maxX = 0, maxY = 0;
+        bool block = keys.size() > 1 && keys[0].getLevelOfDetail() <= _maxDataLevel;
+        for (unsigned i = 0; block && i < keys.size(); ++i)
         {
-            //Get the extents of the tile
-            double xmin, ymin, xmax, ymax;
-            key.getExtent().getBounds(xmin, ymin, xmax, ymax);
+            unsigned x, y;
+            keys[i].getTileXY(x, y);
+            minX = osg::minimum(minX, x); maxX = osg::maximum(maxX, x);
+            minY = osg::minimum(minY, y); maxY = osg::maximum(maxY, y);
+            block = keys[i].getLevelOfDetail() == keys[0].getLevelOfDetail();
+        }
+
+        unsigned cols = block ? maxX - minX + 1 : 0;
+        unsigned rows = block ? maxY - minY + 1 : 0;
+
+        // the keys must fill the block exactly, and the block must stay small.
+        if (block && (cols * rows != keys.size() || cols > 4 || rows > 4))
+            block = false;
+
+        std::vector<bool> filled(cols * rows, false);
+        for (unsigned i = 0; block && i < keys.size(); ++i)
+        {
+            unsigned x, y;
+            keys[i].getTileXY(x, y);
+            unsigned cell = (y - minY) * cols + (x - minX);
+            block = !filled[cell];
+            filled[cell] = true;
+        }
+
+        if (!block)
+        {
+            TileSource::createImagesImpl(keys, out_images, progress);
+            return;
+        }
+
+        out_images.resize(keys.size());
+
+        GDAL_SCOPED_LOCK;
+
+        int tileSize = _options.tileSize().value();
+
+        double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+        bool any = false;
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            double x0, y0, x1, y1;
+            keys[i].getExtent().getBounds(x0, y0, x1, y1);
+            xmin = osg::minimum(xmin, x0); ymin = osg::minimum(ymin, y0);
+            xmax = osg::maximum(xmax, x1); ymax = osg::maximum(ymax, y1);
+            any = any || intersects(keys[i]);
+        }
+
+        if (!any)
+            return;
+
+        osg::ref_ptr<osg::Image> mosaic = createImageForExtent(xmin, ymin, xmax, ymax, cols * tileSize, rows * tileSize, true);
+        if (!mosaic.valid())
+            return;
+
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            if (!intersects(keys[i]))
+                continue;
+
+            unsigned x, y;
+            keys[i].getTileXY(x, y);
+
+            // the mosaic is flipped (first row at the bottom), so the northernmost
+            // tiles come from the last rows.
+            unsigned srcCol = (x - minX) * tileSize;
+            unsigned srcRow = (rows - 1 - (y - minY)) * tileSize;
+
+            osg::Image* image = new osg::Image;
+            image->allocateImage(tileSize, tileSize, 1, mosaic->getPixelFormat(), mosaic->getDataType());
+            for (int r = 0; r < tileSize; ++r)
+            {
+                memcpy(image->data(0, r), mosaic->data(srcCol, srcRow + r), image->getRowSizeInBytes());
+            }
+            out_images[i] = image;
+        }
+    }
 
-            int target_width = tileSize;
-            int target_height = tileSize;
+    /**
+     * Reads the extent into a new RGBA image of the given size. Areas outside the
+     * dataset are left transparent. The caller must hold the GDAL lock.
+     */
+    osg::Image* createImageForExtent(double xmin, double ymin, double xmax, double ymax,
+                                     int imageWidth, int imageHeight, bool hasData)
+    {
+        osg::ref_ptr<osg::Image> image;
+        if (hasData) //TODO: I think this test is OBE -gw
+        {
+            int target_width = imageWidth;
+            int target_height = imageHeight;
             int tile_offset_left = 0;
             int tile_offset_top = 0;
 
@@ -1054,7 +1156,7 @@ public:
                 }
 
                 image = new osg::Image;
-                image->allocateImage(tileSize, tileSize, 1, pixelFormat, GL_UNSIGNED_BYTE);
+                image->allocateImage(imageWidth, imageHeight, 1, pixelFormat, GL_UNSIGNED_BYTE);
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
                 for (int src_row = 0, dst_row = tile_offset_top;
@@ -1095,7 +1197,7 @@ public:
                 }
 
                 image = new osg::Image;
-                image->allocateImage(tileSize, tileSize, 1, pixelFormat, GL_UNSIGNED_BYTE);
+                image->allocateImage(imageWidth, imageHeight, 1, pixelFormat, GL_UNSIGNED_BYTE);
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
                 for (int src_row = 0, dst_row = tile_offset_top;
@@ -1126,7 +1228,7 @@ public:
 				bandPalette->RasterIO(GF_Read, off_x, off_y, width, height, palette, target_width, target_height, GDT_Byte, 0, 0);
 
 				image = new osg::Image;
-				image->allocateImage(tileSize, tileSize, 1, pixelFormat, GL_UNSIGNED_BYTE);
+				image->allocateImage(imageWidth, imageHeight, 1, pixelFormat, GL_UNSIGNED_BYTE);
 				memset(image->data(), 0, image->getImageSizeInBytes());
 
 				for (int src_row = 0, dst_row = tile_offset_top;
@@ -1274,7 +1376,83 @@ public:
     }
 
 
-    float getInterpolatedValue(GDALRasterBand *band, double x, double y)
+    /**
+     * A block of raster values held in memory, so that sampling a heightfield
+     * doesn't need a separate RasterIO call for every post.
+     */
+    struct PixelWindow
+    {
+        int _x0, _y0, _width, _height;
+        std::vector<float> _data;
+
+        bool contains(int c, int r) const {
+            return c >= _x0 && r >= _y0 && c < _x0 + _width && r < _y0 + _height; }
+
+        float get(int c, int r) const {
+            return _data[(r - _y0) * _width + (c - _x0)]; }
+    };
+
+    float readPixel(GDALRasterBand* band, const PixelWindow* window, int c, int r)
+    {
+        if (window && window->contains(c, r))
+            return window->get(c, r);
+
+        float value = 0.0f;
+        band->RasterIO(GF_Read, c, r, 1, 1, &value, 1, 1, GDT_Float32, 0, 0);
+        return value;
+    }
+
+    /**
+     * Reads the pixels under all the keys' extents (plus a one pixel margin for
+     * interpolation) into a window. Fails if the window would be unreasonably large,
+     * which happens at low LODs over big rasters; sampling then falls back to
+     * reading single pixels. Caller must hold the GDAL lock.
+     */
+    bool readPixelWindow(GDALRasterBand* band, const std::vector<TileKey>& keys, PixelWindow& out_window)
+    {
+        double cmin = DBL_MAX, cmax = -DBL_MAX, rmin = DBL_MAX, rmax = -DBL_MAX;
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            if (!intersects(keys[i]))
+                continue;
+
+            double xmin, ymin, xmax, ymax;
+            keys[i].getExtent().getBounds(xmin, ymin, xmax, ymax);
+
+            double c0, r0, c1, r1;
+            GDALApplyGeoTransform(_invtransform, xmin, ymax, &c0, &r0);
+            GDALApplyGeoTransform(_invtransform, xmax, ymin, &c1, &r1);
+            cmin = osg::minimum(cmin, osg::minimum(c0, c1));
+            cmax = osg::maximum(cmax, osg::maximum(c0, c1));
+            rmin = osg::minimum(rmin, osg::minimum(r0, r1));
+            rmax = osg::maximum(rmax, osg::maximum(r0, r1));
+        }
+
+        if (cmin > cmax || rmin > rmax)
+            return false;
+
+        int x0 = osg::maximum((int)floor(cmin) - 1, 0);
+        int y0 = osg::maximum((int)floor(rmin) - 1, 0);
+        int x1 = osg::minimum((int)ceil(cmax) + 1, _warpedDS->GetRasterXSize() - 1);
+        int y1 = osg::minimum((int)ceil(rmax) + 1, _warpedDS->GetRasterYSize() - 1);
+        if (x1 < x0 || y1 < y0)
+            return false;
+
+        const double maxPixels = 4.0 * 1024.0 * 1024.0;
+        if ((double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) > maxPixels)
+            return false;
+
+        out_window._x0 = x0;
+        out_window._y0 = y0;
+        out_window._width = x1 - x0 + 1;
+        out_window._height = y1 - y0 + 1;
+        out_window._data.resize(out_window._width * out_window._height);
+
+        return band->RasterIO(GF_Read, x0, y0, out_window._width, out_window._height,
+            &out_window._data[0], out_window._width, out_window._height, GDT_Float32, 0, 0) == CE_None;
+    }
+
+    float getInterpolatedValue(GDALRasterBand *band, double x, double y, const PixelWindow* window =0L)
     {
         double r, c;
         GDALApplyGeoTransform(_invtransform, x, y, &c, &r);
@@ -1319,7 +1497,7 @@ public:
 
         if ( _options.interpolation() == INTERP_NEAREST )
         {
-            band->RasterIO(GF_Read, (int)osg::round(c), (int)osg::round(r), 1, 1, &result, 1, 1, GDT_Float32, 0, 0);
+            result = readPixel(band, window, (int)osg::round(c), (int)osg::round(r));
             if (!isValidValue( result, band))
             {
                 return NO_DATA_VALUE;
@@ -1337,10 +1515,10 @@ public:
 
             float urHeight, llHeight, ulHeight, lrHeight;
 
-            band->RasterIO(GF_Read, colMin, rowMin, 1, 1, &llHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMin, rowMax, 1, 1, &ulHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMin, 1, 1, &lrHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMax, 1, 1, &urHeight, 1, 1, GDT_Float32, 0, 0);
+            llHeight = readPixel(band, window, colMin, rowMin);
+            ulHeight = readPixel(band, window, colMin, rowMax);
+            lrHeight = readPixel(band, window, colMax, rowMin);
+            urHeight = readPixel(band, window, colMax, rowMax);
 
             /*
             if (!isValidValue(urHeight, band)) urHeight = 0.0f;
@@ -1404,6 +1582,38 @@ public:
 
     osg::HeightField* createHeightField( const TileKey& key,
                                          ProgressCallback* progress)
+    {
+        return sampleHeightField(key, 0L);
+    }
+
+    // override
+    // Reads the raster under all the keys once and samples every heightfield
+    // from memory.
+    void createHeightFieldsImpl( const std::vector<TileKey>& keys,
+                                 std::vector< osg::ref_ptr<osg::HeightField> >& out_hfs,
+                                 ProgressCallback* progress)
+    {
+        out_hfs.resize(keys.size());
+
+        GDAL_SCOPED_LOCK;
+
+        PixelWindow window;
+        bool haveWindow = readPixelWindow(_warpedDS->GetRasterBand(1), keys, window);
+
+        for (unsigned i = 0; i < keys.size(); ++i)
+        {
+            if (progress && progress->isCanceled())
+                break;
+            out_hfs[i] = sampleHeightField(keys[i], haveWindow ? &window : 0L);
+        }
+    }
+
+    /**
+     * Samples the heightfield for a key, from the pixel window where it covers
+     * the tile.
+     */
+    osg::HeightField* sampleHeightField( const TileKey& key,
+                                         const PixelWindow* window)
     {
         if (key.getLevelOfDetail() > _maxDataLevel)
         {
@@ -1437,7 +1647,7 @@ public:
                 for (int r = 0; r < tileSize; ++r)
                 {
                     double geoY = ymin + (dy * (double)r);
-                    float h = getInterpolatedValue(band, geoX, geoY);
+                    float h = getInterpolatedValue(band, geoX, geoY, window);
                     hf->setHeight(c, r, h);
                 }
             }
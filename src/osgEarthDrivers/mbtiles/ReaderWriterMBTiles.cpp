@@ -33,6 +33,8 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <map>
+#include <climits>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -159,18 +161,7 @@ public:
         rc = sqlite3_step( select );
         if ( rc == SQLITE_ROW)
         {                     
-            // the pointer returned from _blob gets freed internally by sqlite, supposedly
-            const char* data = (const char*)sqlite3_column_blob( select, 0 );
-            int imageBufLen = sqlite3_column_bytes( select, 0 );
-
-            // deserialize the image from the buffer:
-            std::string imageString( data, imageBufLen );
-            std::stringstream imageBufStream( imageString );
-            osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
-            if (rr.validImage())
-            {
-                result = rr.takeImage();            
-            }
+            result = readTileData( select, 0 );
         }
         else
         {
@@ -183,6 +174,103 @@ public:
 
     }
 
+    // override
+    // Services a batch of keys with one range query per level instead of one
+    // query per tile.
+    void createImagesImpl( const std::vector<TileKey>& keys,
+                           std::vector< osg::ref_ptr<osg::Image> >& out_images,
+                           ProgressCallback* progress )
+    {
+        out_images.resize( keys.size() );
+
+        typedef std::map< int, std::vector<unsigned> > LevelGroups;
+        LevelGroups groups;
+        for( unsigned i = 0; i < keys.size(); ++i )
+        {
+            int z = keys[i].getLevelOfDetail();
+            if ( z < (int)_minLevel || z > (int)_maxLevel )
+                out_images[i] = createImage( keys[i], progress ); // handles the empty/NULL cases
+            else
+                groups[z].push_back( i );
+        }
+
+        for( LevelGroups::const_iterator g = groups.begin(); g != groups.end(); ++g )
+        {
+            int z = g->first;
+            const std::vector<unsigned>& slots = g->second;
+
+            unsigned int numRows, numCols;
+            keys[slots[0]].getProfile()->getNumTiles( z, numCols, numRows );
+
+            // tile range covered by the group, in TMS (flipped) rows:
+            std::vector<int> cols( slots.size() ), rows( slots.size() );
+            int minCol = INT_MAX, maxCol = INT_MIN, minRow = INT_MAX, maxRow = INT_MIN;
+            for( unsigned j = 0; j < slots.size(); ++j )
+            {
+                cols[j] = keys[slots[j]].getTileX();
+                rows[j] = numRows - keys[slots[j]].getTileY() - 1;
+                minCol = osg::minimum( minCol, cols[j] ); maxCol = osg::maximum( maxCol, cols[j] );
+                minRow = osg::minimum( minRow, rows[j] ); maxRow = osg::maximum( maxRow, rows[j] );
+            }
+
+            // a sparse set would drag in too many unwanted tiles; query those one by one.
+            double rangeSize = (double)(maxCol-minCol+1) * (double)(maxRow-minRow+1);
+            if ( slots.size() == 1 || rangeSize > 4.0 * (double)slots.size() )
+            {
+                for( unsigned j = 0; j < slots.size(); ++j )
+                    out_images[slots[j]] = createImage( keys[slots[j]], progress );
+                continue;
+            }
+
+            sqlite3_stmt* select = NULL;
+            std::string query = 
+                "SELECT tile_column, tile_row, tile_data from tiles where zoom_level = ? "
+                "AND tile_column >= ? AND tile_column <= ? AND tile_row >= ? AND tile_row <= ?";
+            int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
+            if ( rc != SQLITE_OK )
+            {
+                OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+                continue;
+            }
+
+            sqlite3_bind_int( select, 1, z );
+            sqlite3_bind_int( select, 2, minCol );
+            sqlite3_bind_int( select, 3, maxCol );
+            sqlite3_bind_int( select, 4, minRow );
+            sqlite3_bind_int( select, 5, maxRow );
+
+            while( sqlite3_step( select ) == SQLITE_ROW )
+            {
+                int col = sqlite3_column_int( select, 0 );
+                int row = sqlite3_column_int( select, 1 );
+                for( unsigned j = 0; j < slots.size(); ++j )
+                {
+                    if ( cols[j] == col && rows[j] == row )
+                    {
+                        out_images[slots[j]] = readTileData( select, 2 );
+                        break;
+                    }
+                }
+            }
+
+            sqlite3_finalize( select );
+        }
+    }
+
+    // deserializes the image stored in a blob column of the current result row.
+    osg::Image* readTileData( sqlite3_stmt* select, int column )
+    {
+        // the pointer returned from _blob gets freed internally by sqlite, supposedly
+        const char* data = (const char*)sqlite3_column_blob( select, column );
+        int imageBufLen = sqlite3_column_bytes( select, column );
+
+        // deserialize the image from the buffer:
+        std::string imageString( data, imageBufLen );
+        std::stringstream imageBufStream( imageString );
+        osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
+        return rr.validImage() ? rr.takeImage() : 0L;
+    }
+
     bool getMetaData( const std::string& key, std::string& value )
     {
         //get the metadata
@@ -22,6 +22,9 @@
 #include <osgEarth/HTTPClient>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/TaskService>
+
+#include <OpenThreads/Atomic>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -35,6 +38,7 @@
 #include <osgDB/WriteFile>
 
 #include <sstream>
+#include <algorithm>
 
 #include "VPBOptions"
 
@@ -140,6 +144,49 @@ public:
 };
 
 
+namespace
+{
+    /** Approximate memory footprint of a terrain tile's layers, for cache accounting. */
+    unsigned int computeTileSize( osgTerrain::TerrainTile* tile )
+    {
+        unsigned int bytes = 1024; // nominal overhead of the tile itself
+        if ( !tile )
+            return bytes;
+
+        for( unsigned int i=0; i<tile->getNumColorLayers(); ++i )
+        {
+            osgTerrain::Layer* layer = tile->getColorLayer(i);
+            osgTerrain::SwitchLayer* switchLayer = dynamic_cast<osgTerrain::SwitchLayer*>(layer);
+            unsigned int numLayers = switchLayer ? switchLayer->getNumLayers() : 1;
+            for( unsigned int j=0; j<numLayers; ++j )
+            {
+                osgTerrain::ImageLayer* imageLayer = dynamic_cast<osgTerrain::ImageLayer*>(
+                    switchLayer ? switchLayer->getLayer(j) : layer );
+                if ( imageLayer && imageLayer->getImage() )
+                    bytes += imageLayer->getImage()->getImageSizeInBytes();
+            }
+        }
+
+        osgTerrain::HeightFieldLayer* hfLayer = dynamic_cast<osgTerrain::HeightFieldLayer*>(tile->getElevationLayer());
+        if ( hfLayer && hfLayer->getHeightField() )
+            bytes += hfLayer->getHeightField()->getNumColumns() * hfLayer->getHeightField()->getNumRows() * sizeof(float);
+
+        return bytes;
+    }
+
+    TaskService* getPrefetchTaskService()
+    {
+        static Threading::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        Threading::ScopedMutexLock lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "VPB prefetch", 2 );
+        return s_service.get();
+    }
+}
+
+
 class VPBDatabase : public osg::Referenced
 {
 public:
@@ -147,9 +194,14 @@ public:
         _options( in_options ),
         //_directory_structure( FLAT_TASK_DIRECTORIES ),
         _profile( osgEarth::Registry::instance()->getGlobalGeodeticProfile() ),
-        _maxNumTilesInCache( 128 ),
+        _maxCacheBytes( 0 ),
+        _cacheBytes( 0 ),
+        _accessClock( 0 ),
         _initialized( false )
     {
+        // computed in size_t, since a cache of 4GB or more overflows 32 bits.
+        size_t megabytes = (size_t)osg::maximum( _options.tileCacheSizeMB().value(), 1 );
+        _maxCacheBytes = osg::minimum( megabytes, ((size_t)~0) >> 20 ) << 20;
 	}
 	
 	void initialize( const std::string& referenceURI)
@@ -349,18 +401,12 @@ public:
 
         osgTerrain::TileID tileID(level, tile_x, tile_y);
 
-        findTile(tileID, false, out_tile);
-        if (out_tile.valid()) 
+        if ( findTile(tileID, out_tile) )
             return;
 
         std::string filename = createTileName(level, tile_x, tile_y);
         
-        bool foundInBlacklist = false;
-        {
-            Threading::ScopedReadLock sharedLock( _blacklistMutex );
-            foundInBlacklist = _blacklistedFilenames.count(filename) == 1;
-        }
-        if ( foundInBlacklist )
+        if ( isBlacklisted(filename) )
         {
             OE_DEBUG << LC << "file has been found in black list : "<<filename<<std::endl;
             insertTile(tileID, 0);
@@ -375,7 +421,52 @@ public:
         //        return 0;
         //    }
         //}
-        
+
+        HTTPClient::ResultCode result = loadTileFile( filename, tileID, progress, out_tile );
+
+        // warm the cache with the neighboring files that share our parent's parent. (The
+        // other tiles in this tile's own file came in with the read above.)
+        if ( result == HTTPClient::RESULT_OK && _options.prefetch() == true )
+        {
+            prefetchSiblings( level, tile_x, tile_y );
+        }
+    }
+
+    /**
+     * Loads a database file and caches all the terrain tiles it contains. If another
+     * thread (e.g. a prefetch) is already loading the same file, waits for it instead.
+     */
+    HTTPClient::ResultCode loadTileFile( const std::string& filename, const osgTerrain::TileID& tileID,
+                                         ProgressCallback* progress, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile )
+    {
+        osg::ref_ptr<PendingLoad> pending;
+        bool loadHere = false;
+        {
+            Threading::ScopedMutexLock lock( _pendingMutex );
+            _queuedPrefetches.erase( filename );
+            PendingLoads::iterator i = _pendingLoads.find( filename );
+            if ( i != _pendingLoads.end() )
+            {
+                pending = i->second.get();
+            }
+            else
+            {
+                pending = new PendingLoad();
+                _pendingLoads[filename] = pending.get();
+                loadHere = true;
+            }
+        }
+
+        if ( !loadHere )
+        {
+            // take the tile from the loader rather than the cache, which may have
+            // pruned it already.
+            pending->_done.wait();
+            PendingLoad::Tiles::const_iterator i = pending->_tiles.find( tileID );
+            if ( i != pending->_tiles.end() )
+                out_tile = i->second.get();
+            return pending->_result;
+        }
 
         osg::ref_ptr<osgDB::ReaderWriter::Options> localOptions = new osgDB::ReaderWriter::Options;
         localOptions->setPluginData("osgearth_vpb Plugin",(void*)(1));
@@ -390,8 +481,8 @@ public:
             CollectTiles ct;
             node->accept(ct);
 
-            int base_x = (tile_x / 2) * 2;
-            int base_y = (tile_y / 2) * 2;
+            int base_x = (tileID.x / 2) * 2;
+            int base_y = (tileID.y / 2) * 2;
             
             double min_x, max_x, min_y, max_y;
             ct.getRange(min_x, min_y, max_x, max_y);
@@ -410,10 +501,11 @@ public:
                     
                     int local_x = base_x + ((projected.x() > center_x) ? 1 : 0);
                     int local_y = base_y + ((projected.y() > center_y) ? 1 : 0);
-                    osgTerrain::TileID local_tileID(level, local_x, local_y);
+                    osgTerrain::TileID local_tileID(tileID.level, local_x, local_y);
                     
                     tile->setTileID(local_tileID);
                     insertTile(local_tileID, tile);
+                    pending->_tiles[local_tileID] = tile;
 
                     if ( local_tileID == tileID )
                         out_tile = tile;
@@ -431,9 +523,82 @@ public:
                 _blacklistedFilenames.insert( filename );
             }
         }
-        
-        //TODO: just return it instead...
-        //findTile(tileID, false, out_tile);
+
+        {
+            Threading::ScopedMutexLock lock( _pendingMutex );
+            _pendingLoads.erase( filename );
+        }
+        pending->_result = result;
+        pending->_done.set();
+
+        return result;
+    }
+
+    /**
+     * Queues background loads of the three database files neighboring this tile's file.
+     * A file holds a 2x2 block of tiles that are all cached when it's read, so there is
+     * nothing left to prefetch within the file itself; the next requests are most likely
+     * to land in the adjacent blocks.
+     */
+    void prefetchSiblings( int level, unsigned int tile_x, unsigned int tile_y )
+    {
+        if ( level == 0 )
+            return;
+
+        unsigned int numTilesWide, numTilesHigh;
+        _profile->getNumTiles( level, numTilesWide, numTilesHigh );
+
+        // each file holds a 2x2 block of tiles; its siblings are the other blocks
+        // that descend from the same tile two levels up.
+        unsigned int block_x = tile_x / 2, block_y = tile_y / 2;
+        for( unsigned int n=1; n<4; ++n )
+        {
+            unsigned int sx = (block_x ^ (n & 1)) * 2;
+            unsigned int sy = (block_y ^ (n >> 1)) * 2;
+            if ( sx >= numTilesWide || sy >= numTilesHigh )
+                continue;
+
+            osgTerrain::TileID siblingID( level, sx, sy );
+            osg::ref_ptr<osgTerrain::TerrainTile> cached;
+            if ( findTile(siblingID, cached, false) )
+                continue;
+
+            std::string filename = createTileName( level, sx, sy );
+            if ( isBlacklisted(filename) )
+                continue;
+            {
+                // skip files that are already loading or waiting in the prefetch queue.
+                Threading::ScopedMutexLock lock( _pendingMutex );
+                if ( _pendingLoads.find(filename) != _pendingLoads.end() ||
+                     !_queuedPrefetches.insert(filename).second )
+                    continue;
+            }
+
+            ParallelTask<PrefetchTask>* task = new ParallelTask<PrefetchTask>();
+            task->_db       = this;
+            task->_filename = filename;
+            task->_tileID   = siblingID;
+            getPrefetchTaskService()->add( task );
+        }
+    }
+
+    /** Runs a queued prefetch, unless a foreground load has cached the file since. */
+    void prefetchTileFile( const std::string& filename, const osgTerrain::TileID& tileID )
+    {
+        osg::ref_ptr<osgTerrain::TerrainTile> tile;
+        if ( findTile(tileID, tile, false) )
+        {
+            Threading::ScopedMutexLock lock( _pendingMutex );
+            _queuedPrefetches.erase( filename );
+            return;
+        }
+        loadTileFile( filename, tileID, 0L, tile );
+    }
+
+    bool isBlacklisted( const std::string& filename )
+    {
+        Threading::ScopedReadLock sharedLock( _blacklistMutex );
+        return _blacklistedFilenames.count(filename) == 1;
     }
     
     void insertTile(const osgTerrain::TileID& tileID, osgTerrain::TerrainTile* tile)
@@ -442,22 +607,18 @@ public:
 
         if ( _tileMap.find(tileID) == _tileMap.end() )
         {
-            _tileMap[tileID] = tile;
+            CacheEntry& entry = _tileMap[tileID];
+            entry._tile = tile;
+            entry._bytes = computeTileSize( tile );
+            entry._lastUsed = ++_accessClock;
+            _cacheBytes += entry._bytes;
 
-            _tileFIFO.push_back(tileID);
-
-            if (_tileFIFO.size() > _maxNumTilesInCache)
-            {
-                osgTerrain::TileID tileToRemove = _tileFIFO.front();
-                _tileFIFO.pop_front();
-                _tileMap.erase(tileToRemove);
-
-                OE_DEBUG << LC << "Pruned tileID ("<<TileKey::getLOD(tileID)<<", "<<tileID.x<<", "<<tileID.y<<")"<<std::endl;
-            }
+            if ( _cacheBytes > _maxCacheBytes )
+                pruneTiles();
 
             OE_DEBUG << LC << "insertTile ("
                 << TileKey::getLOD(tileID)<<", "<<tileID.x<<", "<<tileID.y<<") " 
-                << " tileFIFO.size()=="<<_tileFIFO.size()<<std::endl;
+                << " cache bytes=="<<_cacheBytes<<std::endl;
         }
         else
         {
@@ -467,21 +628,23 @@ public:
         }
     }
 
-    void findTile(const osgTerrain::TileID& tileID, bool insertBlankTileIfNotFound, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile)
+    /**
+     * Looks up a tile (which may be a NULL placeholder for a missing one) and, if "touch"
+     * is set, bumps its access stamp. Lookups share the read lock, so the stamp is
+     * approximate: two concurrent hits may store their clock values out of order, which
+     * only perturbs the eviction order among tiles used in the same instant.
+     */
+    bool findTile(const osgTerrain::TileID& tileID, osg::ref_ptr<osgTerrain::TerrainTile>& out_tile, bool touch =true)
     {
-        // read with a shared lock
-        {
-            Threading::ScopedReadLock sharedLock( _tileMapMutex );
-            TileMap::iterator itr = _tileMap.find(tileID);
-            if (itr != _tileMap.end())
-                out_tile = itr->second.get();
-        }
-
-        // upgrade lock and write:
-        if (insertBlankTileIfNotFound) 
-            insertTile(tileID, 0);
-
-        //return 0;
+        Threading::ScopedReadLock sharedLock( _tileMapMutex );
+        TileMap::iterator itr = _tileMap.find(tileID);
+        if (itr == _tileMap.end())
+            return false;
+
+        if ( touch )
+            itr->second._lastUsed = ++_accessClock;
+        out_tile = itr->second._tile.get();
+        return true;
     }
 
     const VPBOptions _options;
@@ -494,14 +657,72 @@ public:
     osg::ref_ptr<const Profile> _profile;
     osg::ref_ptr<osg::Node> _rootNode;
     
-    unsigned int _maxNumTilesInCache;
+    struct CacheEntry
+    {
+        CacheEntry() : _bytes(0), _lastUsed(0) { }
+        osg::ref_ptr<osgTerrain::TerrainTile> _tile;
+        unsigned int _bytes;
+        unsigned int _lastUsed; // value of _accessClock at the last access
+    };
+
+    /** Evicts the least recently used tiles until the cache is back under its low-water mark. */
+    void pruneTiles() // call with _tileMapMutex write-locked
+    {
+        typedef std::pair<unsigned int, osgTerrain::TileID> Stamp;
+        std::vector<Stamp> stamps;
+        stamps.reserve( _tileMap.size() );
+        for( TileMap::iterator i = _tileMap.begin(); i != _tileMap.end(); ++i )
+            stamps.push_back( Stamp(i->second._lastUsed, i->first) );
+
+        std::sort( stamps.begin(), stamps.end() );
+
+        // evicting down to 90% amortizes the sort over many inserts.
+        size_t lowWater = _maxCacheBytes - _maxCacheBytes/10;
+        for( unsigned int i=0; i<stamps.size() && _cacheBytes > lowWater; ++i )
+        {
+            TileMap::iterator itr = _tileMap.find( stamps[i].second );
+            _cacheBytes -= itr->second._bytes;
+            _tileMap.erase( itr );
+
+            OE_DEBUG << LC << "Pruned tileID ("<<TileKey::getLOD(stamps[i].second)<<", "<<stamps[i].second.x<<", "<<stamps[i].second.y<<")"<<std::endl;
+        }
+    }
+
+    struct PendingLoad : public osg::Referenced
+    {
+        PendingLoad() : _result( HTTPClient::RESULT_OK ) { }
+        Threading::Event _done;
+        HTTPClient::ResultCode _result;
+
+        // the tiles the file contained; written by the loader before _done is set.
+        typedef std::map<osgTerrain::TileID, osg::ref_ptr<osgTerrain::TerrainTile> > Tiles;
+        Tiles _tiles;
+    };
+
+    struct PrefetchTask
+    {
+        void execute()
+        {
+            _db->prefetchTileFile( _filename, _tileID );
+        }
+
+        osg::ref_ptr<VPBDatabase> _db;
+        std::string _filename;
+        osgTerrain::TileID _tileID;
+    };
+
+    size_t _maxCacheBytes;
+    size_t _cacheBytes;
+    OpenThreads::Atomic _accessClock; // bumped under the shared lock by findTile
     
-    typedef std::map<osgTerrain::TileID, osg::ref_ptr<osgTerrain::TerrainTile> > TileMap;
+    typedef std::map<osgTerrain::TileID, CacheEntry> TileMap;
     TileMap _tileMap;
     Threading::ReadWriteMutex _tileMapMutex;
-    
-    typedef std::list<osgTerrain::TileID> TileIDList;
-    TileIDList _tileFIFO;
+
+    typedef std::map<std::string, osg::ref_ptr<PendingLoad> > PendingLoads;
+    PendingLoads _pendingLoads;
+    std::set<std::string> _queuedPrefetches; // queued on the task service, not started yet
+    Threading::Mutex _pendingMutex;
     
     typedef std::set<std::string> StringSet;
     StringSet _blacklistedFilenames;
@@ -21,6 +21,7 @@
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgEarth/Registry>
 #include <osgEarth/XmlUtils>
+#include <osgEarth/TaskService>
 #include <osgEarthUtil/WMS>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -28,11 +29,16 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osg/ImageSequence>
+#include <osg/observer_ptr>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <iomanip>
+#include <list>
+#include <map>
 
 #include "TileService"
 #include "WMSOptions"
@@ -43,17 +49,150 @@ using namespace osgEarth::Drivers;
 
 // All looping ImageSequences deriving from this class will by in sync due to
 // a shared reference time.
+//
+// Frames may be delivered from other threads, in any order, with setFrame().
+// They join the sequence (in order) on the next update, so a loop starts
+// playing as soon as its first frames arrive and grows as the rest come in.
 class SyncImageSequence : public osg::ImageSequence {
 public:
-    SyncImageSequence() { }
+    SyncImageSequence() : _next(0), _numAdded(0), _secondsPerFrame(1.0) { }
+
+    /** Prepares to receive "numFrames" frames. */
+    void initFrames( unsigned numFrames, double secondsPerFrame ) {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _frameMutex );
+        _frames.assign( numFrames, 0L );
+        _states.assign( numFrames, FRAME_PENDING );
+        _next = 0;
+        _numAdded = 0;
+        _secondsPerFrame = secondsPerFrame;
+    }
+
+    /** Delivers a frame; NULL means it could not be fetched. Thread-safe. */
+    void setFrame( unsigned index, osg::Image* image ) {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _frameMutex );
+        if ( index < _frames.size() ) {
+            _frames[index] = image;
+            _states[index] = image ? FRAME_READY : FRAME_FAILED;
+        }
+    }
+
+    /** Moves the frames that have arrived so far, in order, into the sequence. */
+    void flushFrames() {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _frameMutex );
+        unsigned numAdded = _numAdded;
+        for( ; _next < _frames.size() && _states[_next] != FRAME_PENDING; ++_next ) {
+            if ( _states[_next] == FRAME_READY ) {
+                addImage( _frames[_next].get() );
+                _frames[_next] = 0L;
+                ++_numAdded;
+            }
+        }
+        if ( _numAdded != numAdded )
+            setLength( _secondsPerFrame * (double)_numAdded );
+    }
 
     virtual void update(osg::NodeVisitor* nv) {
+        flushFrames();
         setReferenceTime( 0.0 );
         osg::ImageSequence::update( nv );
     }
+
+private:
+    enum FrameState { FRAME_PENDING, FRAME_READY, FRAME_FAILED };
+
+    OpenThreads::Mutex                      _frameMutex;
+    std::vector< osg::ref_ptr<osg::Image> > _frames;
+    std::vector< FrameState >               _states;
+    unsigned                                _next;
+    unsigned                                _numAdded;
+    double                                  _secondsPerFrame;
 };
 
 
+namespace
+{
+    /**
+     * Process-wide LRU cache of decoded WMS-T frames. Frames are keyed by their
+     * full request URI, which includes the TIME value, so moving the time window
+     * only misses on the frames that are actually new.
+     */
+    class WMSFrameCache
+    {
+    public:
+        WMSFrameCache() : _capacity( 256 ) { }
+
+        void setCapacity( unsigned capacity ) {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _capacity = capacity;
+            trim();
+        }
+
+        bool get( const std::string& key, osg::ref_ptr<osg::Image>& out_image ) {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Table::iterator i = _table.find( key );
+            if ( i == _table.end() )
+                return false;
+            _lru.splice( _lru.begin(), _lru, i->second.second );
+            out_image = i->second.first.get();
+            return true;
+        }
+
+        void put( const std::string& key, osg::Image* image ) {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            if ( _capacity == 0 || !image )
+                return;
+            Table::iterator i = _table.find( key );
+            if ( i != _table.end() ) {
+                _lru.erase( i->second.second );
+                _table.erase( i );
+            }
+            _lru.push_front( key );
+            _table[key] = Entry( image, _lru.begin() );
+            trim();
+        }
+
+    private:
+        void trim() {
+            while( _table.size() > _capacity ) {
+                _table.erase( _lru.back() );
+                _lru.pop_back();
+            }
+        }
+
+        typedef std::list<std::string> LRU;
+        typedef std::pair< osg::ref_ptr<osg::Image>, LRU::iterator > Entry;
+        typedef std::map<std::string, Entry> Table;
+
+        OpenThreads::Mutex _mutex;
+        unsigned           _capacity;
+        LRU                _lru;
+        Table              _table;
+    };
+
+    WMSFrameCache& getFrameCache()
+    {
+        static WMSFrameCache s_cache;
+        return s_cache;
+    }
+
+    // Frame task priorities (lower values run first): frames that a caller is
+    // waiting on run ahead of frames that are streamed into a sequence.
+    const float PRI_FOREGROUND_FRAME = 0.0f;
+    const float PRI_BACKGROUND_FRAME = 1000.0f;
+
+    TaskService* getFrameTaskService()
+    {
+        static OpenThreads::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "WMS frames", 8 );
+        return s_service.get();
+    }
+}
+
+
 class WMSSource : public TileSource
 {
 public:
@@ -71,6 +210,9 @@ public:
         // localize it since we might override them:
         _formatToUse = _options.format().value();
         _srsToUse = _options.srs().value();
+
+        if ( _options.frameCacheSize().isSet() )
+            getFrameCache().setCapacity( *_options.frameCacheSize() );
     }
 
     /** override */
@@ -266,13 +408,7 @@ public:
     {
         osgDB::ReaderWriter* result = 0L;
 
-        std::string uri = createURI(key);
-        if ( !extraAttrs.empty() )
-        {
-            std::string delim = uri.find("?") == std::string::npos ? "?" : "&";
-            uri = uri + delim + extraAttrs;
-        }
-
+        std::string uri = createURI(key, extraAttrs);
 
         out_response = HTTPClient::get( uri, 0L, progress ); //getOptions(), progress );
 
@@ -344,43 +480,147 @@ public:
         return image.release();
     }
 
+    /** fetches (or recalls from the frame cache) the image for the rth time value. */
+    osg::Image* fetchFrame( const TileKey& key, unsigned r, ProgressCallback* progress )
+    {
+        std::string extraAttrs = "TIME=" + _timesVec[r];
+        std::string cacheKey = createURI( key, extraAttrs );
+
+        osg::ref_ptr<osg::Image> image;
+        if ( getFrameCache().get(cacheKey, image) )
+            return image.release();
+
+        HTTPResponse response;
+        osgDB::ReaderWriter* reader = fetchTileAndReader( key, extraAttrs, progress, response );
+        if ( reader )
+        {
+            osgDB::ReaderWriter::ReadResult readResult = reader->readImage( response.getPartStream( 0 ), 0L ); //getOptions() );
+            if ( readResult.error() ) {
+                OE_WARN << "WMS: image read failed for " << createURI(key) << std::endl;
+            }
+            else {
+                image = readResult.getImage();
+                getFrameCache().put( cacheKey, image.get() );
+            }
+        }
+
+        return image.release();
+    }
+
+    /**
+     * Progress callback for a background frame fetch: cancels it once nobody wants
+     * the frame anymore, i.e. when the sequence it belongs to (which lives as long
+     * as the tile that requested it) or this source has been deleted.
+     */
+    struct BackgroundFrameProgress : public ProgressCallback
+    {
+        BackgroundFrameProgress( WMSSource* source, SyncImageSequence* seq ) : _source(source), _seq(seq) { }
+
+        bool reportProgress( double current, double total, const std::string& msg )
+        {
+            if ( !_source.valid() || !_seq.valid() )
+                cancel();
+            return isCanceled();
+        }
+
+        osg::observer_ptr<WMSSource>         _source;
+        osg::observer_ptr<SyncImageSequence> _seq;
+    };
+
+    /**
+     * Fetches one frame on a task thread; delivers it to a sequence and/or an output slot.
+     * Only observes the source and the sequence, so a queued task doesn't keep them alive.
+     */
+    struct FrameTask
+    {
+        void init( WMSSource* source, const TileKey& key, unsigned index,
+                   SyncImageSequence* seq, osg::ref_ptr<osg::Image>* output,
+                   ProgressCallback* progress )
+        {
+            _source   = source;
+            _key      = key;
+            _index    = index;
+            _seq      = seq;
+            _output   = output;
+            _progress = progress;
+        }
+
+        void execute()
+        {
+            // skip the fetch if the frame was abandoned while it sat in the queue.
+            if ( _progress.valid() && (_progress->isCanceled() || _progress->reportProgress(0, 0)) )
+                return;
+
+            osg::ref_ptr<WMSSource> source = _source.get();
+            if ( !source.valid() )
+                return;
+
+            osg::ref_ptr<osg::Image> image = source->fetchFrame( _key, _index, _progress.get() );
+            if ( _output )
+                *_output = image.get();
+
+            osg::ref_ptr<SyncImageSequence> seq = _seq.get();
+            if ( seq.valid() )
+                seq->setFrame( _index, image.get() );
+        }
+
+        osg::observer_ptr<WMSSource>         _source;
+        TileKey                              _key;
+        unsigned                             _index;
+        osg::observer_ptr<SyncImageSequence> _seq;
+        osg::ref_ptr<osg::Image>*            _output;
+        osg::ref_ptr<ProgressCallback>       _progress;
+    };
+
     /** creates a 3D image from timestamped data. */
     osg::Image* createImage3D( const TileKey& key, ProgressCallback* progress )
     {
         osg::ref_ptr<osg::Image> image;
 
-        for( unsigned int r=0; r<_timesVec.size(); ++r )
+        // fetch all the frames at once, the first one on this thread:
+        std::vector< osg::ref_ptr<osg::Image> > frames( _timesVec.size() );
+        if ( frames.size() > 1 )
         {
-            std::string extraAttrs = "TIME=" + _timesVec[r];
-            HTTPResponse response;
-            osgDB::ReaderWriter* reader = fetchTileAndReader( key, extraAttrs, progress, response );
-            if ( reader )
+            // these frames are waited on, so they go ahead of any background ones.
+            // They share the request's progress callback, so canceling the request
+            // cancels their fetches too.
+            Threading::MultiEvent semaphore( frames.size() - 1 );
+            for( unsigned int r=1; r<frames.size(); ++r )
             {
-                osgDB::ReaderWriter::ReadResult readResult = reader->readImage( response.getPartStream( 0 ), 0L ); //getOptions() );
-                if ( readResult.error() ) {
-                    OE_WARN << "WMS: image read failed for " << createURI(key) << std::endl;
-                }
-                else
-                {
-                    osg::ref_ptr<osg::Image> timeImage = readResult.getImage();
-
-                    if ( !image.valid() )
-                    {
-                        image = new osg::Image();
-                        image->allocateImage(
-                            timeImage->s(), timeImage->t(), _timesVec.size(),
-                            timeImage->getPixelFormat(),
-                            timeImage->getDataType(),
-                            timeImage->getPacking() );
-                        image->setInternalTextureFormat( timeImage->getInternalTextureFormat() );
-                    }
+                ParallelTask<FrameTask>* task = new ParallelTask<FrameTask>( &semaphore );
+                task->init( this, key, r, 0L, &frames[r], progress );
+                task->setPriority( PRI_FOREGROUND_FRAME );
+                getFrameTaskService()->add( task );
+            }
+            frames[0] = fetchFrame( key, 0, progress );
+            semaphore.wait();
+        }
+        else if ( frames.size() == 1 )
+        {
+            frames[0] = fetchFrame( key, 0, progress );
+        }
 
-                    memcpy( 
-                        image->data(0,0,r), 
-                        timeImage->data(), 
-                        osg::minimum(image->getImageSizeInBytes(), timeImage->getImageSizeInBytes()) );
-                }
+        for( unsigned int r=0; r<frames.size(); ++r )
+        {
+            osg::Image* timeImage = frames[r].get();
+            if ( !timeImage )
+                continue;
+
+            if ( !image.valid() )
+            {
+                image = new osg::Image();
+                image->allocateImage(
+                    timeImage->s(), timeImage->t(), _timesVec.size(),
+                    timeImage->getPixelFormat(),
+                    timeImage->getDataType(),
+                    timeImage->getPacking() );
+                image->setInternalTextureFormat( timeImage->getInternalTextureFormat() );
             }
+
+            memcpy( 
+                image->data(0,0,r), 
+                timeImage->data(), 
+                osg::minimum(image->getImageSizeInBytes(), timeImage->getImageSizeInBytes()) );
         }
 
         return image.release();
@@ -410,36 +650,36 @@ public:
     //    return seq;
     //}
 
-    /** creates a 3D image from timestamped data. */
+    /** creates an image sequence from timestamped data. */
     osg::Image* createImageSequence( const TileKey& key, ProgressCallback* progress )
     {
-        osg::ImageSequence* seq = new SyncImageSequence(); //osg::ImageSequence();
+        osg::ref_ptr<SyncImageSequence> seq = new SyncImageSequence(); //osg::ImageSequence();
 
         seq->setLoopingMode( osg::ImageStream::LOOPING );
-        seq->setLength( _options.secondsPerFrame().value() * (double)_timesVec.size() );
+        seq->initFrames( _timesVec.size(), _options.secondsPerFrame().value() );
         seq->play();
 
-        for( unsigned int r=0; r<_timesVec.size(); ++r )
+        // The rest of the frames are fetched in the background and join the
+        // sequence as they arrive. Only the first one is fetched here, so the
+        // tile has something to show when we return. The background fetches
+        // are dropped if the sequence is released before they finish.
+        osg::ref_ptr<ProgressCallback> backgroundProgress = new BackgroundFrameProgress( this, seq.get() );
+        for( unsigned int r=1; r<_timesVec.size(); ++r )
         {
-            std::string extraAttrs = "TIME=" + _timesVec[r];
+            ParallelTask<FrameTask>* task = new ParallelTask<FrameTask>();
+            task->init( this, key, r, seq.get(), 0L, backgroundProgress.get() );
+            task->setPriority( PRI_BACKGROUND_FRAME + (float)r );
+            getFrameTaskService()->add( task );
+        }
 
-            HTTPResponse response;
-            osgDB::ReaderWriter* reader = fetchTileAndReader( key, extraAttrs, progress, response );
-            if ( reader )
-            {
-                osgDB::ReaderWriter::ReadResult readResult = reader->readImage( response.getPartStream( 0 ), 0L ); //getOptions() );
-                if ( !readResult.error() )
-                {
-                    seq->addImage( readResult.getImage() );
-                }
-                else
-                {
-                    OE_WARN << "WMS: image read failed for " << createURI(key) << std::endl;
-                }
-            }
+        if ( _timesVec.size() > 0 )
+        {
+            osg::ref_ptr<osg::Image> first = fetchFrame( key, 0, progress );
+            seq->setFrame( 0, first.get() );
+            seq->flushFrames();
         }
 
-        return seq;
+        return seq.release();
     }
 
 
@@ -466,6 +706,17 @@ public:
     }
 
 
+    std::string createURI( const TileKey& key, const std::string& extraAttrs ) const
+    {
+        std::string uri = createURI(key);
+        if ( !extraAttrs.empty() )
+        {
+            std::string delim = uri.find("?") == std::string::npos ? "?" : "&";
+            uri = uri + delim + extraAttrs;
+        }
+        return uri;
+    }
+
     std::string createURI( const TileKey& key ) const
     {
         double minx, miny, maxx, maxy;
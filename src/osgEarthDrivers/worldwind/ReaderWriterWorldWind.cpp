@@ -157,7 +157,6 @@ public:
             unsigned int part_num = out_response.getNumParts() > 1? 1 : 0;
             std::string zipfilename;
             out_response.getPartHeader(part_num, zipfilename);
-            std::istream& input_stream = out_response.getPartStream( part_num );
 
             if ( !osgDB::fileExists(cachefilepath) )
             {
@@ -173,14 +172,7 @@ public:
                 _options.elevationCachePath().unset();
                 return NULL;
             }
-            input_stream.seekg (0, std::ios::end);
-            int length = input_stream.tellg();
-            input_stream.seekg (0, std::ios::beg);
-
-            char *buffer = new char[length];
-            input_stream.read(buffer, length);
-            fout.write(buffer, length);
-            delete[] buffer;
+            fout.write(out_response.getPartData(part_num), out_response.getPartSize(part_num));
             fout.close();
 
 
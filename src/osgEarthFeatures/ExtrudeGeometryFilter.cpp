@@ -26,7 +26,10 @@
 #include <osgUtil/Optimizer>
 #include <osgUtil/SmoothingVisitor>
 #include <osg/Version>
+#include <osg/TriangleIndexFunctor>
 #include <osgEarth/Version>
+#include <osgEarth/TaskService>
+#include <OpenThreads/Thread>
 
 #define LC "[ExtrudeGeometryFilter] "
 
@@ -41,7 +44,9 @@ _mergeGeometry( false ),
 _height( 10.0 ),
 _flatten( true ),
 _wallAngleThresh_deg( 60.0 ),
-_color( osg::Vec4f(1, 1, 1, 1) )
+_color( osg::Vec4f(1, 1, 1, 1) ),
+_useBatching( true ),
+_numBatchThreads( 0 )
 {
     reset();
 }
@@ -334,6 +339,38 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
     return made_geom;
 }
 
+float
+ExtrudeGeometryFilter::getExtrusionHeight( Feature* input, const FilterContext& context )
+{
+    if ( _heightCallback.valid() )
+    {
+        return _heightCallback->operator()(input, context);
+    }
+    else if ( _heightAttr.isSet() )
+    {
+        return input->getDouble(*_heightAttr, _height);
+    }
+    else if ( _heightExpr.isSet() )
+    {
+        return input->eval( _heightExpr.mutable_value() );
+    }
+    else
+    {
+        return _height;
+    }
+}
+
+float
+ExtrudeGeometryFilter::getHeightOffset( Feature* input, const FilterContext& context )
+{
+    float offset = 0.0;
+    if ( _heightOffsetExpr.isSet() )
+    {
+        offset = input->eval( _heightOffsetExpr.mutable_value() );
+    }
+    return offset;
+}
+
 bool
 ExtrudeGeometryFilter::pushFeature( Feature* input, const FilterContext& context )
 {
@@ -356,30 +393,8 @@ ExtrudeGeometryFilter::pushFeature( Feature* input, const FilterContext& context
             static_cast<Polygon*>(part)->open();
         }
 
-        float height;
-
-        if ( _heightCallback.valid() )
-        {
-            height = _heightCallback->operator()(input, context);
-        }
-        else if ( _heightAttr.isSet() )
-        {
-            height = input->getDouble(*_heightAttr, _height);
-        }
-        else if ( _heightExpr.isSet() )
-        {
-            height = input->eval( _heightExpr.mutable_value() );
-        }
-        else
-        {
-            height = _height;
-        }
-
-        float offset = 0.0;
-        if ( _heightOffsetExpr.isSet() )
-        {
-            offset = input->eval( _heightOffsetExpr.mutable_value() );
-        }
+        float height = getExtrusionHeight( input, context );
+        float offset = getHeightOffset( input, context );
 
         if ( extrudeGeometry( part, height, offset, _flatten, walls.get(), rooflines.get(), 0L, _color, context ) )
         {      
@@ -466,6 +481,458 @@ ExtrudeGeometryFilter::pushFeature( Feature* input, const FilterContext& context
     return true;
 }
 
+//------------------------------------------------------------------------
+
+namespace
+{
+    /**
+     * One extrudable part of a feature, along with its reserved ranges in the
+     * combined wall and roof buffers.
+     */
+    struct ExtrusionPart
+    {
+        const Geometry*        _geom;
+        bool                   _closed;
+        bool                   _hasRoof;
+        double                 _height;
+        double                 _offset;
+        unsigned               _numPoints;
+        unsigned               _wallVertOffset;
+        unsigned               _wallIndexOffset;
+        unsigned               _roofVertOffset;
+        std::vector<GLuint>    _roofIndices;    // relative to _roofVertOffset
+        std::vector<osg::Vec3> _roofExtraVerts; // verts added by the tessellator
+    };
+
+    typedef std::vector<ExtrusionPart> ExtrusionPartVector;
+
+    /** Combined output buffers for a batch. */
+    struct ExtrusionBuffers
+    {
+        osg::ref_ptr<osg::Vec3Array>        _wallVerts;
+        osg::ref_ptr<osg::Vec3Array>        _wallNormals;
+        osg::ref_ptr<osg::DrawElementsUInt> _wallIndices;
+        osg::ref_ptr<osg::Vec3Array>        _roofVerts;
+        osg::ref_ptr<osg::Vec3Array>        _roofNormals;
+    };
+
+    /** Number of wall segments the extruder will generate for a ring. */
+    unsigned countSegments( const Geometry* ring, bool closed )
+    {
+        unsigned n = ring->size();
+        return n < 2 ? 0 : closed ? n : n-1;
+    }
+
+    /** Gathers the output of the tessellator as a flat triangle list. */
+    struct TriangleCollector
+    {
+        std::vector<GLuint>* _out;
+        void operator()( unsigned i0, unsigned i1, unsigned i2 )
+        {
+            _out->push_back( i0 );
+            _out->push_back( i1 );
+            _out->push_back( i2 );
+        }
+    };
+
+    inline osg::Vec3 smoothNormal( const osg::Vec3& n, const osg::Vec3& neighbor, double cosThreshold )
+    {
+        if ( n * neighbor >= cosThreshold )
+        {
+            osg::Vec3 s = n + neighbor;
+            s.normalize();
+            return s;
+        }
+        return n;
+    }
+
+    /**
+     * Extrudes one part into its reserved ranges of the combined buffers. This
+     * produces the same positions as ExtrudeGeometryFilter::extrudeGeometry,
+     * but emits four vertices per wall segment and computes the crease-angle
+     * normals directly instead of running the SmoothingVisitor afterwards.
+     */
+    void extrudePart(
+        ExtrusionPart&       part,
+        ExtrusionBuffers&    buf,
+        const FilterContext& cx,
+        bool                 flatten,
+        double               cosWallAngle )
+    {
+        double height = part._height;
+
+        // establish the target length for extrusion:
+        double targetLen = -DBL_MAX;
+        ConstGeometryIterator zfinder( part._geom );
+        while( zfinder.hasMore() )
+        {
+            const Geometry* ring = zfinder.next();
+            for( Geometry::const_iterator m = ring->begin(); m != ring->end(); ++m )
+            {
+                osg::Vec3d m_world = cx.toWorld( *m );
+                double len = cx.isGeocentric() ? m_world.length() + height : m_world.z() + height;
+                if ( len > targetLen )
+                    targetLen = len;
+            }
+        }
+
+        // apply the height offsets
+        height    -= part._offset;
+        targetLen -= part._offset;
+
+        osg::Vec3Array&        wallVerts   = *buf._wallVerts.get();
+        osg::Vec3Array&        wallNormals = *buf._wallNormals.get();
+        osg::DrawElementsUInt& wallIndices = *buf._wallIndices.get();
+
+        unsigned wv = part._wallVertOffset;
+        unsigned wi = part._wallIndexOffset;
+        unsigned rv = part._roofVertOffset;
+
+        osg::ref_ptr<osg::Geometry> roof;
+        osg::Vec3Array* roofTessVerts = 0L;
+        if ( part._hasRoof )
+        {
+            roof = new osg::Geometry();
+            roofTessVerts = new osg::Vec3Array();
+            roofTessVerts->reserve( part._numPoints );
+            roof->setVertexArray( roofTessVerts );
+        }
+
+        std::vector<osg::Vec3> tops;
+        std::vector<osg::Vec3> faceNormals;
+
+        ConstGeometryIterator rings( part._geom );
+        while( rings.hasMore() )
+        {
+            const Geometry* ring = rings.next();
+            unsigned n = ring->size();
+
+            // compute the extruded location of each point:
+            tops.resize( n );
+            for( unsigned k=0; k<n; ++k )
+            {
+                osg::Vec3d m_world = cx.toWorld( (*ring)[k] );
+                osg::Vec3d up, p_vec;
+
+                if ( cx.isGeocentric() )
+                {
+                    up = m_world;
+                    up.normalize();
+                    if ( flatten )
+                        p_vec = m_world * (targetLen / m_world.length());
+                    else
+                        p_vec = m_world + up*height;
+                }
+                else
+                {
+                    up.set( 0, 0, 1 );
+                    if ( flatten )
+                        p_vec.set( m_world.x(), m_world.y(), targetLen );
+                    else
+                        p_vec.set( m_world.x(), m_world.y(), m_world.z() + height );
+                }
+
+                tops[k] = p_vec * cx.referenceFrame();
+
+                if ( roofTessVerts )
+                {
+                    osg::Vec3 normal = osg::Matrixd::transform3x3( up, cx.referenceFrame() );
+                    normal.normalize();
+                    (*buf._roofVerts)[rv]   = tops[k];
+                    (*buf._roofNormals)[rv] = normal;
+                    roofTessVerts->push_back( tops[k] );
+                    ++rv;
+                }
+            }
+
+            if ( roofTessVerts && n > 0 )
+            {
+                roof->addPrimitiveSet( new osg::DrawArrays(
+                    osg::PrimitiveSet::LINE_LOOP, roofTessVerts->size()-n, n ) );
+            }
+
+            // one face normal per wall segment:
+            unsigned numSegs = countSegments( ring, part._closed );
+            faceNormals.resize( numSegs );
+            for( unsigned s=0; s<numSegs; ++s )
+            {
+                unsigned a = s, c = (s+1) % n;
+                osg::Vec3 b0 = (*ring)[a];
+                osg::Vec3 normal = (b0 - tops[a]) ^ (tops[c] - tops[a]);
+                normal.normalize();
+                faceNormals[s] = normal;
+            }
+
+            // emit the walls, smoothing normals across shallow corners:
+            for( unsigned s=0; s<numSegs; ++s )
+            {
+                unsigned a = s, c = (s+1) % n;
+                const osg::Vec3& fn = faceNormals[s];
+
+                osg::Vec3 na = fn, nc = fn;
+                if ( s > 0 || part._closed )
+                    na = smoothNormal( fn, faceNormals[s > 0 ? s-1 : numSegs-1], cosWallAngle );
+                if ( s+1 < numSegs || part._closed )
+                    nc = smoothNormal( fn, faceNormals[s+1 < numSegs ? s+1 : 0], cosWallAngle );
+
+                wallVerts[wv]   = tops[a];
+                wallVerts[wv+1] = (*ring)[a];
+                wallVerts[wv+2] = tops[c];
+                wallVerts[wv+3] = (*ring)[c];
+
+                wallNormals[wv]   = na;
+                wallNormals[wv+1] = na;
+                wallNormals[wv+2] = nc;
+                wallNormals[wv+3] = nc;
+
+                wallIndices[wi++] = wv;
+                wallIndices[wi++] = wv+1;
+                wallIndices[wi++] = wv+2;
+                wallIndices[wi++] = wv+1;
+                wallIndices[wi++] = wv+3;
+                wallIndices[wi++] = wv+2;
+
+                wv += 4;
+            }
+        }
+
+        // tessellate the roof into a local index list:
+        if ( roof.valid() )
+        {
+            osgUtil::Tessellator tess;
+            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
+            tess.retessellatePolygons( *roof.get() );
+
+            osg::TriangleIndexFunctor<TriangleCollector> collector;
+            collector._out = &part._roofIndices;
+            roof->accept( collector );
+
+            // the tessellator appends a vertex wherever it has to split an edge.
+            osg::Vec3Array* tessVerts = dynamic_cast<osg::Vec3Array*>( roof->getVertexArray() );
+            if ( tessVerts && tessVerts->size() > part._numPoints )
+            {
+                part._roofExtraVerts.assign( tessVerts->begin() + part._numPoints, tessVerts->end() );
+            }
+        }
+    }
+
+    /** Extrudes a contiguous range of parts; runs as a ParallelTask. */
+    struct ExtrudePartsTask
+    {
+        void init(ExtrusionPartVector& parts, unsigned first, unsigned last,
+                  ExtrusionBuffers& buf, const FilterContext& cx, bool flatten, double cosWallAngle )
+        {
+            _parts        = &parts;
+            _first        = first;
+            _last         = last;
+            _buf          = &buf;
+            _cx           = &cx;
+            _flatten      = flatten;
+            _cosWallAngle = cosWallAngle;
+        }
+
+        void execute()
+        {
+            for( unsigned i=_first; i<_last; ++i )
+                extrudePart( (*_parts)[i], *_buf, *_cx, _flatten, _cosWallAngle );
+        }
+
+        ExtrusionPartVector* _parts;
+        unsigned             _first, _last;
+        ExtrusionBuffers*    _buf;
+        const FilterContext* _cx;
+        bool                 _flatten;
+        double               _cosWallAngle;
+    };
+
+    // below this many parts, the batch runs on the calling thread.
+    static const unsigned s_minPartsPerTask = 256;
+
+    TaskService* getBatchTaskService()
+    {
+        static OpenThreads::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "ExtrudeGeometryFilter", OpenThreads::GetNumberOfProcessors() );
+        return s_service.get();
+    }
+}
+
+bool
+ExtrudeGeometryFilter::pushBatch( FeatureList& input, const FilterContext& context )
+{
+    // First pass: evaluate the heights (expressions are not thread-safe) and
+    // reserve each part's range in the combined buffers.
+    ExtrusionPartVector parts;
+    parts.reserve( input.size() );
+
+    unsigned numWallVerts   = 0;
+    unsigned numWallIndices = 0;
+    unsigned numRoofVerts   = 0;
+
+    for( FeatureList::iterator i = input.begin(); i != input.end(); ++i )
+    {
+        Feature* feature = i->get();
+        if ( !feature || !feature->getGeometry() )
+            continue;
+
+        float height = getExtrusionHeight( feature, context );
+        float offset = getHeightOffset( feature, context );
+
+        GeometryIterator iter( feature->getGeometry(), false );
+        while( iter.hasMore() )
+        {
+            Geometry* geom = iter.next();
+
+            ExtrusionPart part;
+            part._geom    = geom;
+            part._hasRoof = geom->getType() == Geometry::TYPE_POLYGON;
+            part._closed  = geom->getComponentType() == Geometry::TYPE_POLYGON;
+            part._height  = height;
+            part._offset  = offset;
+
+            // prep the shapes by making sure all polys are open:
+            if ( part._hasRoof )
+                static_cast<Polygon*>(geom)->open();
+
+            unsigned numSegs = 0;
+            ConstGeometryIterator rings( geom );
+            while( rings.hasMore() )
+                numSegs += countSegments( rings.next(), part._closed );
+
+            if ( numSegs == 0 )
+                continue;
+
+            part._numPoints       = geom->getTotalPointCount();
+            part._wallVertOffset  = numWallVerts;
+            part._wallIndexOffset = numWallIndices;
+            part._roofVertOffset  = numRoofVerts;
+
+            numWallVerts   += 4 * numSegs;
+            numWallIndices += 6 * numSegs;
+            if ( part._hasRoof )
+                numRoofVerts += part._numPoints;
+
+            parts.push_back( part );
+        }
+    }
+
+    if ( parts.size() == 0 )
+        return false;
+
+    // Allocate the combined buffers once:
+    ExtrusionBuffers buf;
+    buf._wallVerts   = new osg::Vec3Array( numWallVerts );
+    buf._wallNormals = new osg::Vec3Array( numWallVerts );
+    buf._wallIndices = new osg::DrawElementsUInt( GL_TRIANGLES, numWallIndices );
+    buf._roofVerts   = new osg::Vec3Array( numRoofVerts );
+    buf._roofNormals = new osg::Vec3Array( numRoofVerts );
+
+    double cosWallAngle = cos( osg::DegreesToRadians(_wallAngleThresh_deg) );
+
+    // Second pass: fill the buffers, in parallel if it's worth it.
+    unsigned maxTasks = _numBatchThreads > 0 ? _numBatchThreads : (unsigned)OpenThreads::GetNumberOfProcessors();
+    unsigned numTasks = osg::clampBetween( (unsigned)parts.size() / s_minPartsPerTask, 1u, osg::maximum(maxTasks, 1u) );
+
+    if ( numTasks > 1 )
+    {
+        TaskService* service = getBatchTaskService();
+        Threading::MultiEvent semaphore( numTasks );
+
+        unsigned partsPerTask = parts.size() / numTasks;
+        for( unsigned t=0; t<numTasks; ++t )
+        {
+            unsigned first = t * partsPerTask;
+            unsigned last  = t+1 == numTasks ? parts.size() : first + partsPerTask;
+
+            ParallelTask<ExtrudePartsTask>* task = new ParallelTask<ExtrudePartsTask>( &semaphore );
+            task->init( parts, first, last, buf, context, _flatten, cosWallAngle );
+            service->add( task );
+        }
+
+        semaphore.wait();
+    }
+    else
+    {
+        ExtrudePartsTask task;
+        task.init( parts, 0, parts.size(), buf, context, _flatten, cosWallAngle );
+        task.execute();
+    }
+
+    // Gather the roof triangles, appending any vertices the tessellator added.
+    osg::ref_ptr<osg::DrawElementsUInt> roofIndices = new osg::DrawElementsUInt( GL_TRIANGLES );
+    {
+        unsigned numRoofIndices = 0;
+        for( ExtrusionPartVector::const_iterator p = parts.begin(); p != parts.end(); ++p )
+            numRoofIndices += p->_roofIndices.size();
+        roofIndices->reserve( numRoofIndices );
+    }
+
+    for( ExtrusionPartVector::const_iterator p = parts.begin(); p != parts.end(); ++p )
+    {
+        GLuint extraBase = buf._roofVerts->size();
+        if ( p->_roofExtraVerts.size() > 0 )
+        {
+            osg::Vec3 normal = (*buf._roofNormals)[p->_roofVertOffset];
+            for( std::vector<osg::Vec3>::const_iterator v = p->_roofExtraVerts.begin(); v != p->_roofExtraVerts.end(); ++v )
+            {
+                buf._roofVerts->push_back( *v );
+                buf._roofNormals->push_back( normal );
+            }
+        }
+
+        for( std::vector<GLuint>::const_iterator i = p->_roofIndices.begin(); i != p->_roofIndices.end(); ++i )
+        {
+            if ( *i < p->_numPoints )
+                roofIndices->push_back( p->_roofVertOffset + *i );
+            else
+                roofIndices->push_back( extraBase + (*i - p->_numPoints) );
+        }
+    }
+
+    osg::Vec4Array* colors = new osg::Vec4Array( 1 );
+    (*colors)[0] = _color;
+
+    osg::Geometry* walls = new osg::Geometry();
+    walls->setVertexArray( buf._wallVerts.get() );
+    walls->setNormalArray( buf._wallNormals.get() );
+    walls->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    walls->setColorArray( colors );
+    walls->setColorBinding( osg::Geometry::BIND_OVERALL );
+    walls->addPrimitiveSet( buf._wallIndices.get() );
+
+    //There is no skin, so disable texturing for the walls to prevent other textures from being applied to the walls
+    if ( !_noTextureStateSet.valid() )
+    {
+        _noTextureStateSet = new osg::StateSet();
+        _noTextureStateSet->setTextureMode(0, GL_TEXTURE_2D, osg::StateAttribute::OFF);
+    }
+    walls->setStateSet( _noTextureStateSet.get() );
+
+    _geode->addDrawable( walls );
+
+    if ( roofIndices->size() > 0 )
+    {
+        osg::Geometry* roofs = new osg::Geometry();
+        roofs->setVertexArray( buf._roofVerts.get() );
+        roofs->setNormalArray( buf._roofNormals.get() );
+        roofs->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+        roofs->setColorArray( colors );
+        roofs->setColorBinding( osg::Geometry::BIND_OVERALL );
+        roofs->addPrimitiveSet( roofIndices.get() );
+
+        // mark this geometry as DYNAMIC because otherwise the OSG optimizer will destroy it.
+        roofs->setDataVariance( osg::Object::DYNAMIC );
+
+        _geode->addDrawable( roofs );
+    }
+
+    return true;
+}
+
 namespace 
 {
     struct EnableVBO : public osg::NodeVisitor 
@@ -492,6 +959,13 @@ ExtrudeGeometryFilter::push( FeatureList& input, const FilterContext& context )
 {
     reset();
 
+    // the batch path merges everything, so it can't name individual features.
+    if ( _useBatching && _featureNameExpr.empty() )
+    {
+        pushBatch( input, context );
+        return _geode.release();
+    }
+
     bool ok = true;
     for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
         pushFeature( i->get(), context );
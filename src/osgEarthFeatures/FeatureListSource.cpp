@@ -17,26 +17,98 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureListSource>
+#include <set>
 
+using namespace osgEarth;
 using namespace osgEarth::Features;
 
 FeatureListSource::FeatureListSource():
 FeatureSource()
 {
     _profile = new FeatureProfile(GeoExtent(osgEarth::SpatialReference::create("epsg:4326"), -180, -90, 180, 90));
+    _index = new FeatureSpatialIndex();
+    sync( _indexRevision );
+}
+
+void
+FeatureListSource::syncIndex()
+{
+    if ( !outOfSyncWith(_indexRevision) )
+        return;
+
+    // Somebody changed the list without telling us which features changed, so
+    // walk it: re-index everything (which is a no-op for features that didn't
+    // move) and drop entries whose features are no longer in the list.
+    std::set<Feature*> current;
+    for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+    {
+        current.insert( itr->get() );
+        _index->insert( itr->get() );
+    }
+
+    if ( _index->size() > current.size() )
+    {
+        std::vector<Feature*> indexed;
+        _index->getFeatures( indexed );
+        for (std::vector<Feature*>::iterator i = indexed.begin(); i != indexed.end(); ++i)
+        {
+            if ( current.find(*i) == current.end() )
+                _index->remove( *i );
+        }
+    }
+
+    sync( _indexRevision );
 }
 
 FeatureCursor*
 FeatureListSource::createFeatureCursor( const Symbology::Query& query )
 {
-    //Create a copy of all of the features before returning the cursor.
+    // Resolve the query extent, if there is one, in our own SRS:
+    Bounds queryBounds;
+    bool   spatial = false;
+
+    if ( query.bounds().isSet() )
+    {
+        queryBounds = query.bounds().get();
+        spatial = true;
+    }
+    else if ( query.tileKey().isSet() )
+    {
+        GeoExtent extent = query.tileKey().get().getExtent().transform( _profile->getSRS() );
+        if ( extent.isValid() )
+        {
+            queryBounds = extent.bounds();
+            spatial = true;
+        }
+    }
+
+    //Create a copy of the matching features before returning the cursor.
     //The processing filters in osgEarth can modify the features as they are operating and we don't want our original data destroyed.
     FeatureList cursorFeatures;
-    for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+
+    if ( spatial )
     {
-        Feature* feature = new osgEarth::Features::Feature(*(itr->get()), osg::CopyOp::DEEP_COPY_ALL);        
-        cursorFeatures.push_back( feature );
-    }    
+        std::vector<Feature*> hits;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+            syncIndex();
+            _index->query( queryBounds, hits );
+        }
+
+        for (std::vector<Feature*>::iterator itr = hits.begin(); itr != hits.end(); ++itr)
+        {
+            cursorFeatures.push_back( new osgEarth::Features::Feature(**itr, osg::CopyOp::DEEP_COPY_ALL) );
+        }
+    }
+    else
+    {
+        for (FeatureList::iterator itr = _features.begin(); itr != _features.end(); ++itr)
+        {
+            Feature* feature = new osgEarth::Features::Feature(*(itr->get()), osg::CopyOp::DEEP_COPY_ALL);        
+            cursorFeatures.push_back( feature );
+        }    
+    }
+
     return new FeatureListCursor( cursorFeatures );
 }
 
@@ -58,8 +130,13 @@ FeatureListSource::deleteFeature(FeatureID fid)
     {
         if (itr->get()->getFID() == fid)
         {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+            bool inSync = !outOfSyncWith( _indexRevision );
+            _index->remove( itr->get() );
             _features.erase( itr );
             dirty();
+            if ( inSync )
+                sync( _indexRevision );
             return true;
         }
     }
@@ -81,7 +158,30 @@ FeatureListSource::getFeature( FeatureID fid )
 
 bool FeatureListSource::insertFeature(Feature* feature)
 {
+    if ( !feature )
+        return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+    bool inSync = !outOfSyncWith( _indexRevision );
     _features.push_back( feature );
+    _index->insert( feature );
+    dirty();
+    if ( inSync )
+        sync( _indexRevision );
+    return true;
+}
+
+bool
+FeatureListSource::updateFeature(Feature* feature)
+{
+    if ( !feature )
+        return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+    bool inSync = !outOfSyncWith( _indexRevision );
+    _index->insert( feature );
     dirty();
+    if ( inSync )
+        sync( _indexRevision );
     return true;
 }
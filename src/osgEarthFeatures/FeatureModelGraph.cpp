@@ -27,6 +27,7 @@
 #include <osgDB/ReaderWriter>
 #include <osgDB/WriteFile>
 #include <osgUtil/Optimizer>
+#include <iomanip>
 
 #define LC "[FeatureModelGraph] "
 
@@ -169,6 +170,12 @@ _dirty(false)
     if ( _useTiledSource && options.levels().isSet() && options.levels()->getNumLevels() > 0 )
         _useTiledSource = false;
 
+    // set up the compiled-tile cache, if requested.
+    if ( _options.tileCacheSize().value() > 0 || _options.tileCachePath().isSet() )
+    {
+        _tileCache = new FeatureTileCache( _options.tileCacheSize().value(), _options.tileCachePath().value() );
+    }
+
     setNumChildrenRequiringUpdateTraversal( 1 );
 
     redraw();
@@ -373,7 +380,7 @@ FeatureModelGraph::load( unsigned levelIndex, unsigned tileX, unsigned tileY, co
         FeatureLevel level( 0, maxRange );
         
         TileKey key(lod, tileX, tileY, _source->getFeatureProfile()->getProfile());
-        osg::Group* geometry = build( level, tileExtent, &key );
+        osg::Group* geometry = buildTile( levelIndex, tileX, tileY, level, tileExtent, &key );
         result = geometry;
 
         if (lod < _source->getFeatureProfile()->getMaxLevel())
@@ -404,7 +411,7 @@ FeatureModelGraph::load( unsigned levelIndex, unsigned tileX, unsigned tileY, co
     {
         // no levels defined; just load all the features.
         FeatureLevel all( 0.0f, FLT_MAX );
-        result = build( all, GeoExtent::INVALID, 0 );
+        result = buildTile( levelIndex, tileX, tileY, all, GeoExtent::INVALID, 0 );
     }
 
     else
@@ -424,7 +431,7 @@ FeatureModelGraph::load( unsigned levelIndex, unsigned tileX, unsigned tileY, co
                 s_getTileExtent( lod, tileX, tileY, _usableFeatureExtent ) :
                 GeoExtent::INVALID;
 
-            osg::Group* geometry = build( *level, tileExtent, 0 );
+            osg::Group* geometry = buildTile( levelIndex, tileX, tileY, *level, tileExtent, 0 );
             result = geometry;
 
             // see if there are any more levels. If so, build some pagedlods to bring the
@@ -476,6 +483,75 @@ FeatureModelGraph::load( unsigned levelIndex, unsigned tileX, unsigned tileY, co
     return result;
 }
 
+osg::Group*
+FeatureModelGraph::buildTile(unsigned            levelIndex,
+                             unsigned            tileX,
+                             unsigned            tileY,
+                             const FeatureLevel& level,
+                             const GeoExtent&    extent,
+                             const TileKey*      key )
+{
+    if ( !_tileCache.valid() )
+        return build( level, extent, key );
+
+    // capture the generation before building, so that a redraw() that happens
+    // during the build invalidates the result.
+    std::string generation = _tileCache->getGeneration();
+
+    osg::ref_ptr<osg::Node> cached;
+    if ( _tileCache->get( levelIndex, tileX, tileY, cached ) )
+    {
+        OE_DEBUG << LC << "Tile cache hit: " << levelIndex << "_" << tileX << "_" << tileY << std::endl;
+
+        osg::Group* group = cached->asGroup();
+        if ( !group )
+        {
+            group = new osg::Group();
+            group->addChild( cached.get() );
+        }
+        return group;
+    }
+
+    osg::Group* group = build( level, extent, key );
+    if ( group )
+    {
+        _tileCache->put( levelIndex, tileX, tileY, group, generation );
+    }
+    return group;
+}
+
+void
+FeatureModelGraph::updateTileCacheGeneration()
+{
+    if ( _tileCache.valid() )
+    {
+        // the compiled tiles depend on the layer options, the stylesheet, and the
+        // current state of the feature data.
+        std::string inputs =
+            _options.getConfig().toHashString() +
+            _styles.getConfig().toHashString() +
+            _source->getFeatureSourceOptions().getConfig().toHashString();
+
+        std::stringstream buf;
+        buf << std::hex << std::setw(8) << std::setfill('0') << osgEarth::hashString( inputs );
+
+        // the source revision is an in-process counter, so it can't key the disk
+        // tier: it restarts every session. As long as the source is in the state it
+        // was loaded in, the configuration hash alone is the key (the disk tier
+        // assumes the feature data doesn't change between sessions). Once the source
+        // is edited in this session, key the memory tier on the revision as well and
+        // bypass the disk tier.
+        if ( (int)_initialRevision < 0 )
+            _initialRevision = (int)_revision;
+
+        bool persistent = (int)_revision == (int)_initialRevision;
+        if ( !persistent )
+            buf << std::dec << "_r" << (int)_revision;
+
+        _tileCache->setGeneration( buf.str(), persistent );
+    }
+}
+
 osg::Group*
 FeatureModelGraph::build( const FeatureLevel& level, const GeoExtent& extent, const TileKey* key )
 {
@@ -726,6 +802,11 @@ void
 FeatureModelGraph::redraw()
 {
     removeChildren( 0, getNumChildren() );
+
+    // sync up first, so the tile cache generation reflects the current revision.
+    _source->sync( _revision );
+    updateTileCacheGeneration();
+
     // if there's a display schema in place, set up for quadtree paging.
     if ( _options.levels().isSet() || _useTiledSource ) //_source->getFeatureProfile()->getTiled() )
     {
@@ -741,7 +822,6 @@ FeatureModelGraph::redraw()
             addChild( node );
     }
 
-    _source->sync( _revision );
     _dirty = false;
 }
 
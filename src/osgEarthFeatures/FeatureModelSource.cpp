@@ -39,7 +39,8 @@ _geomTypeOverride( Geometry::TYPE_UNKNOWN ),
 _lit( true ),
 _maxGranularity_deg( 5.0 ),
 _mergeGeometry( false ),
-_clusterCulling( true )
+_clusterCulling( true ),
+_tileCacheSize( 0 )
 {
     fromConfig( _conf );
 }
@@ -61,6 +62,8 @@ FeatureModelSourceOptions::fromConfig( const Config& conf )
     conf.getIfSet( "max_granularity", _maxGranularity_deg );
     conf.getIfSet( "merge_geometry", _mergeGeometry );
     conf.getIfSet( "cluster_culling", _clusterCulling );
+    conf.getIfSet( "tile_cache_size", _tileCacheSize );
+    conf.getIfSet( "tile_cache_path", _tileCachePath );
 
     std::string gt = conf.value( "geometry_type" );
     if ( gt == "line" || gt == "lines" || gt == "linestring" )
@@ -90,6 +93,8 @@ FeatureModelSourceOptions::getConfig() const
     conf.updateIfSet( "max_granularity", _maxGranularity_deg );
     conf.updateIfSet( "merge_geometry", _mergeGeometry );
     conf.updateIfSet( "cluster_culling", _clusterCulling );
+    conf.updateIfSet( "tile_cache_size", _tileCacheSize );
+    conf.updateIfSet( "tile_cache_path", _tileCachePath );
 
 
     if ( _geomTypeOverride.isSet() ) {
@@ -0,0 +1,331 @@
+/* --*-c++-*-- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureSpatialIndex>
+#include <algorithm>
+
+#define LC "[FeatureSpatialIndex] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // children per tree node.
+    const unsigned s_nodeSize = 16;
+
+    // the overflow is always allowed to grow this big before forcing a repack.
+    const unsigned s_minOverflow = 64;
+
+    // position of (x,y) along a Hilbert curve filling an n x n grid (n = power of 2)
+    unsigned hilbertIndex( unsigned n, unsigned x, unsigned y )
+    {
+        unsigned d = 0;
+        for( unsigned s = n/2; s > 0; s /= 2 )
+        {
+            unsigned rx = (x & s) > 0 ? 1 : 0;
+            unsigned ry = (y & s) > 0 ? 1 : 0;
+            d += s * s * ((3 * rx) ^ ry);
+            if ( ry == 0 )
+            {
+                if ( rx == 1 )
+                {
+                    x = n-1 - x;
+                    y = n-1 - y;
+                }
+                std::swap( x, y );
+            }
+        }
+        return d;
+    }
+
+    struct SortByHilbert
+    {
+        bool operator()( const std::pair<unsigned,unsigned>& lhs, const std::pair<unsigned,unsigned>& rhs ) const {
+            return lhs.first < rhs.first;
+        }
+    };
+}
+
+//------------------------------------------------------------------------
+
+void
+FeatureSpatialIndex::Box::expandBy( const Box& rhs )
+{
+    _xmin = std::min( _xmin, rhs._xmin );
+    _ymin = std::min( _ymin, rhs._ymin );
+    _xmax = std::max( _xmax, rhs._xmax );
+    _ymax = std::max( _ymax, rhs._ymax );
+}
+
+//------------------------------------------------------------------------
+
+FeatureSpatialIndex::FeatureSpatialIndex() :
+_numPacked( 0 ),
+_numDead  ( 0 )
+{
+    //nop
+}
+
+bool
+FeatureSpatialIndex::insert( Feature* feature )
+{
+    if ( !feature || !feature->getGeometry() )
+    {
+        remove( feature );
+        return false;
+    }
+    return insert( feature, feature->getGeometry()->getBounds() );
+}
+
+bool
+FeatureSpatialIndex::insert( Feature* feature, const Bounds& bounds )
+{
+    if ( !feature )
+        return false;
+
+    if ( !bounds.isValid() )
+    {
+        remove( feature );
+        return false;
+    }
+
+    Box box( bounds );
+
+    EntryIndex::iterator i = _entryOf.find( feature );
+    if ( i != _entryOf.end() )
+    {
+        Entry& entry = _entries[i->second];
+
+        // unchanged; nothing to do.
+        if ( entry._box._xmin == box._xmin && entry._box._ymin == box._ymin &&
+             entry._box._xmax == box._xmax && entry._box._ymax == box._ymax )
+        {
+            return true;
+        }
+
+        // overflow entries can just be updated in place; packed ones are
+        // retired and re-added to the overflow, since moving them could break
+        // the bounds of their parent nodes.
+        if ( i->second >= _numPacked )
+        {
+            entry._box = box;
+            return true;
+        }
+
+        entry._alive = false;
+        ++_numDead;
+        _entryOf.erase( i );
+    }
+
+    Entry entry;
+    entry._box     = box;
+    entry._feature = feature;
+    entry._alive   = true;
+    _entryOf[feature] = _entries.size();
+    _entries.push_back( entry );
+    return true;
+}
+
+bool
+FeatureSpatialIndex::remove( Feature* feature )
+{
+    EntryIndex::iterator i = _entryOf.find( feature );
+    if ( i == _entryOf.end() )
+        return false;
+
+    _entries[i->second]._alive = false;
+    ++_numDead;
+    _entryOf.erase( i );
+    return true;
+}
+
+bool
+FeatureSpatialIndex::contains( Feature* feature ) const
+{
+    return _entryOf.find( feature ) != _entryOf.end();
+}
+
+void
+FeatureSpatialIndex::clear()
+{
+    _entries.clear();
+    _entryOf.clear();
+    _nodes.clear();
+    _levelOffsets.clear();
+    _levelCounts.clear();
+    _numPacked = 0;
+    _numDead   = 0;
+}
+
+void
+FeatureSpatialIndex::getFeatures( std::vector<Feature*>& output ) const
+{
+    output.reserve( output.size() + _entryOf.size() );
+    for( std::vector<Entry>::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_alive )
+            output.push_back( i->_feature );
+    }
+}
+
+bool
+FeatureSpatialIndex::needsRebuild() const
+{
+    unsigned stale = (_entries.size() - _numPacked) + _numDead;
+    return stale > std::max( s_minOverflow, (unsigned)_entries.size() / 8 );
+}
+
+void
+FeatureSpatialIndex::rebuild()
+{
+    // gather the live entries and their overall extent:
+    std::vector<Entry> live;
+    live.reserve( _entryOf.size() );
+
+    Box extent;
+    for( std::vector<Entry>::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_alive )
+        {
+            if ( live.empty() )
+                extent = i->_box;
+            else
+                extent.expandBy( i->_box );
+            live.push_back( *i );
+        }
+    }
+
+    clear();
+
+    if ( live.empty() )
+        return;
+
+    // sort the entries along a Hilbert curve through their centers, so that
+    // neighboring entries end up in the same nodes:
+    const unsigned n = 1u << 16;
+    double width  = extent._xmax - extent._xmin;
+    double height = extent._ymax - extent._ymin;
+    double sx = width  > 0.0 ? (double)(n-1) / width  : 0.0;
+    double sy = height > 0.0 ? (double)(n-1) / height : 0.0;
+
+    std::vector< std::pair<unsigned,unsigned> > order;
+    order.reserve( live.size() );
+    for( unsigned k = 0; k < live.size(); ++k )
+    {
+        const Box& b = live[k]._box;
+        unsigned x = (unsigned)( sx * (0.5*(b._xmin + b._xmax) - extent._xmin) );
+        unsigned y = (unsigned)( sy * (0.5*(b._ymin + b._ymax) - extent._ymin) );
+        order.push_back( std::make_pair( hilbertIndex(n, x, y), k ) );
+    }
+    std::sort( order.begin(), order.end(), SortByHilbert() );
+
+    // the leaf level is the sorted entries themselves:
+    _entries.reserve( live.size() );
+    _nodes.reserve( live.size() + live.size()/(s_nodeSize-1) + 1 );
+    for( unsigned k = 0; k < order.size(); ++k )
+    {
+        const Entry& entry = live[order[k].second];
+        _entryOf[entry._feature] = _entries.size();
+        _entries.push_back( entry );
+        _nodes.push_back( entry._box );
+    }
+    _numPacked = _entries.size();
+
+    _levelOffsets.push_back( 0 );
+    _levelCounts.push_back( _numPacked );
+
+    // build the upper levels until there's a single root:
+    while( _levelCounts.back() > 1 )
+    {
+        unsigned childOffset = _levelOffsets.back();
+        unsigned childCount  = _levelCounts.back();
+
+        _levelOffsets.push_back( _nodes.size() );
+        for( unsigned first = 0; first < childCount; first += s_nodeSize )
+        {
+            unsigned last = std::min( first + s_nodeSize, childCount );
+            Box box = _nodes[childOffset + first];
+            for( unsigned c = first+1; c < last; ++c )
+                box.expandBy( _nodes[childOffset + c] );
+            _nodes.push_back( box );
+        }
+        _levelCounts.push_back( _nodes.size() - _levelOffsets.back() );
+    }
+}
+
+void
+FeatureSpatialIndex::searchNode( unsigned level, unsigned node, const Box& box, std::vector<Feature*>& output ) const
+{
+    unsigned childLevel = level - 1;
+    unsigned offset = _levelOffsets[childLevel];
+    unsigned first  = node * s_nodeSize;
+    unsigned last   = std::min( first + s_nodeSize, _levelCounts[childLevel] );
+
+    for( unsigned c = first; c < last; ++c )
+    {
+        if ( _nodes[offset + c].intersects(box) )
+        {
+            if ( childLevel == 0 )
+            {
+                if ( _entries[c]._alive )
+                    output.push_back( _entries[c]._feature );
+            }
+            else
+            {
+                searchNode( childLevel, c, box, output );
+            }
+        }
+    }
+}
+
+void
+FeatureSpatialIndex::query( const Bounds& bounds, std::vector<Feature*>& output )
+{
+    if ( !bounds.isValid() )
+        return;
+
+    if ( needsRebuild() )
+        rebuild();
+
+    Box box( bounds );
+
+    // the packed tree:
+    if ( _numPacked == 1 )
+    {
+        if ( _entries[0]._alive && _entries[0]._box.intersects(box) )
+            output.push_back( _entries[0]._feature );
+    }
+    else if ( _numPacked > 1 )
+    {
+        unsigned top = _levelCounts.size() - 1;
+        if ( _nodes[_levelOffsets[top]].intersects(box) )
+            searchNode( top, 0, box, output );
+    }
+
+    // the overflow:
+    for( unsigned k = _numPacked; k < _entries.size(); ++k )
+    {
+        const Entry& entry = _entries[k];
+        if ( entry._alive && entry._box.intersects(box) )
+            output.push_back( entry._feature );
+    }
+}
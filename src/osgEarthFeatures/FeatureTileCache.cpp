@@ -0,0 +1,224 @@
+/* --*-c++-*-- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureTileCache>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/ScopedLock>
+#include <cstdio>
+#include <sstream>
+
+#define LC "[FeatureTileCache] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+namespace
+{
+    // numbers the temporary files so concurrent writers never share one.
+    OpenThreads::Atomic s_tempFileCounter;
+}
+
+//------------------------------------------------------------------------
+
+FeatureTileCache::FeatureTileCache( unsigned maxTilesInMemory, const std::string& path ) :
+_maxTilesInMemory( maxTilesInMemory ),
+_path            ( path ),
+_persistent      ( true )
+{
+    //nop
+}
+
+void
+FeatureTileCache::setGeneration( const std::string& generation, bool persistent )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    if ( generation != _generation )
+    {
+        _generation = generation;
+        _mem.clear();
+        _lru.clear();
+    }
+    _persistent = persistent;
+}
+
+std::string
+FeatureTileCache::getGeneration() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _generation;
+}
+
+void
+FeatureTileCache::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _mem.clear();
+    _lru.clear();
+}
+
+std::string
+FeatureTileCache::makeKey( unsigned level, unsigned x, unsigned y ) const
+{
+    std::stringstream buf;
+    buf << level << "_" << x << "_" << y;
+    std::string str = buf.str();
+    return str;
+}
+
+std::string
+FeatureTileCache::makeFilename( const std::string& generation, unsigned level, unsigned x, unsigned y ) const
+{
+    std::stringstream buf;
+    buf << _path << "/" << generation << "/" << level << "/" << x << "_" << y << ".osgb";
+    std::string str = buf.str();
+    return str;
+}
+
+void
+FeatureTileCache::putInMemory( const std::string& key, osg::Node* node )
+{
+    // assumes the mutex is held.
+    if ( _maxTilesInMemory == 0 )
+        return;
+
+    MemTable::iterator i = _mem.find( key );
+    if ( i != _mem.end() )
+    {
+        _lru.erase( i->second.second );
+        _mem.erase( i );
+    }
+
+    _lru.push_front( key );
+    _mem[key] = MemEntry( node, _lru.begin() );
+
+    while( _mem.size() > _maxTilesInMemory )
+    {
+        _mem.erase( _lru.back() );
+        _lru.pop_back();
+    }
+}
+
+bool
+FeatureTileCache::get( unsigned level, unsigned x, unsigned y, osg::ref_ptr<osg::Node>& out_node )
+{
+    std::string key = makeKey( level, x, y );
+    std::string generation;
+    bool persistent;
+
+    // check the memory tier first, promoting the hit to the front of the LRU.
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        MemTable::iterator i = _mem.find( key );
+        if ( i != _mem.end() )
+        {
+            _lru.splice( _lru.begin(), _lru, i->second.second );
+            out_node = i->second.first.get();
+            _stats._memoryHits++;
+            return true;
+        }
+        generation = _generation;
+        persistent = _persistent;
+    }
+
+    // then the disk tier (outside the lock; reads can be slow).
+    if ( !_path.empty() && persistent )
+    {
+        std::string filename = makeFilename( generation, level, x, y );
+        if ( osgDB::fileExists(filename) )
+        {
+            osg::ref_ptr<osg::Node> node = osgDB::readNodeFile( filename );
+            if ( node.valid() )
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                if ( generation == _generation )
+                    putInMemory( key, node.get() );
+                _stats._diskHits++;
+                out_node = node.get();
+                return true;
+            }
+        }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _stats._misses++;
+    return false;
+}
+
+void
+FeatureTileCache::put( unsigned level, unsigned x, unsigned y, osg::Node* node, const std::string& generation )
+{
+    if ( !node )
+        return;
+
+    bool persistent;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+        // the generation moved on while this tile was building, so it was compiled
+        // from stale inputs; storing it would shadow the rebuilt tile.
+        if ( generation != _generation )
+        {
+            OE_DEBUG << LC << "Dropping stale tile " << level << "_" << x << "_" << y << std::endl;
+            return;
+        }
+
+        putInMemory( makeKey(level, x, y), node );
+        persistent = _persistent;
+    }
+
+    if ( !_path.empty() && persistent )
+    {
+        std::string filename = makeFilename( generation, level, x, y );
+        std::string path = osgDB::getFilePath( filename );
+
+        if ( !osgDB::fileExists(path) && !osgDB::makeDirectory(path) )
+        {
+            OE_WARN << LC << "Couldn't create path " << path << std::endl;
+            return;
+        }
+
+        // write to a temporary file first, so a concurrent reader never sees a partial tile.
+        // It keeps the real extension, since osgDB picks the writer by extension.
+        std::stringstream buf;
+        buf << osgDB::getNameLessExtension(filename) << "." << ++s_tempFileCounter << ".tmp."
+            << osgDB::getFileExtension(filename);
+        std::string tempFilename = buf.str();
+
+        if ( osgDB::writeNodeFile( *node, tempFilename ) && ::rename( tempFilename.c_str(), filename.c_str() ) == 0 )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _stats._diskWrites++;
+        }
+        else
+        {
+            ::remove( tempFilename.c_str() );
+            OE_DEBUG << LC << "Failed to write tile to " << filename << std::endl;
+        }
+    }
+}
+
+FeatureTileCache::Stats
+FeatureTileCache::getStats() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _stats;
+}
@@ -163,7 +163,9 @@ SubstituteModelFilter::cluster(const FeatureList&           features,
 
             geode.dirtyBound();
 
-            MeshConsolidator::run( geode );
+            // the clones share their model's state sets, so merge them by state set
+            // (run() won't merge textured geometry at all).
+            MeshConsolidator::runMergeCompatible( geode );
             //// merge the geometry...
             //osgUtil::Optimizer opt;
             //opt.optimize( &geode, osgUtil::Optimizer::MERGE_GEOMETRY );
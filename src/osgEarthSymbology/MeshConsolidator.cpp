@@ -20,9 +20,12 @@
 #include <osgEarthSymbology/LineFunctor>
 #include <osg/TriangleFunctor>
 #include <osg/TriangleIndexFunctor>
+#include <osg/Timer>
 #include <limits>
 #include <map>
 #include <iterator>
+#include <vector>
+#include <algorithm>
 
 #define LC "[MeshConsolidator] "
 
@@ -149,8 +152,10 @@ namespace
 }
 
 void
-MeshConsolidator::run( osg::Geode& geode )
+MeshConsolidator::run( osg::Geode& geode, Stats* stats )
 {
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+
     unsigned numVerts = 0;
     unsigned numColors = 0;
     unsigned numNormals = 0;
@@ -186,11 +191,22 @@ MeshConsolidator::run( osg::Geode& geode )
         }
     }
 
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+
+    if ( stats )
+    {
+        stats->_numGeometriesIn   += geode.getNumDrawables();
+        stats->_numVerts          += numVerts;
+        stats->_triangulateTime_s += osg::Timer::instance()->delta_s(t0, t1);
+    }
+
     // bail if there are unsupported items in there.
     if (geode.getNumDrawables() < 2 ||
         numTexCoordArrays       > 0 ||
         numVertAttribArrays     > 0 )
     {
+        if ( stats )
+            stats->_numGeometriesOut += geode.getNumDrawables();
         return;
     }
 
@@ -305,4 +321,336 @@ MeshConsolidator::run( osg::Geode& geode )
     // replace the geode's drawables
     geode.removeDrawables( 0, geode.getNumDrawables() );
     geode.addDrawable( newGeom );
+
+    if ( stats )
+    {
+        stats->_numGeometriesOut += 1;
+        stats->_mergeTime_s      += osg::Timer::instance()->delta_s(t1, osg::Timer::instance()->tick());
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /**
+     * Describes the array layout and state of a geometry. Geometries with
+     * equal keys can be concatenated into one.
+     */
+    struct MergeKey
+    {
+        osg::StateSet*                   _stateSet;
+        osg::Geometry::AttributeBinding  _colorBinding;
+        osg::Geometry::AttributeBinding  _normalBinding;
+        osg::Vec4                        _overallColor;
+        osg::Vec3                        _overallNormal;
+        unsigned                         _texCoordUnits; // bitmask
+
+        bool operator < (const MergeKey& rhs) const
+        {
+            if ( _stateSet != rhs._stateSet ) return _stateSet < rhs._stateSet;
+            if ( _colorBinding != rhs._colorBinding ) return _colorBinding < rhs._colorBinding;
+            if ( _normalBinding != rhs._normalBinding ) return _normalBinding < rhs._normalBinding;
+            if ( _overallColor != rhs._overallColor ) return _overallColor < rhs._overallColor;
+            if ( _overallNormal != rhs._overallNormal ) return _overallNormal < rhs._overallNormal;
+            return _texCoordUnits < rhs._texCoordUnits;
+        }
+    };
+
+    // Builds the merge key for a geometry; returns false if the geometry
+    // has an array layout we don't know how to merge.
+    bool makeMergeKey( osg::Geometry* geom, MergeKey& key )
+    {
+        osg::Vec3Array* verts = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
+        if ( !verts || verts->size() == 0 || geom->getNumVertexAttribArrays() > 0 )
+            return false;
+
+        key._stateSet      = geom->getStateSet();
+        key._colorBinding  = geom->getColorArray() ? geom->getColorBinding() : osg::Geometry::BIND_OFF;
+        key._normalBinding = geom->getNormalArray() ? geom->getNormalBinding() : osg::Geometry::BIND_OFF;
+        key._overallColor.set( 0, 0, 0, 0 );
+        key._overallNormal.set( 0, 0, 0 );
+        key._texCoordUnits = 0;
+
+        if ( key._colorBinding != osg::Geometry::BIND_OFF )
+        {
+            osg::Vec4Array* colors = dynamic_cast<osg::Vec4Array*>( geom->getColorArray() );
+            if ( !colors || colors->size() == 0 )
+                return false;
+            if ( key._colorBinding == osg::Geometry::BIND_OVERALL )
+                key._overallColor = (*colors)[0];
+            else if ( key._colorBinding != osg::Geometry::BIND_PER_VERTEX || colors->size() != verts->size() )
+                return false;
+        }
+
+        if ( key._normalBinding != osg::Geometry::BIND_OFF )
+        {
+            osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>( geom->getNormalArray() );
+            if ( !normals || normals->size() == 0 )
+                return false;
+            if ( key._normalBinding == osg::Geometry::BIND_OVERALL )
+                key._overallNormal = (*normals)[0];
+            else if ( key._normalBinding != osg::Geometry::BIND_PER_VERTEX || normals->size() != verts->size() )
+                return false;
+        }
+
+        if ( geom->getNumTexCoordArrays() > sizeof(unsigned)*8 )
+            return false;
+
+        for( unsigned u=0; u<geom->getNumTexCoordArrays(); ++u )
+        {
+            osg::Array* tc = geom->getTexCoordArray(u);
+            if ( tc )
+            {
+                osg::Vec2Array* tc2 = dynamic_cast<osg::Vec2Array*>( tc );
+                if ( !tc2 || tc2->size() != verts->size() )
+                    return false;
+                key._texCoordUnits |= (1u << u);
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    void appendIndices( const T* src, unsigned offset, std::vector<GLuint>& out )
+    {
+        for( typename T::const_iterator i = src->begin(); i != src->end(); ++i )
+            out.push_back( (*i) + offset );
+    }
+
+    template<typename ETYPE>
+    osg::PrimitiveSet* makeTriangles( const std::vector<GLuint>& indices )
+    {
+        ETYPE* de = new ETYPE( GL_TRIANGLES );
+        de->reserve( indices.size() );
+        for( std::vector<GLuint>::const_iterator i = indices.begin(); i != indices.end(); ++i )
+            de->push_back( *i );
+        return de;
+    }
+
+    /**
+     * Concatenates a list of compatible geometries into a single new geometry.
+     * All GL_TRIANGLES element sets are folded into a single element set.
+     */
+    osg::Geometry* mergeChunk( const std::vector<osg::Geometry*>& chunk, const MergeKey& key, unsigned numVerts )
+    {
+        osg::Geometry* newGeom = new osg::Geometry();
+        newGeom->setStateSet( key._stateSet );
+
+        osg::Vec3Array* newVerts = new osg::Vec3Array();
+        newVerts->reserve( numVerts );
+        newGeom->setVertexArray( newVerts );
+
+        osg::Vec4Array* newColors = 0L;
+        if ( key._colorBinding == osg::Geometry::BIND_OVERALL )
+        {
+            newColors = new osg::Vec4Array( 1 );
+            (*newColors)[0] = key._overallColor;
+        }
+        else if ( key._colorBinding == osg::Geometry::BIND_PER_VERTEX )
+        {
+            newColors = new osg::Vec4Array();
+            newColors->reserve( numVerts );
+        }
+        if ( newColors )
+        {
+            newGeom->setColorArray( newColors );
+            newGeom->setColorBinding( key._colorBinding );
+        }
+
+        osg::Vec3Array* newNormals = 0L;
+        if ( key._normalBinding == osg::Geometry::BIND_OVERALL )
+        {
+            newNormals = new osg::Vec3Array( 1 );
+            (*newNormals)[0] = key._overallNormal;
+        }
+        else if ( key._normalBinding == osg::Geometry::BIND_PER_VERTEX )
+        {
+            newNormals = new osg::Vec3Array();
+            newNormals->reserve( numVerts );
+        }
+        if ( newNormals )
+        {
+            newGeom->setNormalArray( newNormals );
+            newGeom->setNormalBinding( key._normalBinding );
+        }
+
+        for( unsigned u=0; u<sizeof(unsigned)*8; ++u )
+        {
+            if ( key._texCoordUnits & (1u << u) )
+            {
+                osg::Vec2Array* tc = new osg::Vec2Array();
+                tc->reserve( numVerts );
+                newGeom->setTexCoordArray( u, tc );
+            }
+        }
+
+        std::vector<GLuint> triIndices;
+        osg::Geometry::PrimitiveSetList newPrimSets;
+        unsigned offset = 0;
+
+        for( std::vector<osg::Geometry*>::const_iterator g = chunk.begin(); g != chunk.end(); ++g )
+        {
+            osg::Geometry* geom = *g;
+            osg::Vec3Array* verts = static_cast<osg::Vec3Array*>( geom->getVertexArray() );
+
+            std::copy( verts->begin(), verts->end(), std::back_inserter(*newVerts) );
+
+            if ( key._colorBinding == osg::Geometry::BIND_PER_VERTEX )
+            {
+                osg::Vec4Array* colors = static_cast<osg::Vec4Array*>( geom->getColorArray() );
+                std::copy( colors->begin(), colors->end(), std::back_inserter(*newColors) );
+            }
+
+            if ( key._normalBinding == osg::Geometry::BIND_PER_VERTEX )
+            {
+                osg::Vec3Array* normals = static_cast<osg::Vec3Array*>( geom->getNormalArray() );
+                std::copy( normals->begin(), normals->end(), std::back_inserter(*newNormals) );
+            }
+
+            for( unsigned u=0; u<geom->getNumTexCoordArrays(); ++u )
+            {
+                osg::Vec2Array* tc = static_cast<osg::Vec2Array*>( geom->getTexCoordArray(u) );
+                if ( tc )
+                {
+                    osg::Vec2Array* newTC = static_cast<osg::Vec2Array*>( newGeom->getTexCoordArray(u) );
+                    std::copy( tc->begin(), tc->end(), std::back_inserter(*newTC) );
+                }
+            }
+
+            for( unsigned j=0; j < geom->getNumPrimitiveSets(); ++j )
+            {
+                osg::PrimitiveSet* pset = geom->getPrimitiveSet(j);
+                bool isTris = pset->getMode() == GL_TRIANGLES;
+                osg::PrimitiveSet* newpset = 0L;
+
+                if ( dynamic_cast<osg::DrawElementsUByte*>(pset) )
+                {
+                    if ( isTris ) appendIndices( static_cast<osg::DrawElementsUByte*>(pset), offset, triIndices );
+                    else newpset = remake( static_cast<osg::DrawElementsUByte*>(pset), numVerts, offset );
+                }
+                else if ( dynamic_cast<osg::DrawElementsUShort*>(pset) )
+                {
+                    if ( isTris ) appendIndices( static_cast<osg::DrawElementsUShort*>(pset), offset, triIndices );
+                    else newpset = remake( static_cast<osg::DrawElementsUShort*>(pset), numVerts, offset );
+                }
+                else if ( dynamic_cast<osg::DrawElementsUInt*>(pset) )
+                {
+                    if ( isTris ) appendIndices( static_cast<osg::DrawElementsUInt*>(pset), offset, triIndices );
+                    else newpset = remake( static_cast<osg::DrawElementsUInt*>(pset), numVerts, offset );
+                }
+                else if ( dynamic_cast<osg::DrawArrays*>(pset) )
+                {
+                    osg::DrawArrays* da = static_cast<osg::DrawArrays*>(pset);
+                    newpset = new osg::DrawArrays( da->getMode(), offset + da->getFirst(), da->getCount() );
+                }
+
+                if ( newpset )
+                    newPrimSets.push_back( newpset );
+            }
+
+            offset += verts->size();
+        }
+
+        if ( triIndices.size() > 0 )
+        {
+            if ( numVerts <= 0x100 )
+                newPrimSets.push_back( makeTriangles<osg::DrawElementsUByte>( triIndices ) );
+            else if ( numVerts <= 0x10000 )
+                newPrimSets.push_back( makeTriangles<osg::DrawElementsUShort>( triIndices ) );
+            else
+                newPrimSets.push_back( makeTriangles<osg::DrawElementsUInt>( triIndices ) );
+        }
+
+        newGeom->setPrimitiveSetList( newPrimSets );
+        return newGeom;
+    }
+}
+
+void
+MeshConsolidator::runMergeCompatible( osg::Geode& geode, unsigned maxVertsPerChunk, Stats* stats )
+{
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+    typedef std::map< MergeKey, std::vector<osg::Geometry*> > MergeGroups;
+    MergeGroups groups;
+
+    // holds on to the original drawables while we rebuild the geode.
+    std::vector< osg::ref_ptr<osg::Drawable> > keep;
+    std::vector< osg::ref_ptr<osg::Drawable> > unmergeable;
+
+    unsigned numVerts = 0;
+
+    // first, triangulate all the geometries and sort them into compatible groups:
+    for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+    {
+        osg::Drawable* drawable = geode.getDrawable(i);
+        keep.push_back( drawable );
+
+        osg::Geometry* geom = drawable->asGeometry();
+        MergeKey key;
+        if ( geom && makeMergeKey(geom, key) )
+        {
+            run( *geom );
+            numVerts += geom->getVertexArray()->getNumElements();
+            groups[key].push_back( geom );
+        }
+        else
+        {
+            unmergeable.push_back( drawable );
+        }
+    }
+
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+
+    geode.removeDrawables( 0, geode.getNumDrawables() );
+
+    for( MergeGroups::iterator g = groups.begin(); g != groups.end(); ++g )
+    {
+        const MergeKey& key = g->first;
+        std::vector<osg::Geometry*>& geoms = g->second;
+
+        if ( geoms.size() == 1 )
+        {
+            geode.addDrawable( geoms[0] );
+            continue;
+        }
+
+        std::vector<osg::Geometry*> chunk;
+        unsigned chunkVerts = 0;
+
+        for( std::vector<osg::Geometry*>::iterator i = geoms.begin(); i != geoms.end(); ++i )
+        {
+            unsigned n = (*i)->getVertexArray()->getNumElements();
+            if ( chunk.size() > 0 && chunkVerts + n > maxVertsPerChunk )
+            {
+                geode.addDrawable( chunk.size() > 1 ? mergeChunk(chunk, key, chunkVerts) : chunk[0] );
+                chunk.clear();
+                chunkVerts = 0;
+            }
+            chunk.push_back( *i );
+            chunkVerts += n;
+        }
+
+        if ( chunk.size() > 0 )
+        {
+            geode.addDrawable( chunk.size() > 1 ? mergeChunk(chunk, key, chunkVerts) : chunk[0] );
+        }
+    }
+
+    for( std::vector< osg::ref_ptr<osg::Drawable> >::iterator i = unmergeable.begin(); i != unmergeable.end(); ++i )
+    {
+        geode.addDrawable( i->get() );
+    }
+
+    if ( stats )
+    {
+        osg::Timer_t t2 = osg::Timer::instance()->tick();
+        stats->_numGeometriesIn   += keep.size();
+        stats->_numGeometriesOut  += geode.getNumDrawables();
+        stats->_numVerts          += numVerts;
+        stats->_triangulateTime_s += osg::Timer::instance()->delta_s(t0, t1);
+        stats->_mergeTime_s       += osg::Timer::instance()->delta_s(t1, t2);
+    }
 }
@@ -21,10 +21,13 @@
 #include <osgEarth/GeoMath>
 #include <osg/TriangleFunctor>
 #include <osg/TriangleIndexFunctor>
+#include <osg/Timer>
 //#include <osgUtil/MeshOptimizers>
 #include <climits>
+#include <cstring>
 #include <queue>
 #include <map>
+#include <vector>
 
 #define LC "[MeshSubdivider] "
 
@@ -114,6 +117,179 @@ namespace
         return fabs( acos( v0n * v1n ) );
     }
 
+    //--------------------------------------------------------------------
+    // Welding and work-list containers. Each comes in two flavors: the
+    // original ordered-map/queue flavor and an open-addressing hash/arena
+    // flavor. The subdivision routines below are templated on them.
+
+    // hashes a float by its bit pattern, folding -0 into +0 so that the
+    // hash agrees with operator== (which the std::map path relies on).
+    inline unsigned hashFloat( float f )
+    {
+        if ( f == 0.0f ) f = 0.0f;
+        unsigned u;
+        ::memcpy( &u, &f, sizeof(unsigned) );
+        return u;
+    }
+
+    inline unsigned hashVec3( const osg::Vec3& v )
+    {
+        unsigned h =
+            (hashFloat(v.x()) * 73856093u) ^
+            (hashFloat(v.y()) * 19349663u) ^
+            (hashFloat(v.z()) * 83492791u);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+
+    inline unsigned hashEdge( GLuint i0, GLuint i1 )
+    {
+        unsigned h = (i0 * 2654435761u) ^ (i1 * 40503u + 0x9e3779b9u);
+        h ^= h >> 15;
+        return h;
+    }
+
+    inline unsigned nextPowerOfTwo( unsigned n )
+    {
+        unsigned p = 64;
+        while( p < n ) p <<= 1;
+        return p;
+    }
+
+    static const GLuint s_empty = UINT_MAX;
+
+    /** Vertex welder backed by an ordered map. */
+    struct VertMapIndex
+    {
+        typedef std::map<osg::Vec3,GLuint> VertMap;
+        VertMap _map;
+
+        void reserve( unsigned ) { }
+
+        // returns the index already recorded for "v", or records and returns "index".
+        GLuint findOrInsert( const osg::Vec3& v, GLuint index )
+        {
+            return _map.insert( VertMap::value_type(v, index) ).first->second;
+        }
+    };
+
+    /** Vertex welder backed by a linear-probing open-addressing hash table. */
+    class VertHashIndex
+    {
+    public:
+        VertHashIndex() : _size(0) { _slots.resize(64); }
+
+        void reserve( unsigned n )
+        {
+            unsigned cap = nextPowerOfTwo( n*2 );
+            if ( cap > _slots.size() )
+                rehash( cap );
+        }
+
+        GLuint findOrInsert( const osg::Vec3& v, GLuint index )
+        {
+            if ( (_size+1)*2 > _slots.size() )
+                rehash( _slots.size()*2 );
+
+            unsigned mask = _slots.size()-1;
+            for( unsigned i = hashVec3(v) & mask; ; i = (i+1) & mask )
+            {
+                Slot& slot = _slots[i];
+                if ( slot._index == s_empty )
+                {
+                    slot._v = v;
+                    slot._index = index;
+                    ++_size;
+                    return index;
+                }
+                else if ( slot._v == v )
+                {
+                    return slot._index;
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            Slot() : _index(s_empty) { }
+            osg::Vec3 _v;
+            GLuint    _index;
+        };
+
+        void rehash( unsigned cap )
+        {
+            std::vector<Slot> old( cap );
+            old.swap( _slots );
+            unsigned mask = cap-1;
+            for( std::vector<Slot>::const_iterator s = old.begin(); s != old.end(); ++s )
+            {
+                if ( s->_index != s_empty )
+                {
+                    unsigned i = hashVec3(s->_v) & mask;
+                    while( _slots[i]._index != s_empty )
+                        i = (i+1) & mask;
+                    _slots[i] = *s;
+                }
+            }
+        }
+
+        std::vector<Slot> _slots;
+        unsigned          _size;
+    };
+
+    /** FIFO work list backed by a std::queue. */
+    template<typename T>
+    class QueueWorkList
+    {
+    public:
+        void reserve( unsigned ) { }
+        void push( const T& t ) { _q.push(t); }
+        T pop() { T t = _q.front(); _q.pop(); return t; }
+        bool empty() const { return _q.empty(); }
+        unsigned size() const { return _q.size(); }
+    private:
+        std::queue<T> _q;
+    };
+
+    /**
+     * FIFO work list backed by a single contiguous arena. Popped items are
+     * reclaimed in bulk once they make up most of the arena, so there's no
+     * per-item allocation and the live items stay contiguous.
+     */
+    template<typename T>
+    class ArenaWorkList
+    {
+    public:
+        ArenaWorkList() : _head(0) { }
+        void reserve( unsigned n ) { _items.reserve(n); }
+        void push( const T& t ) { _items.push_back(t); }
+        bool empty() const { return _head == _items.size(); }
+        unsigned size() const { return _items.size() - _head; }
+
+        T pop()
+        {
+            T t = _items[_head++];
+            if ( _head == _items.size() )
+            {
+                _items.clear();
+                _head = 0;
+            }
+            else if ( _head >= 4096 && _head*2 >= _items.size() )
+            {
+                _items.erase( _items.begin(), _items.begin()+_head );
+                _head = 0;
+            }
+            return t;
+        }
+
+    private:
+        std::vector<T> _items;
+        unsigned       _head;
+    };
+
     //--------------------------------------------------------------------
 
     struct Triangle
@@ -124,19 +300,17 @@ namespace
         GLuint _i0, _i1, _i2;        
     };
 
-    typedef std::queue<Triangle> TriangleQueue;
     typedef std::vector<Triangle> TriangleVector;
     
-
+    template<typename VERTINDEX, typename WORKLIST>
     struct TriangleData
     {
-        typedef std::map<osg::Vec3,GLuint> VertMap;        
-        VertMap _vertMap;
+        VERTINDEX _vertIndex;
         osg::Vec3Array* _sourceVerts;
         osg::Vec2Array* _sourceTexCoords;
         osg::ref_ptr<osg::Vec3Array> _verts;        
         osg::ref_ptr<osg::Vec2Array> _texcoords;
-        TriangleQueue _tris;
+        WORKLIST _tris;
         
         TriangleData()
         {            
@@ -148,6 +322,11 @@ namespace
         void setSourceVerts(osg::Vec3Array* sourceVerts )
         {
             _sourceVerts = sourceVerts;
+            if ( _sourceVerts )
+            {
+                _vertIndex.reserve( _sourceVerts->size() );
+                _verts->reserve( _sourceVerts->size() );
+            }
         }
 
         void setSourceTexCoords(osg::Vec2Array* sourceTexCoords)
@@ -158,23 +337,17 @@ namespace
 
         GLuint record( const osg::Vec3& v, const osg::Vec2f& t )
         {
-            VertMap::iterator i = _vertMap.find(v);
-            if ( i == _vertMap.end() )
+            GLuint index = _vertIndex.findOrInsert( v, _verts->size() );
+            if ( index == _verts->size() )
             {
-                GLuint index = _verts->size();
                 _verts->push_back(v);                
-                _vertMap[v] = index;
                 //Only push back the texture coordinate if it's valid
                 if (_texcoords)
                 {
                   _texcoords->push_back( t );
                 }
-                return index;
-            }
-            else
-            {
-                return i->second;
             }
+            return index;
         }
        
 
@@ -211,7 +384,84 @@ namespace
         bool operator == (const Edge& rhs) const { return _i0==rhs._i0 && _i1==rhs._i1; }
     };
 
-    typedef std::map<Edge,GLuint> EdgeMap;
+    /** Shared-edge welder backed by an ordered map. */
+    struct EdgeMapIndex
+    {
+        typedef std::map<Edge,GLuint> EdgeMap;
+        EdgeMap _map;
+
+        void reserve( unsigned ) { }
+
+        GLuint findOrInsert( const Edge& edge, GLuint index )
+        {
+            return _map.insert( EdgeMap::value_type(edge, index) ).first->second;
+        }
+    };
+
+    /** Shared-edge welder backed by a linear-probing open-addressing hash table. */
+    class EdgeHashIndex
+    {
+    public:
+        EdgeHashIndex() : _size(0) { _slots.resize(64); }
+
+        void reserve( unsigned n )
+        {
+            unsigned cap = nextPowerOfTwo( n*2 );
+            if ( cap > _slots.size() )
+                rehash( cap );
+        }
+
+        GLuint findOrInsert( const Edge& edge, GLuint index )
+        {
+            if ( (_size+1)*2 > _slots.size() )
+                rehash( _slots.size()*2 );
+
+            unsigned mask = _slots.size()-1;
+            for( unsigned i = hashEdge(edge._i0, edge._i1) & mask; ; i = (i+1) & mask )
+            {
+                Slot& slot = _slots[i];
+                if ( slot._index == s_empty )
+                {
+                    slot._edge = edge;
+                    slot._index = index;
+                    ++_size;
+                    return index;
+                }
+                else if ( slot._edge == edge )
+                {
+                    return slot._index;
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            Slot() : _index(s_empty) { }
+            Edge   _edge;
+            GLuint _index;
+        };
+
+        void rehash( unsigned cap )
+        {
+            std::vector<Slot> old( cap );
+            old.swap( _slots );
+            unsigned mask = cap-1;
+            for( std::vector<Slot>::const_iterator s = old.begin(); s != old.end(); ++s )
+            {
+                if ( s->_index != s_empty )
+                {
+                    unsigned i = hashEdge(s->_edge._i0, s->_edge._i1) & mask;
+                    while( _slots[i]._index != s_empty )
+                        i = (i+1) & mask;
+                    _slots[i] = *s;
+                }
+            }
+        }
+
+        std::vector<Slot> _slots;
+        unsigned          _size;
+    };
     
     /**
      * Populates the geometry object with a collection of index elements primitives.
@@ -264,15 +514,14 @@ namespace
         GLuint _i0, _i1;
     };
 
-    typedef std::queue<Line> LineQueue;
     typedef std::vector<Line> LineVector;
 
+    template<typename VERTINDEX, typename WORKLIST>
     struct LineData
     {
-        typedef std::map<osg::Vec3,GLuint> VertMap;
-        VertMap _vertMap;
-        osg::Vec3Array* _verts;
-        LineQueue _lines;
+        VERTINDEX _vertIndex;
+        osg::ref_ptr<osg::Vec3Array> _verts;
+        WORKLIST _lines;
         
         LineData()
         {
@@ -281,18 +530,12 @@ namespace
 
         GLuint record( const osg::Vec3& v )
         {
-            VertMap::iterator i = _vertMap.find(v);
-            if ( i == _vertMap.end() )
+            GLuint index = _vertIndex.findOrInsert( v, _verts->size() );
+            if ( index == _verts->size() )
             {
-                GLuint index = _verts->size();
                 _verts->push_back(v);
-                _vertMap[v] = index;
-                return index;
-            }
-            else
-            {
-                return i->second;
             }
+            return index;
         }
         
         void operator()( const osg::Vec3& v0, const osg::Vec3& v1, bool temp )
@@ -350,28 +593,33 @@ namespace
      * line set, subdivides it according to the granularity threshold, and replaces
      * the data in the Geometry object with the new vertex and primitive data.
      */
+    template<typename VERTINDEX, typename WORKLIST>
     void subdivideLines(
-        double               granularity,
-        GeoInterpolation     interp,
-        osg::Geometry&       geom,
-        const osg::Matrixd&  W2L, // world=>local xform
-        const osg::Matrixd&  L2W, // local=>world xform
-        unsigned int         maxElementsPerEBO )
+        double                   granularity,
+        GeoInterpolation         interp,
+        osg::Geometry&           geom,
+        const osg::Matrixd&      W2L, // world=>local xform
+        const osg::Matrixd&      L2W, // local=>world xform
+        unsigned int             maxElementsPerEBO,
+        MeshSubdivider::Stats&   stats )
     {
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+
         // collect all the line segments in the geometry.
-        LineFunctor<LineData> data;
+        LineFunctor< LineData<VERTINDEX,WORKLIST> > data;
         geom.accept( data );
     
-        int numLinesIn = data._lines.size();
+        unsigned numLinesIn = data._lines.size();
 
         LineVector done;
-        done.reserve( 2 * data._lines.size() );
+        done.reserve( 2 * numLinesIn );
+
+        osg::Timer_t t1 = osg::Timer::instance()->tick();
 
         // Subdivide lines until we run out.
-        while( data._lines.size() > 0 )
+        while( !data._lines.empty() )
         {
-            Line line = data._lines.front();
-            data._lines.pop();
+            Line line = data._lines.pop();
 
             osg::Vec3d v0_w = (*data._verts)[line._i0] * L2W;
             osg::Vec3d v1_w = (*data._verts)[line._i1] * L2W;
@@ -393,13 +641,15 @@ namespace
             }
         }
 
+        osg::Timer_t t2 = osg::Timer::instance()->tick();
+
         if ( done.size() > 0 )
         {
             while( geom.getNumPrimitiveSets() > 0 )
                 geom.removePrimitiveSet(0);
 
             // set the new VBO.
-            geom.setVertexArray( data._verts );
+            geom.setVertexArray( data._verts.get() );
 
             if ( data._verts->size() < 256 )
                 populateLines<osg::DrawElementsUByte,GLubyte>( geom, done, maxElementsPerEBO );
@@ -408,11 +658,48 @@ namespace
             else
                 populateLines<osg::DrawElementsUInt,GLuint>( geom, done, maxElementsPerEBO );
         }
+
+        osg::Timer_t t3 = osg::Timer::instance()->tick();
+
+        stats._numPrimsIn      += numLinesIn;
+        stats._numPrimsOut     += done.size();
+        stats._numVertsOut     += data._verts->size();
+        stats._weldTime_s      += osg::Timer::instance()->delta_s(t0, t1);
+        stats._subdivideTime_s += osg::Timer::instance()->delta_s(t1, t2);
+        stats._populateTime_s  += osg::Timer::instance()->delta_s(t2, t3);
     }
 
 
     //----------------------------------------------------------------------
 
+    /**
+     * Records the midpoint of an edge, re-using the vertex created by a
+     * previous split of the same (shared) edge if there is one.
+     */
+    template<typename EDGEINDEX>
+    GLuint splitEdge(
+        EDGEINDEX&          edges,
+        GLuint              i0,
+        GLuint              i1,
+        const osg::Vec3d&   v0_w,
+        const osg::Vec3d&   v1_w,
+        const osg::Vec2&    t0,
+        const osg::Vec2&    t1,
+        osg::Vec3Array*     verts,
+        osg::Vec2Array*     texcoords,
+        GeoInterpolation    interp,
+        const osg::Matrixd& W2L )
+    {
+        Edge edge( osg::minimum(i0, i1), osg::maximum(i0, i1) );
+        GLuint i = edges.findOrInsert( edge, verts->size() );
+        if ( i == verts->size() )
+        {
+            verts->push_back( geocentricMidpoint(v0_w, v1_w, interp) * W2L );
+            texcoords->push_back( (t0 + t1) / 2.0f );
+        }
+        return i;
+    }
+
     /**
      * Collects all the triangles from the geometry, coalesces them into a single
      * triangle set, subdivides them according to the granularity threshold, and
@@ -422,35 +709,39 @@ namespace
      * The subdivision algorithm is adapted from http://bit.ly/dTIagq
      * (c) Copyright 2010 Patrick Cozzi and Deron Ohlarik, MIT License.
      */
+    template<typename VERTINDEX, typename EDGEINDEX, typename WORKLIST>
     void subdivideTriangles(
-        double               granularity,
-        GeoInterpolation     interp,
-        osg::Geometry&       geom,
-        const osg::Matrixd&  W2L, // world=>local xform
-        const osg::Matrixd&  L2W, // local=>world xform
-        unsigned int         maxElementsPerEBO )
+        double                   granularity,
+        GeoInterpolation         interp,
+        osg::Geometry&           geom,
+        const osg::Matrixd&      W2L, // world=>local xform
+        const osg::Matrixd&      L2W, // local=>world xform
+        unsigned int             maxElementsPerEBO,
+        MeshSubdivider::Stats&   stats )
     {
-        
+        osg::Timer_t timer0 = osg::Timer::instance()->tick();
+
         // collect all the triangled in the geometry.
-        osg::TriangleIndexFunctor<TriangleData> data;;
+        osg::TriangleIndexFunctor< TriangleData<VERTINDEX,WORKLIST> > data;
         data.setSourceVerts(dynamic_cast<osg::Vec3Array*>(geom.getVertexArray()));
         data.setSourceTexCoords(dynamic_cast<osg::Vec2Array*>(geom.getTexCoordArray(0)));
         geom.accept( data );
 
-        
-        int numTrisIn = data._tris.size();        
+        unsigned numTrisIn = data._tris.size();        
 
         TriangleVector done;
-        done.reserve(2.0 * data._tris.size());
+        done.reserve(2 * numTrisIn);
 
         // Used to make sure shared edges are not split more than once.
-        EdgeMap edges;
+        EDGEINDEX edges;
+        edges.reserve( numTrisIn );
+
+        osg::Timer_t timer1 = osg::Timer::instance()->tick();
 
         // Subdivide triangles until we run out
-        while( data._tris.size() > 0 )
+        while( !data._tris.empty() )
         {
-            Triangle tri = data._tris.front();
-            data._tris.pop();
+            Triangle tri = data._tris.pop();
 
             osg::Vec3d v0_w = (*data._verts)[tri._i0] * L2W;
             osg::Vec3d v1_w = (*data._verts)[tri._i1] * L2W;
@@ -469,63 +760,24 @@ namespace
             {
                 if ( g0 == max )
                 {
-                    Edge edge( osg::minimum(tri._i0, tri._i1), osg::maximum(tri._i0, tri._i1) );
-                    
-                    EdgeMap::iterator ei = edges.find(edge);
-                    GLuint i;
-                    if ( ei == edges.end() )
-                    {
-                        data._verts->push_back( geocentricMidpoint(v0_w, v1_w, interp) * W2L );
-                        data._texcoords->push_back( (t0 + t1) / 2.0f );
-                        i = data._verts->size() - 1;
-                        edges[edge] = i;
-                    }
-                    else
-                    {
-                        i = ei->second;
-                    }
+                    GLuint i = splitEdge( edges, tri._i0, tri._i1, v0_w, v1_w, t0, t1,
+                        data._verts.get(), data._texcoords.get(), interp, W2L );
 
                     data._tris.push( Triangle(tri._i0, i, tri._i2) );
                     data._tris.push( Triangle(i, tri._i1, tri._i2) );
                 }
                 else if ( g1 == max )
                 {
-                    Edge edge( osg::minimum(tri._i1, tri._i2), osg::maximum(tri._i1,tri._i2) );
-
-                    EdgeMap::iterator ei = edges.find(edge);
-                    GLuint i;
-                    if ( ei == edges.end() )
-                    {
-                        data._verts->push_back( geocentricMidpoint(v1_w, v2_w, interp) * W2L );
-                        data._texcoords->push_back( (t1 + t2) / 2.0f );
-                        i = data._verts->size() - 1;
-                        edges[edge] = i;
-                    }
-                    else
-                    {
-                        i = ei->second;
-                    }
+                    GLuint i = splitEdge( edges, tri._i1, tri._i2, v1_w, v2_w, t1, t2,
+                        data._verts.get(), data._texcoords.get(), interp, W2L );
 
                     data._tris.push( Triangle(tri._i1, i, tri._i0) );
                     data._tris.push( Triangle(i, tri._i2, tri._i0) );
                 }
                 else if ( g2 == max )
                 {
-                    Edge edge( osg::minimum(tri._i2, tri._i0), osg::maximum(tri._i2,tri._i0) );
-
-                    EdgeMap::iterator ei = edges.find(edge);
-                    GLuint i;
-                    if ( ei == edges.end() )
-                    {
-                        data._verts->push_back( geocentricMidpoint(v2_w, v0_w, interp) * W2L );
-                        data._texcoords->push_back( (t2 + t0) / 2.0f );
-                        i = data._verts->size() - 1;
-                        edges[edge] = i;
-                    }
-                    else
-                    {
-                        i = ei->second;
-                    }
+                    GLuint i = splitEdge( edges, tri._i2, tri._i0, v2_w, v0_w, t2, t0,
+                        data._verts.get(), data._texcoords.get(), interp, W2L );
 
                     data._tris.push( Triangle(tri._i2, i, tri._i1) );
                     data._tris.push( Triangle(i, tri._i0, tri._i1) );
@@ -538,6 +790,8 @@ namespace
             }
         }
 
+        osg::Timer_t timer2 = osg::Timer::instance()->tick();
+
         if ( done.size() > 0 )
         {
             // first, remove the old primitive sets.
@@ -556,15 +810,26 @@ namespace
             else
                 populateTriangles<osg::DrawElementsUInt,GLuint>( geom, done, maxElementsPerEBO );
         }
+
+        osg::Timer_t timer3 = osg::Timer::instance()->tick();
+
+        stats._numPrimsIn      += numTrisIn;
+        stats._numPrimsOut     += done.size();
+        stats._numVertsOut     += data._verts->size();
+        stats._weldTime_s      += osg::Timer::instance()->delta_s(timer0, timer1);
+        stats._subdivideTime_s += osg::Timer::instance()->delta_s(timer1, timer2);
+        stats._populateTime_s  += osg::Timer::instance()->delta_s(timer2, timer3);
     }
 
     void subdivide(
-        double               granularity,
-        GeoInterpolation     interp,
-        osg::Geometry&       geom,
-        const osg::Matrixd&  W2L, // world=>local xform
-        const osg::Matrixd&  L2W, // local=>world xform
-        unsigned int         maxElementsPerEBO )
+        double                   granularity,
+        GeoInterpolation         interp,
+        osg::Geometry&           geom,
+        const osg::Matrixd&      W2L, // world=>local xform
+        const osg::Matrixd&      L2W, // local=>world xform
+        unsigned int             maxElementsPerEBO,
+        bool                     useHashWelding,
+        MeshSubdivider::Stats&   stats )
     {
         GLenum mode = geom.getPrimitiveSet(0)->getMode();
 
@@ -573,11 +838,17 @@ namespace
 
         if ( mode == GL_LINES || mode == GL_LINE_STRIP || mode == GL_LINE_LOOP )
         {
-            subdivideLines( granularity, interp, geom, W2L, L2W, maxElementsPerEBO );
+            if ( useHashWelding )
+                subdivideLines<VertHashIndex, ArenaWorkList<Line> >( granularity, interp, geom, W2L, L2W, maxElementsPerEBO, stats );
+            else
+                subdivideLines<VertMapIndex, QueueWorkList<Line> >( granularity, interp, geom, W2L, L2W, maxElementsPerEBO, stats );
         }
         else
         {
-            subdivideTriangles( granularity, interp, geom, W2L, L2W, maxElementsPerEBO );
+            if ( useHashWelding )
+                subdivideTriangles<VertHashIndex, EdgeHashIndex, ArenaWorkList<Triangle> >( granularity, interp, geom, W2L, L2W, maxElementsPerEBO, stats );
+            else
+                subdivideTriangles<VertMapIndex, EdgeMapIndex, QueueWorkList<Triangle> >( granularity, interp, geom, W2L, L2W, maxElementsPerEBO, stats );
 
             //osgUtil::VertexCacheVisitor cacheOptimizer;
             //cacheOptimizer.optimizeVertices( geom );
@@ -594,7 +865,8 @@ MeshSubdivider::MeshSubdivider(const osg::Matrixd& world2local,
                                const osg::Matrixd& local2world ) :
 _local2world(local2world),
 _world2local(world2local),
-_maxElementsPerEBO( INT_MAX )
+_maxElementsPerEBO( INT_MAX ),
+_useHashWelding( true )
 {
     if ( !_world2local.isIdentity() && _local2world.isIdentity() )
         _local2world = osg::Matrixd::inverse(_world2local);
@@ -608,5 +880,6 @@ MeshSubdivider::run(osg::Geometry& geom, double granularity, GeoInterpolation in
     if ( geom.getNumPrimitiveSets() < 1 )
         return;
 
-    subdivide( granularity, interp, geom, _world2local, _local2world, _maxElementsPerEBO );
+    subdivide( granularity, interp, geom, _world2local, _local2world, _maxElementsPerEBO, _useHashWelding, _stats );
+    _stats._numRuns++;
 }
@@ -212,7 +212,8 @@ _tether_mode( TETHER_CENTER ),
 _arc_viewpoints( false ),
 _auto_vp_duration( false ),
 _min_vp_duration_s( 3.0 ),
-_max_vp_duration_s( 8.0 )
+_max_vp_duration_s( 8.0 ),
+_use_terrain_intersector( false )
 {
     //NOP
 }
@@ -235,7 +236,8 @@ _tether_mode( rhs._tether_mode ),
 _arc_viewpoints( rhs._arc_viewpoints ),
 _auto_vp_duration( rhs._auto_vp_duration ),
 _min_vp_duration_s( rhs._min_vp_duration_s ),
-_max_vp_duration_s( rhs._max_vp_duration_s )
+_max_vp_duration_s( rhs._max_vp_duration_s ),
+_use_terrain_intersector( rhs._use_terrain_intersector )
 {
     //NOP
 }
@@ -393,6 +395,12 @@ EarthManipulator::Settings::setAutoViewpointDurationLimits( double minSeconds, d
     _max_vp_duration_s = osg::clampAbove( maxSeconds, _min_vp_duration_s );
 }
 
+void
+EarthManipulator::Settings::setUseTerrainIntersector( bool value )
+{
+    _use_terrain_intersector = value;
+}
+
 /************************************************************************/
 
 
@@ -604,6 +612,8 @@ EarthManipulator::established()
         // reset the srs cache:
         _cached_srs = NULL;
         _srs_lookup_failed = false;
+        _map_node = 0L;
+        _terrain_intersector = 0L;
 
         // track the local angles.
         recalculateLocalPitchAndAzimuth();
@@ -708,6 +718,7 @@ EarthManipulator::getSRS() const
         {
             nonconst_this->_cached_srs = mapNode->getMap()->getProfile()->getSRS();
             nonconst_this->_is_geocentric = mapNode->isGeocentric();
+            nonconst_this->_map_node = mapNode;
         }
 
         // if that doesn't work, try gleaning info from a CSN:
@@ -735,6 +746,30 @@ EarthManipulator::getSRS() const
     return _cached_srs.get();
 }
 
+TerrainIntersector*
+EarthManipulator::getTerrainIntersector() const
+{
+    if ( !_settings->getUseTerrainIntersector() || !getSRS() )
+        return 0L;
+
+    // intersect the elevation data directly rather than the scene graph. The intersector
+    // holds a map frame and tile caches, so don't build it until someone turns it on.
+    if ( !_terrain_intersector.valid() )
+    {
+        osg::ref_ptr<osgEarth::MapNode> mapNode = _map_node.get();
+        if ( mapNode.valid() )
+        {
+            EarthManipulator* nonconst_this = const_cast<EarthManipulator*>(this);
+            nonconst_this->_terrain_intersector = new TerrainIntersector( mapNode->getMap() );
+            const TerrainOptions& terrainOptions = mapNode->getMapNodeOptions().getTerrainOptions();
+            if ( terrainOptions.verticalScale().isSet() )
+                _terrain_intersector->setVerticalScale( terrainOptions.verticalScale().value() );
+        }
+    }
+
+    return _terrain_intersector.get();
+}
+
 
 static double
 normalizeAzimRad( double input ) {
@@ -1062,6 +1097,12 @@ EarthManipulator::getTetherNode() const
 bool
 EarthManipulator::intersect(const osg::Vec3d& start, const osg::Vec3d& end, osg::Vec3d& intersection) const
 {
+    TerrainIntersector* terrainIntersector = getTerrainIntersector();
+    if ( terrainIntersector )
+    {
+        return terrainIntersector->intersect( start, end, intersection );
+    }
+
     osg::ref_ptr<osg::Node> safeNode = _node.get();
     if ( safeNode.valid() )
     {
@@ -1866,6 +1907,12 @@ EarthManipulator::screenToWorld(float x, float y, osg::View* theView, osg::Vec3d
     if ( !camera )
         camera = view->getCamera();
 
+    TerrainIntersector* terrainIntersector = getTerrainIntersector();
+    if ( terrainIntersector )
+    {
+        return terrainIntersector->intersect( camera, local_x, local_y, out_coords );
+    }
+
     osgUtil::LineSegmentIntersector::CoordinateFrame cf = 
         camera->getViewport() ? osgUtil::Intersector::WINDOW : osgUtil::Intersector::PROJECTION;
 
@@ -40,7 +40,8 @@ _geoInterpolation( GEOINTERP_GREAT_CIRCLE ),
 _mouseButton( osgGA::GUIEventAdapter::LEFT_MOUSE_BUTTON),
 _isPath( false ),
 _mapNode( mapNode ),
-_intersectionMask(0xffffffff)
+_intersectionMask(0xffffffff),
+_useTerrainIntersector( false )
 {
     LineString* line = new LineString();
     _feature = new Feature();
@@ -195,13 +196,52 @@ bool MeasureToolHandler::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIAct
 
 bool MeasureToolHandler::getLocationAt(osgViewer::View* view, double x, double y, double &lon, double &lat)
 {
-    osgUtil::LineSegmentIntersector::Intersections results;            
-    if ( view->computeIntersections( x, y, results, _intersectionMask ) )
+    osg::Vec3d point;
+    bool found = false;
+
+    // the intersector only sees the terrain, so only use it when the intersection
+    // mask is set to pick the terrain and nothing else.
+    bool terrainOnly = false;
+    if ( _useTerrainIntersector && _mapNode.valid() && _mapNode->getTerrainEngine() )
+    {
+        osg::Group* models = _mapNode->getModelLayerGroup();
+        terrainOnly =
+            (_mapNode->getTerrainEngine()->getNodeMask() & _intersectionMask) != 0 &&
+            (!models || (models->getNodeMask() & _intersectionMask) == 0) &&
+            (_mapNode->getOverlayGroup()->getNodeMask() & _intersectionMask) == 0;
+    }
+
+    if ( terrainOnly )
+    {
+        if ( !_terrainIntersector.valid() )
+        {
+            _terrainIntersector = new TerrainIntersector( _mapNode->getMap() );
+            const TerrainOptions& terrainOptions = _mapNode->getMapNodeOptions().getTerrainOptions();
+            if ( terrainOptions.verticalScale().isSet() )
+                _terrainIntersector->setVerticalScale( terrainOptions.verticalScale().value() );
+        }
+
+        float local_x = (float)x, local_y = (float)y;
+        const osg::Camera* camera = view->getCameraContainingPosition( x, y, local_x, local_y );
+        if ( !camera )
+            camera = view->getCamera();
+
+        found = _terrainIntersector->intersect( camera, local_x, local_y, point );
+    }
+    else
     {
-        // find the first hit under the mouse:
-        osgUtil::LineSegmentIntersector::Intersection first = *(results.begin());
-        osg::Vec3d point = first.getWorldIntersectPoint();
+        osgUtil::LineSegmentIntersector::Intersections results;            
+        if ( view->computeIntersections( x, y, results, _intersectionMask ) )
+        {
+            // find the first hit under the mouse:
+            osgUtil::LineSegmentIntersector::Intersection first = *(results.begin());
+            point = first.getWorldIntersectPoint();
+            found = true;
+        }
+    }
 
+    if ( found )
+    {
         double lat_rad, lon_rad, height;       
         _mapNode->getMap()->getProfile()->getSRS()->getEllipsoid()->convertXYZToLatLongHeight( point.x(), point.y(), point.z(), lat_rad, lon_rad, height );
         lat = osg::RadiansToDegrees( lat_rad );
@@ -23,6 +23,7 @@
 #include <osg/Geometry>
 #include <osg/Depth>
 #include <osgText/Text>
+#include <osg/Timer>
 #include <sstream>
 
 #define LC "[GeoGraph] "
@@ -99,11 +100,78 @@ namespace
 
         return objects.end();
     }
+
+    /**
+     * Extrudes the center and corners of a geodetic extent up and down to get
+     * ten geocentric points that bound the cell's volume.
+     */
+    void computeBoundaryPoints( const osg::EllipsoidModel* em,
+                                double xMin, double yMin, double xMax, double yMax,
+                                std::vector<osg::Vec3d>& out_points )
+    {
+        static const double hae =  1e6;
+        static const double hbe = -1e5;
+
+        // find the geodetic center:
+        osg::Vec3d gcenter( 0.5*(xMin+xMax), 0.5*(yMin+yMax), 0.0 );
+
+        // convert to a geocentric vector:
+        osg::Vec3d center;
+        em->convertLatLongHeightToXYZ(
+            osg::DegreesToRadians(gcenter.y()), osg::DegreesToRadians(gcenter.x()), 0.0, center.x(), center.y(), center.z());
+
+        osg::Vec3d centerVec = center;
+        centerVec.normalize();
+
+        // find the 4 geodetic corners:
+        osg::Vec3d gcorner[4];
+        gcorner[0].set( xMin, yMin, 0.0 );
+        gcorner[1].set( xMin, yMax, 0.0 );
+        gcorner[2].set( xMax, yMax, 0.0 );
+        gcorner[3].set( xMax, yMin, 0.0 );
+
+        // and convert those to geocentric vectors:
+        osg::Vec3d corner[4];
+        osg::Vec3d cornerVec[4];
+        for(unsigned i=0; i<4; ++i )
+        {
+            em->convertLatLongHeightToXYZ(
+                osg::DegreesToRadians(gcorner[i].y()), osg::DegreesToRadians(gcorner[i].x()), 0.0,
+                corner[i].x(), corner[i].y(), corner[i].z() );
+            cornerVec[i] = corner[i];
+            cornerVec[i].normalize();
+        }   
+        
+        // now extrude the center and corners up and down to get the boundary points:
+        out_points.resize( 10 );
+        unsigned p = 0;
+        out_points[p++] = center + centerVec*hae;
+        out_points[p++] = center +centerVec*hbe;
+        for( unsigned i=0; i<4; ++i )
+        {
+            out_points[p++] = corner[i] + cornerVec[i]*hae;
+            out_points[p++] = corner[i] + cornerVec[i]*hbe;
+        }
+    }
+
+    bool intersectsFrustum( const std::vector<osg::Vec3d>& points, const osg::Polytope& tope )
+    {
+        const osg::Polytope::PlaneList& planes = tope.getPlaneList();
+        for( osg::Polytope::PlaneList::const_iterator i = planes.begin(); i != planes.end(); ++i )
+        {
+            if ( i->intersect( points ) < 0 )
+                return false;
+        }
+        return true;
+    }
 }
 
 //------------------------------------------------------------------------
 
-GeoObject::GeoObject()
+GeoObject::GeoObject() :
+_looseCell   ( -1 ),
+_looseSlot   ( 0 ),
+_loosePending( false )
 {
     //NOP
 }
@@ -188,50 +256,10 @@ _frameStamp( 0 )
 void
 GeoCell::generateBoundaries()
 {
-    const osg::EllipsoidModel* em = _extent.getSRS()->getEllipsoid();
-    static const double hae =  1e6;
-    static const double hbe = -1e5;
-
-    // find the geodetic center:
-    osg::Vec3d gcenter;
-    _extent.getCentroid( gcenter.x(), gcenter.y() );
-
-    // convert to a geocentric vector:
-    osg::Vec3d center;
-    em->convertLatLongHeightToXYZ(
-        osg::DegreesToRadians(gcenter.y()), osg::DegreesToRadians(gcenter.x()), 0.0, center.x(), center.y(), center.z());
-
-    osg::Vec3d centerVec = center;
-    centerVec.normalize();
-
-    // find the 4 geodetic corners:
-    osg::Vec3d gcorner[4];
-    gcorner[0].set( _extent.xMin(), _extent.yMin(), 0.0 );
-    gcorner[1].set( _extent.xMin(), _extent.yMax(), 0.0 );
-    gcorner[2].set( _extent.xMax(), _extent.yMax(), 0.0 );
-    gcorner[3].set( _extent.xMax(), _extent.yMin(), 0.0 );
-
-    // and convert those to geocentric vectors:
-    osg::Vec3d corner[4];
-    osg::Vec3d cornerVec[4];
-    for(unsigned i=0; i<4; ++i )
-    {
-        em->convertLatLongHeightToXYZ(
-            osg::DegreesToRadians(gcorner[i].y()), osg::DegreesToRadians(gcorner[i].x()), 0.0,
-            corner[i].x(), corner[i].y(), corner[i].z() );
-        cornerVec[i] = corner[i];
-        cornerVec[i].normalize();
-    }   
-    
-    // now extrude the center and corners up and down to get the boundary points:
-    unsigned p = 0;
-    _boundaryPoints[p++] = center + centerVec*hae;
-    _boundaryPoints[p++] = center +centerVec*hbe;
-    for( unsigned i=0; i<4; ++i )
-    {
-        _boundaryPoints[p++] = corner[i] + cornerVec[i]*hae;
-        _boundaryPoints[p++] = corner[i] + cornerVec[i]*hbe;
-    }
+    computeBoundaryPoints(
+        _extent.getSRS()->getEllipsoid(),
+        _extent.xMin(), _extent.yMin(), _extent.xMax(), _extent.yMax(),
+        _boundaryPoints );
 }
 
 osg::BoundingSphere
@@ -285,13 +313,7 @@ GeoCell::generateBoundaryGeometry()
 bool
 GeoCell::intersects( const osg::Polytope& tope ) const
 {
-    const osg::Polytope::PlaneList& planes = tope.getPlaneList();
-    for( osg::Polytope::PlaneList::const_iterator i = planes.begin(); i != planes.end(); ++i )
-    {
-        if ( i->intersect( _boundaryPoints ) < 0 )
-            return false;
-    }
-    return true;
+    return intersectsFrustum( _boundaryPoints, tope );
 }
 
 void
@@ -512,6 +534,344 @@ GeoCell::reindexObject( GeoObject* object )
     }
 }
 
+//------------------------------------------------------------------------
+
+#undef  LC
+#define LC "[LooseGeoGraph] "
+
+LooseGeoGraph::LooseGeoGraph(const GeoExtent& extent, float maxRange, unsigned maxObjects,
+                             float splitRangeFactor, float looseness, unsigned maxDepth ) :
+_extent          ( extent ),
+_maxRange        ( maxRange ),
+_maxObjects      ( osg::maximum(maxObjects, 1u) ),
+_splitRangeFactor( splitRangeFactor ),
+_looseness       ( osg::maximum(looseness, 1.0f) ),
+_maxDepth        ( maxDepth ),
+_numObjects      ( 0 )
+{
+    addCell( extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), maxRange, -1, 0 );
+
+    // we do our own culling; and we need an update traversal to apply queued updates.
+    this->setCullingActive( false );
+    ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+}
+
+int
+LooseGeoGraph::addCell(double xMin, double yMin, double xMax, double yMax,
+                       float range, int parent, unsigned depth )
+{
+    Cell cell;
+    cell._xMin = xMin; cell._yMin = yMin; cell._xMax = xMax; cell._yMax = yMax;
+
+    double pad = 0.5 * ((double)_looseness - 1.0);
+    cell._looseXMin = xMin - pad*(xMax-xMin);
+    cell._looseXMax = xMax + pad*(xMax-xMin);
+    cell._looseYMin = yMin - pad*(yMax-yMin);
+    cell._looseYMax = yMax + pad*(yMax-yMin);
+
+    cell._range      = range;
+    cell._parent     = parent;
+    cell._firstChild = -1;
+    cell._depth      = depth;
+
+    const osg::EllipsoidModel* em = _extent.getSRS()->getEllipsoid();
+    em->convertLatLongHeightToXYZ(
+        osg::DegreesToRadians(0.5*(yMin+yMax)), osg::DegreesToRadians(0.5*(xMin+xMax)), 0.0,
+        cell._center.x(), cell._center.y(), cell._center.z() );
+
+    // cull against the loose bounds, since objects may stray that far.
+    computeBoundaryPoints(
+        em,
+        osg::maximum(cell._looseXMin, -180.0), osg::maximum(cell._looseYMin, -90.0),
+        osg::minimum(cell._looseXMax,  180.0), osg::minimum(cell._looseYMax,  90.0),
+        cell._boundary );
+
+    _cells.push_back( cell );
+    return (int)_cells.size() - 1;
+}
+
+void
+LooseGeoGraph::split( int index )
+{
+    // copy what we need; adding cells may reallocate the cell array.
+    double   xMin  = _cells[index]._xMin, yMin = _cells[index]._yMin;
+    double   xMid  = 0.5*(_cells[index]._xMin + _cells[index]._xMax);
+    double   yMid  = 0.5*(_cells[index]._yMin + _cells[index]._yMax);
+    double   xMax  = _cells[index]._xMax, yMax = _cells[index]._yMax;
+    float    range = _cells[index]._range * _splitRangeFactor;
+    unsigned depth = _cells[index]._depth + 1;
+
+    int first = addCell( xMin, yMin, xMid, yMid, range, index, depth );
+    addCell( xMid, yMin, xMax, yMid, range, index, depth );
+    addCell( xMin, yMid, xMid, yMax, range, index, depth );
+    addCell( xMid, yMid, xMax, yMax, range, index, depth );
+
+    _cells[index]._firstChild = first;
+    _stats._splits++;
+}
+
+int
+LooseGeoGraph::childContaining( int index, double x, double y ) const
+{
+    const Cell& cell = _cells[index];
+    double xMid = 0.5*(cell._xMin + cell._xMax);
+    double yMid = 0.5*(cell._yMin + cell._yMax);
+    return cell._firstChild + (x >= xMid ? 1 : 0) + (y >= yMid ? 2 : 0);
+}
+
+void
+LooseGeoGraph::addToCell( int index, GeoObject* object )
+{
+    Cell& cell = _cells[index];
+    object->_looseCell = index;
+    object->_looseSlot = cell._objects.size();
+    cell._objects.push_back( object );
+}
+
+void
+LooseGeoGraph::removeFromCell( GeoObject* object )
+{
+    std::vector< osg::ref_ptr<GeoObject> >& objects = _cells[object->_looseCell]._objects;
+    unsigned slot = object->_looseSlot;
+
+    // keep the array contiguous: move the last object into the freed slot.
+    if ( slot+1 < objects.size() )
+    {
+        objects[slot] = objects.back();
+        objects[slot]->_looseSlot = slot;
+    }
+    objects.pop_back();
+
+    object->_looseCell = -1;
+}
+
+void
+LooseGeoGraph::insertInto( int index, GeoObject* object )
+{
+    osg::ref_ptr<GeoObject> current = object;
+
+    for( ;; )
+    {
+        Cell& cell = _cells[index];
+
+        if ( cell._objects.size() < _maxObjects || cell._depth >= _maxDepth )
+        {
+            addToCell( index, current.get() );
+            return;
+        }
+
+        // the cell is full. The lowest-priority object (this one or a resident)
+        // gets pushed down a level.
+        unsigned lowest = 0;
+        for( unsigned i=1; i<cell._objects.size(); ++i )
+        {
+            if ( cell._objects[i]->getPriority() < cell._objects[lowest]->getPriority() )
+                lowest = i;
+        }
+
+        if ( cell._objects[lowest]->getPriority() < current->getPriority() )
+        {
+            osg::ref_ptr<GeoObject> displaced = cell._objects[lowest].get();
+            displaced->_looseCell = -1;
+            cell._objects[lowest] = current.get();
+            current->_looseCell = index;
+            current->_looseSlot = lowest;
+            current = displaced.get();
+        }
+
+        osg::Vec3d location;
+        if ( !current->getLocation(location) )
+        {
+            // should never happen; keep it here rather than lose it.
+            addToCell( index, current.get() );
+            return;
+        }
+
+        if ( _cells[index]._firstChild < 0 )
+            split( index );
+
+        int child = childContaining( index, location.x(), location.y() );
+        if ( !_cells[child].looseContains(location.x(), location.y()) )
+        {
+            // outside the core extent of the whole tree; overfill this cell instead.
+            addToCell( index, current.get() );
+            return;
+        }
+
+        index = child;
+    }
+}
+
+bool
+LooseGeoGraph::insertObject( GeoObject* object )
+{
+    osg::Vec3d location;
+    if ( !object || object->_looseCell >= 0 || !object->getLocation(location) )
+        return false;
+
+    if ( !_cells[0].looseContains(location.x(), location.y()) )
+        return false;
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+    insertInto( 0, object );
+    _numObjects++;
+    _stats._inserts++;
+
+    _stats._insertSeconds += osg::Timer::instance()->delta_s( t0, osg::Timer::instance()->tick() );
+    return true;
+}
+
+bool
+LooseGeoGraph::removeObject( GeoObject* object )
+{
+    if ( !object || object->_looseCell < 0 || object->_looseCell >= (int)_cells.size() )
+        return false;
+
+    std::vector< osg::ref_ptr<GeoObject> >& objects = _cells[object->_looseCell]._objects;
+    if ( object->_looseSlot >= objects.size() || objects[object->_looseSlot].get() != object )
+        return false;
+
+    osg::ref_ptr<GeoObject> safe = object;
+    removeFromCell( object );
+    _numObjects--;
+    _stats._removes++;
+    return true;
+}
+
+void
+LooseGeoGraph::reindexObject( GeoObject* object )
+{
+    if ( object && !object->_loosePending )
+    {
+        object->_loosePending = true;
+        _pending.push_back( object );
+    }
+}
+
+void
+LooseGeoGraph::applyUpdates()
+{
+    if ( _pending.empty() )
+        return;
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+    for( unsigned i=0; i<_pending.size(); ++i )
+    {
+        GeoObject* object = _pending[i].get();
+        object->_loosePending = false;
+
+        // removed since it was queued?
+        if ( object->_looseCell < 0 )
+            continue;
+
+        _stats._reindexes++;
+
+        osg::Vec3d location;
+        if ( !object->getLocation(location) )
+            continue;
+
+        // still within its cell's loose bounds? nothing to do.
+        int index = object->_looseCell;
+        if ( _cells[index].looseContains(location.x(), location.y()) )
+            continue;
+
+        // already parked in the root, outside the graph's extent (see below)? leave it there.
+        if ( index == 0 )
+            continue;
+
+        // climb to the first ancestor that still contains it, and re-insert from there.
+        osg::ref_ptr<GeoObject> safe = object;
+        removeFromCell( object );
+        _stats._migrations++;
+
+        while( _cells[index]._parent >= 0 && !_cells[index].looseContains(location.x(), location.y()) )
+            index = _cells[index]._parent;
+
+        if ( _cells[index].looseContains(location.x(), location.y()) )
+        {
+            insertInto( index, object );
+        }
+        else
+        {
+            // it left the graph's extent. Park it in the root cell rather than lose track of it.
+            OE_WARN << LC << "Object moved outside the graph's extent; keeping it in the root cell" << std::endl;
+            addToCell( 0, object );
+        }
+    }
+
+    _pending.clear();
+
+    _stats._updateSeconds += osg::Timer::instance()->delta_s( t0, osg::Timer::instance()->tick() );
+}
+
+osg::BoundingSphere
+LooseGeoGraph::computeBound() const
+{
+    osg::BoundingSphere bs;
+    const std::vector<osg::Vec3d>& points = _cells[0]._boundary;
+    for( unsigned i=0; i<points.size(); ++i )
+        bs.expandBy( points[i] );
+    return bs;
+}
+
+void
+LooseGeoGraph::cull( int index, osgUtil::CullVisitor* cv )
+{
+    const Cell& cell = _cells[index];
+
+    // custom culling: the loose boundary points must intersect the frustum.
+    if ( !intersectsFrustum( cell._boundary, cv->getCurrentCullingSet().getFrustum() ) )
+        return;
+
+    for( unsigned i=0; i<cell._objects.size(); ++i )
+    {
+        osg::Node* node = cell._objects[i]->getNode();
+        if ( node )
+            node->accept( *cv );
+    }
+
+    // children are in range based on the distance to this cell's center (as with osg::LOD).
+    if ( cell._firstChild >= 0 )
+    {
+        float distance = cv->getDistanceToViewPoint( cell._center, true );
+        for( int c = cell._firstChild; c < cell._firstChild+4; ++c )
+        {
+            if ( distance < _cells[c]._range )
+                cull( c, cv );
+        }
+    }
+}
+
+void
+LooseGeoGraph::traverse( osg::NodeVisitor& nv )
+{
+    if ( nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
+    {
+        applyUpdates();
+    }
+
+    if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>( &nv );
+        if ( cv && cv->getDistanceToViewPoint(_cells[0]._center, true) < _cells[0]._range )
+            cull( 0, cv );
+    }
+    else
+    {
+        for( unsigned c=0; c<_cells.size(); ++c )
+        {
+            for( unsigned i=0; i<_cells[c]._objects.size(); ++i )
+            {
+                osg::Node* node = _cells[c]._objects[i]->getNode();
+                if ( node )
+                    node->accept( nv );
+            }
+        }
+    }
+}
+
 #if 0
 bool
 GeoCell::reindex( GeoObject* object )